@@ -0,0 +1,79 @@
+#include <memory>
+#include <vector>
+#include <cryptopp/osrng.h>
+#include "util/base64.h"
+#include "Benchmark.h"
+
+using namespace i2p::util;
+using namespace i2p::benchmark;
+
+const size_t BASE64_INPUT_SIZE = 387; // identity with certificate, as in addresses
+const size_t BASE32_INPUT_SIZE = 32; // ident hash, as in .b32.i2p addresses
+
+struct EncodingBuffers
+{
+    std::vector<uint8_t> bytes;
+    std::vector<char> encoded;
+    size_t encodedLen;
+};
+
+static std::shared_ptr<EncodingBuffers> CreateEncodingBuffers (size_t size, bool base32)
+{
+    auto buffers = std::make_shared<EncodingBuffers> ();
+    buffers->bytes.resize (size);
+    CryptoPP::AutoSeededRandomPool rnd;
+    rnd.GenerateBlock (buffers->bytes.data (), size);
+    buffers->encoded.resize (size*2 + 8);
+    buffers->encodedLen = base32 ?
+        ByteStreamToBase32 (buffers->bytes.data (), size, buffers->encoded.data (), buffers->encoded.size ()) :
+        ByteStreamToBase64 (buffers->bytes.data (), size, buffers->encoded.data (), buffers->encoded.size ());
+    return buffers;
+}
+
+BENCHMARK(Base64Encode, BASE64_INPUT_SIZE, []()
+{
+    auto buffers = CreateEncodingBuffers (BASE64_INPUT_SIZE, false);
+    return [buffers](uint64_t numIterations)
+    {
+        for (uint64_t i = 0; i < numIterations; i++)
+            ByteStreamToBase64 (buffers->bytes.data (), buffers->bytes.size (),
+                buffers->encoded.data (), buffers->encoded.size ());
+        DoNotOptimize (buffers->encoded.data ());
+    };
+});
+
+BENCHMARK(Base64Decode, BASE64_INPUT_SIZE, []()
+{
+    auto buffers = CreateEncodingBuffers (BASE64_INPUT_SIZE, false);
+    return [buffers](uint64_t numIterations)
+    {
+        for (uint64_t i = 0; i < numIterations; i++)
+            Base64ToByteStream (buffers->encoded.data (), buffers->encodedLen,
+                buffers->bytes.data (), buffers->bytes.size ());
+        DoNotOptimize (buffers->bytes.data ());
+    };
+});
+
+BENCHMARK(Base32Encode, BASE32_INPUT_SIZE, []()
+{
+    auto buffers = CreateEncodingBuffers (BASE32_INPUT_SIZE, true);
+    return [buffers](uint64_t numIterations)
+    {
+        for (uint64_t i = 0; i < numIterations; i++)
+            ByteStreamToBase32 (buffers->bytes.data (), buffers->bytes.size (),
+                buffers->encoded.data (), buffers->encoded.size ());
+        DoNotOptimize (buffers->encoded.data ());
+    };
+});
+
+BENCHMARK(Base32Decode, BASE32_INPUT_SIZE, []()
+{
+    auto buffers = CreateEncodingBuffers (BASE32_INPUT_SIZE, true);
+    return [buffers](uint64_t numIterations)
+    {
+        for (uint64_t i = 0; i < numIterations; i++)
+            Base32ToByteStream (buffers->encoded.data (), buffers->encodedLen,
+                buffers->bytes.data (), buffers->bytes.size ());
+        DoNotOptimize (buffers->bytes.data ());
+    };
+});
@@ -0,0 +1,155 @@
+#include <string.h>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <algorithm>
+#include "util/Log.h"
+#include "version.h"
+#include "Benchmark.h"
+
+namespace i2p
+{
+namespace benchmark
+{
+    const int DEFAULT_MIN_TIME = 500; // in milliseconds
+
+    std::vector<Benchmark>& GetBenchmarks ()
+    {
+        static std::vector<Benchmark> benchmarks;
+        return benchmarks;
+    }
+
+    static volatile const void * g_Sink = nullptr;
+    void DoNotOptimize (const void * p)
+    {
+        g_Sink = p;
+    }
+
+    struct BenchmarkResult
+    {
+        std::string name;
+        uint64_t numIterations;
+        double nsPerIteration, mbPerSecond;
+    };
+
+    static double RunLoop (const BenchmarkLoop& loop, uint64_t numIterations) // in nanoseconds
+    {
+        auto start = std::chrono::steady_clock::now ();
+        loop (numIterations);
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now () - start).count ();
+    }
+
+    static BenchmarkResult Run (const Benchmark& benchmark, int minTime)
+    {
+        auto loop = benchmark.setup ();
+        double minDuration = minTime*1000000.0;
+        // find number of iterations running for about minTime, first run warms caches up
+        uint64_t numIterations = 1;
+        double duration = RunLoop (loop, numIterations);
+        while (duration < minDuration)
+        {
+            double factor = duration > 0 ? minDuration*1.2/duration : 100;
+            if (factor > 100) factor = 100; // duration of short runs is not accurate
+            if (factor < 2) factor = 2;
+            numIterations = static_cast<uint64_t>(numIterations*factor);
+            duration = RunLoop (loop, numIterations);
+        }
+        BenchmarkResult result;
+        result.name = benchmark.name;
+        result.numIterations = numIterations;
+        result.nsPerIteration = duration/numIterations;
+        result.mbPerSecond = benchmark.bytesPerIteration ?
+            benchmark.bytesPerIteration*numIterations*1000.0/duration : 0; // bytes per ns * 1000 = MB/s
+        return result;
+    }
+
+    static void Usage ()
+    {
+        std::cout << "Usage: i2pd-benchmarks [--filter=substring] [--min-time=ms] [--format=csv|json] [--list] [--log]" << std::endl;
+    }
+}
+}
+
+int main (int argc, char * argv[])
+{
+    using namespace i2p::benchmark;
+    std::string filter, format = "csv";
+    int minTime = DEFAULT_MIN_TIME;
+    bool list = false, log = false;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg (argv[i]);
+        if (!arg.compare (0, 9, "--filter="))
+            filter = arg.substr (9);
+        else if (!arg.compare (0, 11, "--min-time="))
+            minTime = std::stoi (arg.substr (11));
+        else if (!arg.compare (0, 9, "--format="))
+            format = arg.substr (9);
+        else if (arg == "--list")
+            list = true;
+        else if (arg == "--log")
+            log = true;
+        else
+        {
+            Usage ();
+            return 1;
+        }
+    }
+    if (format != "csv" && format != "json")
+    {
+        Usage ();
+        return 1;
+    }
+    if (log)
+        StartLog ("");
+    else
+        StartLog (new std::ostream (nullptr)); // parsers complain about fake netDb, drop it
+
+    bool json = format == "json" && !list;
+    if (json)
+    {
+        std::cout << "{\"version\":\"" << VERSION << "\",\"aesni\":";
+#ifdef AESNI
+        std::cout << "true";
+#else
+        std::cout << "false";
+#endif
+        std::cout << ",\"benchmarks\":[";
+    }
+    else if (!list)
+        std::cout << "name,iterations,ns_per_iteration,mb_per_second" << std::endl;
+
+    auto& benchmarks = GetBenchmarks ();
+    // registration order depends on linker
+    std::sort (benchmarks.begin (), benchmarks.end (),
+        [](const Benchmark& b1, const Benchmark& b2) { return b1.name < b2.name; });
+    bool first = true;
+    for (auto& it: benchmarks)
+    {
+        if (!filter.empty () && it.name.find (filter) == std::string::npos) continue;
+        if (list)
+        {
+            std::cout << it.name << std::endl;
+            continue;
+        }
+        auto result = Run (it, minTime);
+        std::cout << std::fixed;
+        if (json)
+        {
+            if (!first) std::cout << ",";
+            std::cout << "\n{\"name\":\"" << result.name << "\",\"iterations\":" << result.numIterations
+                << ",\"ns_per_iteration\":" << std::setprecision (1) << result.nsPerIteration
+                << ",\"mb_per_second\":" << std::setprecision (2) << result.mbPerSecond << "}";
+        }
+        else
+            std::cout << result.name << "," << result.numIterations << ","
+                << std::setprecision (1) << result.nsPerIteration << ","
+                << std::setprecision (2) << result.mbPerSecond << std::endl;
+        first = false;
+    }
+    if (json)
+        std::cout << "\n]}" << std::endl;
+
+    StopLog ();
+    return 0;
+}
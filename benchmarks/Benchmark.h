@@ -0,0 +1,44 @@
+#ifndef BENCHMARK_H__
+#define BENCHMARK_H__
+
+#include <inttypes.h>
+#include <string>
+#include <vector>
+#include <functional>
+
+namespace i2p
+{
+namespace benchmark
+{
+    typedef std::function<void (uint64_t numIterations)> BenchmarkLoop;
+    // prepares keys and buffers, called only if benchmark is selected
+    typedef std::function<BenchmarkLoop ()> BenchmarkSetup;
+
+    struct Benchmark
+    {
+        std::string name;
+        size_t bytesPerIteration; // 0 if throughput doesn't make sense
+        BenchmarkSetup setup;
+    };
+
+    std::vector<Benchmark>& GetBenchmarks ();
+
+    struct BenchmarkRegistrar
+    {
+        BenchmarkRegistrar (const std::string& name, size_t bytesPerIteration, BenchmarkSetup setup)
+        {
+            GetBenchmarks ().push_back ({ name, bytesPerIteration, setup });
+        }
+    };
+
+    // result must be used somewhere, otherwise loop might be optimized out
+    void DoNotOptimize (const void * p);
+}
+}
+
+// names are reported as is and must stay the same between releases.
+// Setup is variadic, since commas of lambda's body are not protected by parentheses
+#define BENCHMARK(name, bytesPerIteration, ...) \
+    static i2p::benchmark::BenchmarkRegistrar g_Benchmark_##name (#name, bytesPerIteration, __VA_ARGS__)
+
+#endif
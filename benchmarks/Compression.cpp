@@ -0,0 +1,84 @@
+#include <memory>
+#include <string>
+#include <vector>
+#include <cryptopp/gzip.h>
+#include "util/Compression.h"
+#include "Benchmark.h"
+
+using namespace i2p::util;
+using namespace i2p::benchmark;
+
+const size_t GZIP_INPUT_SIZE = 1024; // about one streaming packet
+
+struct GzipBuffers
+{
+    std::string text;
+    std::vector<uint8_t> compressed, uncompressed;
+    size_t compressedLen;
+};
+
+static std::shared_ptr<GzipBuffers> CreateGzipBuffers ()
+{
+    auto buffers = std::make_shared<GzipBuffers> ();
+    while (buffers->text.size () < GZIP_INPUT_SIZE)
+        buffers->text += "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nServer: i2pd\r\n<p>Hello</p>\r\n";
+    buffers->text.resize (GZIP_INPUT_SIZE);
+    buffers->compressed.resize (GZIP_INPUT_SIZE*2);
+    buffers->uncompressed.resize (GZIP_INPUT_SIZE);
+    buffers->compressedLen = GzipCompress ((const uint8_t *)buffers->text.data (), GZIP_INPUT_SIZE,
+        buffers->compressed.data (), buffers->compressed.size ());
+    return buffers;
+}
+
+// per packet compressor, as before contexts were reused
+BENCHMARK(GzipCompressNewContext, GZIP_INPUT_SIZE, []()
+{
+    auto buffers = CreateGzipBuffers ();
+    return [buffers](uint64_t numIterations)
+    {
+        for (uint64_t i = 0; i < numIterations; i++)
+        {
+            CryptoPP::Gzip compressor;
+            compressor.Put ((const uint8_t *)buffers->text.data (), GZIP_INPUT_SIZE);
+            compressor.MessageEnd ();
+            compressor.Get (buffers->compressed.data (), compressor.MaxRetrievable ());
+        }
+        DoNotOptimize (buffers->compressed.data ());
+    };
+});
+
+BENCHMARK(GzipCompress, GZIP_INPUT_SIZE, []()
+{
+    auto buffers = CreateGzipBuffers ();
+    return [buffers](uint64_t numIterations)
+    {
+        for (uint64_t i = 0; i < numIterations; i++)
+            GzipCompress ((const uint8_t *)buffers->text.data (), GZIP_INPUT_SIZE,
+                buffers->compressed.data (), buffers->compressed.size ());
+        DoNotOptimize (buffers->compressed.data ());
+    };
+});
+
+BENCHMARK(GzipCompressStored, GZIP_INPUT_SIZE, []()
+{
+    auto buffers = CreateGzipBuffers ();
+    return [buffers](uint64_t numIterations)
+    {
+        for (uint64_t i = 0; i < numIterations; i++)
+            GzipCompress ((const uint8_t *)buffers->text.data (), GZIP_INPUT_SIZE,
+                buffers->compressed.data (), buffers->compressed.size (), GZIP_STORED_LEVEL);
+        DoNotOptimize (buffers->compressed.data ());
+    };
+});
+
+BENCHMARK(GzipDecompress, GZIP_INPUT_SIZE, []()
+{
+    auto buffers = CreateGzipBuffers ();
+    return [buffers](uint64_t numIterations)
+    {
+        for (uint64_t i = 0; i < numIterations; i++)
+            GzipDecompress (buffers->compressed.data (), buffers->compressedLen,
+                buffers->uncompressed.data (), buffers->uncompressed.size ());
+        DoNotOptimize (buffers->uncompressed.data ());
+    };
+});
@@ -0,0 +1,229 @@
+#include <memory>
+#include <vector>
+#include <cryptopp/osrng.h>
+#include "crypto/aes.h"
+#include "crypto/ElGamal.h"
+#include "crypto/Signature.h"
+#include "crypto/EdDSA25519.h"
+#include "tunnel/TunnelCrypto.h"
+#include "tunnel/TunnelBase.h"
+#include "Benchmark.h"
+
+using namespace i2p::crypto;
+using namespace i2p::benchmark;
+
+const size_t CBC_BUFFER_SIZE = 1024;
+
+BENCHMARK(TunnelEncryption, i2p::tunnel::TUNNEL_DATA_ENCRYPTED_SIZE, []()
+{
+    auto encryption = std::make_shared<TunnelEncryption> ();
+    CryptoPP::AutoSeededRandomPool rnd;
+    AESKey layerKey, ivKey;
+    rnd.GenerateBlock (layerKey, 32);
+    rnd.GenerateBlock (ivKey, 32);
+    encryption->SetKeys (layerKey, ivKey);
+    auto buf = std::make_shared<AESAlignedBuffer<i2p::tunnel::TUNNEL_DATA_MSG_SIZE> > ();
+    uint8_t * data = *buf;
+    rnd.GenerateBlock (data, i2p::tunnel::TUNNEL_DATA_MSG_SIZE);
+    return [encryption, buf, data](uint64_t numIterations)
+    {
+        for (uint64_t i = 0; i < numIterations; i++)
+            encryption->Encrypt (data + 4, data + 4); // in place like transit tunnels do
+        DoNotOptimize (data);
+    };
+});
+
+BENCHMARK(TunnelDecryption, i2p::tunnel::TUNNEL_DATA_ENCRYPTED_SIZE, []()
+{
+    auto decryption = std::make_shared<TunnelDecryption> ();
+    CryptoPP::AutoSeededRandomPool rnd;
+    AESKey layerKey, ivKey;
+    rnd.GenerateBlock (layerKey, 32);
+    rnd.GenerateBlock (ivKey, 32);
+    decryption->SetKeys (layerKey, ivKey);
+    auto buf = std::make_shared<AESAlignedBuffer<i2p::tunnel::TUNNEL_DATA_MSG_SIZE> > ();
+    uint8_t * data = *buf;
+    rnd.GenerateBlock (data, i2p::tunnel::TUNNEL_DATA_MSG_SIZE);
+    return [decryption, buf, data](uint64_t numIterations)
+    {
+        for (uint64_t i = 0; i < numIterations; i++)
+            decryption->Decrypt (data + 4, data + 4);
+        DoNotOptimize (data);
+    };
+});
+
+BENCHMARK(CBCEncryption, CBC_BUFFER_SIZE, []()
+{
+    auto encryption = std::make_shared<CBCEncryption> ();
+    CryptoPP::AutoSeededRandomPool rnd;
+    AESKey key;
+    uint8_t iv[16];
+    rnd.GenerateBlock (key, 32);
+    rnd.GenerateBlock (iv, 16);
+    encryption->SetKey (key);
+    encryption->SetIV (iv);
+    auto buf = std::make_shared<AESAlignedBuffer<CBC_BUFFER_SIZE> > ();
+    uint8_t * data = *buf;
+    rnd.GenerateBlock (data, CBC_BUFFER_SIZE);
+    return [encryption, buf, data](uint64_t numIterations)
+    {
+        for (uint64_t i = 0; i < numIterations; i++)
+            encryption->Encrypt (data, CBC_BUFFER_SIZE, data);
+        DoNotOptimize (data);
+    };
+});
+
+BENCHMARK(CBCDecryption, CBC_BUFFER_SIZE, []()
+{
+    auto decryption = std::make_shared<CBCDecryption> ();
+    CryptoPP::AutoSeededRandomPool rnd;
+    AESKey key;
+    uint8_t iv[16];
+    rnd.GenerateBlock (key, 32);
+    rnd.GenerateBlock (iv, 16);
+    decryption->SetKey (key);
+    decryption->SetIV (iv);
+    auto buf = std::make_shared<AESAlignedBuffer<CBC_BUFFER_SIZE> > ();
+    uint8_t * data = *buf;
+    rnd.GenerateBlock (data, CBC_BUFFER_SIZE);
+    return [decryption, buf, data](uint64_t numIterations)
+    {
+        for (uint64_t i = 0; i < numIterations; i++)
+            decryption->Decrypt (data, CBC_BUFFER_SIZE, data);
+        DoNotOptimize (data);
+    };
+});
+
+BENCHMARK(ECBEncryption, 16, []()
+{
+    auto encryption = std::make_shared<ECBEncryption> ();
+    CryptoPP::AutoSeededRandomPool rnd;
+    AESKey key;
+    rnd.GenerateBlock (key, 32);
+    encryption->SetKey (key);
+    auto block = std::make_shared<CipherBlock> ();
+    rnd.GenerateBlock (block->buf, 16);
+    return [encryption, block](uint64_t numIterations)
+    {
+        for (uint64_t i = 0; i < numIterations; i++)
+            encryption->Encrypt (block.get (), block.get ());
+        DoNotOptimize (block.get ());
+    };
+});
+
+BENCHMARK(ECBDecryption, 16, []()
+{
+    auto decryption = std::make_shared<ECBDecryption> ();
+    CryptoPP::AutoSeededRandomPool rnd;
+    AESKey key;
+    rnd.GenerateBlock (key, 32);
+    decryption->SetKey (key);
+    auto block = std::make_shared<CipherBlock> ();
+    rnd.GenerateBlock (block->buf, 16);
+    return [decryption, block](uint64_t numIterations)
+    {
+        for (uint64_t i = 0; i < numIterations; i++)
+            decryption->Decrypt (block.get (), block.get ());
+        DoNotOptimize (block.get ());
+    };
+});
+
+struct ElGamalKeys
+{
+    uint8_t privateKey[256], publicKey[256];
+    uint8_t data[222], encrypted[514];
+};
+
+static std::shared_ptr<ElGamalKeys> CreateElGamalKeys ()
+{
+    auto keys = std::make_shared<ElGamalKeys> ();
+    CryptoPP::AutoSeededRandomPool rnd;
+    GenerateElGamalKeyPair (rnd, keys->privateKey, keys->publicKey);
+    rnd.GenerateBlock (keys->data, 222);
+    ElGamalEncryption (keys->publicKey).Encrypt (keys->data, 222, keys->encrypted, true);
+    return keys;
+}
+
+BENCHMARK(ElGamalEncrypt, 0, []()
+{
+    auto keys = CreateElGamalKeys ();
+    return [keys](uint64_t numIterations)
+    {
+        for (uint64_t i = 0; i < numIterations; i++)
+        {
+            // includes (k, g^k) generation, since precomputation is not started
+            ElGamalEncryption encryption (keys->publicKey);
+            encryption.Encrypt (keys->data, 222, keys->encrypted, true);
+        }
+        DoNotOptimize (keys->encrypted);
+    };
+});
+
+BENCHMARK(ElGamalDecrypt, 0, []()
+{
+    auto keys = CreateElGamalKeys ();
+    return [keys](uint64_t numIterations)
+    {
+        for (uint64_t i = 0; i < numIterations; i++)
+            ElGamalDecrypt (keys->privateKey, keys->encrypted, keys->data, true);
+        DoNotOptimize (keys->data);
+    };
+});
+
+const size_t VERIFY_MESSAGE_SIZE = 1024; // about RouterInfo size
+const size_t MAX_SIGNING_PRIVATE_KEY_LENGTH = RSASHA5124096_KEY_LENGTH*2;
+const size_t MAX_SIGNATURE_LENGTH = RSASHA5124096_KEY_LENGTH;
+
+template<typename TSigner, typename TVerifier>
+BenchmarkSetup VerifierBenchmark (std::function<void (CryptoPP::RandomNumberGenerator&, uint8_t *, uint8_t *)> createKeys)
+{
+    return [createKeys]()
+    {
+        CryptoPP::AutoSeededRandomPool rnd;
+        std::vector<uint8_t> privateKey (MAX_SIGNING_PRIVATE_KEY_LENGTH), publicKey (MAX_SIGNING_PRIVATE_KEY_LENGTH);
+        createKeys (rnd, privateKey.data (), publicKey.data ());
+        auto message = std::make_shared<std::vector<uint8_t> > (VERIFY_MESSAGE_SIZE);
+        rnd.GenerateBlock (message->data (), message->size ());
+        auto signature = std::make_shared<std::vector<uint8_t> > (MAX_SIGNATURE_LENGTH);
+        TSigner (privateKey.data ()).Sign (rnd, message->data (), message->size (), signature->data ());
+        auto verifier = std::make_shared<TVerifier> (publicKey.data ());
+        return [verifier, message, signature](uint64_t numIterations)
+        {
+            bool result = true;
+            for (uint64_t i = 0; i < numIterations; i++)
+                result &= verifier->Verify (message->data (), message->size (), signature->data ());
+            DoNotOptimize (&result);
+        };
+    };
+}
+
+static void CreateRSASHA2562048RandomKeys (CryptoPP::RandomNumberGenerator& rnd, uint8_t * privateKey, uint8_t * publicKey)
+{
+    CreateRSARandomKeys (rnd, RSASHA2562048_KEY_LENGTH, privateKey, publicKey);
+}
+
+static void CreateRSASHA3843072RandomKeys (CryptoPP::RandomNumberGenerator& rnd, uint8_t * privateKey, uint8_t * publicKey)
+{
+    CreateRSARandomKeys (rnd, RSASHA3843072_KEY_LENGTH, privateKey, publicKey);
+}
+
+static void CreateRSASHA5124096RandomKeys (CryptoPP::RandomNumberGenerator& rnd, uint8_t * privateKey, uint8_t * publicKey)
+{
+    CreateRSARandomKeys (rnd, RSASHA5124096_KEY_LENGTH, privateKey, publicKey);
+}
+
+BENCHMARK(VerifyDSA, VERIFY_MESSAGE_SIZE, VerifierBenchmark<DSASigner, DSAVerifier> (CreateDSARandomKeys));
+BENCHMARK(VerifyECDSAP256, VERIFY_MESSAGE_SIZE,
+    VerifierBenchmark<ECDSAP256Signer, ECDSAP256Verifier> (CreateECDSAP256RandomKeys));
+BENCHMARK(VerifyECDSAP384, VERIFY_MESSAGE_SIZE,
+    VerifierBenchmark<ECDSAP384Signer, ECDSAP384Verifier> (CreateECDSAP384RandomKeys));
+BENCHMARK(VerifyECDSAP521, VERIFY_MESSAGE_SIZE,
+    VerifierBenchmark<ECDSAP521Signer, ECDSAP521Verifier> (CreateECDSAP521RandomKeys));
+BENCHMARK(VerifyRSASHA2562048, VERIFY_MESSAGE_SIZE,
+    VerifierBenchmark<RSASHA2562048Signer, RSASHA2562048Verifier> (CreateRSASHA2562048RandomKeys));
+BENCHMARK(VerifyRSASHA3843072, VERIFY_MESSAGE_SIZE,
+    VerifierBenchmark<RSASHA3843072Signer, RSASHA3843072Verifier> (CreateRSASHA3843072RandomKeys));
+BENCHMARK(VerifyRSASHA5124096, VERIFY_MESSAGE_SIZE,
+    VerifierBenchmark<RSASHA5124096Signer, RSASHA5124096Verifier> (CreateRSASHA5124096RandomKeys));
+BENCHMARK(VerifyEDDSA25519, VERIFY_MESSAGE_SIZE,
+    VerifierBenchmark<EDDSA25519Signer, EDDSA25519Verifier> (CreateEDDSARandomKeys));
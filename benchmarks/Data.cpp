@@ -0,0 +1,90 @@
+#include <string.h>
+#include <memory>
+#include <vector>
+#include "util/I2PEndian.h"
+#include "util/Timestamp.h"
+#include "version.h"
+#include "RouterContext.h"
+#include "Identity.h"
+#include "RouterInfo.h"
+#include "LeaseSet.h"
+#include "NetworkDatabase.h"
+#include "Benchmark.h"
+
+using namespace i2p::benchmark;
+
+const int NUM_BENCHMARK_LEASES = 5;
+
+struct SampleData
+{
+    std::vector<uint8_t> routerInfo, leaseSet;
+};
+
+// signed RouterInfo and LeaseSet of random identities. Router is added to netDb
+// as gateway of all leases, so LeaseSet parser doesn't request it
+static std::shared_ptr<SampleData> CreateSampleData ()
+{
+    auto data = std::make_shared<SampleData> ();
+    auto routerKeys = i2p::data::PrivateKeys::CreateRandomKeys ();
+    i2p::data::RouterInfo routerInfo;
+    routerInfo.SetRouterIdentity (routerKeys.GetPublic ());
+    routerInfo.AddSSUAddress ("127.0.0.1", 12345, routerInfo.GetIdentHash ());
+    routerInfo.AddNTCPAddress ("127.0.0.1", 12345);
+    routerInfo.SetCaps (i2p::data::RouterInfo::eReachable | i2p::data::RouterInfo::eSSUTesting);
+    routerInfo.SetProperty ("netId", "2");
+    routerInfo.SetProperty ("router.version", I2P_VERSION);
+    routerInfo.CreateBuffer (routerKeys);
+    data->routerInfo.assign (routerInfo.GetBuffer (), routerInfo.GetBuffer () + routerInfo.GetBufferLen ());
+    i2p::data::netdb.AddRouterInfo (routerInfo.GetIdentHash (), routerInfo.GetBuffer (), routerInfo.GetBufferLen ());
+
+    auto keys = i2p::data::PrivateKeys::CreateRandomKeys ();
+    auto& identity = keys.GetPublic ();
+    auto& rnd = i2p::context.GetRandomNumberGenerator ();
+    data->leaseSet.resize (i2p::data::MAX_LS_BUFFER_SIZE);
+    uint8_t * buf = data->leaseSet.data ();
+    size_t len = identity.ToBuffer (buf, data->leaseSet.size ());
+    rnd.GenerateBlock (buf + len, 256 + identity.GetSigningPublicKeyLen ()); // encryption and unused signing keys
+    len += 256 + identity.GetSigningPublicKeyLen ();
+    buf[len] = NUM_BENCHMARK_LEASES;
+    len++;
+    uint64_t endDate = i2p::util::GetMillisecondsSinceEpoch () + 10*60*1000; // 10 minutes
+    for (int i = 0; i < NUM_BENCHMARK_LEASES; i++)
+    {
+        memcpy (buf + len, routerInfo.GetIdentHash (), 32);
+        len += 32;
+        htobe32buf (buf + len, rnd.GenerateWord32 ());
+        len += 4;
+        htobe64buf (buf + len, endDate);
+        len += 8;
+    }
+    keys.Sign (buf, len, buf + len);
+    len += identity.GetSignatureLen ();
+    data->leaseSet.resize (len);
+    return data;
+}
+
+BENCHMARK(RouterInfoParse, 0, []()
+{
+    auto data = CreateSampleData ();
+    return [data](uint64_t numIterations)
+    {
+        for (uint64_t i = 0; i < numIterations; i++)
+        {
+            i2p::data::RouterInfo routerInfo (data->routerInfo.data (), data->routerInfo.size ());
+            DoNotOptimize (&routerInfo);
+        }
+    };
+});
+
+BENCHMARK(LeaseSetParse, 0, []()
+{
+    auto data = CreateSampleData ();
+    return [data](uint64_t numIterations)
+    {
+        for (uint64_t i = 0; i < numIterations; i++)
+        {
+            i2p::data::LeaseSet leaseSet (data->leaseSet.data (), data->leaseSet.size ());
+            DoNotOptimize (&leaseSet);
+        }
+    };
+});
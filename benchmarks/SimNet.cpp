@@ -0,0 +1,500 @@
+// Runs private I2P network of i2pd processes on localhost and measures streaming through it.
+// Routers are seeded from each other's RouterInfos, so neither reseed nor external network is used.
+// Client tunnel on the last router connects to server tunnel on the first one, pointing to sink below
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include "util/Log.h"
+#include "util/I2PEndian.h"
+#include "util/base64.h"
+#include "version.h"
+#include "Identity.h"
+#include "RouterInfo.h"
+
+namespace i2p
+{
+namespace simnet
+{
+    const int DEFAULT_NUM_ROUTERS = 8;
+    const int DEFAULT_NUM_FLOODFILLS = 2;
+    const int DEFAULT_BASE_PORT = 21000;
+    const int DEFAULT_TRANSFER_SIZE = 4; // in MB
+    const int DEFAULT_NUM_PINGS = 20;
+    const int DEFAULT_TIMEOUT = 600; // in seconds, for network to become ready and for transfer
+    const int READY_ATTEMPT_TIMEOUT = 30; // in seconds
+    const int ROUTER_STOP_TIMEOUT = 30; // in seconds
+    const size_t TRANSFER_CHUNK_SIZE = 65536;
+    const char SERVER_KEYS[] = "simnet.dat";
+
+    struct Options
+    {
+        std::string i2pd, dir, format = "csv", logLevel = "info";
+        int numRouters = DEFAULT_NUM_ROUTERS, numFloodfills = DEFAULT_NUM_FLOODFILLS,
+            basePort = DEFAULT_BASE_PORT, size = DEFAULT_TRANSFER_SIZE,
+            numPings = DEFAULT_NUM_PINGS, timeout = DEFAULT_TIMEOUT;
+        bool keep = false;
+
+        // router i listens on basePort + i, its HTTP server and proxies on next hundreds
+        int GetClientTunnelPort () const { return basePort + 400; };
+        int GetSinkPort () const { return basePort + 401; };
+    };
+
+    struct Router
+    {
+        boost::filesystem::path dataDir;
+        int index;
+        bool isFloodfill;
+        pid_t pid;
+        std::vector<uint8_t> routerInfo;
+        std::string identHash;
+    };
+
+    // keys and RouterInfo as RouterContext creates them, but with loopback address and fixed port
+    static void CreateRouter (Router& router, const Options& options)
+    {
+        boost::filesystem::create_directories (router.dataDir);
+        auto keys = i2p::data::CreateRandomKeys ();
+        std::ofstream fk ((router.dataDir / "router.keys").string (), std::ofstream::binary | std::ofstream::out);
+        fk.write ((char *)&keys, sizeof (keys));
+
+        i2p::data::PrivateKeys privateKeys;
+        privateKeys = keys;
+        i2p::data::RouterInfo routerInfo;
+        routerInfo.SetRouterIdentity (privateKeys.GetPublic ());
+        int port = options.basePort + router.index;
+        routerInfo.AddSSUAddress ("127.0.0.1", port, routerInfo.GetIdentHash ());
+        routerInfo.AddNTCPAddress ("127.0.0.1", port);
+        uint8_t caps = i2p::data::RouterInfo::eReachable | i2p::data::RouterInfo::eHighBandwidth |
+            i2p::data::RouterInfo::eSSUTesting;
+        if (router.isFloodfill) caps |= i2p::data::RouterInfo::eFloodfill;
+        routerInfo.SetCaps (caps);
+        routerInfo.SetProperty ("coreVersion", I2P_VERSION);
+        routerInfo.SetProperty ("netId", "2");
+        routerInfo.SetProperty ("router.version", I2P_VERSION);
+        routerInfo.CreateBuffer (privateKeys);
+        routerInfo.SaveToFile ((router.dataDir / "router.info").string ());
+        router.routerInfo.assign (routerInfo.GetBuffer (), routerInfo.GetBuffer () + routerInfo.GetBufferLen ());
+        router.identHash = routerInfo.GetIdentHashBase64 ();
+    }
+
+    // the same layout as NetDb creates and loads
+    static void SeedNetDb (const Router& router, const std::vector<Router>& routers)
+    {
+        auto netDb = router.dataDir / "netDb";
+        const char * chars = i2p::util::GetBase64SubstitutionTable ();
+        for (int i = 0; i < 64; i++)
+            boost::filesystem::create_directories (netDb / (std::string ("r") + chars[i]));
+        for (auto& it: routers)
+        {
+            if (&it == &router) continue;
+            std::ofstream f ((netDb / (std::string ("r") + it.identHash[0]) / ("routerInfo-" + it.identHash + ".dat")).string (),
+                std::ofstream::binary | std::ofstream::out);
+            f.write ((const char *)it.routerInfo.data (), it.routerInfo.size ());
+        }
+    }
+
+    // returns b32 address of server tunnel
+    static std::string CreateTunnels (const Router& server, const Router& client, const Options& options)
+    {
+        auto keys = i2p::data::PrivateKeys::CreateRandomKeys (i2p::data::SIGNING_KEY_TYPE_ECDSA_SHA256_P256);
+        std::vector<uint8_t> buf (keys.GetFullLen ());
+        size_t len = keys.ToBuffer (buf.data (), buf.size ());
+        std::ofstream fk ((server.dataDir / SERVER_KEYS).string (), std::ofstream::binary | std::ofstream::out);
+        fk.write ((const char *)buf.data (), len);
+        std::string address = keys.GetPublic ().GetIdentHash ().ToBase32 () + ".b32.i2p";
+
+        std::ofstream fs ((server.dataDir / "tunnels.cfg").string ());
+        fs << "[simnet-server]\ntype = server\nhost = 127.0.0.1\nport = " << options.GetSinkPort ()
+            << "\nkeys = " << SERVER_KEYS << "\n";
+        std::ofstream fc ((client.dataDir / "tunnels.cfg").string ());
+        fc << "[simnet-client]\ntype = client\nport = " << options.GetClientTunnelPort ()
+            << "\ndestination = " << address << "\n";
+        return address;
+    }
+
+    static pid_t StartRouter (const Router& router, const Options& options)
+    {
+        int port = options.basePort + router.index;
+        std::vector<std::string> args =
+        {
+            options.i2pd,
+            "--datadir=" + router.dataDir.string (),
+            "--daemon=0",
+            "--reseed=0",
+            "--host=127.0.0.1",
+            "--port=" + std::to_string (port),
+            "--httpport=" + std::to_string (port + 100),
+            "--httpproxyport=" + std::to_string (port + 200),
+            "--socksproxyport=" + std::to_string (port + 300),
+            "--floodfill=" + std::string (router.isFloodfill ? "1" : "0"),
+            "--bandwidth=O",
+            "--loglevel=" + options.logLevel
+        };
+        pid_t pid = fork ();
+        if (pid == 0)
+        {
+            // log goes to stdout if not daemon
+            int fd = open ((router.dataDir / "i2pd.log").string ().c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd >= 0)
+            {
+                dup2 (fd, 1);
+                dup2 (fd, 2);
+                close (fd);
+            }
+            std::vector<char *> argv;
+            for (auto& it: args)
+                argv.push_back (const_cast<char *>(it.c_str ()));
+            argv.push_back (nullptr);
+            execv (argv[0], argv.data ());
+            _exit (127);
+        }
+        return pid;
+    }
+
+    static void StopRouters (std::vector<Router>& routers)
+    {
+        for (auto& it: routers)
+            if (it.pid > 0) kill (it.pid, SIGTERM);
+        auto deadline = std::chrono::steady_clock::now () + std::chrono::seconds (ROUTER_STOP_TIMEOUT);
+        for (auto& it: routers)
+        {
+            if (it.pid <= 0) continue;
+            while (waitpid (it.pid, nullptr, WNOHANG) == 0)
+            {
+                if (std::chrono::steady_clock::now () > deadline)
+                {
+                    std::cerr << "Router " << it.index << " doesn't stop, killed" << std::endl;
+                    kill (it.pid, SIGKILL);
+                    waitpid (it.pid, nullptr, 0);
+                    break;
+                }
+                std::this_thread::sleep_for (std::chrono::milliseconds (100));
+            }
+            it.pid = 0;
+        }
+    }
+
+    static bool AreRoutersRunning (std::vector<Router>& routers)
+    {
+        for (auto& it: routers)
+            if (waitpid (it.pid, nullptr, WNOHANG) != 0)
+            {
+                std::cerr << "Router " << it.index << " exited, see " << (it.dataDir / "i2pd.log").string () << std::endl;
+                it.pid = 0;
+                return false;
+            }
+        return true;
+    }
+
+    // user + system time of all routers in nanoseconds
+    static double GetRoutersCPUTime (const std::vector<Router>& routers)
+    {
+        double ticks = 0;
+        for (auto& it: routers)
+        {
+            std::ifstream f ("/proc/" + std::to_string (it.pid) + "/stat");
+            std::string stat;
+            std::getline (f, stat);
+            auto pos = stat.rfind (')'); // command might contain spaces
+            if (pos == std::string::npos) continue;
+            std::istringstream s (stat.substr (pos + 1));
+            std::string field;
+            for (int i = 0; i < 11; i++) s >> field; // state ... cmajflt
+            uint64_t utime = 0, stime = 0;
+            s >> utime >> stime;
+            ticks += utime + stime;
+        }
+        return ticks*1000000000.0/sysconf (_SC_CLK_TCK);
+    }
+
+    static bool WriteAll (int fd, const uint8_t * buf, size_t len)
+    {
+        while (len > 0)
+        {
+            auto l = send (fd, buf, len, MSG_NOSIGNAL);
+            if (l <= 0) return false;
+            buf += l; len -= l;
+        }
+        return true;
+    }
+
+    static bool ReadAll (int fd, uint8_t * buf, size_t len)
+    {
+        while (len > 0)
+        {
+            auto l = recv (fd, buf, len, 0);
+            if (l <= 0) return false;
+            buf += l; len -= l;
+        }
+        return true;
+    }
+
+    static void SetTimeout (int fd, int timeout)
+    {
+        struct timeval tv = { timeout, 0 };
+        setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+        setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+    }
+
+    // request is 8 bytes length followed by data, reply is the same length once all data is received.
+    // Zero length is ping
+    static bool Request (int fd, uint64_t len)
+    {
+        static std::vector<uint8_t> data (TRANSFER_CHUNK_SIZE, 0x55);
+        uint8_t header[8];
+        htobe64buf (header, len);
+        if (!WriteAll (fd, header, 8)) return false;
+        while (len > 0)
+        {
+            size_t l = std::min<uint64_t> (len, data.size ());
+            if (!WriteAll (fd, data.data (), l)) return false;
+            len -= l;
+        }
+        uint8_t reply[8];
+        return ReadAll (fd, reply, 8) && !memcmp (header, reply, 8);
+    }
+
+    static void HandleSinkConnection (int fd)
+    {
+        std::vector<uint8_t> buf (TRANSFER_CHUNK_SIZE);
+        uint8_t header[8];
+        while (ReadAll (fd, header, 8))
+        {
+            uint64_t len = bufbe64toh (header);
+            while (len > 0)
+            {
+                auto l = recv (fd, buf.data (), std::min<uint64_t> (len, buf.size ()), 0);
+                if (l <= 0) break;
+                len -= l;
+            }
+            if (len > 0 || !WriteAll (fd, header, 8)) break;
+        }
+        close (fd);
+    }
+
+    static int CreateSink (int port)
+    {
+        int fd = socket (AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+        sockaddr_in addr;
+        memset (&addr, 0, sizeof (addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons (port);
+        addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+        if (bind (fd, (sockaddr *)&addr, sizeof (addr)) < 0 || listen (fd, 5) < 0)
+        {
+            close (fd);
+            return -1;
+        }
+        std::thread ([fd]()
+            {
+                int s;
+                while ((s = accept (fd, nullptr, nullptr)) >= 0)
+                    std::thread (HandleSinkConnection, s).detach ();
+            }).detach ();
+        return fd;
+    }
+
+    static int Connect (int port)
+    {
+        int fd = socket (AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr;
+        memset (&addr, 0, sizeof (addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons (port);
+        addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+        if (connect (fd, (sockaddr *)&addr, sizeof (addr)) < 0)
+        {
+            close (fd);
+            return -1;
+        }
+        int one = 1;
+        setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+        return fd;
+    }
+
+    // tunnels are built and LeaseSet is found once ping goes through. Returns connected socket
+    static int WaitForReady (std::vector<Router>& routers, const Options& options)
+    {
+        auto deadline = std::chrono::steady_clock::now () + std::chrono::seconds (options.timeout);
+        while (std::chrono::steady_clock::now () < deadline && AreRoutersRunning (routers))
+        {
+            int fd = Connect (options.GetClientTunnelPort ());
+            if (fd >= 0)
+            {
+                SetTimeout (fd, READY_ATTEMPT_TIMEOUT);
+                if (Request (fd, 0)) return fd;
+                close (fd);
+            }
+            std::this_thread::sleep_for (std::chrono::seconds (5));
+        }
+        return -1;
+    }
+
+    struct Result
+    {
+        double readySeconds, latencyMs, throughputKBps, cpuNsPerByte;
+    };
+
+    static bool Measure (int fd, std::vector<Router>& routers, const Options& options, Result& result)
+    {
+        std::vector<double> pings;
+        for (int i = 0; i < options.numPings; i++)
+        {
+            auto start = std::chrono::steady_clock::now ();
+            if (!Request (fd, 0)) return false;
+            pings.push_back (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now () - start).count ());
+        }
+        std::sort (pings.begin (), pings.end ());
+        result.latencyMs = pings.empty () ? 0 : pings[pings.size ()/2]; // median
+
+        uint64_t size = (uint64_t)options.size*1024*1024;
+        SetTimeout (fd, options.timeout);
+        double cpuTime = GetRoutersCPUTime (routers);
+        auto start = std::chrono::steady_clock::now ();
+        if (!Request (fd, size)) return false;
+        double duration = std::chrono::duration<double>(std::chrono::steady_clock::now () - start).count ();
+        cpuTime = GetRoutersCPUTime (routers) - cpuTime;
+        result.throughputKBps = size/1024.0/duration;
+        result.cpuNsPerByte = cpuTime/size;
+        return true;
+    }
+
+    static void PrintResult (const Result& result, const Options& options)
+    {
+        std::cout << std::fixed << std::setprecision (2);
+        if (options.format == "json")
+            std::cout << "{\"version\":\"" << VERSION << "\",\"routers\":" << options.numRouters
+                << ",\"floodfills\":" << options.numFloodfills << ",\"bytes\":" << (uint64_t)options.size*1024*1024
+                << ",\"ready_seconds\":" << result.readySeconds << ",\"latency_ms\":" << result.latencyMs
+                << ",\"throughput_kbps\":" << result.throughputKBps << ",\"cpu_ns_per_byte\":" << result.cpuNsPerByte
+                << "}" << std::endl;
+        else
+            std::cout << "routers,floodfills,bytes,ready_seconds,latency_ms,throughput_kbps,cpu_ns_per_byte\n"
+                << options.numRouters << "," << options.numFloodfills << "," << (uint64_t)options.size*1024*1024 << ","
+                << result.readySeconds << "," << result.latencyMs << "," << result.throughputKBps << ","
+                << result.cpuNsPerByte << std::endl;
+    }
+
+    static void Usage ()
+    {
+        std::cout << "Usage: i2pd-simnet --i2pd=path [--routers=" << DEFAULT_NUM_ROUTERS << "] [--floodfills="
+            << DEFAULT_NUM_FLOODFILLS << "] [--size=MB] [--pings=n] [--baseport=port] [--timeout=seconds]"
+            << " [--dir=path] [--keep] [--loglevel=level] [--format=csv|json]" << std::endl;
+    }
+
+    static bool ParseOptions (int argc, char * argv[], Options& options)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg (argv[i]), value;
+            auto pos = arg.find ('=');
+            if (pos != std::string::npos)
+            {
+                value = arg.substr (pos + 1);
+                arg = arg.substr (0, pos);
+            }
+            if (arg == "--i2pd") options.i2pd = boost::filesystem::system_complete (value).string ();
+            else if (arg == "--dir") options.dir = value;
+            else if (arg == "--format") options.format = value;
+            else if (arg == "--loglevel") options.logLevel = value;
+            else if (arg == "--routers") options.numRouters = std::stoi (value);
+            else if (arg == "--floodfills") options.numFloodfills = std::stoi (value);
+            else if (arg == "--baseport") options.basePort = std::stoi (value);
+            else if (arg == "--size") options.size = std::stoi (value);
+            else if (arg == "--pings") options.numPings = std::stoi (value);
+            else if (arg == "--timeout") options.timeout = std::stoi (value);
+            else if (arg == "--keep") options.keep = true;
+            else return false;
+        }
+        // client and server tunnels are 3 hops each, and at least one floodfill is needed for LeaseSet
+        return !options.i2pd.empty () && options.numRouters >= 4 && options.numRouters < 100 &&
+            options.numFloodfills >= 1 && options.numFloodfills <= options.numRouters &&
+            (options.format == "csv" || options.format == "json");
+    }
+}
+}
+
+int main (int argc, char * argv[])
+{
+    using namespace i2p::simnet;
+    Options options;
+    try
+    {
+        if (!ParseOptions (argc, argv, options))
+        {
+            Usage ();
+            return 1;
+        }
+    }
+    catch (std::exception&)
+    {
+        Usage ();
+        return 1;
+    }
+    StartLog (new std::ostream (nullptr));
+
+    boost::filesystem::path dir = options.dir.empty () ?
+        boost::filesystem::temp_directory_path () / boost::filesystem::unique_path ("i2pd-simnet-%%%%%%%%") :
+        boost::filesystem::path (options.dir);
+    std::vector<Router> routers (options.numRouters);
+    for (int i = 0; i < options.numRouters; i++)
+    {
+        routers[i].index = i;
+        routers[i].dataDir = dir / ("router" + std::to_string (i));
+        routers[i].isFloodfill = i < options.numFloodfills;
+        routers[i].pid = 0;
+        CreateRouter (routers[i], options);
+    }
+    for (auto& it: routers)
+        SeedNetDb (it, routers);
+    auto address = CreateTunnels (routers.front (), routers.back (), options);
+    int sink = CreateSink (options.GetSinkPort ());
+    if (sink < 0)
+    {
+        std::cerr << "Can't listen on port " << options.GetSinkPort () << std::endl;
+        return 1;
+    }
+    std::cerr << "Starting " << options.numRouters << " routers in " << dir.string () << ", server " << address << std::endl;
+
+    auto start = std::chrono::steady_clock::now ();
+    for (auto& it: routers)
+        it.pid = StartRouter (it, options);
+    Result result;
+    bool success = false;
+    int fd = WaitForReady (routers, options);
+    if (fd >= 0)
+    {
+        result.readySeconds = std::chrono::duration<double>(std::chrono::steady_clock::now () - start).count ();
+        std::cerr << "Ready in " << result.readySeconds << " seconds, transferring " << options.size << " MB" << std::endl;
+        success = Measure (fd, routers, options, result);
+        close (fd);
+    }
+    if (success)
+        PrintResult (result, options);
+    else
+        std::cerr << "Failed. Router logs are in " << dir.string () << std::endl;
+
+    StopRouters (routers);
+    close (sink);
+    if (success && !options.keep)
+        boost::filesystem::remove_all (dir);
+    StopLog ();
+    return success ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+#include <memory>
+#include <vector>
+#include "RouterContext.h"
+#include "I2NPProtocol.h"
+#include "tunnel/TunnelGateway.h"
+#include "tunnel/TunnelEndpoint.h"
+#include "tunnel/TunnelConfig.h"
+#include "crypto/ElGamal.h"
+#include "Benchmark.h"
+
+using namespace i2p::benchmark;
+
+const size_t BENCHMARK_I2NP_MESSAGE_SIZE = 4000; // fragmented into 4 tunnel messages
+const int NUM_BENCHMARK_TUNNEL_HOPS = 3;
+
+static std::shared_ptr<i2p::I2NPMessage> CreateBenchmarkMessage ()
+{
+    std::vector<uint8_t> payload (BENCHMARK_I2NP_MESSAGE_SIZE);
+    i2p::context.GetRandomNumberGenerator ().GenerateBlock (payload.data (), payload.size ());
+    return i2p::ToSharedI2NPMessage (i2p::CreateI2NPMessage (i2p::eI2NPData, payload.data (), payload.size ()));
+}
+
+BENCHMARK(TunnelGatewayFragmentation, BENCHMARK_I2NP_MESSAGE_SIZE, []()
+{
+    auto buffer = std::make_shared<i2p::tunnel::TunnelGatewayBuffer> (1);
+    i2p::tunnel::TunnelMessageBlock block;
+    block.deliveryType = i2p::tunnel::eDeliveryTypeLocal;
+    block.data = CreateBenchmarkMessage ();
+    return [buffer, block](uint64_t numIterations)
+    {
+        for (uint64_t i = 0; i < numIterations; i++)
+        {
+            buffer->PutI2NPMsg (block);
+            buffer->CompleteCurrentTunnelDataMessage ();
+            DoNotOptimize (buffer->GetTunnelDataMsgs ().back ().get ());
+            buffer->ClearTunnelDataMsgs ();
+        }
+    };
+});
+
+BENCHMARK(TunnelEndpointReassembly, BENCHMARK_I2NP_MESSAGE_SIZE, []()
+{
+    // fragments as gateway creates them before encryption, what endpoint gets after decryption.
+    // Delivery to another router from inbound tunnel is dropped by endpoint, so nothing is sent
+    i2p::tunnel::TunnelGatewayBuffer buffer (1);
+    i2p::tunnel::TunnelMessageBlock block;
+    block.deliveryType = i2p::tunnel::eDeliveryTypeRouter;
+    i2p::context.GetRandomNumberGenerator ().GenerateBlock (block.hash, 32);
+    block.data = CreateBenchmarkMessage ();
+    buffer.PutI2NPMsg (block);
+    buffer.CompleteCurrentTunnelDataMessage ();
+    auto fragments = std::make_shared<std::vector<std::shared_ptr<i2p::I2NPMessage> > > (buffer.GetTunnelDataMsgs ());
+    auto endpoint = std::make_shared<i2p::tunnel::TunnelEndpoint> (true);
+    return [fragments, endpoint](uint64_t numIterations)
+    {
+        for (uint64_t i = 0; i < numIterations; i++)
+            for (auto& it: *fragments)
+            {
+                // endpoint keeps fragments, so every iteration gets a copy like from the wire
+                auto msg = i2p::ToSharedI2NPMessage (i2p::NewI2NPShortMessage ());
+                *msg = *it;
+                endpoint->HandleDecryptedTunnelDataMsg (msg);
+            }
+        DoNotOptimize (endpoint.get ());
+    };
+});
+
+struct BenchmarkTunnelHops
+{
+    std::vector<std::shared_ptr<i2p::tunnel::TunnelHopConfig> > hops;
+    uint8_t records[NUM_BENCHMARK_TUNNEL_HOPS*i2p::TUNNEL_BUILD_RECORD_SIZE];
+};
+
+// routers of random identities. Last hop replies to the first one, so router context is not needed
+static std::shared_ptr<BenchmarkTunnelHops> CreateBenchmarkTunnelHops ()
+{
+    auto tunnel = std::make_shared<BenchmarkTunnelHops> ();
+    for (int i = 0; i < NUM_BENCHMARK_TUNNEL_HOPS; i++)
+    {
+        auto router = std::make_shared<i2p::data::RouterInfo> ();
+        router->SetRouterIdentity (i2p::data::PrivateKeys::CreateRandomKeys ().GetPublic ());
+        auto hop = std::make_shared<i2p::tunnel::TunnelHopConfig> (router);
+        if (!tunnel->hops.empty ()) tunnel->hops.back ()->SetNext (hop.get ());
+        tunnel->hops.push_back (hop);
+    }
+    tunnel->hops.back ()->SetNextRouter (tunnel->hops.front ()->router);
+    return tunnel;
+}
+
+// iteration is records encryption of one tunnel build, as tunnel builds per second of one thread
+static void CreateBuildRequestRecords (std::shared_ptr<BenchmarkTunnelHops> tunnel, uint64_t numIterations)
+{
+    for (uint64_t i = 0; i < numIterations; i++)
+        for (int j = 0; j < NUM_BENCHMARK_TUNNEL_HOPS; j++)
+            tunnel->hops[j]->CreateBuildRequestRecord (tunnel->records + j*i2p::TUNNEL_BUILD_RECORD_SIZE, i);
+    DoNotOptimize (tunnel->records);
+}
+
+BENCHMARK(TunnelBuildRecords, 0, []()
+{
+    auto tunnel = CreateBenchmarkTunnelHops ();
+    return [tunnel](uint64_t numIterations)
+    {
+        CreateBuildRequestRecords (tunnel, numIterations);
+    };
+});
+
+struct ElGamalPrecomputationScope
+{
+    ElGamalPrecomputationScope () { i2p::crypto::elGamalPrecomputation.Start (); };
+    ~ElGamalPrecomputationScope () { i2p::crypto::elGamalPrecomputation.Stop (); };
+};
+
+BENCHMARK(TunnelBuildRecordsPrecomputed, 0, []()
+{
+    // g^k comes from background thread, rate is limited by it once the pool is exhausted
+    auto tunnel = CreateBenchmarkTunnelHops ();
+    auto precomputation = std::make_shared<ElGamalPrecomputationScope> ();
+    return [tunnel, precomputation](uint64_t numIterations)
+    {
+        CreateBuildRequestRecords (tunnel, numIterations);
+    };
+});
@@ -1,3 +1,4 @@
+#include <string.h>
 #include <fstream>
 #include <iostream>
 #include <boost/property_tree/ptree.hpp>
@@ -45,7 +46,8 @@ namespace client
         m_HttpProxy = new i2p::proxy::HTTPProxy(
             i2p::util::config::GetArg("-httpproxyaddress", "127.0.0.1"),
             i2p::util::config::GetArg("-httpproxyport", 4446),
-            localDestination
+            localDestination,
+            i2p::util::config::GetArg("-httpproxykeepalive", i2p::proxy::HTTP_PROXY_DEFAULT_MAX_IDLE_STREAMS)
         );
         m_HttpProxy->Start();
         LogPrint("HTTP Proxy started");
@@ -175,7 +177,8 @@ namespace client
         m_SharedLocalDestination = nullptr; 
     }   
     
-    std::shared_ptr<ClientDestination> ClientContext::LoadLocalDestination (const std::string& filename, bool isPublic)
+    std::shared_ptr<ClientDestination> ClientContext::LoadLocalDestination (const std::string& filename, bool isPublic,
+        const std::map<std::string, std::string> * params)
     {
         i2p::data::PrivateKeys keys;
         std::string fullPath = i2p::util::filesystem::GetFullPath (filename);
@@ -215,7 +218,7 @@ namespace client
         }
         else
         {
-            localDestination = std::make_shared<ClientDestination> (keys, isPublic);
+            localDestination = std::make_shared<ClientDestination> (keys, isPublic, params);
             m_Destinations[localDestination->GetIdentHash ()] = localDestination;
             localDestination->Start ();
         }
@@ -277,6 +280,20 @@ namespace client
         return nullptr;
     }   
 
+    template<typename Section>
+    void ClientContext::ReadI2CPOptions (const Section& section, std::map<std::string, std::string>& options) const
+    {
+        for (auto& it: section)
+        {
+            const std::string& name = it.first;
+            if (!name.compare (0, strlen (I2P_TUNNEL_I2CP_INBOUND_PREFIX), I2P_TUNNEL_I2CP_INBOUND_PREFIX) ||
+                !name.compare (0, strlen (I2P_TUNNEL_I2CP_OUTBOUND_PREFIX), I2P_TUNNEL_I2CP_OUTBOUND_PREFIX) ||
+                !name.compare (0, strlen (I2P_TUNNEL_I2CP_STREAMING_PREFIX), I2P_TUNNEL_I2CP_STREAMING_PREFIX) ||
+                !name.compare (0, strlen (I2P_TUNNEL_I2CP_PREFIX), I2P_TUNNEL_I2CP_PREFIX))
+                options[name] = it.second.data ();
+        }
+    }
+
     void ClientContext::ReadTunnels ()
     {
         boost::property_tree::ptree pt;
@@ -306,14 +323,22 @@ namespace client
                     );
                     std::string keys = section.second.get(I2P_CLIENT_TUNNEL_KEYS, "");
                     int destinationPort = section.second.get(I2P_CLIENT_TUNNEL_DESTINATION_PORT, 0);
+                    int streamPoolSize = section.second.get(I2P_CLIENT_TUNNEL_STREAM_POOL_SIZE, 0);
+                    int streamPoolIdleTimeout = section.second.get(I2P_CLIENT_TUNNEL_STREAM_POOL_IDLE_TIMEOUT,
+                        I2P_CLIENT_TUNNEL_DEFAULT_STREAM_POOL_IDLE_TIMEOUT);
 
                     std::shared_ptr<ClientDestination> localDestination = nullptr;
                     if(keys.length () > 0)
-                        localDestination = LoadLocalDestination (keys, false);
+                    {
+                        std::map<std::string, std::string> options;
+                        ReadI2CPOptions (section.second, options);
+                        localDestination = LoadLocalDestination (keys, false, &options);
+                    }
 
                     auto clientTunnel = new I2PClientTunnel(
                         dest, address, port, localDestination, destinationPort
                     );
+                    clientTunnel->SetStreamPool (streamPoolSize, streamPoolIdleTimeout);
                     // TODO: allow muliple tunnels on the same port (but on a different address)
                     if(m_ClientTunnels.insert(std::make_pair(port, std::unique_ptr<I2PClientTunnel>(clientTunnel))).second)
                         clientTunnel->Start ();
@@ -330,7 +355,9 @@ namespace client
                     int inPort = section.second.get (I2P_SERVER_TUNNEL_INPORT, 0);
                     std::string accessList = section.second.get (I2P_SERVER_TUNNEL_ACCESS_LIST, "");                    
 
-                    auto localDestination = LoadLocalDestination (keys, true);
+                    std::map<std::string, std::string> options;
+                    ReadI2CPOptions (section.second, options);
+                    auto localDestination = LoadLocalDestination (keys, true, &options);
                     I2PServerTunnel * serverTunnel = (type == I2P_TUNNELS_SECTION_TYPE_HTTP) ? new I2PServerTunnelHTTP (host, port, localDestination, inPort) : new I2PServerTunnel (host, port, localDestination, inPort);
                     if (accessList.length () > 0) {
                         std::set<i2p::data::IdentHash> idents;
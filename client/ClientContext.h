@@ -26,11 +26,18 @@ namespace client
     const char I2P_CLIENT_TUNNEL_DESTINATION[] = "destination";
     const char I2P_CLIENT_TUNNEL_KEYS[] = "keys";
     const char I2P_CLIENT_TUNNEL_DESTINATION_PORT[] = "destinationport";    
+    const char I2P_CLIENT_TUNNEL_STREAM_POOL_SIZE[] = "streampoolsize";
+    const char I2P_CLIENT_TUNNEL_STREAM_POOL_IDLE_TIMEOUT[] = "streampoolidletimeout";
     const char I2P_SERVER_TUNNEL_HOST[] = "host";   
     const char I2P_SERVER_TUNNEL_PORT[] = "port";
     const char I2P_SERVER_TUNNEL_KEYS[] = "keys";
     const char I2P_SERVER_TUNNEL_INPORT[] = "inport";
-    const char I2P_SERVER_TUNNEL_ACCESS_LIST[] = "accesslist";      
+    const char I2P_SERVER_TUNNEL_ACCESS_LIST[] = "accesslist";
+    // I2CP options of tunnel's destination, passed as is
+    const char I2P_TUNNEL_I2CP_INBOUND_PREFIX[] = "inbound.";
+    const char I2P_TUNNEL_I2CP_OUTBOUND_PREFIX[] = "outbound.";      
+    const char I2P_TUNNEL_I2CP_STREAMING_PREFIX[] = "i2p.streaming.";
+    const char I2P_TUNNEL_I2CP_PREFIX[] = "i2cp.";
 
     class ClientContext
     {
@@ -49,7 +56,8 @@ namespace client
                 const std::map<std::string, std::string> * params = nullptr);
             void DeleteLocalDestination (std::shared_ptr<ClientDestination> destination);
             std::shared_ptr<ClientDestination> FindLocalDestination (const i2p::data::IdentHash& destination) const;        
-            std::shared_ptr<ClientDestination> LoadLocalDestination (const std::string& filename, bool isPublic);
+            std::shared_ptr<ClientDestination> LoadLocalDestination (const std::string& filename, bool isPublic,
+                const std::map<std::string, std::string> * params = nullptr);
 
             AddressBook& GetAddressBook () { return m_AddressBook; };
             const SAMBridge * GetSAMBridge () const { return m_SamBridge; };
@@ -57,6 +65,8 @@ namespace client
         private:
 
             void ReadTunnels ();
+            template<typename Section>
+            void ReadI2CPOptions (const Section& section, std::map<std::string, std::string>& options) const;
     
         private:
 
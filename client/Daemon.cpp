@@ -60,6 +60,7 @@ namespace i2p
 
             isDaemon = i2p::util::config::GetArg("-daemon", 0);
             isLogging = i2p::util::config::GetArg("-log", 1);
+            SetLogLevel (i2p::util::config::GetArg("-loglevel", "debug"));
 
             int port = i2p::util::config::GetArg("-port", 0);
             if (port)
@@ -79,6 +80,24 @@ namespace i2p
                     i2p::context.SetLowBandwidth ();
             }   
 
+            i2p::data::netdb.SetReseed (i2p::util::config::GetArg("-reseed", 1));
+            i2p::transport::transports.SetNumNTCPThreads (i2p::util::config::GetArg("-ntcpthreads", 1));
+            i2p::transport::transports.SetNumHandshakeWorkers (i2p::util::config::GetArg("-handshakethreads", 
+                i2p::transport::HANDSHAKE_DEFAULT_NUM_WORKERS));
+            i2p::transport::transports.GetHandshakeWorkers ().SetMaxRatePerIP (i2p::util::config::GetArg("-handshakeratelimit",
+                i2p::transport::HANDSHAKE_DEFAULT_MAX_RATE_PER_IP));
+
+            // traffic shaping, rates in KBps, bursts in KB
+            auto& limiter = i2p::transport::transports.GetBandwidthLimiter ();
+            limiter.SetTotalLimit (i2p::util::config::GetArg("-bwlimit", 0)*1024,
+                i2p::util::config::GetArg("-bwburst", 0)*1024);
+            limiter.SetClassLimit (i2p::eTrafficClassClient, i2p::util::config::GetArg("-bwclient", 0)*1024,
+                i2p::util::config::GetArg("-bwclientburst", 0)*1024);
+            limiter.SetClassLimit (i2p::eTrafficClassTransit, i2p::util::config::GetArg("-bwtransit", 0)*1024,
+                i2p::util::config::GetArg("-bwtransitburst", 0)*1024);
+            limiter.SetClassLimit (i2p::eTrafficClassNetDb, i2p::util::config::GetArg("-bwnetdb", 0)*1024,
+                i2p::util::config::GetArg("-bwnetdbburst", 0)*1024);
+
             LogPrint("CMD parameters:");
             for (int i = 0; i < argc; ++i)
                 LogPrint(i, "  ", argv[i]);
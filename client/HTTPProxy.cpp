@@ -1,11 +1,9 @@
 #include <cstring>
-#include <cassert>
-#include <boost/lexical_cast.hpp>
-#include <boost/regex.hpp>
 #include <string>
-#include <atomic>
 #include "HTTPProxy.h"
 #include "util/util.h"
+#include "util/Timestamp.h"
+#include "util/Metrics.h"
 #include "Identity.h"
 #include "Streaming.h"
 #include "Destination.h"
@@ -18,48 +16,78 @@ namespace i2p
 namespace proxy
 {
     static const size_t http_buffer_size = 8192;
-    class HTTPProxyHandler: public i2p::client::I2PServiceHandler, public std::enable_shared_from_this<HTTPProxyHandler> 
+
+    /**
+     * Serves requests of one client connection one after another (HTTP/1.1 keep-alive).
+     * Request head is rewritten and sent over idle stream of the proxy if any,
+     * response head is rewritten and its body is forwarded as is until its end is found by the parser.
+     * After 101 Switching Protocols the connection is handed over to I2PTunnelConnection
+     */
+    class HTTPProxyHandler: public i2p::client::I2PServiceHandler, public std::enable_shared_from_this<HTTPProxyHandler>
     {
         private:
-            enum state 
-            {
-                GET_METHOD,
-                GET_HOSTNAME,
-                GET_HTTPV,
-                GET_HTTPVNL, //TODO: fallback to finding HOst: header if needed
-                DONE
-            };
-
-            void EnterState(state nstate);
-            bool HandleData(uint8_t *http_buff, std::size_t len);
+
             void HandleSockRecv(const boost::system::error_code & ecode, std::size_t bytes_transfered);
             void Terminate();
             void AsyncSockRead();
-            void HTTPRequestFailed(/*std::string message*/);
-            void ExtractRequest();
+            void HTTPRequestFailed(const char * status);
+            bool ExtractRequest();
             bool ValidateHTTPRequest();
             void HandleJumpServices();
-            bool CreateHTTPRequest(uint8_t *http_buff, std::size_t len);
+            void CreateHTTPRequest();
+            void CreateHTTPResponse();
             void SentHTTPFailed(const boost::system::error_code & ecode);
+
+            void HandleClientData ();
+            void ConnectStream ();
+            void CreateStream ();
             void HandleStreamRequestComplete (std::shared_ptr<i2p::stream::Stream> stream);
+            void SendRequestBody ();
+            void StreamReceive ();
+            void HandleStreamReceive (const boost::system::error_code& ecode, std::size_t bytes_transferred);
+            void HandleResponseData ();
+            void HandleSockWrite (const boost::system::error_code& ecode);
+            void CompleteResponse ();
+            void SwitchProtocols ();
+            HTTPProxyServer * GetProxy () { return static_cast<HTTPProxyServer *>(GetOwner ()); };
 
-            uint8_t m_http_buff[http_buffer_size];
+            uint8_t m_http_buff[http_buffer_size], m_stream_buff[http_buffer_size];
+            const uint8_t * m_client_data, * m_stream_data; // not parsed yet
+            size_t m_client_data_len, m_stream_data_len;
             std::shared_ptr<boost::asio::ip::tcp::socket> m_sock;
-            std::string m_request; //Data left to be sent
+            std::shared_ptr<i2p::stream::Stream> m_stream;
+            i2p::util::http::HTTPParser m_request_parser, m_response_parser;
+            std::string m_request; //Rewritten request head
+            std::string m_response; //Error response or rewritten response head
             std::string m_url; //URL
             std::string m_method; //Method
             std::string m_version; //HTTP version
             std::string m_address; //Address
             std::string m_path; //Path
             int m_port; //Port
-            state m_state;//Parsing state
+            i2p::data::IdentHash m_ident; //Destination of address
+            bool m_keep_alive; //Client keeps connection after response
+            bool m_reused_stream; //Stream was idle in proxy
+            bool m_upgrade; //Client asked to switch protocols
+            bool m_switched; //Got 101, everything from stream is forwarded as is
+            size_t m_response_len; //Forwarded to client
 
         public:
 
-            HTTPProxyHandler(HTTPProxyServer * parent, std::shared_ptr<boost::asio::ip::tcp::socket> sock) : 
-                I2PServiceHandler(parent), m_sock(sock)
-                { EnterState(GET_METHOD); }
-            ~HTTPProxyHandler() { Terminate(); }
+            HTTPProxyHandler(HTTPProxyServer * parent, std::shared_ptr<boost::asio::ip::tcp::socket> sock) :
+                I2PServiceHandler(parent), m_client_data (nullptr), m_stream_data (nullptr),
+                m_client_data_len (0), m_stream_data_len (0), m_sock(sock),
+                m_request_parser (false), m_response_parser (true), m_port (0),
+                m_keep_alive (false), m_reused_stream (false), m_upgrade (false), m_switched (false),
+                m_response_len (0)
+                {}
+            ~HTTPProxyHandler()
+            {
+                // can't call Terminate from destructor, there is no shared_ptr anymore
+                if (Kill()) return;
+                if (m_stream) m_stream->Close ();
+                if (m_sock) m_sock->close ();
+            }
             void Handle () { AsyncSockRead(); }
     };
 
@@ -77,7 +105,12 @@ namespace proxy
 
     void HTTPProxyHandler::Terminate() {
         if (Kill()) return;
-        if (m_sock) 
+        if (m_stream)
+        {
+            m_stream->Close ();
+            m_stream = nullptr;
+        }
+        if (m_sock)
         {
             LogPrint(eLogDebug,"--- HTTP Proxy close sock");
             m_sock->close();
@@ -86,52 +119,58 @@ namespace proxy
         Done(shared_from_this());
     }
 
-    /* All hope is lost beyond this point */
-    //TODO: handle this apropriately
-    void HTTPProxyHandler::HTTPRequestFailed(/*HTTPProxyHandler::errTypes error*/)
+    void HTTPProxyHandler::HTTPRequestFailed(const char * status)
     {
-        static std::string response = "HTTP/1.0 500 Internal Server Error\r\nContent-type: text/html\r\nContent-length: 0\r\n";
-        boost::asio::async_write(*m_sock, boost::asio::buffer(response,response.size()),
+        if (m_stream)
+        {
+            m_stream->Close ();
+            m_stream = nullptr;
+        }
+        m_response = "HTTP/1.0 ";
+        m_response += status;
+        m_response += "\r\nContent-type: text/html\r\nContent-length: 0\r\nConnection: close\r\n\r\n";
+        boost::asio::async_write(*m_sock, boost::asio::buffer(m_response),
                      std::bind(&HTTPProxyHandler::SentHTTPFailed, shared_from_this(), std::placeholders::_1));
     }
 
-    void HTTPProxyHandler::EnterState(HTTPProxyHandler::state nstate) 
-    {
-        m_state = nstate;
-    }
-
-    void HTTPProxyHandler::ExtractRequest()
+    bool HTTPProxyHandler::ExtractRequest()
     {
+        m_method = m_request_parser.GetMethod ();
+        m_url = m_request_parser.GetURL ();
+        m_version = m_request_parser.GetVersion ();
         LogPrint(eLogDebug,"--- HTTP Proxy method is: ", m_method, "\nRequest is: ", m_url);
-        std::string server="";
-        std::string port="80";
-        boost::regex rHTTP("http://(.*?)(:(\\d+))?(/.*)");
-        boost::smatch m;
-        std::string path;
-        if(boost::regex_search(m_url, m, rHTTP, boost::match_extra)) 
+        // http://host[:port][/path]
+        static const std::string scheme ("http://");
+        if (m_url.compare (0, scheme.length (), scheme)) return false;
+        size_t hostEnd = m_url.find_first_of (":/?", scheme.length ()), pathStart = hostEnd;
+        m_address = m_url.substr (scheme.length (), hostEnd - scheme.length ());
+        m_port = 80;
+        if (hostEnd != std::string::npos && m_url[hostEnd] == ':')
         {
-            server=m[1].str();
-            if (m[2].str() != "")  port=m[3].str();
-            path=m[4].str();
-        }
-        LogPrint(eLogDebug,"--- HTTP Proxy server is: ",server, " port is: ", port, "\n path is: ",path);
-        m_address = server;
-        m_port = boost::lexical_cast<int>(port);
-        m_path = path;
+            pathStart = m_url.find_first_of ("/?", hostEnd);
+            auto port = m_url.substr (hostEnd + 1, pathStart - hostEnd - 1);
+            if (port.empty () || port.length () > 5 || port.find_first_not_of ("0123456789") != std::string::npos)
+                return false;
+            m_port = std::stoi (port);
+        }
+        m_path = pathStart != std::string::npos ? m_url.substr (pathStart) : "/";
+        if (m_path[0] != '/') m_path.insert (0, 1, '/');
+        LogPrint(eLogDebug,"--- HTTP Proxy server is: ", m_address, " port is: ", m_port, "\n path is: ", m_path);
+        return !m_address.empty ();
     }
 
-    bool HTTPProxyHandler::ValidateHTTPRequest() 
+    bool HTTPProxyHandler::ValidateHTTPRequest()
     {
-        if ( m_version != "HTTP/1.0" && m_version != "HTTP/1.1" ) 
+        if ( m_version != "HTTP/1.0" && m_version != "HTTP/1.1" )
         {
             LogPrint(eLogError,"--- HTTP Proxy unsupported version: ", m_version);
-            HTTPRequestFailed(); //TODO: send right stuff
+            HTTPRequestFailed("505 HTTP Version Not Supported");
             return false;
         }
         return true;
     }
 
-    void HTTPProxyHandler::HandleJumpServices() 
+    void HTTPProxyHandler::HandleJumpServices()
     {
         static const char * helpermark1 = "?i2paddresshelper=";
         static const char * helpermark2 = "&i2paddresshelper=";
@@ -163,133 +202,441 @@ namespace proxy
         m_path.erase(addressHelperPos);
     }
 
-    bool HTTPProxyHandler::CreateHTTPRequest(uint8_t *http_buff, std::size_t len) 
+    void HTTPProxyHandler::CreateHTTPRequest()
     {
-        ExtractRequest(); //TODO: parse earlier
-        if (!ValidateHTTPRequest()) return false;
-        HandleJumpServices();
-        m_request = m_method;
+        m_request.clear (); // capacity is kept for next request
+        m_request += m_method;
         m_request.push_back(' ');
         m_request += m_path;
         m_request.push_back(' ');
         m_request += m_version;
-        m_request.push_back('\r');
-        m_request.push_back('\n');
-        m_request.append("Connection: close\r\n");
-        m_request.append(reinterpret_cast<const char *>(http_buff),len);
-        return true;
+        m_request.append("\r\n");
+        for (size_t i = 0; i < m_request_parser.GetNumHeaders (); i++)
+        {
+            // hop-by-hop headers are ours, Upgrade is passed if Connection asks for it
+            if (m_request_parser.IsHeader (i, "Connection") || m_request_parser.IsHeader (i, "Proxy-Connection") ||
+                m_request_parser.IsHeader (i, "Keep-Alive") || m_request_parser.IsHeader (i, "Proxy-Authorization") ||
+                (!m_upgrade && m_request_parser.IsHeader (i, "Upgrade")))
+                continue;
+            m_request_parser.AppendHeader (i, m_request);
+        }
+        if (m_upgrade)
+            m_request.append("Connection: upgrade\r\n");
+        else
+            m_request.append(GetProxy ()->GetMaxIdleStreams () > 0 ? "Connection: keep-alive\r\n" : "Connection: close\r\n");
+        m_request.append("\r\n");
     }
 
-    bool HTTPProxyHandler::HandleData(uint8_t *http_buff, std::size_t len)
+    void HTTPProxyHandler::CreateHTTPResponse()
     {
-        assert(len); // This should always be called with a least a byte left to parse
-        while (len > 0) 
+        m_response.clear ();
+        m_response += m_response_parser.GetVersion ();
+        m_response.push_back(' ');
+        m_response += std::to_string (m_response_parser.GetStatusCode ());
+        m_response.push_back(' ');
+        m_response += m_response_parser.GetReason ();
+        m_response.append("\r\n");
+        int code = m_response_parser.GetStatusCode ();
+        for (size_t i = 0; i < m_response_parser.GetNumHeaders (); i++)
         {
-            //TODO: fallback to finding HOst: header if needed
-            switch (m_state) 
-            {
-                case GET_METHOD:
-                    switch (*http_buff) 
-                    {
-                        case ' ': EnterState(GET_HOSTNAME); break;
-                        default: m_method.push_back(*http_buff); break;
-                    }
-                break;
-                case GET_HOSTNAME:
-                    switch (*http_buff) 
-                    {
-                        case ' ': EnterState(GET_HTTPV); break;
-                        default: m_url.push_back(*http_buff); break;
-                    }
-                break;
-                case GET_HTTPV:
-                    switch (*http_buff) 
-                    {
-                        case '\r': EnterState(GET_HTTPVNL); break;
-                        default: m_version.push_back(*http_buff); break;
-                    }
-                break;
-                case GET_HTTPVNL:
-                    switch (*http_buff) 
-                    {
-                        case '\n': EnterState(DONE); break;
-                        default:
-                            LogPrint(eLogError,"--- HTTP Proxy rejected invalid request ending with: ", ((int)*http_buff));
-                            HTTPRequestFailed(); //TODO: add correct code
-                            return false;
-                    }
-                break;
-                default:
-                    LogPrint(eLogError,"--- HTTP Proxy invalid state: ", m_state);
-                    HTTPRequestFailed(); //TODO: add correct code 500
-                    return false;
-            }
-            http_buff++;
-            len--;
-            if (m_state == DONE)
-                return CreateHTTPRequest(http_buff,len);
+            // hop-by-hop headers of stream leg, 101 keeps Upgrade and Connection for the new protocol.
+            // Transfer-Encoding stays, body is forwarded with its framing and client's version was sent to server
+            if (code != 101 && (m_response_parser.IsHeader (i, "Connection") ||
+                m_response_parser.IsHeader (i, "Keep-Alive") || m_response_parser.IsHeader (i, "Upgrade")))
+                continue;
+            if (m_response_parser.IsHeader (i, "Proxy-Connection"))
+                continue;
+            m_response_parser.AppendHeader (i, m_response);
         }
-        return true;
+        if (code >= 200)
+        {
+            bool keepAlive = m_keep_alive && m_response_parser.GetBodyType () != i2p::util::http::HTTPParser::eUntilCloseBody;
+            m_response.append(keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n");
+        }
+        m_response.append("\r\n");
     }
 
     void HTTPProxyHandler::HandleSockRecv(const boost::system::error_code & ecode, std::size_t len)
     {
         LogPrint(eLogDebug,"--- HTTP Proxy sock recv: ", len);
-        if(ecode) 
+        if(ecode)
         {
-            LogPrint(eLogWarning," --- HTTP Proxy sock recv got error: ", ecode);
-                        Terminate();
+            if (ecode != boost::asio::error::eof || m_request_parser.GetState () != i2p::util::http::HTTPParser::eHead)
+                LogPrint(eLogWarning," --- HTTP Proxy sock recv got error: ", ecode);
+            Terminate();
             return;
         }
+        m_client_data = m_http_buff;
+        m_client_data_len = len;
+        HandleClientData ();
+    }
 
-        if (HandleData(m_http_buff, len)) 
+    void HTTPProxyHandler::HandleClientData ()
+    {
+        if (!m_client_data_len)
         {
-            if (m_state == DONE) 
-            {
+            AsyncSockRead ();
+            return;
+        }
+        if (m_request_parser.GetState () != i2p::util::http::HTTPParser::eHead)
+        {
+            SendRequestBody ();
+            return;
+        }
+        size_t len = m_request_parser.Parse ((const char *)m_client_data, m_client_data_len);
+        m_client_data += len;
+        m_client_data_len -= len;
+        switch (m_request_parser.GetState ())
+        {
+            case i2p::util::http::HTTPParser::eHead:
+                AsyncSockRead ();
+            break;
+            case i2p::util::http::HTTPParser::eError:
+                LogPrint(eLogError,"--- HTTP Proxy rejected invalid request");
+                HTTPRequestFailed("400 Bad Request");
+            break;
+            default:
+                if (!ExtractRequest ())
+                {
+                    LogPrint(eLogError,"--- HTTP Proxy can't parse URL ", m_url);
+                    HTTPRequestFailed("400 Bad Request");
+                    return;
+                }
+                if (!ValidateHTTPRequest()) return;
+                HandleJumpServices();
+                m_keep_alive = m_request_parser.IsKeepAlive ();
+                m_upgrade = m_request_parser.IsUpgrade ();
+                CreateHTTPRequest();
                 LogPrint(eLogInfo,"--- HTTP Proxy requested: ", m_url);
-                GetOwner()->CreateStream (std::bind (&HTTPProxyHandler::HandleStreamRequestComplete,
-                        shared_from_this(), std::placeholders::_1), m_address, m_port);
-            } 
-            else 
-                AsyncSockRead();
+                ConnectStream ();
         }
-
     }
 
-    void HTTPProxyHandler::SentHTTPFailed(const boost::system::error_code & ecode)
+    void HTTPProxyHandler::ConnectStream ()
     {
-        if (!ecode)
-            Terminate();
-        else 
+        if (!i2p::client::context.GetAddressBook ().GetIdentHash (m_address, m_ident))
         {
-            LogPrint (eLogError,"--- HTTP Proxy Closing socket after sending failure because: ", ecode.message ());
-            Terminate();
+            LogPrint (eLogWarning, "--- HTTP Proxy remote destination ", m_address, " not found");
+            HTTPRequestFailed("502 Bad Gateway");
+            return;
+        }
+        static auto& numReused = i2p::util::metrics.GetCounter ("i2pd_http_proxy_requests_total",
+            "Requests of HTTP proxy by stream", "stream=\"reused\"");
+        auto stream = GetProxy ()->GetIdleStream (m_ident, m_port);
+        if (stream)
+        {
+            numReused.Inc ();
+            m_reused_stream = true;
+            HandleStreamRequestComplete (stream);
         }
+        else
+            CreateStream ();
+    }
+
+    void HTTPProxyHandler::CreateStream ()
+    {
+        static auto& numCreated = i2p::util::metrics.GetCounter ("i2pd_http_proxy_requests_total",
+            "Requests of HTTP proxy by stream", "stream=\"new\"");
+        numCreated.Inc ();
+        m_reused_stream = false;
+        GetOwner()->GetLocalDestination ()->CreateStream (std::bind (&HTTPProxyHandler::HandleStreamRequestComplete,
+            shared_from_this(), std::placeholders::_1), m_ident, m_port);
     }
 
     void HTTPProxyHandler::HandleStreamRequestComplete (std::shared_ptr<i2p::stream::Stream> stream)
     {
-        if (stream) 
+        if (Dead ())
         {
-            if (Kill()) return;
-            LogPrint (eLogInfo,"--- HTTP Proxy New I2PTunnel connection");
-            auto connection = std::make_shared<i2p::client::I2PTunnelConnection>(GetOwner(), m_sock, stream);
-            GetOwner()->AddHandler (connection);
-            connection->I2PConnect (reinterpret_cast<const uint8_t*>(m_request.data()), m_request.size());
-            Done(shared_from_this());
-        } 
-        else 
+            if (stream) stream->Close ();
+            return;
+        }
+        if (!stream)
         {
             LogPrint (eLogError,"--- HTTP Proxy Issue when creating the stream, check the previous warnings for more info.");
-            HTTPRequestFailed(); // TODO: Send correct error message host unreachable
+            HTTPRequestFailed("502 Bad Gateway");
+            return;
+        }
+        LogPrint (eLogDebug, "--- HTTP Proxy ", m_reused_stream ? "reused" : "new", " stream to ", m_address);
+        m_stream = stream;
+        m_response_parser.Reset (m_method == "HEAD");
+        m_response_len = 0;
+        m_stream_data_len = 0;
+        // head and body bytes we already have get to the same SendBuffer call, so new stream's SYN carries them
+        m_stream->Send (reinterpret_cast<const uint8_t *>(m_request.data ()), m_request.size ()); // connect and send
+        if (m_request_parser.GetState () == i2p::util::http::HTTPParser::eBody)
+            SendRequestBody ();
+        StreamReceive ();
+    }
+
+    void HTTPProxyHandler::SendRequestBody ()
+    {
+        if (!m_client_data_len)
+        {
+            AsyncSockRead ();
+            return;
         }
+        size_t len = m_request_parser.Parse ((const char *)m_client_data, m_client_data_len);
+        if (m_request_parser.GetState () == i2p::util::http::HTTPParser::eError)
+        {
+            LogPrint (eLogError,"--- HTTP Proxy invalid request body");
+            Terminate ();
+            return;
+        }
+        auto data = m_client_data;
+        m_client_data += len;
+        m_client_data_len -= len;
+        auto s = shared_from_this ();
+        m_stream->AsyncSend (data, len,
+            [s](const boost::system::error_code& ecode)
+            {
+                if (ecode)
+                    s->Terminate ();
+                else if (s->m_request_parser.GetState () == i2p::util::http::HTTPParser::eBody)
+                    s->SendRequestBody ();
+            });
     }
 
-    HTTPProxyServer::HTTPProxyServer(const std::string& address, int port, std::shared_ptr<i2p::client::ClientDestination> localDestination): 
-        TCPIPAcceptor(address, port, localDestination ? localDestination : i2p::client::context.GetSharedLocalDestination ()) 
+    void HTTPProxyHandler::StreamReceive ()
     {
+        m_stream->AsyncReceive (boost::asio::buffer (m_stream_buff, http_buffer_size),
+            std::bind (&HTTPProxyHandler::HandleStreamReceive, shared_from_this (),
+                std::placeholders::_1, std::placeholders::_2),
+            i2p::client::I2P_TUNNEL_CONNECTION_MAX_IDLE);
+    }
+
+    void HTTPProxyHandler::HandleStreamReceive (const boost::system::error_code& ecode, std::size_t bytes_transferred)
+    {
+        if (Dead ()) return;
+        if (ecode)
+        {
+            if (ecode == boost::asio::error::operation_aborted) return;
+            if (m_response_parser.GetBodyType () == i2p::util::http::HTTPParser::eUntilCloseBody)
+                Terminate (); // end of response
+            else if (!m_response_len && m_reused_stream &&
+                m_request_parser.GetBodyType () == i2p::util::http::HTTPParser::eNoBody)
+            {
+                // idle stream was closed by server, request is sent again
+                LogPrint (eLogDebug, "--- HTTP Proxy idle stream to ", m_address, " is closed: ", ecode.message ());
+                m_stream->Close ();
+                m_stream = nullptr;
+                CreateStream ();
+            }
+            else if (!m_response_len)
+            {
+                LogPrint (eLogError, "--- HTTP Proxy no response from ", m_address, ": ", ecode.message ());
+                HTTPRequestFailed("502 Bad Gateway");
+            }
+            else
+            {
+                LogPrint (eLogWarning, "--- HTTP Proxy stream read error: ", ecode.message ());
+                Terminate ();
+            }
+            return;
+        }
+        m_stream_data = m_stream_buff;
+        m_stream_data_len = bytes_transferred;
+        HandleResponseData ();
     }
-    
+
+    void HTTPProxyHandler::HandleResponseData ()
+    {
+        bool isHead = m_response_parser.GetState () == i2p::util::http::HTTPParser::eHead;
+        size_t len = m_switched ? m_stream_data_len :
+            m_response_parser.Parse ((const char *)m_stream_data, m_stream_data_len);
+        if (m_response_parser.GetState () == i2p::util::http::HTTPParser::eError)
+        {
+            LogPrint (eLogError, "--- HTTP Proxy invalid response from ", m_address);
+            if (m_response_len)
+                Terminate ();
+            else
+                HTTPRequestFailed("502 Bad Gateway");
+            return;
+        }
+        auto data = m_stream_data;
+        m_stream_data += len;
+        m_stream_data_len -= len;
+        if (isHead)
+        {
+            if (m_response_parser.GetState () == i2p::util::http::HTTPParser::eHead)
+            {
+                StreamReceive (); // head is kept by parser until it's complete
+                return;
+            }
+            CreateHTTPResponse ();
+            data = reinterpret_cast<const uint8_t *>(m_response.data ());
+            len = m_response.size ();
+        }
+        m_response_len += len;
+        boost::asio::async_write (*m_sock, boost::asio::buffer (data, len),
+            std::bind (&HTTPProxyHandler::HandleSockWrite, shared_from_this (), std::placeholders::_1));
+    }
+
+    void HTTPProxyHandler::HandleSockWrite (const boost::system::error_code& ecode)
+    {
+        if (ecode)
+        {
+            LogPrint (eLogWarning, "--- HTTP Proxy write error: ", ecode.message ());
+            if (ecode != boost::asio::error::operation_aborted)
+                Terminate ();
+            return;
+        }
+        if (m_switched)
+        {
+            // rest of stream data is the new protocol's already
+            if (m_stream_data_len)
+                HandleResponseData ();
+            else
+                SwitchProtocols ();
+            return;
+        }
+        if (m_response_parser.GetState () == i2p::util::http::HTTPParser::eComplete)
+        {
+            if (m_response_parser.GetStatusCode () == 101)
+            {
+                if (!m_upgrade || m_request_parser.GetState () != i2p::util::http::HTTPParser::eComplete)
+                {
+                    LogPrint (eLogError, "--- HTTP Proxy unexpected 101 response from ", m_address);
+                    Terminate ();
+                    return;
+                }
+                m_switched = true;
+                if (m_stream_data_len)
+                    HandleResponseData ();
+                else
+                    SwitchProtocols ();
+                return;
+            }
+            if (m_response_parser.GetStatusCode () >= 200)
+            {
+                CompleteResponse ();
+                return;
+            }
+            m_response_parser.Reset (m_method == "HEAD"); // interim response, final one follows
+        }
+        if (m_stream_data_len)
+            HandleResponseData ();
+        else
+            StreamReceive ();
+    }
+
+    void HTTPProxyHandler::CompleteResponse ()
+    {
+        bool isRequestSent = m_request_parser.GetState () == i2p::util::http::HTTPParser::eComplete;
+        if (!isRequestSent)
+            m_keep_alive = false; // response came before whole request body
+        // stream is reused if nothing is left after response
+        if (isRequestSent && !m_stream_data_len && !m_stream->GetReceiveQueueSize () && m_response_parser.IsKeepAlive ())
+            GetProxy ()->ReleaseStream (m_stream, m_ident, m_port);
+        else
+            m_stream->Close ();
+        m_stream = nullptr;
+        if (!m_keep_alive)
+        {
+            Terminate ();
+            return;
+        }
+        m_request_parser.Reset ();
+        HandleClientData (); // next request might be received already
+    }
+
+    void HTTPProxyHandler::SwitchProtocols ()
+    {
+        // stream isn't pooled, it's owned by the connection from now on
+        if (Kill ()) return;
+        LogPrint (eLogDebug, "--- HTTP Proxy switched protocols with ", m_address);
+        auto connection = std::make_shared<i2p::client::I2PTunnelConnection>(GetOwner(), m_sock, m_stream);
+        GetOwner()->AddHandler (connection);
+        // client data after request head belongs to the new protocol, stream copies it
+        connection->I2PConnect (m_client_data_len ? m_client_data : nullptr, m_client_data_len);
+        m_stream = nullptr;
+        m_sock = nullptr;
+        Done(shared_from_this());
+    }
+
+    void HTTPProxyHandler::SentHTTPFailed(const boost::system::error_code & ecode)
+    {
+        if (ecode)
+            LogPrint (eLogError,"--- HTTP Proxy Closing socket after sending failure because: ", ecode.message ());
+        Terminate();
+    }
+
+    HTTPProxyServer::HTTPProxyServer(const std::string& address, int port, std::shared_ptr<i2p::client::ClientDestination> localDestination,
+        int maxIdleStreams):
+        TCPIPAcceptor(address, port, localDestination ? localDestination : i2p::client::context.GetSharedLocalDestination ()),
+        m_MaxIdleStreams (maxIdleStreams), m_LastCleanupTime (0)
+    {
+    }
+
+    void HTTPProxyServer::Stop ()
+    {
+        {
+            std::unique_lock<std::mutex> l(m_IdleStreamsMutex);
+            for (auto& it: m_IdleStreams)
+                for (auto& it1: it.second)
+                    it1.first->Close ();
+            m_IdleStreams.clear ();
+        }
+        TCPIPAcceptor::Stop ();
+    }
+
+    std::shared_ptr<i2p::stream::Stream> HTTPProxyServer::GetIdleStream (const i2p::data::IdentHash& ident, int port)
+    {
+        std::unique_lock<std::mutex> l(m_IdleStreamsMutex);
+        auto it = m_IdleStreams.find (std::make_pair (ident, port));
+        if (it == m_IdleStreams.end ()) return nullptr;
+        auto ts = i2p::util::GetSecondsSinceEpoch ();
+        std::shared_ptr<i2p::stream::Stream> stream;
+        auto& streams = it->second;
+        while (!stream && !streams.empty ())
+        {
+            auto idle = streams.back (); // most recently used is most likely alive
+            streams.pop_back ();
+            if (idle.first->IsOpen () && !idle.first->GetReceiveQueueSize () &&
+                ts < idle.second + HTTP_PROXY_IDLE_STREAM_TIMEOUT)
+                stream = idle.first;
+            else
+                idle.first->Close ();
+        }
+        if (streams.empty ())
+            m_IdleStreams.erase (it);
+        return stream;
+    }
+
+    void HTTPProxyServer::ReleaseStream (std::shared_ptr<i2p::stream::Stream> stream, const i2p::data::IdentHash& ident, int port)
+    {
+        if (m_MaxIdleStreams > 0)
+        {
+            std::unique_lock<std::mutex> l(m_IdleStreamsMutex);
+            auto ts = i2p::util::GetSecondsSinceEpoch ();
+            if (ts > m_LastCleanupTime + HTTP_PROXY_IDLE_STREAM_TIMEOUT)
+                CleanupIdleStreams (ts);
+            auto& streams = m_IdleStreams[std::make_pair (ident, port)];
+            streams.push_back (std::make_pair (stream, ts));
+            if ((int)streams.size () <= m_MaxIdleStreams) return;
+            stream = streams.front ().first; // oldest
+            streams.pop_front ();
+        }
+        stream->Close ();
+    }
+
+    void HTTPProxyServer::CleanupIdleStreams (uint64_t ts)
+    {
+        for (auto it = m_IdleStreams.begin (); it != m_IdleStreams.end ();)
+        {
+            auto& streams = it->second;
+            while (!streams.empty () && ts >= streams.front ().second + HTTP_PROXY_IDLE_STREAM_TIMEOUT)
+            {
+                streams.front ().first->Close ();
+                streams.pop_front ();
+            }
+            if (streams.empty ())
+                it = m_IdleStreams.erase (it);
+            else
+                it++;
+        }
+        m_LastCleanupTime = ts;
+    }
+
     std::shared_ptr<i2p::client::I2PServiceHandler> HTTPProxyServer::CreateHandler(std::shared_ptr<boost::asio::ip::tcp::socket> socket)
     {
         return std::make_shared<HTTPProxyHandler> (this, socket);
@@ -3,26 +3,53 @@
 
 #include <memory>
 #include <set>
+#include <map>
+#include <list>
 #include <boost/asio.hpp>
 #include <mutex>
 #include "I2PService.h"
 #include "Destination.h"
+#include "Streaming.h"
 
 namespace i2p
 {
 namespace proxy
 {
+    const int HTTP_PROXY_DEFAULT_MAX_IDLE_STREAMS = 4; // per destination and port
+    const int HTTP_PROXY_IDLE_STREAM_TIMEOUT = 30; // in seconds
+
     class HTTPProxyServer: public i2p::client::TCPIPAcceptor
     {
         public:
 
-            HTTPProxyServer(const std::string& address, int port, std::shared_ptr<i2p::client::ClientDestination> localDestination = nullptr);
+            HTTPProxyServer(const std::string& address, int port, std::shared_ptr<i2p::client::ClientDestination> localDestination = nullptr,
+                int maxIdleStreams = HTTP_PROXY_DEFAULT_MAX_IDLE_STREAMS);
             ~HTTPProxyServer() {};
 
+            void Stop ();
+
+            // streams after complete response are kept for next requests to same destination
+            int GetMaxIdleStreams () const { return m_MaxIdleStreams; };
+            std::shared_ptr<i2p::stream::Stream> GetIdleStream (const i2p::data::IdentHash& ident, int port);
+            void ReleaseStream (std::shared_ptr<i2p::stream::Stream> stream, const i2p::data::IdentHash& ident, int port);
+
         protected:
             // Implements TCPIPAcceptor
             std::shared_ptr<i2p::client::I2PServiceHandler> CreateHandler(std::shared_ptr<boost::asio::ip::tcp::socket> socket);
             const char* GetName() { return "HTTP Proxy"; }
+
+        private:
+
+            void CleanupIdleStreams (uint64_t ts);
+
+        private:
+
+            int m_MaxIdleStreams;
+            std::mutex m_IdleStreamsMutex;
+            // by destination and port, most recently released last, with release time
+            std::map<std::pair<i2p::data::IdentHash, int>,
+                std::list<std::pair<std::shared_ptr<i2p::stream::Stream>, uint64_t> > > m_IdleStreams;
+            uint64_t m_LastCleanupTime;
     };
 
     typedef HTTPProxyServer HTTPProxy;
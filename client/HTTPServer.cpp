@@ -4,6 +4,8 @@
 #include <ctime>
 #include "util/base64.h"
 #include "util/Log.h"
+#include "util/Metrics.h"
+#include "crypto/ElGamal.h"
 #include "tunnel/Tunnel.h"
 #include "tunnel/TransitTunnel.h"
 #include "transport/Transports.h"
@@ -466,6 +468,7 @@ namespace util
     const char HTTP_COMMAND_TUNNELS[] = "tunnels";
     const char HTTP_COMMAND_TRANSIT_TUNNELS[] = "transit_tunnels";
     const char HTTP_COMMAND_TRANSPORTS[] = "transports";    
+    const char HTTP_COMMAND_PEERS[] = "peers";
     const char HTTP_COMMAND_START_ACCEPTING_TUNNELS[] = "start_accepting_tunnels";  
     const char HTTP_COMMAND_STOP_ACCEPTING_TUNNELS[] = "stop_accepting_tunnels";        
     const char HTTP_COMMAND_LOCAL_DESTINATIONS[] = "local_destinations";
@@ -474,6 +477,7 @@ namespace util
     const char HTTP_COMMAND_SAM_SESSIONS[] = "sam_sessions";
     const char HTTP_COMMAND_SAM_SESSION[] = "sam_session";
     const char HTTP_PARAM_SAM_SESSION_ID[] = "id";
+    const char HTTP_PATH_METRICS[] = "/metrics";
     
     namespace misc_strings
     {
@@ -546,6 +550,11 @@ namespace util
     void HTTPConnection::RunRequest ()
     {
         auto address = ExtractAddress ();
+        if (address == HTTP_PATH_METRICS)
+        {
+            HandleMetricsRequest ();
+            return;
+        }
         if (address.length () > 1 && address[1] != '?') // not just '/' or '/?'
             return; // TODO: error handling
 
@@ -609,6 +618,13 @@ namespace util
         SendReply (s.str ());
     }
 
+    void HTTPConnection::HandleMetricsRequest ()
+    {
+        std::stringstream s;
+        i2p::util::metrics.Write (s);
+        SendReply (s.str (), 200, "text/plain; version=0.0.4");
+    }
+
     void HTTPConnection::FillContent (std::stringstream& s)
     {
         s << "<h2>Welcome to the Webconsole!</h2><br>";
@@ -660,6 +676,8 @@ namespace util
         s << "<br><b><a href=/?" << HTTP_COMMAND_TUNNELS << ">Tunnels</a></b>";
         s << "<br><b><a href=/?" << HTTP_COMMAND_TRANSIT_TUNNELS << ">Transit tunnels</a></b>";
         s << "<br><b><a href=/?" << HTTP_COMMAND_TRANSPORTS << ">Transports</a></b>";
+        s << "<br><b><a href=/?" << HTTP_COMMAND_PEERS << ">Peers</a></b>";
+        s << "<br><b><a href=" << HTTP_PATH_METRICS << ">Metrics</a></b>";
         if (i2p::client::context.GetSAMBridge ())
             s << "<br><b><a href=/?" << HTTP_COMMAND_SAM_SESSIONS << ">SAM sessions</a></b>";
         s << "<br>";
@@ -678,6 +696,8 @@ namespace util
             ShowTransports (s);
         else if (cmd == HTTP_COMMAND_TUNNELS)
             ShowTunnels (s);
+        else if (cmd == HTTP_COMMAND_PEERS)
+            ShowPeers (s);
         else if (cmd == HTTP_COMMAND_TRANSIT_TUNNELS)
             ShowTransitTunnels (s);
         else if (cmd == HTTP_COMMAND_START_ACCEPTING_TUNNELS)
@@ -706,10 +726,59 @@ namespace util
 
     void HTTPConnection::ShowTransports (std::stringstream& s)
     {
+        auto& handshakeWorkers = i2p::transport::transports.GetHandshakeWorkers ();
+        s << "Handshakes (p50/p90/p99 ms): ";
+        auto& ntcpLatency = handshakeWorkers.GetNTCPLatency ();
+        s << "NTCP " << ntcpLatency.GetPercentile (50) << "/" << ntcpLatency.GetPercentile (90) 
+          << "/" << ntcpLatency.GetPercentile (99) << " of " << ntcpLatency.GetNumHandshakes ();
+        auto& ssuLatency = handshakeWorkers.GetSSULatency ();
+        s << ", SSU " << ssuLatency.GetPercentile (50) << "/" << ssuLatency.GetPercentile (90) 
+          << "/" << ssuLatency.GetPercentile (99) << " of " << ssuLatency.GetNumHandshakes ();
+        s << "<br>Handshake queue: " << handshakeWorkers.GetQueueSize () << ", rejected " 
+          << handshakeWorkers.GetNumRejected () << ", rate limited " << handshakeWorkers.GetNumRateLimited () << "<br><br>";
+        auto& limiter = i2p::transport::transports.GetBandwidthLimiter ();
+        if (limiter.IsLimited ())
+        {
+            static const char * classNames[] = { "Client", "Transit", "NetDb" };
+            s << "Bandwidth limit: " << limiter.GetTotalBucket ().GetRate ()/1024 << " KBps<br>";
+            for (int i = 0; i < i2p::eNumTrafficClasses; i++)
+            {
+                auto trafficClass = (i2p::TrafficClass)i;
+                auto& stats = limiter.GetStats (trafficClass);
+                s << classNames[i] << ": ";
+                auto rate = limiter.GetClassBucket (trafficClass).GetRate ();
+                if (rate) s << rate/1024 << " KBps assured, ";
+                s << "sent " << stats.sentBytes/1024 << "K, delayed " << stats.numDelayedMessages
+                  << ", dropped " << stats.numDroppedMessages << " (" << stats.droppedBytes/1024 << "K)<br>";
+            }
+            s << "<br>";
+        }
         auto ntcpServer = i2p::transport::transports.GetNTCPServer (); 
         if (ntcpServer)
         {   
             s << "NTCP<br>";
+            if (ntcpServer->GetNumThreads () > 1)
+            {
+                s << "Sessions per thread:";
+                for (int i = 0; i < ntcpServer->GetNumThreads (); i++)
+                    s << " " << ntcpServer->GetNumSessions (i);
+                s << "<br>";
+            }   
+            auto& writeStats = ntcpServer->GetWriteStats ();
+            if (writeStats.numWrites > 0)
+            {
+                s << "Writes: " << writeStats.numWrites << ", messages per write: " 
+                  << (double)writeStats.numWrittenMessages/writeStats.numWrites << "<br>Bytes per write:";
+                for (size_t i = 0; i < i2p::transport::NTCP_WRITE_HISTOGRAM_SIZE; i++)
+                {
+                    if (i < i2p::transport::NTCP_WRITE_HISTOGRAM_SIZE - 1)
+                        s << " &lt;" << (i2p::transport::NTCP_WRITE_HISTOGRAM_MIN_SIZE << i);
+                    else
+                        s << " more";
+                    s << ":" << writeStats.histogram[i];
+                }   
+                s << "<br>";
+            }   
             for (auto it: ntcpServer->GetNTCPSessions ())
             {
                 if (it.second && it.second->IsEstablished ())
@@ -750,6 +819,8 @@ namespace util
     void HTTPConnection::ShowTunnels (std::stringstream& s)
     {
         s << "Queue size:" << i2p::tunnel::tunnels.GetQueueSize () << "<br>";
+        s << "Build queue size:" << i2p::tunnel::tunnels.GetBuildQueueSize ()
+          << ", precomputed ElGamal keys: " << i2p::crypto::elGamalPrecomputation.GetNumPrecomputed () << "<br>";
 
         for (auto it: i2p::tunnel::tunnels.GetOutboundTunnels ())
         {
@@ -776,6 +847,44 @@ namespace util
         }
     }   
 
+    void HTTPConnection::ShowPeers (std::stringstream& s)
+    {
+        static const char * tierNames[] = { "Fast", "High capacity", "Standard" };
+        std::vector<std::shared_ptr<const i2p::data::RouterInfo> > tiers[i2p::data::eNumPeerTiers];
+        for (int i = 0; i < i2p::data::ePeerTierStandard; i++)
+            tiers[i] = i2p::data::netdb.GetPeerTier ((i2p::data::PeerTier)i);
+        // weight of empty tier goes to next one, as client tunnels select hops
+        int weights[i2p::data::eNumPeerTiers], carried = 0;
+        for (int i = 0; i < i2p::data::eNumPeerTiers; i++)
+        {
+            weights[i] = i2p::data::PEER_TIER_WEIGHTS[i] + carried;
+            carried = 0;
+            if (i < i2p::data::ePeerTierStandard && tiers[i].empty ())
+            {
+                carried = weights[i];
+                weights[i] = 0;
+            }
+        }
+        s << "<b>Hop selection weights:</b>";
+        for (int i = 0; i < i2p::data::eNumPeerTiers; i++)
+            s << " " << tierNames[i] << " " << weights[i] << "%";
+        s << "<br><br>";
+        s << "<table><tr><th>Peer</th><th>Tier</th><th>Weight %</th><th>Latency ms</th><th>Test RTT ms</th>"
+          << "<th>Build ms</th><th>KB per tunnel</th><th>Agreed/Declined</th><th>Tests failed</th></tr>";
+        for (int i = 0; i < i2p::data::ePeerTierStandard; i++)
+            for (auto& it: tiers[i])
+            {
+                auto profile = it->GetProfile ();
+                s << "<tr><td>" << it->GetIdentHashAbbreviation () << "</td><td>" << tierNames[i] << "</td>";
+                s << "<td>" << (double)weights[i]/tiers[i].size () << "</td>";
+                s << "<td>" << profile->GetLatency () << "</td><td>" << profile->GetTestRTT () << "</td>";
+                s << "<td>" << profile->GetBuildLatency () << "</td><td>" << profile->GetBytesPerTunnel ()/1024 << "</td>";
+                s << "<td>" << profile->GetNumTunnelsAgreed () << "/" << profile->GetNumTunnelsDeclined () << "</td>";
+                s << "<td>" << profile->GetNumTestsFailed () << "</td></tr>";
+            }
+        s << "</table>";
+    }
+
     void HTTPConnection::ShowTransitTunnels (std::stringstream& s)
     {
         for (auto it: i2p::tunnel::tunnels.GetTransitTunnels ())
@@ -813,7 +922,12 @@ namespace util
             auto pool = dest->GetTunnelPool ();
             if (pool)
             {
-                s << "<b>Tunnels:</b><br>";
+                s << "<b>Tunnels:</b> <i>" << pool->GetNumInboundTunnels () << " inbound, " 
+                  << pool->GetNumOutboundTunnels () << " outbound" << (pool->IsAdaptive () ? " (adaptive)" : "") << "</i><br>";
+                s << "<b>Pending builds:</b> <i>" << pool->GetNumPendingInboundBuilds () << " inbound, "
+                  << pool->GetNumPendingOutboundBuilds () << " outbound</i><br>";
+                if (pool->GetTimeToReady ())
+                    s << "<b>Ready in:</b> <i>" << pool->GetTimeToReady () << " ms</i><br>";
                 for (auto it: pool->GetOutboundTunnels ())
                 {
                     it->GetTunnelConfig ()->Print (s);
@@ -822,6 +936,7 @@ namespace util
                         s << " " << "Failed";
                     else if (state == i2p::tunnel::eTunnelStateExpiring)
                         s << " " << "Exp";
+                    s << " " << it->GetTestRTT () << "ms " << it->GetThroughput ()/1024 << "KBps";
                     s << "<br>" << std::endl;
                 }
                 for (auto it: pool->GetInboundTunnels ())
@@ -835,7 +950,7 @@ namespace util
                     s << "<br>" << std::endl;
                 }
             }   
-            s << "<br><b>Streams:</b><br>";
+            s << "<br><b>Streams:</b> <i>" << dest->GetStreamingDestination ()->GetSendBufferSize () << " bytes buffered</i><br>";
             for (auto it: dest->GetStreamingDestination ()->GetStreams ())
             {   
                 s << it.first << "->" << i2p::client::context.GetAddressBook ().ToAddress(it.second->GetRemoteIdentity ()) << " ";
@@ -912,7 +1027,7 @@ namespace util
         s << "Accepting tunnels stopped" <<  std::endl;
     }
 
-    void HTTPConnection::SendReply (const std::string& content, int status)
+    void HTTPConnection::SendReply (const std::string& content, int status, const std::string& contentType)
     {
         m_Reply.content = content;
         m_Reply.headers.resize(3);
@@ -925,7 +1040,7 @@ namespace util
             m_Reply.headers[1].name = "Content-Length";
             m_Reply.headers[1].value = boost::lexical_cast<std::string>(m_Reply.content.size());
             m_Reply.headers[2].name = "Content-Type";
-            m_Reply.headers[2].value = "text/html";
+            m_Reply.headers[2].value = contentType;
         }
         boost::asio::async_write (*m_Socket, m_Reply.to_buffers(status),
             std::bind (&HTTPConnection::HandleWriteReply, shared_from_this (), std::placeholders::_1));
@@ -55,13 +55,15 @@ namespace util
             void Terminate ();
             void HandleReceive (const boost::system::error_code& ecode, std::size_t bytes_transferred);
             void HandleWriteReply(const boost::system::error_code& ecode);
-            void SendReply (const std::string& content, int status = 200);
+            void SendReply (const std::string& content, int status = 200, const std::string& contentType = "text/html");
 
             void HandleRequest (const std::string& address);
+            void HandleMetricsRequest ();
             void HandleCommand (const std::string& command, std::stringstream& s);
             void ShowTransports (std::stringstream& s);
             void ShowTunnels (std::stringstream& s);
             void ShowTransitTunnels (std::stringstream& s);
+            void ShowPeers (std::stringstream& s);
             void ShowLocalDestinations (std::stringstream& s);
             void ShowLocalDestination (const std::string& b32, std::stringstream& s);
             void ShowSAMSessions (std::stringstream& s);
@@ -22,13 +22,17 @@ namespace client
     }
     
     void I2PService::CreateStream (StreamRequestComplete streamRequestComplete, const std::string& dest, int port) {
+        CreateStream (streamRequestComplete, dest.c_str (), dest.length (), port);
+    }
+
+    void I2PService::CreateStream (StreamRequestComplete streamRequestComplete, const char * dest, size_t len, int port) {
         assert(streamRequestComplete);
         i2p::data::IdentHash identHash;
-        if (i2p::client::context.GetAddressBook ().GetIdentHash (dest, identHash))
+        if (i2p::client::context.GetAddressBook ().GetIdentHash (dest, len, identHash))
             m_LocalDestination->CreateStream (streamRequestComplete, identHash, port);
         else
         {
-            LogPrint (eLogWarning, "Remote destination ", dest, " not found");
+            LogPrint (eLogWarning, "Remote destination ", std::string (dest, len), " not found");
             streamRequestComplete (nullptr);
         }
     }
@@ -40,6 +40,7 @@ namespace client
             inline std::shared_ptr<ClientDestination> GetLocalDestination () { return m_LocalDestination; }
             inline void SetLocalDestination (std::shared_ptr<ClientDestination> dest) { m_LocalDestination = dest; }
             void CreateStream (StreamRequestComplete streamRequestComplete, const std::string& dest, int port = 0);
+            void CreateStream (StreamRequestComplete streamRequestComplete, const char * dest, size_t len, int port = 0);
 
             inline boost::asio::io_service& GetService () { return m_LocalDestination->GetService (); }
 
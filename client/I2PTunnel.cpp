@@ -1,5 +1,7 @@
 #include <cassert>
 #include "util/Log.h"
+#include "util/Timestamp.h"
+#include "util/Metrics.h"
 #include "Destination.h"
 #include "ClientContext.h"
 #include "I2PTunnel.h"
@@ -11,7 +13,7 @@ namespace client
     I2PTunnelConnection::I2PTunnelConnection (I2PService * owner, std::shared_ptr<boost::asio::ip::tcp::socket> socket,
         std::shared_ptr<const i2p::data::LeaseSet> leaseSet, int port): 
         I2PServiceHandler(owner), m_Socket (socket), m_RemoteEndpoint (socket->remote_endpoint ()),
-        m_IsQuiet (true)
+        m_IsQuiet (true), m_SYNDataTimer (owner->GetService ())
     {
         m_Stream = GetOwner()->GetLocalDestination ()->CreateStream (leaseSet, port);
     }   
@@ -19,14 +21,16 @@ namespace client
     I2PTunnelConnection::I2PTunnelConnection (I2PService * owner,
         std::shared_ptr<boost::asio::ip::tcp::socket> socket, std::shared_ptr<i2p::stream::Stream> stream):
         I2PServiceHandler(owner), m_Socket (socket), m_Stream (stream),
-        m_RemoteEndpoint (socket->remote_endpoint ()), m_IsQuiet (true)
+        m_RemoteEndpoint (socket->remote_endpoint ()), m_IsQuiet (true),
+        m_SYNDataTimer (owner->GetService ())
     {
     }
 
     I2PTunnelConnection::I2PTunnelConnection (I2PService * owner, std::shared_ptr<i2p::stream::Stream> stream,
         std::shared_ptr<boost::asio::ip::tcp::socket> socket, const boost::asio::ip::tcp::endpoint& target, bool quiet):
         I2PServiceHandler(owner), m_Socket (socket), m_Stream (stream),
-        m_RemoteEndpoint (target), m_IsQuiet (quiet)
+        m_RemoteEndpoint (target), m_IsQuiet (quiet),
+        m_SYNDataTimer (owner->GetService ())
     {
     }
 
@@ -40,11 +44,25 @@ namespace client
         {
             if (msg)
                 m_Stream->Send (msg, len); // connect and send
+            else if (m_Stream->GetStatus () == i2p::stream::eStreamStatusNew)
+            {
+                // client speaks first in most protocols, give it a moment to put its data in SYN
+                m_SYNDataTimer.expires_from_now (boost::posix_time::milliseconds (I2P_TUNNEL_CONNECTION_SYN_DATA_TIMEOUT));
+                m_SYNDataTimer.async_wait (std::bind (&I2PTunnelConnection::HandleSYNDataTimer,
+                    shared_from_this (), std::placeholders::_1));
+            }
             else    
-                m_Stream->Send (m_Buffer, 0); // connect
+                m_Stream->Send (nullptr, 0); // connect
+            StartRelay ();
         }
-        StreamReceive ();
-        Receive ();
+    }
+
+    void I2PTunnelConnection::HandleSYNDataTimer (const boost::system::error_code& ecode)
+    {
+        // relay has sent SYN with client data already if status has changed
+        if (ecode != boost::asio::error::operation_aborted && m_Stream &&
+            m_Stream->GetStatus () == i2p::stream::eStreamStatusNew)
+            m_Stream->Send (nullptr, 0); // no data from client, connect
     }
         
     void I2PTunnelConnection::Connect ()
@@ -57,6 +75,9 @@ namespace client
     void I2PTunnelConnection::Terminate ()
     {
         if (Kill()) return;
+        m_SYNDataTimer.cancel ();
+        if (m_Relay)
+            m_Relay->Stop ();
         if (m_Stream)
         {
             m_Stream->Close ();
@@ -66,75 +87,22 @@ namespace client
         Done(shared_from_this ());
     }           
 
-    void I2PTunnelConnection::Receive ()
-    {
-        m_Socket->async_read_some (boost::asio::buffer(m_Buffer, I2P_TUNNEL_CONNECTION_BUFFER_SIZE),                
-            std::bind(&I2PTunnelConnection::HandleReceived, shared_from_this (), 
-            std::placeholders::_1, std::placeholders::_2));
-    }   
-    
-    void I2PTunnelConnection::HandleReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred)
-    {
-        if (ecode)
-        {
-            LogPrint ("I2PTunnel read error: ", ecode.message ());
-            if (ecode != boost::asio::error::operation_aborted)
-                Terminate ();
-        }
-        else
-        {   
-            if (m_Stream)
-            {   
-                auto s = shared_from_this ();
-                m_Stream->AsyncSend (m_Buffer, bytes_transferred,
-                    [s](const boost::system::error_code& ecode)
-                    {
-                        if (!ecode)
-                            s->Receive ();
-                        else
-                            s->Terminate ();
-                    });
-            }   
-        }
-    }   
-
-    void I2PTunnelConnection::HandleWrite (const boost::system::error_code& ecode)
-    {
-        if (ecode)
-        {
-            LogPrint ("I2PTunnel write error: ", ecode.message ());
-            if (ecode != boost::asio::error::operation_aborted)
-                Terminate ();
-        }
-        else
-            StreamReceive ();
-    }
-
-    void I2PTunnelConnection::StreamReceive ()
+    void I2PTunnelConnection::StartRelay ()
     {
-        if (m_Stream)
-            m_Stream->AsyncReceive (boost::asio::buffer (m_StreamBuffer, I2P_TUNNEL_CONNECTION_BUFFER_SIZE),
-                std::bind (&I2PTunnelConnection::HandleStreamReceive, shared_from_this (),
-                    std::placeholders::_1, std::placeholders::_2),
-                I2P_TUNNEL_CONNECTION_MAX_IDLE);
-    }   
-
-    void I2PTunnelConnection::HandleStreamReceive (const boost::system::error_code& ecode, std::size_t bytes_transferred)
-    {
-        if (ecode)
-        {
-            LogPrint ("I2PTunnel stream read error: ", ecode.message ());
-            if (ecode != boost::asio::error::operation_aborted)
-                Terminate ();
-        }
-        else
-            Write (m_StreamBuffer, bytes_transferred);
-    }
-
-    void I2PTunnelConnection::Write (const uint8_t * buf, size_t len)
-    {
-        m_Socket->async_send (boost::asio::buffer (buf, len),
-            std::bind (&I2PTunnelConnection::HandleWrite, shared_from_this (), std::placeholders::_1));
+        m_Relay = std::make_shared<StreamRelay> (m_Socket, m_Stream, I2P_TUNNEL_CONNECTION_MAX_IDLE);
+        std::weak_ptr<I2PTunnelConnection> connection (shared_from_this ());
+        m_Relay->SetStreamDataFilter (
+            [connection](const uint8_t * buf, size_t len, std::string& out)
+            {
+                auto s = connection.lock ();
+                return s ? s->FilterStreamData (buf, len, out) : false;
+            });
+        m_Relay->Start (
+            [connection](void)
+            {
+                auto s = connection.lock ();
+                if (s) s->Terminate ();
+            });
     }
 
     void I2PTunnelConnection::HandleConnect (const boost::system::error_code& ecode)
@@ -148,58 +116,77 @@ namespace client
         {
             LogPrint ("I2PTunnel connected");
             if (m_IsQuiet)
-                StreamReceive ();
+                StartRelay ();
             else
             {
                 // send destination first like received from I2P
-                std::string dest = m_Stream->GetRemoteIdentity ().ToBase64 ();
-                dest += "\n";
-                memcpy (m_StreamBuffer, dest.c_str (), dest.size ());
-                HandleStreamReceive (boost::system::error_code (), dest.size ());
+                auto dest = std::make_shared<std::string> (m_Stream->GetRemoteIdentity ().ToBase64 ());
+                *dest += "\n";
+                auto s = shared_from_this ();
+                boost::asio::async_write (*m_Socket, boost::asio::buffer (*dest),
+                    [s, dest](const boost::system::error_code& ecode, std::size_t)
+                    {
+                        if (ecode)
+                        {
+                            LogPrint ("I2PTunnel write error: ", ecode.message ());
+                            if (ecode != boost::asio::error::operation_aborted)
+                                s->Terminate ();
+                        }
+                        else
+                            s->StartRelay ();
+                    });
             }   
-            Receive (); 
         }
     }
 
     I2PTunnelConnectionHTTP::I2PTunnelConnectionHTTP (I2PService * owner, std::shared_ptr<i2p::stream::Stream> stream,
         std::shared_ptr<boost::asio::ip::tcp::socket> socket, 
         const boost::asio::ip::tcp::endpoint& target, const std::string& host):
-        I2PTunnelConnection (owner, stream, socket, target), m_Host (host), m_HeaderSent (false)
+        I2PTunnelConnection (owner, stream, socket, target), m_Host (host), m_Parser (false),
+        m_IsUpgraded (false)
     {
     }
 
-    void I2PTunnelConnectionHTTP::Write (const uint8_t * buf, size_t len)
+    bool I2PTunnelConnectionHTTP::FilterStreamData (const uint8_t * buf, size_t len, std::string& out)
     {
-        if (m_HeaderSent)
-            I2PTunnelConnection::Write (buf, len);
-        else
-        {   
-            m_InHeader.clear ();
-            m_InHeader.write ((const char *)buf, len);
-            std::string line;
-            bool endOfHeader = false;
-            while (!endOfHeader)
+        if (m_IsUpgraded) return false;
+        out.clear ();
+        size_t pos = 0;
+        while (pos < len && !m_IsUpgraded)
+        {
+            if (m_Parser.GetState () == i2p::util::http::HTTPParser::eComplete)
+                m_Parser.Reset (); // next request
+            auto state = m_Parser.GetState ();
+            size_t n = m_Parser.Parse ((const char *)buf + pos, len - pos);
+            if (m_Parser.GetState () == i2p::util::http::HTTPParser::eError)
             {
-                std::getline(m_InHeader, line);
-                if (!m_InHeader.fail ())
-                {
-                    if (line.find ("Host:") != std::string::npos)
-                        m_OutHeader << "Host: " << m_Host << "\r\n";
-                    else
-                        m_OutHeader << line << "\n";
-                    if (line == "\r") endOfHeader = true;
-                }
-                else
-                    break;
+                LogPrint (eLogError, "I2PTunnel: malformed HTTP request");
+                out.clear ();
+                Terminate ();
+                return true;
             }
-
-            if (endOfHeader)
+            if (state == i2p::util::http::HTTPParser::eHead)
             {
-                m_OutHeader << m_InHeader.str (); // data right after header
-                m_HeaderSent = true;
-                I2PTunnelConnection::Write ((uint8_t *)m_OutHeader.str ().c_str (), m_OutHeader.str ().length ());
+                if (m_Parser.GetState () != i2p::util::http::HTTPParser::eHead)
+                {
+                    // head is complete, replace Host
+                    out += m_Parser.GetMethod () + " " + m_Parser.GetURL () + " " + m_Parser.GetVersion () + "\r\n";
+                    for (size_t i = 0; i < m_Parser.GetNumHeaders (); i++)
+                        if (m_Parser.IsHeader (i, "Host"))
+                            out += "Host: " + m_Host + "\r\n";
+                        else
+                            m_Parser.AppendHeader (i, out);
+                    out += "\r\n";
+                    m_IsUpgraded = m_Parser.IsUpgrade ();
+                }
             }
-        }   
+            else
+                out.append ((const char *)buf + pos, n); // body
+            pos += n;
+        }
+        if (pos < len)
+            out.append ((const char *)buf + pos, len - pos); // after upgrade
+        return true;
     }
 
     /* This handler tries to stablish a connection with the desired server and dies if it fails to do so */
@@ -221,9 +208,23 @@ namespace client
 
     void I2PClientTunnelHandler::Handle()
     {
-        GetOwner()->GetLocalDestination ()->CreateStream ( 
-            std::bind (&I2PClientTunnelHandler::HandleStreamRequestComplete, shared_from_this(), std::placeholders::_1), 
-            m_DestinationIdentHash, m_DestinationPort);
+        static auto& numPooled = i2p::util::metrics.GetCounter ("i2pd_client_tunnel_connections_total",
+            "Connections of client tunnels by stream", "stream=\"pooled\"");
+        static auto& numCreated = i2p::util::metrics.GetCounter ("i2pd_client_tunnel_connections_total",
+            "Connections of client tunnels by stream", "stream=\"new\"");
+        auto stream = static_cast<I2PClientTunnel *>(GetOwner())->GetPooledStream ();
+        if (stream)
+        {
+            numPooled.Inc ();
+            HandleStreamRequestComplete (stream);
+        }
+        else
+        {
+            numCreated.Inc ();
+            GetOwner()->GetLocalDestination ()->CreateStream ( 
+                std::bind (&I2PClientTunnelHandler::HandleStreamRequestComplete, shared_from_this(), std::placeholders::_1), 
+                m_DestinationIdentHash, m_DestinationPort);
+        }
     }
 
     void I2PClientTunnelHandler::HandleStreamRequestComplete (std::shared_ptr<i2p::stream::Stream> stream)
@@ -255,28 +256,167 @@ namespace client
         Done(shared_from_this());
     }
 
+    I2PClientTunnelStreamPool::I2PClientTunnelStreamPool (std::shared_ptr<ClientDestination> localDestination,
+        const i2p::data::IdentHash& destination, int destinationPort, int size, int idleTimeout):
+        m_LocalDestination (localDestination), m_Destination (destination), m_DestinationPort (destinationPort),
+        m_Size (size), m_IdleTimeout (idleTimeout), m_IsRunning (false), m_NumPendingStreams (0),
+        m_RefillTimer (localDestination->GetService ())
+    {
+    }
+
+    void I2PClientTunnelStreamPool::Start ()
+    {
+        m_IsRunning = true;
+        m_LocalDestination->GetService ().post (std::bind (&I2PClientTunnelStreamPool::Refill, shared_from_this ()));
+    }
+
+    void I2PClientTunnelStreamPool::Stop ()
+    {
+        m_IsRunning = false;
+        m_RefillTimer.cancel ();
+        std::unique_lock<std::mutex> l(m_StreamsMutex);
+        for (auto& it: m_Streams)
+            it.first->Close ();
+        m_Streams.clear ();
+    }
+
+    std::shared_ptr<i2p::stream::Stream> I2PClientTunnelStreamPool::GetStream ()
+    {
+        std::shared_ptr<i2p::stream::Stream> stream;
+        {
+            std::unique_lock<std::mutex> l(m_StreamsMutex);
+            auto ts = i2p::util::GetSecondsSinceEpoch ();
+            while (!stream && !m_Streams.empty ())
+            {
+                auto idle = m_Streams.front (); // oldest, before it expires
+                m_Streams.pop_front ();
+                auto status = idle.first->GetStatus ();
+                if ((status == i2p::stream::eStreamStatusNew || status == i2p::stream::eStreamStatusOpen) &&
+                    ts < idle.second + m_IdleTimeout)
+                    stream = idle.first; // data received from server while idle, like IRC greeting, is kept
+                else
+                    idle.first->Close ();
+            }
+        }
+        if (m_IsRunning)
+            m_LocalDestination->GetService ().post (std::bind (&I2PClientTunnelStreamPool::Refill, shared_from_this ()));
+        return stream;
+    }
+
+    void I2PClientTunnelStreamPool::Refill ()
+    {
+        if (!m_IsRunning) return;
+        int numStreams;
+        {
+            std::unique_lock<std::mutex> l(m_StreamsMutex);
+            // replace streams closed by server or idle for too long
+            auto ts = i2p::util::GetSecondsSinceEpoch ();
+            for (auto it = m_Streams.begin (); it != m_Streams.end ();)
+            {
+                auto status = it->first->GetStatus ();
+                if ((status != i2p::stream::eStreamStatusNew && status != i2p::stream::eStreamStatusOpen) ||
+                    ts >= it->second + m_IdleTimeout)
+                {
+                    it->first->Close ();
+                    it = m_Streams.erase (it);
+                }
+                else
+                    it++;
+            }
+            numStreams = m_Streams.size () + m_NumPendingStreams;
+            m_NumPendingStreams += m_Size - numStreams > 0 ? m_Size - numStreams : 0;
+        }
+        for (int i = numStreams; i < m_Size; i++)
+            m_LocalDestination->CreateStream (std::bind (&I2PClientTunnelStreamPool::HandleStreamRequestComplete,
+                shared_from_this (), std::placeholders::_1), m_Destination, m_DestinationPort);
+        ScheduleRefill ();
+    }
+
+    void I2PClientTunnelStreamPool::ScheduleRefill ()
+    {
+        m_RefillTimer.cancel ();
+        m_RefillTimer.expires_from_now (boost::posix_time::seconds (I2P_CLIENT_TUNNEL_STREAM_POOL_REFILL_INTERVAL));
+        m_RefillTimer.async_wait (std::bind (&I2PClientTunnelStreamPool::HandleRefillTimer,
+            shared_from_this (), std::placeholders::_1));
+    }
+
+    void I2PClientTunnelStreamPool::HandleRefillTimer (const boost::system::error_code& ecode)
+    {
+        if (ecode != boost::asio::error::operation_aborted)
+            Refill ();
+    }
+
+    void I2PClientTunnelStreamPool::HandleStreamRequestComplete (std::shared_ptr<i2p::stream::Stream> stream)
+    {
+        std::unique_lock<std::mutex> l(m_StreamsMutex);
+        m_NumPendingStreams--;
+        if (!stream)
+        {
+            LogPrint (eLogWarning, "Can't create pooled stream, will try again in ", 
+                I2P_CLIENT_TUNNEL_STREAM_POOL_REFILL_INTERVAL, " seconds");
+            return;
+        }
+        if (!m_IsRunning)
+        {
+            stream->Close ();
+            return;
+        }
+        stream->Send (nullptr, 0); // connect
+        m_Streams.push_back (std::make_pair (stream, i2p::util::GetSecondsSinceEpoch ()));
+    }
+
     I2PClientTunnel::I2PClientTunnel(
         const std::string& destination, const std::string& address, int port,
         std::shared_ptr<ClientDestination> localDestination, int destinationPort
     )
         : TCPIPAcceptor(address, port, localDestination), m_Destination(destination),
-          m_DestinationIdentHash(nullptr), m_DestinationPort(destinationPort)
+          m_DestinationIdentHash(nullptr), m_DestinationPort(destinationPort),
+          m_StreamPoolSize (0), m_StreamPoolIdleTimeout (I2P_CLIENT_TUNNEL_DEFAULT_STREAM_POOL_IDLE_TIMEOUT)
     {}  
 
     void I2PClientTunnel::Start ()
     {
         TCPIPAcceptor::Start ();
         GetIdentHash();
+        StartStreamPool ();
     }
 
     void I2PClientTunnel::Stop ()
     {
         TCPIPAcceptor::Stop();
+        if (m_StreamPool)
+        {
+            m_StreamPool->Stop ();
+            m_StreamPool = nullptr;
+        }
         auto *originalIdentHash = m_DestinationIdentHash;
         m_DestinationIdentHash = nullptr;
         delete originalIdentHash;
     }
 
+    void I2PClientTunnel::SetStreamPool (int size, int idleTimeout)
+    {
+        m_StreamPoolSize = size;
+        m_StreamPoolIdleTimeout = idleTimeout;
+    }
+
+    void I2PClientTunnel::StartStreamPool ()
+    {
+        // destination might be unknown before address book is loaded
+        if (m_StreamPoolSize > 0 && !m_StreamPool && m_DestinationIdentHash)
+        {
+            LogPrint (eLogInfo, "Stream pool of ", m_StreamPoolSize, " streams to ", m_Destination, " started");
+            m_StreamPool = std::make_shared<I2PClientTunnelStreamPool> (GetLocalDestination (),
+                *m_DestinationIdentHash, m_DestinationPort, m_StreamPoolSize, m_StreamPoolIdleTimeout);
+            m_StreamPool->Start ();
+        }
+    }
+
+    std::shared_ptr<i2p::stream::Stream> I2PClientTunnel::GetPooledStream ()
+    {
+        return m_StreamPool ? m_StreamPool->GetStream () : nullptr;
+    }
+
     /* HACK: maybe we should create a caching IdentHash provider in AddressBook */
     const i2p::data::IdentHash * I2PClientTunnel::GetIdentHash ()
     {
@@ -295,7 +435,10 @@ namespace client
     {
         const i2p::data::IdentHash *identHash = GetIdentHash();
         if (identHash)
+        {
+            StartStreamPool ();
             return  std::make_shared<I2PClientTunnelHandler>(this, *identHash, m_DestinationPort, socket);
+        }
         else
             return nullptr;
     }
@@ -4,21 +4,26 @@
 #include <inttypes.h>
 #include <string>
 #include <set>
+#include <list>
+#include <mutex>
 #include <memory>
-#include <sstream>
 #include <boost/asio.hpp>
+#include "util/util.h"
 #include "Identity.h"
 #include "Destination.h"
 #include "Streaming.h"
 #include "I2PService.h"
+#include "StreamRelay.h"
 
 namespace i2p
 {
 namespace client
 {
-    const size_t I2P_TUNNEL_CONNECTION_BUFFER_SIZE = 8192;
     const int I2P_TUNNEL_CONNECTION_MAX_IDLE = 3600; // in seconds  
     const int I2P_TUNNEL_DESTINATION_REQUEST_TIMEOUT = 10; // in seconds
+    const int I2P_TUNNEL_CONNECTION_SYN_DATA_TIMEOUT = 100; // in milliseconds, wait for client data to send in SYN
+    const int I2P_CLIENT_TUNNEL_DEFAULT_STREAM_POOL_IDLE_TIMEOUT = 120; // in seconds
+    const int I2P_CLIENT_TUNNEL_STREAM_POOL_REFILL_INTERVAL = 10; // in seconds
 
 
     class I2PTunnelConnection: public I2PServiceHandler, public std::enable_shared_from_this<I2PTunnelConnection>
@@ -38,23 +43,20 @@ namespace client
         protected:
 
             void Terminate ();  
-
-            void Receive ();
-            void HandleReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred);    
-            virtual void Write (const uint8_t * buf, size_t len); // can be overloaded
-            void HandleWrite (const boost::system::error_code& ecode);  
-
-            void StreamReceive ();
-            void HandleStreamReceive (const boost::system::error_code& ecode, std::size_t bytes_transferred);
+            void StartRelay ();
             void HandleConnect (const boost::system::error_code& ecode);
+            void HandleSYNDataTimer (const boost::system::error_code& ecode);
+            // data from I2P before it's written to socket, returns false to write it as is
+            virtual bool FilterStreamData (const uint8_t *, size_t, std::string&) { return false; };
 
         private:
 
-            uint8_t m_Buffer[I2P_TUNNEL_CONNECTION_BUFFER_SIZE], m_StreamBuffer[I2P_TUNNEL_CONNECTION_BUFFER_SIZE];
             std::shared_ptr<boost::asio::ip::tcp::socket> m_Socket;
             std::shared_ptr<i2p::stream::Stream> m_Stream;
+            std::shared_ptr<StreamRelay> m_Relay;
             boost::asio::ip::tcp::endpoint m_RemoteEndpoint;
             bool m_IsQuiet; // don't send destination
+            boost::asio::deadline_timer m_SYNDataTimer;
     };
 
     class I2PTunnelConnectionHTTP: public I2PTunnelConnection
@@ -67,13 +69,48 @@ namespace client
 
         protected:
 
-            void Write (const uint8_t * buf, size_t len);
+            bool FilterStreamData (const uint8_t * buf, size_t len, std::string& out);
 
         private:
         
             std::string m_Host;
-            std::stringstream m_InHeader, m_OutHeader;
-            bool m_HeaderSent;
+            i2p::util::http::HTTPParser m_Parser; // client tunnels reuse streams, every request is rewritten
+            bool m_IsUpgraded; // rest goes as is
+    };
+
+    /**
+     * Keeps streams to client tunnel's destination connected ahead of TCP connections,
+     * so LeaseSet lookup and SYN round trip are not on the way of new connection.
+     * Refilled in background, streams idle for too long are replaced
+     */
+    class I2PClientTunnelStreamPool: public std::enable_shared_from_this<I2PClientTunnelStreamPool>
+    {
+        public:
+
+            I2PClientTunnelStreamPool (std::shared_ptr<ClientDestination> localDestination,
+                const i2p::data::IdentHash& destination, int destinationPort, int size, int idleTimeout);
+
+            void Start ();
+            void Stop ();
+            std::shared_ptr<i2p::stream::Stream> GetStream (); // nullptr if no idle streams
+
+        private:
+
+            void Refill ();
+            void ScheduleRefill ();
+            void HandleRefillTimer (const boost::system::error_code& ecode);
+            void HandleStreamRequestComplete (std::shared_ptr<i2p::stream::Stream> stream);
+
+        private:
+
+            std::shared_ptr<ClientDestination> m_LocalDestination;
+            i2p::data::IdentHash m_Destination;
+            int m_DestinationPort, m_Size, m_IdleTimeout;
+            bool m_IsRunning;
+            std::mutex m_StreamsMutex;
+            std::list<std::pair<std::shared_ptr<i2p::stream::Stream>, uint64_t> > m_Streams; // with connect time
+            int m_NumPendingStreams;
+            boost::asio::deadline_timer m_RefillTimer;
     };
 
     class I2PClientTunnel: public TCPIPAcceptor
@@ -95,13 +132,19 @@ namespace client
             void Start ();
             void Stop ();
 
+            void SetStreamPool (int size, int idleTimeout = I2P_CLIENT_TUNNEL_DEFAULT_STREAM_POOL_IDLE_TIMEOUT);
+            std::shared_ptr<i2p::stream::Stream> GetPooledStream ();
+
         private:
 
             const i2p::data::IdentHash * GetIdentHash ();
+            void StartStreamPool ();
 
             std::string m_Destination;
             const i2p::data::IdentHash * m_DestinationIdentHash;
             int m_DestinationPort;  
+            int m_StreamPoolSize, m_StreamPoolIdleTimeout;
+            std::shared_ptr<I2PClientTunnelStreamPool> m_StreamPool;
     };  
 
     class I2PServerTunnel: public I2PService
@@ -3,10 +3,15 @@
 #ifdef _MSC_VER
 #include <stdlib.h>
 #endif
+#if defined(__linux__)
+#include <errno.h>
+#include <sys/socket.h>
+#endif
 #include <boost/lexical_cast.hpp>
 #include "util/base64.h"
 #include "Identity.h"
 #include "util/Log.h"
+#include "util/Metrics.h"
 #include "Destination.h"
 #include "ClientContext.h"
 #include "SAM.h"
@@ -16,7 +21,7 @@ namespace i2p
 namespace client
 {
     SAMSocket::SAMSocket (SAMBridge& owner): 
-        m_Owner (owner), m_Socket (m_Owner.GetService ()), m_Timer (m_Owner.GetService ()),
+        m_Owner (owner), m_Socket (std::make_shared<boost::asio::ip::tcp::socket> (m_Owner.GetService ())), m_Timer (m_Owner.GetService ()),
         m_BufferOffset (0), m_SocketType (eSAMSocketTypeUnknown), m_IsSilent (false), 
         m_Stream (nullptr), m_Session (nullptr)
     {
@@ -29,6 +34,11 @@ namespace client
 
     void SAMSocket::CloseStream ()
     {
+        if (m_Relay)
+        {
+            m_Relay->Stop ();
+            m_Relay.reset ();
+        }
         if (m_Stream)
         {   
             m_Stream->Close ();
@@ -64,12 +74,12 @@ namespace client
                 ;
         }
         m_SocketType = eSAMSocketTypeTerminated;
-        m_Socket.close ();
+        m_Socket->close ();
     }
 
     void SAMSocket::ReceiveHandshake ()
     {
-        m_Socket.async_read_some (boost::asio::buffer(m_Buffer, SAM_SOCKET_BUFFER_SIZE),                
+        m_Socket->async_read_some (boost::asio::buffer(m_Buffer, SAM_SOCKET_BUFFER_SIZE),                
             std::bind(&SAMSocket::HandleHandshakeReceived, shared_from_this (), 
             std::placeholders::_1, std::placeholders::_2));
     }
@@ -118,7 +128,7 @@ namespace client
 #else       
                     size_t l = snprintf (m_Buffer, SAM_SOCKET_BUFFER_SIZE, SAM_HANDSHAKE_REPLY, version.c_str ());
 #endif
-                    boost::asio::async_write (m_Socket, boost::asio::buffer (m_Buffer, l), boost::asio::transfer_all (),
+                    boost::asio::async_write (*m_Socket, boost::asio::buffer (m_Buffer, l), boost::asio::transfer_all (),
                         std::bind(&SAMSocket::HandleHandshakeReplySent, shared_from_this (), 
                         std::placeholders::_1, std::placeholders::_2));
                 }   
@@ -143,7 +153,7 @@ namespace client
         }
         else
         {
-            m_Socket.async_read_some (boost::asio::buffer(m_Buffer, SAM_SOCKET_BUFFER_SIZE),                
+            m_Socket->async_read_some (boost::asio::buffer(m_Buffer, SAM_SOCKET_BUFFER_SIZE),                
                 std::bind(&SAMSocket::HandleMessage, shared_from_this (), 
                 std::placeholders::_1, std::placeholders::_2)); 
         }   
@@ -152,7 +162,7 @@ namespace client
     void SAMSocket::SendMessageReply (const char * msg, size_t len, bool close)
     {
         if (!m_IsSilent) 
-            boost::asio::async_write (m_Socket, boost::asio::buffer (msg, len), boost::asio::transfer_all (),
+            boost::asio::async_write (*m_Socket, boost::asio::buffer (msg, len), boost::asio::transfer_all (),
                 std::bind(&SAMSocket::HandleMessageReplySent, shared_from_this (), 
                 std::placeholders::_1, std::placeholders::_2, close));
         else
@@ -274,6 +284,33 @@ namespace client
             return;
         }
 
+        // forwarding of datagrams to client's UDP socket
+        boost::asio::ip::udp::endpoint forwardEndpoint;
+        auto port = params.find (SAM_PARAM_FORWARD_PORT);
+        if (style == SAM_VALUE_DATAGRAM && port != params.end ())
+        {
+            int forwardPort = 0;
+            try
+            {
+                forwardPort = boost::lexical_cast<int>(port->second);
+            }
+            catch (boost::bad_lexical_cast&)
+            {
+            }
+            auto host = params.find (SAM_PARAM_FORWARD_HOST);
+            boost::system::error_code ec;
+            auto address = boost::asio::ip::address::from_string (
+                host != params.end () ? host->second : SAM_DATAGRAM_FORWARD_DEFAULT_HOST, ec);
+            if (ec || forwardPort <= 0 || forwardPort > 65535)
+            {
+                LogPrint (eLogError, "SAM invalid datagram forwarding address ",
+                    host != params.end () ? host->second : SAM_DATAGRAM_FORWARD_DEFAULT_HOST, ":", port->second);
+                SendMessageReply (SAM_SESSION_STATUS_I2P_ERROR, strlen(SAM_SESSION_STATUS_I2P_ERROR), true);
+                return;
+            }
+            forwardEndpoint = boost::asio::ip::udp::endpoint (address, forwardPort);
+        }
+
         // create destination   
         m_Session = m_Owner.CreateSession (id, destination == SAM_VALUE_TRANSIENT ? "" : destination, &params); 
         if (m_Session)
@@ -282,8 +319,18 @@ namespace client
             if (style == SAM_VALUE_DATAGRAM)
             {
                 auto dest = m_Session->localDestination->CreateDatagramDestination ();
-                dest->SetReceiver (std::bind (&SAMSocket::HandleI2PDatagramReceive, shared_from_this (), 
-                    std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4, std::placeholders::_5));
+                if (forwardEndpoint.port ())
+                {
+                    auto forwarder = std::make_shared<SAMDatagramForwarder> (m_Owner.GetService (),
+                        m_Owner.GetDatagramEndpoint ().address (), forwardEndpoint, m_Session->localDestination);
+                    dest->SetReceiver (std::bind (&SAMDatagramForwarder::HandleI2PDatagramReceive, forwarder,
+                        std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4, std::placeholders::_5));
+                    forwarder->Start ();
+                    m_Session->datagramForwarder = forwarder;
+                }
+                else
+                    dest->SetReceiver (std::bind (&SAMSocket::HandleI2PDatagramReceive, shared_from_this (), 
+                        std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4, std::placeholders::_5));
             }
 
             if (m_Session->localDestination->IsReady ())
@@ -321,10 +368,20 @@ namespace client
         size_t l = m_Session->localDestination->GetPrivateKeys ().ToBuffer (buf, 1024);
         size_t l1 = i2p::util::ByteStreamToBase64 (buf, l, priv, 1024);
         priv[l1] = 0;
+        size_t l2;
+        if (m_Session->datagramForwarder)
+#ifdef _MSC_VER
+            l2 = sprintf_s (m_Buffer, SAM_SOCKET_BUFFER_SIZE, SAM_SESSION_CREATE_REPLY_OK_FORWARD, priv,
+                (int)m_Session->datagramForwarder->GetPort ());
+#else       
+            l2 = snprintf (m_Buffer, SAM_SOCKET_BUFFER_SIZE, SAM_SESSION_CREATE_REPLY_OK_FORWARD, priv,
+                (int)m_Session->datagramForwarder->GetPort ());
+#endif
+        else
 #ifdef _MSC_VER
-        size_t l2 = sprintf_s (m_Buffer, SAM_SOCKET_BUFFER_SIZE, SAM_SESSION_CREATE_REPLY_OK, priv);
+            l2 = sprintf_s (m_Buffer, SAM_SOCKET_BUFFER_SIZE, SAM_SESSION_CREATE_REPLY_OK, priv);
 #else       
-        size_t l2 = snprintf (m_Buffer, SAM_SOCKET_BUFFER_SIZE, SAM_SESSION_CREATE_REPLY_OK, priv);
+            l2 = snprintf (m_Buffer, SAM_SOCKET_BUFFER_SIZE, SAM_SESSION_CREATE_REPLY_OK, priv);
 #endif
         SendMessageReply (m_Buffer, l2, false);
     }
@@ -369,11 +426,20 @@ namespace client
         m_SocketType = eSAMSocketTypeStream;
         m_Session->sockets.push_back (shared_from_this ());
         m_Stream = m_Session->localDestination->CreateStream (remote);
-        m_Stream->Send ((uint8_t *)m_Buffer, 0); // connect
-        I2PReceive ();          
+        // SYN goes with first client data, if it comes right after our reply
+        m_Timer.expires_from_now (boost::posix_time::milliseconds (SAM_STREAM_CONNECT_SYN_DATA_TIMEOUT));
+        m_Timer.async_wait (std::bind (&SAMSocket::HandleSYNDataTimer,
+            shared_from_this (), std::placeholders::_1));
         SendMessageReply (SAM_STREAM_STATUS_OK, strlen(SAM_STREAM_STATUS_OK), false);
     }
 
+    void SAMSocket::HandleSYNDataTimer (const boost::system::error_code& ecode)
+    {
+        if (ecode != boost::asio::error::operation_aborted && m_Stream &&
+            m_Stream->GetStatus () == i2p::stream::eStreamStatusNew)
+            m_Stream->Send (nullptr, 0); // no data from client, connect
+    }
+
     void SAMSocket::HandleConnectLeaseSetRequestComplete (std::shared_ptr<i2p::data::LeaseSet> leaseSet)
     {
         if (leaseSet)
@@ -544,64 +610,33 @@ namespace client
 
     void SAMSocket::Receive ()
     {
+        if (m_SocketType == eSAMSocketTypeStream)
+        {
+            // STREAM CONNECT has been replied, the rest is data
+            StartRelay ();
+            return;
+        }
         if (m_BufferOffset >= SAM_SOCKET_BUFFER_SIZE)
         {
             LogPrint (eLogError, "Buffer is full. Terminate");
             Terminate ();
             return;
         }
-        m_Socket.async_read_some (boost::asio::buffer(m_Buffer + m_BufferOffset, SAM_SOCKET_BUFFER_SIZE - m_BufferOffset),                
-            std::bind((m_SocketType == eSAMSocketTypeStream) ? &SAMSocket::HandleReceived : &SAMSocket::HandleMessage,
-            shared_from_this (), std::placeholders::_1, std::placeholders::_2));
+        m_Socket->async_read_some (boost::asio::buffer(m_Buffer + m_BufferOffset, SAM_SOCKET_BUFFER_SIZE - m_BufferOffset),                
+            std::bind(&SAMSocket::HandleMessage, shared_from_this (), std::placeholders::_1, std::placeholders::_2));
     }
 
-    void SAMSocket::HandleReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred)
+    void SAMSocket::StartRelay ()
     {
-        if (ecode)
-        {
-            LogPrint ("SAM read error: ", ecode.message ());
-            if (ecode != boost::asio::error::operation_aborted)
-                Terminate ();
-        }
-        else
-        {
-            if (m_Stream)
-            {   
-                auto s = shared_from_this ();
-                m_Stream->AsyncSend ((uint8_t *)m_Buffer, bytes_transferred,
-                    [s](const boost::system::error_code& ecode)
-                    {
-                        if (!ecode)
-                            s->Receive ();
-                        else
-                            s->Terminate ();
-                    });
-            }   
-        }
-    }
-
-    void SAMSocket::I2PReceive ()
-    {
-        if (m_Stream)
-            m_Stream->AsyncReceive (boost::asio::buffer (m_StreamBuffer, SAM_SOCKET_BUFFER_SIZE),
-                std::bind (&SAMSocket::HandleI2PReceive, shared_from_this (),
-                    std::placeholders::_1, std::placeholders::_2),
-                SAM_SOCKET_CONNECTION_MAX_IDLE);
-    }   
-
-    void SAMSocket::HandleI2PReceive (const boost::system::error_code& ecode, std::size_t bytes_transferred)
-    {
-        if (ecode)
-        {
-            LogPrint ("SAM stream read error: ", ecode.message ());
-            if (ecode != boost::asio::error::operation_aborted)
-                Terminate ();
-        }
-        else
-        {
-            boost::asio::async_write (m_Socket, boost::asio::buffer (m_StreamBuffer, bytes_transferred),
-                std::bind (&SAMSocket::HandleWriteI2PData, shared_from_this (), std::placeholders::_1));
-        }
+        if (!m_Stream || m_Relay) return;
+        m_Relay = std::make_shared<StreamRelay> (m_Socket, m_Stream, SAM_SOCKET_CONNECTION_MAX_IDLE);
+        std::weak_ptr<SAMSocket> socket (shared_from_this ());
+        m_Relay->Start (
+            [socket](void)
+            {
+                auto s = socket.lock ();
+                if (s) s->Terminate ();
+            });
     }
 
     void SAMSocket::HandleWriteI2PData (const boost::system::error_code& ecode)
@@ -612,8 +647,6 @@ namespace client
             if (ecode != boost::asio::error::operation_aborted)
                 Terminate ();
         }
-        else
-            I2PReceive ();
     }
 
     void SAMSocket::HandleI2PAccept (std::shared_ptr<i2p::stream::Stream> stream)
@@ -621,28 +654,52 @@ namespace client
         if (stream)
         {
             LogPrint ("SAM incoming I2P connection for session ", m_ID);
-            m_Stream = stream;
             context.GetAddressBook ().InsertAddress (stream->GetRemoteIdentity ());
             auto session = m_Owner.FindSession (m_ID);
             if (session)    
                 session->localDestination->StopAcceptingStreams (); 
-            m_SocketType = eSAMSocketTypeStream;
-            if (!m_IsSilent)
-            {
-                // send remote peer address
-                uint8_t ident[1024];
-                size_t l = stream->GetRemoteIdentity ().ToBuffer (ident, 1024);
-                size_t l1 = i2p::util::ByteStreamToBase64 (ident, l, (char *)m_StreamBuffer, SAM_SOCKET_BUFFER_SIZE);
-                m_StreamBuffer[l1] = '\n';
-                HandleI2PReceive (boost::system::error_code (), l1 +1); // we send identity like it has been received from stream
-            }   
-            else
-                I2PReceive ();
+            // we are in destination's thread, socket belongs to SAM's
+            auto s = shared_from_this ();
+            m_Owner.GetService ().post ([s, stream](void) { s->HandleI2PAcceptInSAMThread (stream); });
         }
         else
             LogPrint (eLogInfo, "SAM I2P acceptor has been reset");
     }   
 
+    void SAMSocket::HandleI2PAcceptInSAMThread (std::shared_ptr<i2p::stream::Stream> stream)
+    {
+        if (m_SocketType == eSAMSocketTypeTerminated)
+        {
+            stream->Close ();
+            return;
+        }
+        m_Stream = stream;
+        m_SocketType = eSAMSocketTypeStream;
+        boost::system::error_code ecode;
+        m_Socket->cancel (ecode); // command read of STREAM ACCEPT, the rest is data
+        if (!m_IsSilent)
+        {
+            // send remote peer address like it has been received from stream
+            auto dest = std::make_shared<std::string> (stream->GetRemoteIdentity ().ToBase64 ());
+            *dest += "\n";
+            auto s = shared_from_this ();
+            boost::asio::async_write (*m_Socket, boost::asio::buffer (*dest),
+                [s, dest](const boost::system::error_code& ecode, std::size_t)
+                {
+                    if (ecode)
+                    {
+                        LogPrint ("SAM socket write error: ", ecode.message ());
+                        if (ecode != boost::asio::error::operation_aborted)
+                            s->Terminate ();
+                    }
+                    else
+                        s->StartRelay ();
+                });
+        }   
+        else
+            StartRelay ();
+    }
+
     void SAMSocket::HandleI2PDatagramReceive (const i2p::data::IdentityEx& from, uint16_t, uint16_t, const uint8_t * buf, size_t len)
     {
         LogPrint (eLogDebug, "SAM datagram received ", len);
@@ -655,13 +712,183 @@ namespace client
         if (len < SAM_SOCKET_BUFFER_SIZE - l)   
         {   
             memcpy (m_StreamBuffer + l, buf, len);
-            boost::asio::async_write (m_Socket, boost::asio::buffer (m_StreamBuffer, len + l),
+            boost::asio::async_write (*m_Socket, boost::asio::buffer (m_StreamBuffer, len + l),
                 std::bind (&SAMSocket::HandleWriteI2PData, shared_from_this (), std::placeholders::_1));
         }
         else
             LogPrint (eLogWarning, "SAM received datagram size ", len," exceeds buffer");
     }
 
+    SAMDatagramForwarder::SAMDatagramForwarder (boost::asio::io_service& service, const boost::asio::ip::address& localAddress,
+        const boost::asio::ip::udp::endpoint& client, std::shared_ptr<ClientDestination> localDestination):
+        m_Service (service), m_Socket (service, boost::asio::ip::udp::endpoint (localAddress, 0)),
+        m_ClientEndpoint (client), m_LocalDestination (localDestination), m_IsFlushScheduled (false)
+    {
+    }
+
+    void SAMDatagramForwarder::Start ()
+    {
+        boost::system::error_code ecode;
+        m_Socket.non_blocking (true, ecode); // we read only what is available
+        auto localDestination = m_LocalDestination.lock ();
+        auto datagramDestination = localDestination ? localDestination->GetDatagramDestination () : nullptr;
+        // one byte more, so longer datagrams are rejected rather than truncated
+        size_t maxPayloadSize = (datagramDestination ? datagramDestination->GetMaxPayloadSize () : i2p::datagram::MAX_DATAGRAM_SIZE) + 1;
+        m_ReceiveBuffers.resize (SAM_DATAGRAM_BATCH_SIZE);
+        for (auto& it: m_ReceiveBuffers)
+            it.resize (SAM_DATAGRAM_FORWARD_HEADER_SIZE + maxPayloadSize);
+        Receive ();
+        LogPrint ("SAM forwards datagrams to ", m_ClientEndpoint, " from port ", GetPort ());
+    }
+
+    void SAMDatagramForwarder::Stop ()
+    {
+        boost::system::error_code ecode;
+        m_Socket.close (ecode);
+    }
+
+    void SAMDatagramForwarder::Receive ()
+    {
+        m_Socket.async_receive (boost::asio::null_buffers (),
+            std::bind (&SAMDatagramForwarder::HandleReceive, shared_from_this (), std::placeholders::_1));
+    }
+
+    void SAMDatagramForwarder::HandleReceive (const boost::system::error_code& ecode)
+    {
+        if (ecode)
+        {
+            if (ecode != boost::asio::error::operation_aborted)
+                LogPrint ("SAM datagram forwarder receive error: ", ecode.message ());
+            return;
+        }
+#if defined(__linux__)
+        mmsghdr msgs[SAM_DATAGRAM_BATCH_SIZE];
+        iovec iovs[SAM_DATAGRAM_BATCH_SIZE];
+        boost::asio::ip::udp::endpoint senders[SAM_DATAGRAM_BATCH_SIZE];
+        memset (msgs, 0, sizeof (msgs));
+        for (int i = 0; i < SAM_DATAGRAM_BATCH_SIZE; i++)
+        {
+            iovs[i].iov_base = m_ReceiveBuffers[i].data ();
+            iovs[i].iov_len = m_ReceiveBuffers[i].size ();
+            msgs[i].msg_hdr.msg_name = senders[i].data ();
+            msgs[i].msg_hdr.msg_namelen = senders[i].capacity ();
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int num = recvmmsg (m_Socket.native_handle (), msgs, SAM_DATAGRAM_BATCH_SIZE, MSG_DONTWAIT, nullptr);
+        for (int i = 0; i < num; i++)
+        {
+            senders[i].resize (msgs[i].msg_hdr.msg_namelen);
+            HandleDatagram (senders[i], m_ReceiveBuffers[i].data (), msgs[i].msg_len);
+        }
+#else
+        for (auto& it: m_ReceiveBuffers)
+        {
+            boost::asio::ip::udp::endpoint sender;
+            boost::system::error_code ec;
+            size_t len = m_Socket.receive_from (boost::asio::buffer (it), sender, 0, ec);
+            if (ec) break; // would block
+            HandleDatagram (sender, it.data (), len);
+        }
+#endif
+        Receive ();
+    }
+
+    void SAMDatagramForwarder::HandleDatagram (const boost::asio::ip::udp::endpoint& sender, const uint8_t * buf, size_t len)
+    {
+        if (sender != m_ClientEndpoint)
+        {
+            // only the session's client may send through it
+            LogPrint (eLogWarning, "SAM forwarded datagram from unexpected ", sender, " dropped");
+            return;
+        }
+        if (len <= SAM_DATAGRAM_FORWARD_HEADER_SIZE)
+        {
+            LogPrint (eLogWarning, "SAM forwarded datagram is too short ", len);
+            return;
+        }
+        auto localDestination = m_LocalDestination.lock ();
+        auto datagramDestination = localDestination ? localDestination->GetDatagramDestination () : nullptr;
+        if (datagramDestination)
+            datagramDestination->SendDatagramTo (buf + SAM_DATAGRAM_FORWARD_HEADER_SIZE,
+                len - SAM_DATAGRAM_FORWARD_HEADER_SIZE, i2p::data::IdentHash (buf));
+    }
+
+    void SAMDatagramForwarder::HandleI2PDatagramReceive (const i2p::data::IdentityEx& from, uint16_t, uint16_t, const uint8_t * buf, size_t len)
+    {
+        std::vector<uint8_t> datagram (SAM_DATAGRAM_FORWARD_HEADER_SIZE + len);
+        memcpy (datagram.data (), from.GetIdentHash (), SAM_DATAGRAM_FORWARD_HEADER_SIZE);
+        memcpy (datagram.data () + SAM_DATAGRAM_FORWARD_HEADER_SIZE, buf, len);
+        std::unique_lock<std::mutex> l(m_SendQueueMutex);
+        if (m_SendQueue.size () >= SAM_DATAGRAM_FORWARD_MAX_QUEUE_SIZE)
+        {
+            static auto& numDropped = i2p::util::metrics.GetCounter ("i2pd_sam_datagrams_dropped_total",
+                "Incoming datagrams dropped because SAM thread is behind");
+            numDropped.Inc ();
+            LogPrint (eLogWarning, "SAM datagram forwarding queue is full. Dropped");
+            return;
+        }
+        m_SendQueue.push_back (std::move (datagram));
+        if (!m_IsFlushScheduled)
+        {
+            // datagrams coming before SAM thread gets to it go in same batch
+            m_IsFlushScheduled = true;
+            m_Service.post (std::bind (&SAMDatagramForwarder::Flush, shared_from_this ()));
+        }
+    }
+
+    void SAMDatagramForwarder::Flush ()
+    {
+        std::vector<std::vector<uint8_t> > datagrams;
+        {
+            std::unique_lock<std::mutex> l(m_SendQueueMutex);
+            datagrams.swap (m_SendQueue);
+            m_IsFlushScheduled = false;
+        }
+#if defined(__linux__)
+        mmsghdr msgs[SAM_DATAGRAM_BATCH_SIZE];
+        iovec iovs[SAM_DATAGRAM_BATCH_SIZE];
+        for (size_t offset = 0; offset < datagrams.size (); offset += SAM_DATAGRAM_BATCH_SIZE)
+        {
+            int num = std::min (datagrams.size () - offset, (size_t)SAM_DATAGRAM_BATCH_SIZE);
+            memset (msgs, 0, sizeof (msgs));
+            for (int i = 0; i < num; i++)
+            {
+                iovs[i].iov_base = datagrams[offset + i].data ();
+                iovs[i].iov_len = datagrams[offset + i].size ();
+                msgs[i].msg_hdr.msg_name = m_ClientEndpoint.data ();
+                msgs[i].msg_hdr.msg_namelen = m_ClientEndpoint.size ();
+                msgs[i].msg_hdr.msg_iov = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            for (int sent = 0; sent < num;)
+            {
+                int n = sendmmsg (m_Socket.native_handle (), msgs + sent, num - sent, 0);
+                if (n > 0)
+                    sent += n; // partial batch, retry the rest
+                else if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    LogPrint (eLogWarning, num - sent, " SAM datagrams to ", m_ClientEndpoint, " dropped, socket buffer is full");
+                    break;
+                }
+                else
+                {
+                    LogPrint (eLogWarning, "SAM datagram to ", m_ClientEndpoint, " dropped: ", strerror (errno));
+                    sent++; // skip failed one
+                }
+            }
+        }
+#else
+        for (auto& it: datagrams)
+        {
+            boost::system::error_code ec;
+            m_Socket.send_to (boost::asio::buffer (it), m_ClientEndpoint, 0, ec);
+            if (ec)
+                LogPrint (eLogWarning, "SAM datagram to ", m_ClientEndpoint, " dropped: ", ec.message ());
+        }
+#endif
+    }
+
     SAMSession::SAMSession (std::shared_ptr<ClientDestination> dest):
         localDestination (dest)
     {
@@ -671,6 +898,8 @@ namespace client
     {
         for (auto it: sockets)
             it->SetSocketType (eSAMSocketTypeTerminated);
+        if (datagramForwarder)
+            datagramForwarder->Stop ();
         i2p::client::context.DeleteLocalDestination (localDestination);
     }
 
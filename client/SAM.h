@@ -8,11 +8,13 @@
 #include <thread>
 #include <mutex>
 #include <memory>
+#include <vector>
 #include <boost/asio.hpp>
 #include "Identity.h"
 #include "LeaseSet.h"
 #include "Streaming.h"
 #include "Destination.h"
+#include "StreamRelay.h"
 
 namespace i2p
 {
@@ -20,15 +22,22 @@ namespace client
 {
     const size_t SAM_SOCKET_BUFFER_SIZE = 8192;
     const int SAM_SOCKET_CONNECTION_MAX_IDLE = 3600; // in seconds
+    const int SAM_STREAM_CONNECT_SYN_DATA_TIMEOUT = 100; // in milliseconds, wait for client data to send in SYN
     const int SAM_SESSION_READINESS_CHECK_INTERVAL = 20; // in seconds  
+    const int SAM_DATAGRAM_BATCH_SIZE = 16; // datagrams per syscall where supported
+    const char SAM_DATAGRAM_FORWARD_DEFAULT_HOST[] = "127.0.0.1";
+    const size_t SAM_DATAGRAM_FORWARD_HEADER_SIZE = 32; // remote ident hash
+    const size_t SAM_DATAGRAM_FORWARD_MAX_QUEUE_SIZE = 1024; // datagrams waiting for SAM thread, new are dropped if exceeded
     const char SAM_HANDSHAKE[] = "HELLO VERSION";
     const char SAM_HANDSHAKE_REPLY[] = "HELLO REPLY RESULT=OK VERSION=%s\n";
     const char SAM_HANDSHAKE_I2P_ERROR[] = "HELLO REPLY RESULT=I2P_ERROR\n";    
     const char SAM_SESSION_CREATE[] = "SESSION CREATE";
     const char SAM_SESSION_CREATE_REPLY_OK[] = "SESSION STATUS RESULT=OK DESTINATION=%s\n";
+    const char SAM_SESSION_CREATE_REPLY_OK_FORWARD[] = "SESSION STATUS RESULT=OK DESTINATION=%s UDP_PORT=%d\n";
     const char SAM_SESSION_CREATE_DUPLICATED_ID[] = "SESSION STATUS RESULT=DUPLICATED_ID\n";
     const char SAM_SESSION_CREATE_DUPLICATED_DEST[] = "SESSION STATUS RESULT=DUPLICATED_DEST\n";    
     const char SAM_SESSION_STATUS_INVALID_KEY[] = "SESSION STATUS RESULT=INVALID_KEY\n";
+    const char SAM_SESSION_STATUS_I2P_ERROR[] = "SESSION STATUS RESULT=I2P_ERROR\n";
     const char SAM_STREAM_CONNECT[] = "STREAM CONNECT";
     const char SAM_STREAM_STATUS_OK[] = "STREAM STATUS RESULT=OK\n";
     const char SAM_STREAM_STATUS_INVALID_ID[] = "STREAM STATUS RESULT=INVALID_ID\n";
@@ -53,6 +62,9 @@ namespace client
     const char SAM_PARAM_NAME[] = "NAME";
     const char SAM_PARAM_SIGNATURE_TYPE[] = "SIGNATURE_TYPE";   
     const char SAM_PARAM_SIZE[] = "SIZE";
+    // not standard PORT and HOST, forwarded datagrams are prefixed by binary ident hash rather than destination line
+    const char SAM_PARAM_FORWARD_HOST[] = "I2PD_FORWARD_HOST";
+    const char SAM_PARAM_FORWARD_PORT[] = "I2PD_FORWARD_PORT";
     const char SAM_VALUE_TRANSIENT[] = "TRANSIENT"; 
     const char SAM_VALUE_STREAM[] = "STREAM";
     const char SAM_VALUE_DATAGRAM[] = "DATAGRAM";
@@ -79,7 +91,7 @@ namespace client
             ~SAMSocket ();          
             void CloseStream (); // TODO: implement it better   
 
-            boost::asio::ip::tcp::socket& GetSocket () { return m_Socket; };
+            boost::asio::ip::tcp::socket& GetSocket () { return *m_Socket; };
             void ReceiveHandshake ();
             void SetSocketType (SAMSocketType socketType) { m_SocketType = socketType; };
             SAMSocketType GetSocketType () const { return m_SocketType; };
@@ -93,11 +105,10 @@ namespace client
             void SendMessageReply (const char * msg, size_t len, bool close);           
             void HandleMessageReplySent (const boost::system::error_code& ecode, std::size_t bytes_transferred, bool close);
             void Receive ();
-            void HandleReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred);
 
-            void I2PReceive (); 
-            void HandleI2PReceive (const boost::system::error_code& ecode, std::size_t bytes_transferred);
+            void StartRelay ();
             void HandleI2PAccept (std::shared_ptr<i2p::stream::Stream> stream);
+            void HandleI2PAcceptInSAMThread (std::shared_ptr<i2p::stream::Stream> stream);
             void HandleWriteI2PData (const boost::system::error_code& ecode);
             void HandleI2PDatagramReceive (const i2p::data::IdentityEx& from, uint16_t fromPort, uint16_t toPort, const uint8_t * buf, size_t len);
 
@@ -111,6 +122,7 @@ namespace client
 
             void Connect (std::shared_ptr<const i2p::data::LeaseSet> remote);
             void HandleConnectLeaseSetRequestComplete (std::shared_ptr<i2p::data::LeaseSet> leaseSet);
+            void HandleSYNDataTimer (const boost::system::error_code& ecode);
             void SendNamingLookupReply (const i2p::data::IdentityEx& identity);
             void HandleNamingLookupLeaseSetRequestComplete (std::shared_ptr<i2p::data::LeaseSet> leaseSet, i2p::data::IdentHash ident);
             void HandleSessionReadinessCheckTimer (const boost::system::error_code& ecode);
@@ -119,7 +131,7 @@ namespace client
         private:
 
             SAMBridge& m_Owner;
-            boost::asio::ip::tcp::socket m_Socket;
+            std::shared_ptr<boost::asio::ip::tcp::socket> m_Socket;
             boost::asio::deadline_timer m_Timer;
             char m_Buffer[SAM_SOCKET_BUFFER_SIZE + 1];
             size_t m_BufferOffset;
@@ -128,13 +140,51 @@ namespace client
             std::string m_ID; // nickname
             bool m_IsSilent;
             std::shared_ptr<i2p::stream::Stream> m_Stream;
+            std::shared_ptr<StreamRelay> m_Relay;
             SAMSession * m_Session;
     };  
 
+    /**
+     * Datagrams of session with PORT= are exchanged with client over UDP as binary frames,
+     * 32 bytes of remote ident hash followed by payload, with no SAM text to parse or format.
+     * Client sends to our own socket, several datagrams are moved per syscall where supported
+     */
+    class SAMDatagramForwarder: public std::enable_shared_from_this<SAMDatagramForwarder>
+    {
+        public:
+
+            SAMDatagramForwarder (boost::asio::io_service& service, const boost::asio::ip::address& localAddress,
+                const boost::asio::ip::udp::endpoint& client, std::shared_ptr<ClientDestination> localDestination);
+
+            void Start ();
+            void Stop ();
+            uint16_t GetPort () const { return m_Socket.local_endpoint ().port (); };
+            void HandleI2PDatagramReceive (const i2p::data::IdentityEx& from, uint16_t fromPort, uint16_t toPort, const uint8_t * buf, size_t len);
+
+        private:
+
+            void Receive ();
+            void HandleReceive (const boost::system::error_code& ecode);
+            void HandleDatagram (const boost::asio::ip::udp::endpoint& sender, const uint8_t * buf, size_t len);
+            void Flush ();
+
+        private:
+
+            boost::asio::io_service& m_Service;
+            boost::asio::ip::udp::socket m_Socket;
+            boost::asio::ip::udp::endpoint m_ClientEndpoint;
+            std::weak_ptr<ClientDestination> m_LocalDestination;
+            std::vector<std::vector<uint8_t> > m_ReceiveBuffers; // batch from client
+            std::mutex m_SendQueueMutex;
+            std::vector<std::vector<uint8_t> > m_SendQueue; // to client
+            bool m_IsFlushScheduled;
+    };
+
     struct SAMSession
     {
         std::shared_ptr<ClientDestination> localDestination;
         std::list<std::shared_ptr<SAMSocket> > sockets;
+        std::shared_ptr<SAMDatagramForwarder> datagramForwarder;
         
         SAMSession (std::shared_ptr<ClientDestination> dest);       
         ~SAMSession ();
@@ -153,6 +203,7 @@ namespace client
             void Stop ();
             
             boost::asio::io_service& GetService () { return m_Service; };
+            const boost::asio::ip::udp::endpoint& GetDatagramEndpoint () const { return m_DatagramEndpoint; };
             SAMSession * CreateSession (const std::string& id, const std::string& destination, // empty string  means transient
                 const std::map<std::string, std::string> * params);
             void CloseSession (const std::string& id);
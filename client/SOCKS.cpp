@@ -501,7 +501,7 @@ namespace proxy
             {
                 LogPrint(eLogInfo,"--- SOCKS requested ", m_address.dns.ToString(), ":" , m_port);
                 GetOwner()->CreateStream ( std::bind (&SOCKSHandler::HandleStreamRequestComplete,
-                        shared_from_this(), std::placeholders::_1), m_address.dns.ToString(), m_port);
+                        shared_from_this(), std::placeholders::_1), m_address.dns.value, m_address.dns.size, m_port);
             } 
             else
                 AsyncSockRead();
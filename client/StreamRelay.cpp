@@ -0,0 +1,188 @@
+#include <vector>
+#include "util/Log.h"
+#include "StreamRelay.h"
+
+namespace i2p
+{
+namespace client
+{
+    class StreamRelayBuffers
+    {
+        public:
+
+            ~StreamRelayBuffers ()
+            {
+                for (auto it: m_Buffers)
+                    delete[] it;
+            }
+
+            uint8_t * Acquire ()
+            {
+                {
+                    std::unique_lock<std::mutex> l(m_BuffersMutex);
+                    if (!m_Buffers.empty ())
+                    {
+                        auto buf = m_Buffers.back ();
+                        m_Buffers.pop_back ();
+                        return buf;
+                    }
+                }
+                return new uint8_t[STREAM_RELAY_BUFFER_SIZE];
+            }
+
+            void Release (uint8_t * buf)
+            {
+                {
+                    std::unique_lock<std::mutex> l(m_BuffersMutex);
+                    if (m_Buffers.size () < STREAM_RELAY_MAX_POOLED_BUFFERS)
+                    {
+                        m_Buffers.push_back (buf);
+                        return;
+                    }
+                }
+                delete[] buf;
+            }
+
+        private:
+
+            std::mutex m_BuffersMutex;
+            std::vector<uint8_t *> m_Buffers;
+    };
+    static StreamRelayBuffers streamRelayBuffers;
+
+    StreamRelay::StreamRelay (std::shared_ptr<boost::asio::ip::tcp::socket> socket,
+        std::shared_ptr<i2p::stream::Stream> stream, int maxIdle):
+        m_Socket (socket), m_Stream (stream), m_MaxIdle (maxIdle), m_IsClosed (false)
+    {
+    }
+
+    StreamRelay::~StreamRelay ()
+    {
+    }
+
+    void StreamRelay::Start (const CloseHandler& closeHandler)
+    {
+        m_CloseHandler = closeHandler;
+        boost::system::error_code ecode;
+        m_Socket->non_blocking (true, ecode); // we read only what is available
+        StreamReceive ();
+        SocketReceive ();
+    }
+
+    void StreamRelay::Stop ()
+    {
+        m_IsClosed = true;
+        std::unique_lock<std::mutex> l(m_CloseHandlerMutex);
+        m_CloseHandler = nullptr;
+    }
+
+    void StreamRelay::Close ()
+    {
+        if (m_IsClosed.exchange (true)) return;
+        CloseHandler closeHandler;
+        {
+            std::unique_lock<std::mutex> l(m_CloseHandlerMutex);
+            std::swap (closeHandler, m_CloseHandler);
+        }
+        if (closeHandler) closeHandler ();
+    }
+
+    void StreamRelay::SocketReceive ()
+    {
+        if (m_IsClosed) return;
+        m_Socket->async_read_some (boost::asio::null_buffers (),
+            std::bind (&StreamRelay::HandleSocketReadable, shared_from_this (), std::placeholders::_1));
+    }
+
+    void StreamRelay::HandleSocketReadable (const boost::system::error_code& ecode)
+    {
+        if (m_IsClosed) return;
+        if (ecode)
+        {
+            LogPrint ("StreamRelay read error: ", ecode.message ());
+            if (ecode != boost::asio::error::operation_aborted)
+                Close ();
+            return;
+        }
+        auto buf = streamRelayBuffers.Acquire ();
+        boost::system::error_code ec;
+        size_t len = m_Socket->read_some (boost::asio::buffer (buf, STREAM_RELAY_BUFFER_SIZE), ec);
+        if (ec)
+        {
+            streamRelayBuffers.Release (buf);
+            if (ec == boost::asio::error::would_block)
+                SocketReceive ();
+            else
+            {
+                LogPrint ("StreamRelay read error: ", ec.message ());
+                Close ();
+            }
+            return;
+        }
+        auto s = shared_from_this ();
+        // stream copies data to its send buffer, handler is called when there is room for more
+        m_Stream->AsyncSend (buf, len,
+            [s](const boost::system::error_code& ecode)
+            {
+                if (!ecode)
+                    s->SocketReceive ();
+                else
+                    s->Close ();
+            });
+        streamRelayBuffers.Release (buf);
+    }
+
+    void StreamRelay::StreamReceive ()
+    {
+        if (m_IsClosed) return;
+        m_Stream->AsyncReceivePacket (std::bind (&StreamRelay::HandleStreamReceive, shared_from_this (),
+            std::placeholders::_1, std::placeholders::_2), m_MaxIdle);
+    }
+
+    void StreamRelay::HandleStreamReceive (const boost::system::error_code& ecode, i2p::stream::Packet * packet)
+    {
+        if (ecode)
+        {
+            LogPrint ("StreamRelay stream read error: ", ecode.message ());
+            if (ecode != boost::asio::error::operation_aborted)
+                Close ();
+            return;
+        }
+        if (m_IsClosed)
+        {
+            delete packet;
+            return;
+        }
+        if (m_StreamDataFilter && m_StreamDataFilter (packet->GetBuffer (), packet->GetLength (), m_FilteredData))
+        {
+            delete packet;
+            if (m_FilteredData.empty ())
+                StreamReceive (); // filter waits for more
+            else
+                boost::asio::async_write (*m_Socket, boost::asio::buffer (m_FilteredData),
+                    std::bind (&StreamRelay::HandleSocketWrite, shared_from_this (), std::placeholders::_1));
+            return;
+        }
+        auto s = shared_from_this ();
+        boost::asio::async_write (*m_Socket, boost::asio::buffer (packet->GetBuffer (), packet->GetLength ()),
+            [s, packet](const boost::system::error_code& ecode, std::size_t)
+            {
+                delete packet;
+                s->HandleSocketWrite (ecode);
+            });
+    }
+
+    void StreamRelay::HandleSocketWrite (const boost::system::error_code& ecode)
+    {
+        m_FilteredData.clear ();
+        if (ecode)
+        {
+            LogPrint ("StreamRelay write error: ", ecode.message ());
+            if (ecode != boost::asio::error::operation_aborted)
+                Close ();
+        }
+        else
+            StreamReceive ();
+    }
+}
+}
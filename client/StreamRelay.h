@@ -0,0 +1,68 @@
+#ifndef STREAM_RELAY_H__
+#define STREAM_RELAY_H__
+
+#include <inttypes.h>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <boost/asio.hpp>
+#include "Streaming.h"
+
+namespace i2p
+{
+namespace client
+{
+    const size_t STREAM_RELAY_BUFFER_SIZE = 8192;
+    const size_t STREAM_RELAY_MAX_POOLED_BUFFERS = 64;
+
+    /**
+     * Moves data between TCP socket and I2P stream in both directions.
+     * Stream packets are written to the socket as received, without copying,
+     * socket data is read into pooled buffers only when the socket is readable,
+     * so idle connections hold no buffers.
+     * Each direction waits for the other side to take its data before reading more.
+     */
+    class StreamRelay: public std::enable_shared_from_this<StreamRelay>
+    {
+        public:
+
+            typedef std::function<void ()> CloseHandler;
+            // may replace data from I2P by out, returns false to write it as is
+            typedef std::function<bool (const uint8_t * buf, size_t len, std::string& out)> StreamDataFilter;
+
+            StreamRelay (std::shared_ptr<boost::asio::ip::tcp::socket> socket,
+                std::shared_ptr<i2p::stream::Stream> stream, int maxIdle); // maxIdle in seconds
+            ~StreamRelay ();
+
+            void SetStreamDataFilter (const StreamDataFilter& filter) { m_StreamDataFilter = filter; };
+            void Start (const CloseHandler& closeHandler); // handler is called once either side fails
+            void Stop (); // socket and stream are closed by owner
+
+        private:
+
+            void Close ();
+
+            void SocketReceive ();
+            void HandleSocketReadable (const boost::system::error_code& ecode);
+
+            void StreamReceive ();
+            void HandleStreamReceive (const boost::system::error_code& ecode, i2p::stream::Packet * packet);
+            void HandleSocketWrite (const boost::system::error_code& ecode);
+
+        private:
+
+            std::shared_ptr<boost::asio::ip::tcp::socket> m_Socket;
+            std::shared_ptr<i2p::stream::Stream> m_Stream;
+            int m_MaxIdle;
+            std::atomic<bool> m_IsClosed;
+            std::mutex m_CloseHandlerMutex;
+            CloseHandler m_CloseHandler;
+            StreamDataFilter m_StreamDataFilter;
+            std::string m_FilteredData;
+    };
+}
+}
+
+#endif
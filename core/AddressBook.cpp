@@ -1,4 +1,5 @@
 #include <string.h>
+#include <ctype.h>
 #include <inttypes.h>
 #include <string>
 #include <map>
@@ -30,8 +31,7 @@ namespace client
             void AddAddress (const i2p::data::IdentityEx& address);
             void RemoveAddress (const i2p::data::IdentHash& ident);
 
-            int Load (std::map<std::string, i2p::data::IdentHash>& addresses);
-            int Save (const std::map<std::string, i2p::data::IdentHash>& addresses);
+            int Load (AddressBookIndex& index);
 
         private:    
             
@@ -97,14 +97,21 @@ namespace client
             boost::filesystem::remove (filename);
     }
 
-    int AddressBookFilesystemStorage::Load (std::map<std::string, i2p::data::IdentHash>& addresses)
+    int AddressBookFilesystemStorage::Load (AddressBookIndex& index)
     {
-        int num = 0;    
+        auto indexFilename = GetPath () / "addresses.idx";
+        if (index.Open (indexFilename.string ()))
+        {
+            LogPrint (eLogInfo, index.GetNumAddresses (), " addresses loaded");
+            return index.GetNumAddresses ();
+        }
+        // convert addresses.csv from previous versions
+        int num = 0;
         auto filename = GetPath () / "addresses.csv";
         std::ifstream f (filename.c_str (), std::ofstream::in); // in text mode
         if (f.is_open ())   
         {
-            addresses.clear ();
+            AddressBookIndex::Addresses addresses;
             while (!f.eof ())
             {
                 std::string s;
@@ -120,36 +127,18 @@ namespace client
 
                     i2p::data::IdentHash ident;
                     ident.FromBase32 (addr);
-                    addresses[name] = ident;
+                    addresses.push_back (std::make_pair (name, ident));
                     num++;
                 }       
             }
-            LogPrint (eLogInfo, num, " addresses loaded");
+            index.Merge (addresses);
+            LogPrint (eLogInfo, num, " addresses loaded from ", filename);
         }
         else
-            LogPrint (eLogWarning, filename, " not found");
+            LogPrint (eLogWarning, indexFilename, " not found");
         return num;
     }
 
-    int AddressBookFilesystemStorage::Save (const std::map<std::string, i2p::data::IdentHash>& addresses)
-    {
-        int num = 0;
-        auto filename = GetPath () / "addresses.csv";
-        std::ofstream f (filename.c_str (), std::ofstream::out); // in text mode
-        if (f.is_open ())   
-        {
-            for (auto it: addresses)
-            {
-                f << it.first << "," << it.second.ToBase32 () << std::endl;
-                num++;
-            }
-            LogPrint (eLogInfo, num, " addresses saved");
-        }
-        else    
-            LogPrint (eLogError, "Can't open file ", filename); 
-        return num; 
-    }   
-
 //---------------------------------------------------------------------
     AddressBook::AddressBook ()
         : m_Storage (nullptr), m_IsLoaded (false), m_IsDownloading (false), 
@@ -194,7 +183,6 @@ namespace client
         }   
         if (m_Storage)
         {
-            m_Storage->Save (m_Addresses);
             delete m_Storage;
             m_Storage = nullptr;
         }
@@ -213,48 +201,59 @@ namespace client
         return new AddressBookFilesystemStorage ();
     }   
 
+    // returns position of sub, ASCII only
+    static size_t FindCaseInsensitive (const char * s, size_t len, const char * sub, size_t subLen)
+    {
+        for (size_t pos = 0; pos + subLen <= len; pos++)
+        {
+            size_t i = 0;
+            while (i < subLen && tolower ((unsigned char)s[pos + i]) == sub[i]) i++;
+            if (i == subLen) return pos;
+        }
+        return std::string::npos;
+    }
+
     bool AddressBook::GetIdentHash (const std::string& address, i2p::data::IdentHash& ident)
     {
-        auto pos = address.find(".b32.i2p");
+        return GetIdentHash (address.c_str (), address.length (), ident);
+    }
+
+    bool AddressBook::GetIdentHash (const char * address, size_t len, i2p::data::IdentHash& ident)
+    {
+        auto pos = FindCaseInsensitive (address, len, ".b32.i2p", 8);
         if (pos != std::string::npos)
         {
-            i2p::util::Base32ToByteStream (address.c_str(), pos, ident, 32);
+            char b32[64]; // base32 is lower case
+            if (pos > sizeof (b32)) return false;
+            for (size_t i = 0; i < pos; i++)
+                b32[i] = tolower ((unsigned char)address[i]);
+            i2p::util::Base32ToByteStream (b32, pos, ident, 32);
             return true;
         }
         else
         {   
-            pos = address.find (".i2p");
+            pos = FindCaseInsensitive (address, len, ".i2p", 4);
             if (pos != std::string::npos)
-            {
-                auto identHash = FindAddress (address); 
-                if (identHash)
-                {
-                    ident = *identHash;
-                    return true;
-                }
-                else
-                    return false;
-            }
+                return FindAddress (address, len, ident);
         }   
         // if not .b32 we assume full base64 address
         i2p::data::IdentityEx dest;
-        if (!dest.FromBase64 (address))
+        if (!dest.FromBase64 (std::string (address, len)))
             return false;
         ident = dest.GetIdentHash ();
         return true;
     }
     
-    const i2p::data::IdentHash * AddressBook::FindAddress (const std::string& address)
+    bool AddressBook::FindAddress (const char * address, size_t len, i2p::data::IdentHash& ident)
     {
         if (!m_IsLoaded)
             LoadHosts ();
         if (m_IsLoaded)
         {
-            auto it = m_Addresses.find (address);
-            if (it != m_Addresses.end ())
-                return &it->second;
+            std::unique_lock<std::mutex> l(m_AddressBookMutex); // index is remapped on merge
+            return m_Index.Find (address, len, ident);
         }
-        return nullptr; 
+        return false; 
     }
 
     ClientDestination* AddressBook::getSharedLocalDestination() const
@@ -266,10 +265,14 @@ namespace client
     {
         i2p::data::IdentityEx ident;
         ident.FromBase64 (base64);
+        if (!m_IsLoaded)
+            LoadHosts (); // index file is opened by it, otherwise merge would be lost on load
         if (!m_Storage)
              m_Storage = CreateStorage ();
         m_Storage->AddAddress (ident);
-        m_Addresses[address] = ident.GetIdentHash ();
+        AddressBookIndex::Addresses addresses;
+        addresses.push_back (std::make_pair (address, ident.GetIdentHash ()));
+        MergeAddresses (addresses);
         LogPrint (address,"->", ToAddress(ident.GetIdentHash ()), " added");
     }
 
@@ -293,7 +296,13 @@ namespace client
     {
         if (!m_Storage)
              m_Storage = CreateStorage ();
-        if (m_Storage->Load (m_Addresses) > 0)
+        int num;
+        {
+            std::unique_lock<std::mutex> l(m_MergeMutex);
+            std::unique_lock<std::mutex> l1(m_AddressBookMutex);
+            num = m_Storage->Load (m_Index);
+        }
+        if (num > 0)
         {
             m_IsLoaded = true;
             return;
@@ -323,8 +332,9 @@ namespace client
 
     void AddressBook::LoadHostsFromStream (std::istream& f)
     {
-        std::unique_lock<std::mutex> l(m_AddressBookMutex);
+        // only changed addresses are stored and merged into index
         int numAddresses = 0;
+        AddressBookIndex::Addresses changed;
         std::string s;
         while (!f.eof ())
         {
@@ -343,22 +353,46 @@ namespace client
                 i2p::data::IdentityEx ident;
                 if (ident.FromBase64(addr))
                 {   
-                    m_Addresses[name] = ident.GetIdentHash ();
-                    m_Storage->AddAddress (ident);
                     numAddresses++;
+                    i2p::data::IdentHash current;
+                    bool found;
+                    {
+                        std::unique_lock<std::mutex> l(m_AddressBookMutex);
+                        found = m_Index.Find (name.c_str (), name.length (), current);
+                    }
+                    if (found && current == ident.GetIdentHash ())
+                        continue;
+                    m_Storage->AddAddress (ident);
+                    changed.push_back (std::make_pair (name, ident.GetIdentHash ()));
                 }   
                 else
                     LogPrint (eLogError, "Malformed address ", addr, " for ", name);
             }       
         }
-        LogPrint (eLogInfo, numAddresses, " addresses processed");
+        LogPrint (eLogInfo, numAddresses, " addresses processed, ", changed.size (), " changed");
+        if (!changed.empty ())
+            MergeAddresses (changed);
         if (numAddresses > 0)
-        {   
             m_IsLoaded = true;
-            m_Storage->Save (m_Addresses);
-        }   
     }   
     
+    void AddressBook::MergeAddresses (AddressBookIndex::Addresses& addresses)
+    {
+        // new index is built and written while lookups go on, they wait only for remapping
+        std::unique_lock<std::mutex> l(m_MergeMutex);
+        std::vector<uint8_t> image;
+        size_t numChanges = m_Index.Merge (addresses, image);
+        if (!numChanges) return;
+        bool isWritten = m_Index.Write (image);
+        size_t numAddresses;
+        {
+            std::unique_lock<std::mutex> l1(m_AddressBookMutex);
+            m_Index.Replace (image, isWritten);
+            numAddresses = m_Index.GetNumAddresses ();
+        }
+        LogPrint (eLogInfo, numChanges, " address book changes merged, ", numAddresses, " addresses");
+    }
+
     void AddressBook::LoadSubscriptions ()
     {
         if (!m_Subscriptions.size ())
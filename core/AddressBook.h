@@ -12,6 +12,7 @@
 #include "util/util.h"
 #include "Identity.h"
 #include "util/Log.h"
+#include "AddressBookIndex.h"
 
 namespace i2p
 {
@@ -35,8 +36,7 @@ namespace client
             virtual void AddAddress (const i2p::data::IdentityEx& address) = 0;
             virtual void RemoveAddress (const i2p::data::IdentHash& ident) = 0;
         
-            virtual int Load (std::map<std::string, i2p::data::IdentHash>& addresses) = 0;
-            virtual int Save (const std::map<std::string, i2p::data::IdentHash>& addresses) = 0;
+            virtual int Load (AddressBookIndex& index) = 0; // index is persisted by itself
     };          
 
     class ClientDestination;
@@ -50,8 +50,9 @@ namespace client
             void Start (ClientDestination* local_destination);
             void Stop ();
             bool GetIdentHash (const std::string& address, i2p::data::IdentHash& ident);
+            bool GetIdentHash (const char * address, size_t len, i2p::data::IdentHash& ident); // doesn't allocate for .i2p and .b32.i2p
             bool GetAddress (const std::string& address, i2p::data::IdentityEx& identity);
-            const i2p::data::IdentHash * FindAddress (const std::string& address);
+            bool FindAddress (const char * address, size_t len, i2p::data::IdentHash& ident); // case insensitive
 
             ClientDestination* getSharedLocalDestination() const;
 
@@ -71,13 +72,15 @@ namespace client
             AddressBookStorage * CreateStorage ();  
             void LoadHosts ();
             void LoadSubscriptions ();
+            void MergeAddresses (AddressBookIndex::Addresses& addresses);
 
             void HandleSubscriptionsUpdateTimer (const boost::system::error_code& ecode);
 
         private:    
 
-            std::mutex m_AddressBookMutex;
-            std::map<std::string, i2p::data::IdentHash>  m_Addresses;
+            std::mutex m_MergeMutex; // taken before m_AddressBookMutex
+            std::mutex m_AddressBookMutex; // lookups and remapping of index
+            AddressBookIndex m_Index;
             AddressBookStorage * m_Storage;
             volatile bool m_IsLoaded, m_IsDownloading;
             std::vector<AddressBookSubscription *> m_Subscriptions;
@@ -0,0 +1,327 @@
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+#include <fstream>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "util/I2PEndian.h"
+#include "util/Log.h"
+#include "AddressBookIndex.h"
+
+namespace i2p
+{
+namespace client
+{
+    static inline char ToLower (char c)
+    {
+        return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+    }
+
+    // name1 is in lower case already
+    static int CompareNames (const char * name1, size_t len1, const char * name2, size_t len2)
+    {
+        size_t len = std::min (len1, len2);
+        for (size_t i = 0; i < len; i++)
+        {
+            char c = ToLower (name2[i]);
+            if (name1[i] != c)
+                return (uint8_t)name1[i] < (uint8_t)c ? -1 : 1;
+        }
+        if (len1 == len2) return 0;
+        return len1 < len2 ? -1 : 1;
+    }
+
+    AddressBookIndex::AddressBookIndex ():
+        m_Data (nullptr), m_Size (0), m_NumRecords (0), m_Mapped (nullptr), m_MappedSize (0)
+    {
+    }
+
+    AddressBookIndex::~AddressBookIndex ()
+    {
+        Close ();
+    }
+
+    bool AddressBookIndex::Open (const std::string& filename)
+    {
+        Close ();
+        m_FileName = filename;
+        return Map ();
+    }
+
+    void AddressBookIndex::Close ()
+    {
+        Unmap ();
+        m_Buffer.clear ();
+        m_Data = nullptr;
+        m_Size = 0;
+        m_NumRecords = 0;
+    }
+
+    bool AddressBookIndex::Map ()
+    {
+#ifndef _WIN32
+        int fd = open (m_FileName.c_str (), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat (fd, &st) < 0 || (size_t)st.st_size < ADDRESS_BOOK_INDEX_HEADER_SIZE)
+        {
+            close (fd);
+            return false;
+        }
+        void * mapped = mmap (nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close (fd); // mapping stays valid
+        if (mapped == MAP_FAILED)
+        {
+            LogPrint (eLogError, "Can't map ", m_FileName);
+            return false;
+        }
+        m_Mapped = mapped;
+        m_MappedSize = st.st_size;
+        if (!SetData ((const uint8_t *)mapped, st.st_size))
+        {
+            Unmap ();
+            return false;
+        }
+        return true;
+#else
+        std::ifstream f (m_FileName.c_str (), std::ifstream::binary);
+        if (!f.is_open ()) return false;
+        f.seekg (0, std::ios::end);
+        size_t len = f.tellg ();
+        f.seekg (0, std::ios::beg);
+        m_Buffer.resize (len);
+        f.read ((char *)m_Buffer.data (), len);
+        if (!f || !SetData (m_Buffer.data (), len))
+        {
+            m_Buffer.clear ();
+            return false;
+        }
+        return true;
+#endif
+    }
+
+    void AddressBookIndex::Unmap ()
+    {
+#ifndef _WIN32
+        if (m_Mapped)
+        {
+            munmap (m_Mapped, m_MappedSize);
+            m_Mapped = nullptr;
+            m_MappedSize = 0;
+            m_Data = nullptr;
+            m_Size = 0;
+            m_NumRecords = 0;
+        }
+#endif
+    }
+
+    bool AddressBookIndex::SetData (const uint8_t * data, size_t len)
+    {
+        m_Data = nullptr; m_Size = 0; m_NumRecords = 0;
+        if (len < ADDRESS_BOOK_INDEX_HEADER_SIZE || memcmp (data, ADDRESS_BOOK_INDEX_MAGIC, ADDRESS_BOOK_INDEX_MAGIC_SIZE))
+        {
+            LogPrint (eLogError, "Address book index ", m_FileName, " is invalid");
+            return false;
+        }
+        size_t numRecords = bufbe32toh (data + ADDRESS_BOOK_INDEX_MAGIC_SIZE);
+        if (numRecords > (len - ADDRESS_BOOK_INDEX_HEADER_SIZE)/ADDRESS_BOOK_INDEX_RECORD_SIZE)
+        {
+            LogPrint (eLogError, "Address book index ", m_FileName, " is truncated");
+            return false;
+        }
+        // names must be within the file, we don't check them on lookup
+        for (size_t i = 0; i < numRecords; i++)
+        {
+            const uint8_t * record = data + ADDRESS_BOOK_INDEX_HEADER_SIZE + i*ADDRESS_BOOK_INDEX_RECORD_SIZE;
+            size_t offset = bufbe32toh (record), nameLen = record[4];
+            if (offset > len || nameLen > len - offset)
+            {
+                LogPrint (eLogError, "Address book index ", m_FileName, " record ", i, " is out of bounds");
+                return false;
+            }
+        }
+        m_Data = data;
+        m_Size = len;
+        m_NumRecords = numRecords;
+        return true;
+    }
+
+    const char * AddressBookIndex::GetName (size_t i, size_t& len) const
+    {
+        const uint8_t * record = m_Data + ADDRESS_BOOK_INDEX_HEADER_SIZE + i*ADDRESS_BOOK_INDEX_RECORD_SIZE;
+        len = record[4];
+        return (const char *)(m_Data + bufbe32toh (record));
+    }
+
+    const i2p::data::IdentHash& AddressBookIndex::GetIdentHash (size_t i) const
+    {
+        return *(const i2p::data::IdentHash *)(m_Data + ADDRESS_BOOK_INDEX_HEADER_SIZE +
+            i*ADDRESS_BOOK_INDEX_RECORD_SIZE + 8);
+    }
+
+    size_t AddressBookIndex::LowerBound (const char * name, size_t len) const
+    {
+        size_t first = 0, count = m_NumRecords;
+        while (count > 0)
+        {
+            size_t step = count/2, i = first + step, l;
+            auto n = GetName (i, l);
+            if (CompareNames (n, l, name, len) < 0)
+            {
+                first = i + 1;
+                count -= step + 1;
+            }
+            else
+                count = step;
+        }
+        return first;
+    }
+
+    bool AddressBookIndex::Find (const char * name, size_t len, i2p::data::IdentHash& ident) const
+    {
+        if (!m_NumRecords || len > ADDRESS_BOOK_MAX_NAME_LENGTH) return false;
+        size_t i = LowerBound (name, len), l;
+        if (i >= m_NumRecords) return false;
+        auto n = GetName (i, l);
+        if (CompareNames (n, l, name, len)) return false;
+        ident = GetIdentHash (i);
+        return true;
+    }
+
+    size_t AddressBookIndex::Merge (Addresses& addresses)
+    {
+        std::vector<uint8_t> image;
+        size_t numChanges = Merge (addresses, image);
+        if (!numChanges) return 0;
+        Replace (image, Write (image));
+        LogPrint (eLogInfo, numChanges, " address book changes merged, ", m_NumRecords, " addresses");
+        return numChanges;
+    }
+
+    size_t AddressBookIndex::Merge (Addresses& addresses, std::vector<uint8_t>& image) const
+    {
+        image.clear ();
+        // normalize, the last one wins for same name
+        for (auto& it: addresses)
+            std::transform (it.first.begin (), it.first.end (), it.first.begin (), ToLower);
+        std::stable_sort (addresses.begin (), addresses.end (),
+            [](const Addresses::value_type& a, const Addresses::value_type& b) { return a.first < b.first; });
+        Addresses updates;
+        updates.reserve (addresses.size ());
+        for (auto& it: addresses)
+        {
+            if (it.first.empty () || it.first.length () > ADDRESS_BOOK_MAX_NAME_LENGTH)
+            {
+                LogPrint (eLogWarning, "Address book name of length ", it.first.length (), " skipped");
+                continue;
+            }
+            if (!updates.empty () && updates.back ().first == it.first)
+                updates.back ().second = it.second;
+            else
+                updates.push_back (it);
+        }
+
+        // merge with current records, both are sorted
+        struct Entry
+        {
+            const char * name;
+            size_t len;
+            const i2p::data::IdentHash * ident;
+        };
+        std::vector<Entry> entries;
+        entries.reserve (m_NumRecords + updates.size ());
+        size_t numChanges = 0, i = 0, namesSize = 0;
+        auto add = [&entries, &namesSize](const char * name, size_t len, const i2p::data::IdentHash * ident)
+        {
+            entries.push_back ({ name, len, ident });
+            namesSize += len;
+        };
+        for (auto& it: updates)
+        {
+            size_t l;
+            const char * n = nullptr;
+            int cmp = -1;
+            while (i < m_NumRecords)
+            {
+                n = GetName (i, l);
+                cmp = CompareNames (n, l, it.first.c_str (), it.first.length ());
+                if (cmp >= 0) break;
+                add (n, l, &GetIdentHash (i));
+                i++;
+            }
+            if (i < m_NumRecords && !cmp)
+            {
+                if (!(GetIdentHash (i) == it.second)) numChanges++;
+                i++;
+            }
+            else
+                numChanges++;
+            add (it.first.c_str (), it.first.length (), &it.second);
+        }
+        if (!numChanges) return 0;
+        for (; i < m_NumRecords; i++)
+        {
+            size_t l;
+            auto n = GetName (i, l);
+            add (n, l, &GetIdentHash (i));
+        }
+
+        // build new image
+        size_t recordsSize = entries.size ()*ADDRESS_BOOK_INDEX_RECORD_SIZE;
+        image.resize (ADDRESS_BOOK_INDEX_HEADER_SIZE + recordsSize + namesSize, 0);
+        memcpy (image.data (), ADDRESS_BOOK_INDEX_MAGIC, ADDRESS_BOOK_INDEX_MAGIC_SIZE);
+        htobe32buf (image.data () + ADDRESS_BOOK_INDEX_MAGIC_SIZE, entries.size ());
+        uint8_t * record = image.data () + ADDRESS_BOOK_INDEX_HEADER_SIZE;
+        size_t offset = ADDRESS_BOOK_INDEX_HEADER_SIZE + recordsSize;
+        for (auto& it: entries)
+        {
+            htobe32buf (record, offset);
+            record[4] = it.len;
+            memcpy (record + 8, *it.ident, 32);
+            memcpy (image.data () + offset, it.name, it.len);
+            offset += it.len;
+            record += ADDRESS_BOOK_INDEX_RECORD_SIZE;
+        }
+        return numChanges;
+    }
+
+    bool AddressBookIndex::Write (const std::vector<uint8_t>& image) const
+    {
+        if (m_FileName.empty ()) return false;
+        // current file stays mapped until Replace
+        bool written = false;
+        std::string tmp = m_FileName + ".tmp";
+        std::ofstream f (tmp.c_str (), std::ofstream::binary | std::ofstream::out | std::ofstream::trunc);
+        if (f.is_open ())
+        {
+            f.write ((const char *)image.data (), image.size ());
+            f.close ();
+            if (f)
+            {
+#ifdef _WIN32
+                remove (m_FileName.c_str ()); // rename doesn't replace existing file, nothing is mapped
+#endif
+                written = !rename (tmp.c_str (), m_FileName.c_str ());
+            }
+        }
+        if (!written)
+            LogPrint (eLogError, "Can't write address book index ", m_FileName);
+        return written;
+    }
+
+    void AddressBookIndex::Replace (std::vector<uint8_t>& image, bool isWritten)
+    {
+        Close ();
+        if (!isWritten || !Map ())
+        {
+            // keep it in memory
+            m_Buffer.swap (image);
+            SetData (m_Buffer.data (), m_Buffer.size ());
+        }
+    }
+}
+}
@@ -0,0 +1,79 @@
+#ifndef ADDRESS_BOOK_INDEX_H__
+#define ADDRESS_BOOK_INDEX_H__
+
+#include <inttypes.h>
+#include <string>
+#include <vector>
+#include <utility>
+#include "Identity.h"
+
+namespace i2p
+{
+namespace client
+{
+    const char ADDRESS_BOOK_INDEX_MAGIC[] = "I2PDABI1"; // without terminating zero
+    const size_t ADDRESS_BOOK_INDEX_MAGIC_SIZE = 8;
+    const size_t ADDRESS_BOOK_INDEX_HEADER_SIZE = 16; // magic, number of records, reserved
+    const size_t ADDRESS_BOOK_INDEX_RECORD_SIZE = 40; // name offset, name length, reserved, ident hash
+    const size_t ADDRESS_BOOK_MAX_NAME_LENGTH = 255;
+
+    /**
+     * Host names sorted in lower case, fixed size records followed by names,
+     * memory-mapped from file, so loading doesn't parse anything.
+     * Changes are merged into new file which replaces the old one.
+     * Merging is split in steps, so lookups have to wait only for Replace
+     */
+    class AddressBookIndex
+    {
+        public:
+
+            typedef std::vector<std::pair<std::string, i2p::data::IdentHash> > Addresses;
+
+            AddressBookIndex ();
+            ~AddressBookIndex ();
+
+            bool Open (const std::string& filename); // false if file is missing or invalid, index is empty then
+            void Close ();
+            // case insensitive, doesn't allocate
+            bool Find (const char * name, size_t len, i2p::data::IdentHash& ident) const;
+            // adds new and replaces changed, file is rewritten only if something has changed
+            size_t Merge (Addresses& addresses); // returns number of changes
+            // steps of Merge, image is left empty if nothing has changed
+            size_t Merge (Addresses& addresses, std::vector<uint8_t>& image) const;
+            bool Write (const std::vector<uint8_t>& image) const; // replaces index file
+            void Replace (std::vector<uint8_t>& image, bool isWritten); // maps written file or keeps image
+            size_t GetNumAddresses () const { return m_NumRecords; };
+
+            template<typename Visitor>
+            void ForEach (Visitor v) const // v (const char * name, size_t len, const IdentHash& ident)
+            {
+                for (size_t i = 0; i < m_NumRecords; i++)
+                {
+                    size_t len;
+                    auto name = GetName (i, len);
+                    v (name, len, GetIdentHash (i));
+                }
+            }
+
+        private:
+
+            bool Map (); // from m_FileName
+            void Unmap ();
+            bool SetData (const uint8_t * data, size_t len); // validates header and records
+            const char * GetName (size_t i, size_t& len) const;
+            const i2p::data::IdentHash& GetIdentHash (size_t i) const;
+            size_t LowerBound (const char * name, size_t len) const;
+
+        private:
+
+            std::string m_FileName;
+            const uint8_t * m_Data;
+            size_t m_Size, m_NumRecords;
+            void * m_Mapped; // region of mmap, if mapped
+            size_t m_MappedSize;
+            std::vector<uint8_t> m_Buffer; // if file can't be mapped or written
+    };
+}
+}
+
+#endif
@@ -1,8 +1,9 @@
 #include <string.h>
 #include <vector>
 #include <cryptopp/sha.h>
-#include <cryptopp/gzip.h>
 #include "util/Log.h"
+#include "util/Metrics.h"
+#include "util/Compression.h"
 #include "tunnel/TunnelBase.h"
 #include "RouterContext.h"
 #include "Destination.h"
@@ -13,61 +14,170 @@ namespace i2p
 namespace datagram
 {
     DatagramDestination::DatagramDestination (i2p::client::ClientDestination& owner): 
-        m_Owner (owner), m_Receiver (nullptr)
+        m_Owner (owner), m_Receiver (nullptr), m_IsRunning (true), m_Thread (nullptr)
     {
+        m_Thread = new std::thread (std::bind (&DatagramDestination::Run, this));
+    }
+
+    DatagramDestination::~DatagramDestination ()
+    {
+        {
+            std::unique_lock<std::mutex> l(m_OutgoingMutex);
+            m_IsRunning = false;
+            m_OutgoingCondition.notify_all ();
+        }
+        if (m_Thread)
+        {
+            m_Thread->join ();
+            delete m_Thread;
+            m_Thread = nullptr;
+        }
     }
         
+    size_t DatagramDestination::GetMaxPayloadSize () const
+    {
+        auto& identity = m_Owner.GetIdentity ();
+        return MAX_DATAGRAM_SIZE - identity.GetFullLen () - identity.GetSignatureLen ();
+    }
+
     void DatagramDestination::SendDatagramTo (const uint8_t * payload, size_t len, const i2p::data::IdentHash& ident, uint16_t fromPort, uint16_t toPort)
     {
-        uint8_t buf[MAX_DATAGRAM_SIZE];
-        auto identityLen = m_Owner.GetIdentity ().ToBuffer (buf, MAX_DATAGRAM_SIZE);
+        if (len > GetMaxPayloadSize ())
+        {
+            LogPrint (eLogWarning, "Datagram size ", len, " exceeds max size");
+            return;
+        }
+        std::unique_lock<std::mutex> l(m_OutgoingMutex);
+        if (m_Outgoing.size () >= DATAGRAM_MAX_QUEUE_SIZE)
+        {
+            static auto& numDropped = i2p::util::metrics.GetCounter ("i2pd_datagrams_dropped_total",
+                "Outgoing datagrams dropped because of full send queue");
+            numDropped.Inc ();
+            LogPrint (eLogWarning, "Datagram send queue is full. Dropped");
+            return;
+        }
+        m_Outgoing.push_back ({ ident, fromPort, toPort, std::vector<uint8_t>(payload, payload + len) });
+        m_OutgoingCondition.notify_one ();
+    }
+
+    void DatagramDestination::Run ()
+    {
+        std::vector<OutgoingDatagram> outgoing;
+        while (true)
+        {
+            outgoing.clear ();
+            {
+                std::unique_lock<std::mutex> l(m_OutgoingMutex);
+                while (m_IsRunning && m_Outgoing.empty ())
+                    m_OutgoingCondition.wait (l);
+                if (!m_IsRunning) break;
+                std::swap (outgoing, m_Outgoing); // take whole batch
+            }
+            // group by remote, keeping order for each
+            std::map<i2p::data::IdentHash, DataMessages> msgs;
+            for (auto& it: outgoing)
+            {
+                try
+                {
+                    auto msg = SignAndCompress (it);
+                    if (msg) msgs[it.ident].push_back (msg);
+                }
+                catch (std::exception& ex)
+                {
+                    LogPrint (eLogError, "Datagram signing error: ", ex.what ());
+                }
+            }
+            for (auto& it: msgs)
+                m_Owner.GetService ().post (std::bind (&DatagramDestination::SendDataMessages, this, it.first, it.second));
+        }
+    }
+
+    std::shared_ptr<I2NPMessage> DatagramDestination::SignAndCompress (const OutgoingDatagram& datagram)
+    {
+        uint8_t buf[MAX_DATAGRAM_SIZE]; // including identity and signature
+        auto identityLen = m_Owner.GetIdentity ().ToBuffer (buf, sizeof (buf));
         uint8_t * signature = buf + identityLen;
         auto signatureLen = m_Owner.GetIdentity ().GetSignatureLen ();
         uint8_t * buf1 = signature + signatureLen;
         size_t headerLen = identityLen + signatureLen;
+        size_t len = datagram.payload.size ();
+        if (headerLen + len > sizeof (buf)) return nullptr;
         
-        memcpy (buf1, payload, len);    
+        memcpy (buf1, datagram.payload.data (), len);   
         if (m_Owner.GetIdentity ().GetSigningKeyType () == i2p::data::SIGNING_KEY_TYPE_DSA_SHA1)
         {
             uint8_t hash[32];   
             CryptoPP::SHA256().CalculateDigest (hash, buf1, len);
-            m_Owner.Sign (hash, 32, signature);
+            m_Owner.GetPrivateKeys ().Sign (m_Rnd, hash, 32, signature);
         }
         else
-            m_Owner.Sign (buf1, len, signature);
+            m_Owner.GetPrivateKeys ().Sign (m_Rnd, buf1, len, signature);
+
+        int level = i2p::util::GZIP_STORED_LEVEL;
+        if (len > DATAGRAM_COMPRESSION_THRESHOLD_SIZE && m_Owner.IsGzip ())
+            level = i2p::util::GetGzipLevel (buf1, len, DATAGRAM_DEFLATE_LEVEL); // identity and signature don't compress
+        return CreateDataMessage (buf, len + headerLen, level, datagram.fromPort, datagram.toPort); 
+    }
 
-        auto msg = CreateDataMessage (buf, len + headerLen, fromPort, toPort); 
+    void DatagramDestination::SendDataMessages (const i2p::data::IdentHash& ident, DataMessages msgs)
+    {
         auto remote = m_Owner.FindLeaseSet (ident);
         if (remote)
-            m_Owner.GetService ().post (std::bind (&DatagramDestination::SendMsg, this, msg, remote));
+            SendMsgs (msgs, remote);
         else
-            m_Owner.RequestDestination (ident, std::bind (&DatagramDestination::HandleLeaseSetRequestComplete, this, std::placeholders::_1, msg));
+            m_Owner.RequestDestination (ident, std::bind (&DatagramDestination::HandleLeaseSetRequestComplete, 
+                this, std::placeholders::_1, msgs));
     }
 
-    void DatagramDestination::HandleLeaseSetRequestComplete (std::shared_ptr<i2p::data::LeaseSet> remote, I2NPMessage * msg)
+    void DatagramDestination::HandleLeaseSetRequestComplete (std::shared_ptr<i2p::data::LeaseSet> remote, DataMessages msgs)
     {
         if (remote)
-            SendMsg (msg, remote);
-        else
-            DeleteI2NPMessage (msg);
+            SendMsgs (msgs, remote);
     }   
         
-    void DatagramDestination::SendMsg (I2NPMessage * msg, std::shared_ptr<const i2p::data::LeaseSet> remote)
+    void DatagramDestination::SendMsgs (DataMessages msgs, std::shared_ptr<const i2p::data::LeaseSet> remote)
     {
         auto outboundTunnel = m_Owner.GetTunnelPool ()->GetNextOutboundTunnel ();
         auto leases = remote->GetNonExpiredLeases ();
         if (!leases.empty () && outboundTunnel)
         {
-            std::vector<i2p::tunnel::TunnelMessageBlock> msgs;          
+            static auto& numSent = i2p::util::metrics.GetCounter ("i2pd_datagrams_sent_total",
+                "Outgoing datagrams");
+            static auto& numGarlic = i2p::util::metrics.GetCounter ("i2pd_datagram_garlic_messages_total",
+                "Garlic messages carrying outgoing datagrams");
+            std::vector<i2p::tunnel::TunnelMessageBlock> blocks;
             uint32_t i = i2p::context.GetRandomNumberGenerator ().GenerateWord32 (0, leases.size () - 1);
-            auto garlic = m_Owner.WrapMessage (remote, ToSharedI2NPMessage (msg), true);
-            msgs.push_back (i2p::tunnel::TunnelMessageBlock 
-                { 
-                    i2p::tunnel::eDeliveryTypeTunnel,
-                    leases[i].tunnelGateway, leases[i].tunnelID,
-                    garlic
-                });
-            outboundTunnel->SendTunnelDataMsg (msgs);
+            // pack consecutive datagrams into one garlic message as long as it stays small
+            DataMessages packed;
+            size_t packedSize = 0;
+            for (size_t j = 0; j < msgs.size (); j++)
+            {
+                packed.push_back (msgs[j]);
+                packedSize += msgs[j]->GetLength ();
+                bool isLast = j + 1 >= msgs.size ();
+                if (isLast || packed.size () >= DATAGRAM_MAX_NUM_PACKED ||
+                    packedSize + msgs[j + 1]->GetLength () > DATAGRAM_MAX_PACKED_SIZE)
+                {
+                    auto garlic = m_Owner.WrapMessages (remote, packed, true);
+                    if (garlic)
+                    {
+                        blocks.push_back (i2p::tunnel::TunnelMessageBlock 
+                            { 
+                                i2p::tunnel::eDeliveryTypeTunnel,
+                                leases[i].tunnelGateway, leases[i].tunnelID,
+                                garlic
+                            });
+                        numGarlic.Inc ();
+                        numSent.Inc (packed.size ());
+                    }
+                    else
+                        LogPrint (eLogWarning, "Failed to wrap ", packed.size (), " datagrams. Dropped");
+                    packed.clear ();
+                    packedSize = 0;
+                }
+            }
+            if (!blocks.empty ())
+                outboundTunnel->SendTunnelDataMsg (blocks);
         }
         else
         {
@@ -75,7 +185,6 @@ namespace datagram
                 LogPrint (eLogWarning, "Failed to send datagram. All leases expired");
             else
                 LogPrint (eLogWarning, "Failed to send datagram. No outbound tunnels");
-            DeleteI2NPMessage (msg);    
         }   
     }
 
@@ -113,32 +222,30 @@ namespace datagram
     void DatagramDestination::HandleDataMessagePayload (uint16_t fromPort, uint16_t toPort, const uint8_t * buf, size_t len)
     {
         // unzip it
-        CryptoPP::Gunzip decompressor;
-        decompressor.Put (buf, len);
-        decompressor.MessageEnd();
         uint8_t uncompressed[MAX_DATAGRAM_SIZE];
-        auto uncompressedLen = decompressor.MaxRetrievable ();
-        if (uncompressedLen <= MAX_DATAGRAM_SIZE)
-        {
-            decompressor.Get (uncompressed, uncompressedLen);
+        auto uncompressedLen = i2p::util::GzipDecompress (buf, len, uncompressed, MAX_DATAGRAM_SIZE);
+        if (uncompressedLen)
             HandleDatagram (fromPort, toPort, uncompressed, uncompressedLen); 
-        }
         else
-            LogPrint ("Received datagram size ", uncompressedLen,  " exceeds max size");
-
+            LogPrint ("Received datagram is invalid or exceeds max size");
     }
 
-    I2NPMessage * DatagramDestination::CreateDataMessage (const uint8_t * payload, size_t len, uint16_t fromPort, uint16_t toPort)
+    std::shared_ptr<I2NPMessage> DatagramDestination::CreateDataMessage (const uint8_t * payload, size_t len, int level,
+        uint16_t fromPort, uint16_t toPort)
     {
-        I2NPMessage * msg = NewI2NPMessage ();
-        CryptoPP::Gzip compressor; // default level
-        compressor.Put (payload, len);
-        compressor.MessageEnd();
-        int size = compressor.MaxRetrievable ();
+        auto msg = ToSharedI2NPMessage (NewI2NPMessage ());
         uint8_t * buf = msg->GetPayload ();
+        size_t size = i2p::util::GzipCompress (payload, len, buf + 4, msg->maxLen - msg->len - 4, level);
+        if (level != i2p::util::GZIP_STORED_LEVEL && (!size || size >= len))
+            // output is stored if it doesn't get smaller, cheaper for receiver to inflate
+            size = i2p::util::GzipCompress (payload, len, buf + 4, msg->maxLen - msg->len - 4, i2p::util::GZIP_STORED_LEVEL);
+        if (!size)
+        {
+            LogPrint (eLogWarning, "Datagram is too long");
+            return nullptr;
+        }
         htobe32buf (buf, size); // length
         buf += 4;
-        compressor.Get (buf, size);
         htobe16buf (buf + 4, fromPort); // source port
         htobe16buf (buf + 6, toPort); // destination port 
         buf[9] = i2p::client::PROTOCOL_TYPE_DATAGRAM; // datagram protocol
@@ -5,6 +5,11 @@
 #include <memory>
 #include <functional>
 #include <map>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cryptopp/osrng.h>
 #include "Identity.h"
 #include "LeaseSet.h"
 #include "I2NPProtocol.h"
@@ -18,6 +23,16 @@ namespace client
 namespace datagram
 {
     const size_t MAX_DATAGRAM_SIZE = 32768;
+    const size_t DATAGRAM_COMPRESSION_THRESHOLD_SIZE = 66; // smaller payloads are stored uncompressed
+    const int DATAGRAM_DEFLATE_LEVEL = 1; // fastest
+    const size_t DATAGRAM_MAX_QUEUE_SIZE = 1024; // pending datagrams, new are dropped if exceeded
+    const size_t DATAGRAM_MAX_PACKED_SIZE = 4096; // of data messages packed into one garlic message
+    const size_t DATAGRAM_MAX_NUM_PACKED = 16; // data messages in one garlic message
+
+    /**
+     * Outgoing datagrams are queued and signed and compressed by a worker thread in batches,
+     * then sent from destination's thread grouped by remote, several datagrams per garlic message
+     */
     class DatagramDestination
     {
         typedef std::function<void (const i2p::data::IdentityEx& from, uint16_t fromPort, uint16_t toPort, const uint8_t * buf, size_t len)> Receiver;
@@ -25,9 +40,10 @@ namespace datagram
         public:
 
             DatagramDestination (i2p::client::ClientDestination& owner);
-            ~DatagramDestination () {};             
+            ~DatagramDestination ();                
 
             void SendDatagramTo (const uint8_t * payload, size_t len, const i2p::data::IdentHash& ident, uint16_t fromPort = 0, uint16_t toPort = 0);
+            size_t GetMaxPayloadSize () const; // receivers accept MAX_DATAGRAM_SIZE including our identity and signature
             void HandleDataMessagePayload (uint16_t fromPort, uint16_t toPort, const uint8_t * buf, size_t len);
 
             void SetReceiver (const Receiver& receiver) { m_Receiver = receiver; };
@@ -38,10 +54,23 @@ namespace datagram
 
         private:
 
-            void HandleLeaseSetRequestComplete (std::shared_ptr<i2p::data::LeaseSet> leaseSet, I2NPMessage * msg);
+            struct OutgoingDatagram
+            {
+                i2p::data::IdentHash ident;
+                uint16_t fromPort, toPort;
+                std::vector<uint8_t> payload;
+            };
+            typedef std::vector<std::shared_ptr<const I2NPMessage> > DataMessages;
+
+            void Run ();
+            std::shared_ptr<I2NPMessage> SignAndCompress (const OutgoingDatagram& datagram); // worker thread
+
+            void SendDataMessages (const i2p::data::IdentHash& ident, DataMessages msgs);
+            void HandleLeaseSetRequestComplete (std::shared_ptr<i2p::data::LeaseSet> leaseSet, DataMessages msgs);
             
-            I2NPMessage * CreateDataMessage (const uint8_t * payload, size_t len, uint16_t fromPort, uint16_t toPort);
-            void SendMsg (I2NPMessage * msg, std::shared_ptr<const i2p::data::LeaseSet> remote);
+            std::shared_ptr<I2NPMessage> CreateDataMessage (const uint8_t * payload, size_t len, int level,
+                uint16_t fromPort, uint16_t toPort);
+            void SendMsgs (DataMessages msgs, std::shared_ptr<const i2p::data::LeaseSet> remote);
             void HandleDatagram (uint16_t fromPort, uint16_t toPort, const uint8_t * buf, size_t len);
 
         private:
@@ -49,6 +78,13 @@ namespace datagram
             i2p::client::ClientDestination& m_Owner;
             Receiver m_Receiver; // default
             std::map<uint16_t, Receiver> m_ReceiversByPorts;
+
+            bool m_IsRunning;
+            std::thread * m_Thread;
+            std::mutex m_OutgoingMutex;
+            std::condition_variable m_OutgoingCondition;
+            std::vector<OutgoingDatagram> m_Outgoing;
+            CryptoPP::AutoSeededRandomPool m_Rnd; // used by worker thread only
     };      
 }
 }
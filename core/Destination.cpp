@@ -16,14 +16,19 @@ namespace client
     ClientDestination::ClientDestination (const i2p::data::PrivateKeys& keys, bool isPublic, 
             const std::map<std::string, std::string> * params):
         m_IsRunning (false), m_Thread (nullptr), m_Work (m_Service),    
-        m_Keys (keys), m_IsPublic (isPublic), m_PublishReplyToken (0),
-        m_DatagramDestination (nullptr), m_PublishConfirmationTimer (m_Service), m_CleanupTimer (m_Service)
+        m_Keys (keys),
+        m_IsPublic (isPublic), m_PublishReplyToken (0),
+        m_StreamingSendBufferSize (i2p::stream::STREAM_DEFAULT_SEND_BUFFER_SIZE), m_IsGzip (true),
+        m_SendQueueSize (0), m_DatagramDestination (nullptr), m_PublishConfirmationTimer (m_Service), m_CleanupTimer (m_Service),
+        m_LeaseSetRefreshTimer (m_Service)
     {
         i2p::crypto::GenerateElGamalKeyPair(i2p::context.GetRandomNumberGenerator (), m_EncryptionPrivateKey, m_EncryptionPublicKey);
         int inboundTunnelLen = DEFAULT_INBOUND_TUNNEL_LENGTH;
         int outboundTunnelLen = DEFAULT_OUTBOUND_TUNNEL_LENGTH;
         int inboundTunnelsQuantity = DEFAULT_INBOUND_TUNNELS_QUANTITY;
         int outboundTunnelsQuantity = DEFAULT_OUTBOUND_TUNNELS_QUANTITY;
+        int minInboundTunnels = 0, maxInboundTunnels = 0, minOutboundTunnels = 0, maxOutboundTunnels = 0; // 0 means quantity
+        int maxPendingInboundBuilds = 0, maxPendingOutboundBuilds = 0; // 0 means default
         std::shared_ptr<std::vector<i2p::data::IdentHash> > explicitPeers;
         if (params)
         {
@@ -67,6 +72,21 @@ namespace client
                     LogPrint (eLogInfo, "Outbound tunnels quantity set to ", quantity);
                 }   
             }
+            auto readQuantity = [params](const char * param, int& quantity)
+            {
+                auto it = params->find (param);
+                if (it != params->end ())
+                {
+                    int q = boost::lexical_cast<int>(it->second);
+                    if (q > 0) quantity = q;
+                }
+            };
+            readQuantity (I2CP_PARAM_INBOUND_TUNNELS_MIN_QUANTITY, minInboundTunnels);
+            readQuantity (I2CP_PARAM_INBOUND_TUNNELS_MAX_QUANTITY, maxInboundTunnels);
+            readQuantity (I2CP_PARAM_OUTBOUND_TUNNELS_MIN_QUANTITY, minOutboundTunnels);
+            readQuantity (I2CP_PARAM_OUTBOUND_TUNNELS_MAX_QUANTITY, maxOutboundTunnels);
+            readQuantity (I2CP_PARAM_INBOUND_MAX_PENDING_BUILDS, maxPendingInboundBuilds);
+            readQuantity (I2CP_PARAM_OUTBOUND_MAX_PENDING_BUILDS, maxPendingOutboundBuilds);
             it = params->find (I2CP_PARAM_EXPLICIT_PEERS);
             if (it != params->end ())
             {
@@ -81,13 +101,40 @@ namespace client
                 }
                 LogPrint (eLogInfo, "Explicit peers set to ", it->second);
             }
+            it = params->find (I2CP_PARAM_STREAMING_SEND_BUFFER_SIZE);
+            if (it != params->end ())
+            {
+                int size = boost::lexical_cast<int>(it->second);
+                if (size > 0)
+                {
+                    m_StreamingSendBufferSize = size;
+                    LogPrint (eLogInfo, "Stream send buffer size set to ", size);
+                }
+            }
+            it = params->find (I2CP_PARAM_GZIP);
+            if (it != params->end ())
+            {
+                m_IsGzip = it->second != "false";
+                LogPrint (eLogInfo, "Gzip compression ", m_IsGzip ? "enabled" : "disabled");
+            }
         }   
         m_Pool = i2p::tunnel::tunnels.CreateTunnelPool (this, inboundTunnelLen, outboundTunnelLen, inboundTunnelsQuantity, outboundTunnelsQuantity);  
+        m_Pool->SetMaxPendingBuilds (maxPendingInboundBuilds, maxPendingOutboundBuilds);
         if (explicitPeers)
             m_Pool->SetExplicitPeers (explicitPeers);
+        else if (minInboundTunnels || maxInboundTunnels || minOutboundTunnels || maxOutboundTunnels)
+        {
+            if (!minInboundTunnels) minInboundTunnels = std::min (inboundTunnelsQuantity, maxInboundTunnels ? maxInboundTunnels : inboundTunnelsQuantity);
+            if (!maxInboundTunnels) maxInboundTunnels = std::max (inboundTunnelsQuantity, minInboundTunnels);
+            if (!minOutboundTunnels) minOutboundTunnels = std::min (outboundTunnelsQuantity, maxOutboundTunnels ? maxOutboundTunnels : outboundTunnelsQuantity);
+            if (!maxOutboundTunnels) maxOutboundTunnels = std::max (outboundTunnelsQuantity, minOutboundTunnels);
+            m_Pool->SetQuantityRange (minInboundTunnels, std::max (minInboundTunnels, maxInboundTunnels),
+                minOutboundTunnels, std::max (minOutboundTunnels, maxOutboundTunnels));
+        }
         if (m_IsPublic)
             LogPrint (eLogInfo, "Local address ", i2p::client::GetB32Address(GetIdentHash()), " created");
         m_StreamingDestination = std::make_shared<i2p::stream::StreamingDestination> (*this); // TODO:
+        m_StreamingDestination->SetMaxSendBufferSize (m_StreamingSendBufferSize);
     }
 
     ClientDestination::~ClientDestination ()
@@ -132,6 +179,7 @@ namespace client
             m_CleanupTimer.expires_from_now (boost::posix_time::minutes (DESTINATION_CLEANUP_TIMEOUT));
             m_CleanupTimer.async_wait (std::bind (&ClientDestination::HandleCleanupTimer,
                 this, std::placeholders::_1));
+            ScheduleLeaseSetRefresh ();
         }   
     }
         
@@ -140,16 +188,11 @@ namespace client
         if (m_IsRunning)
         {   
             m_CleanupTimer.cancel ();
+            m_LeaseSetRefreshTimer.cancel ();
             m_IsRunning = false;
             m_StreamingDestination->Stop ();    
             for (auto it: m_StreamingDestinationsByPorts)
                 it.second->Stop ();
-            if (m_DatagramDestination)
-            {
-                auto d = m_DatagramDestination;
-                m_DatagramDestination = nullptr;
-                delete d;
-            }   
             if (m_Pool)
             {   
                 m_Pool->SetLocalDestination (nullptr);
@@ -162,29 +205,28 @@ namespace client
                 delete m_Thread;
                 m_Thread = 0;
             }   
+            // handlers posted by datagram worker can't run anymore
+            if (m_DatagramDestination)
+            {
+                auto d = m_DatagramDestination;
+                m_DatagramDestination = nullptr;
+                delete d;
+            }   
         }   
     }   
 
     std::shared_ptr<const i2p::data::LeaseSet> ClientDestination::FindLeaseSet (const i2p::data::IdentHash& ident)
     {
-        auto it = m_RemoteLeaseSets.find (ident);
-        if (it != m_RemoteLeaseSets.end ())
+        auto leaseSet = m_RemoteLeaseSets.Get (ident);
+        if (!leaseSet)
         {   
-            if (it->second->HasNonExpiredLeases ())
-                return it->second;
+            leaseSet = i2p::data::netdb.FindLeaseSet (ident);
+            if (leaseSet && leaseSet->HasNonExpiredLeases ())
+                m_RemoteLeaseSets.Put (leaseSet);
             else
-                LogPrint ("All leases of remote LeaseSet expired");
-        }   
-        else
-        {   
-            auto ls = i2p::data::netdb.FindLeaseSet (ident);
-            if (ls)
-            {
-                m_RemoteLeaseSets[ident] = ls;          
-                return ls;
-            }   
+                leaseSet = nullptr;
         }
-        return nullptr;
+        return leaseSet;
     }   
 
     std::shared_ptr<const i2p::data::LeaseSet> ClientDestination::GetLeaseSet ()
@@ -261,34 +303,20 @@ namespace client
         if (buf[DATABASE_STORE_TYPE_OFFSET] == 1) // LeaseSet
         {
             LogPrint (eLogDebug, "Remote LeaseSet");
-            auto it = m_RemoteLeaseSets.find (buf + DATABASE_STORE_KEY_OFFSET);
-            if (it != m_RemoteLeaseSets.end ())
+            // streams and other threads might hold previous one, so it's replaced rather than updated
+            leaseSet = std::make_shared<i2p::data::LeaseSet> (buf + offset, len - offset);
+            if (leaseSet->IsValid () && leaseSet->GetIdentHash () == i2p::data::IdentHash (buf + DATABASE_STORE_KEY_OFFSET))
             {
-                leaseSet = it->second;
-                leaseSet->Update (buf + offset, len - offset); 
-                if (leaseSet->IsValid ())
-                    LogPrint (eLogDebug, "Remote LeaseSet updated");
+                if (m_RemoteLeaseSets.Put (leaseSet))
+                    LogPrint (eLogDebug, "Remote LeaseSet added");
                 else
-                {
-                    LogPrint (eLogDebug, "Remote LeaseSet update failed");
-                    m_RemoteLeaseSets.erase (it);
-                    leaseSet = nullptr;
-                }
+                    LogPrint (eLogDebug, "Remote LeaseSet is older than cached. Cached one is used");
             }
             else
-            {   
-                leaseSet = std::make_shared<i2p::data::LeaseSet> (buf + offset, len - offset);
-                if (leaseSet->IsValid ())
-                {
-                    LogPrint (eLogDebug, "New remote LeaseSet added");
-                    m_RemoteLeaseSets[buf + DATABASE_STORE_KEY_OFFSET] = leaseSet;
-                }
-                else
-                {
-                    LogPrint (eLogError, "New remote LeaseSet verification failed");
-                    leaseSet = nullptr;
-                }
-            }   
+            {
+                LogPrint (eLogError, "Remote LeaseSet verification failed");
+                leaseSet = nullptr;
+            }
         }   
         else
             LogPrint (eLogError, "Unexpected client's DatabaseStore type ", buf[DATABASE_STORE_TYPE_OFFSET], ". Dropped");
@@ -508,6 +536,7 @@ namespace client
     std::shared_ptr<i2p::stream::StreamingDestination> ClientDestination::CreateStreamingDestination (int port)
     {
         auto dest = std::make_shared<i2p::stream::StreamingDestination> (*this, port); 
+        dest->SetMaxSendBufferSize (m_StreamingSendBufferSize);
         if (port)
             m_StreamingDestinationsByPorts[port] = dest;
         else // update default 
@@ -644,6 +673,9 @@ namespace client
         {
             CleanupRoutingSessions ();
             CleanupRemoteLeaseSets ();
+            m_StreamingDestination->CleanupRemoteLeases ();
+            for (auto it: m_StreamingDestinationsByPorts)
+                it.second->CleanupRemoteLeases ();
             m_CleanupTimer.expires_from_now (boost::posix_time::minutes (DESTINATION_CLEANUP_TIMEOUT));
             m_CleanupTimer.async_wait (std::bind (&ClientDestination::HandleCleanupTimer,
                 this, std::placeholders::_1));
@@ -652,15 +684,37 @@ namespace client
 
     void ClientDestination::CleanupRemoteLeaseSets ()
     {
-        for (auto it = m_RemoteLeaseSets.begin (); it != m_RemoteLeaseSets.end ();)
+        m_RemoteLeaseSets.Cleanup ();
+    }
+
+    void ClientDestination::ScheduleLeaseSetRefresh ()
+    {
+        m_LeaseSetRefreshTimer.expires_from_now (boost::posix_time::seconds (LEASESET_REFRESH_CHECK_INTERVAL));
+        m_LeaseSetRefreshTimer.async_wait (std::bind (&ClientDestination::HandleLeaseSetRefreshTimer,
+            this, std::placeholders::_1));
+    }
+
+    void ClientDestination::HandleLeaseSetRefreshTimer (const boost::system::error_code& ecode)
+    {
+        if (ecode != boost::asio::error::operation_aborted)
         {
-            if (!it->second->HasNonExpiredLeases ()) // all leases expired
+            m_RemoteLeaseSets.Cleanup ();
+            // request LeaseSets of active peers before their leases expire, so streams don't stall
+            if (IsReady ())
             {
-                LogPrint ("Remote LeaseSet ", it->second->GetIdentHash ().ToBase64 (), " expired");
-                it = m_RemoteLeaseSets.erase (it);
-            }   
-            else 
-                it++;
+                for (auto& ident: m_RemoteLeaseSets.GetLeaseSetsToRefresh ())
+                {
+                    if (m_LeaseSetRequests.count (ident)) continue; // requested already
+                    LogPrint (eLogDebug, "Refreshing remote LeaseSet ", ident.ToBase64 ());
+                    auto ts = i2p::util::GetMillisecondsSinceEpoch ();
+                    RequestLeaseSet (ident, [this, ts](std::shared_ptr<i2p::data::LeaseSet> leaseSet)
+                        {
+                            if (leaseSet)
+                                m_RemoteLeaseSets.RefreshCompleted (i2p::util::GetMillisecondsSinceEpoch () - ts);
+                        });
+                }
+            }
+            ScheduleLeaseSetRefresh ();
         }
     }
 }
@@ -3,6 +3,7 @@
 
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <memory>
 #include <map>
 #include <set>
@@ -13,6 +14,7 @@
 #include "tunnel/TunnelPool.h"
 #include "crypto/CryptoConst.h"
 #include "LeaseSet.h"
+#include "LeaseSetCache.h"
 #include "Garlic.h"
 #include "NetworkDatabase.h"
 #include "Streaming.h"
@@ -40,7 +42,17 @@ namespace client
     const int DEFAULT_INBOUND_TUNNELS_QUANTITY = 5;
     const char I2CP_PARAM_OUTBOUND_TUNNELS_QUANTITY[] = "outbound.quantity";
     const int DEFAULT_OUTBOUND_TUNNELS_QUANTITY = 5;
+    // adaptive quantity, tunnels are added or dropped by traffic within [min, max]
+    const char I2CP_PARAM_INBOUND_TUNNELS_MIN_QUANTITY[] = "inbound.minQuantity";
+    const char I2CP_PARAM_INBOUND_TUNNELS_MAX_QUANTITY[] = "inbound.maxQuantity";
+    const char I2CP_PARAM_OUTBOUND_TUNNELS_MIN_QUANTITY[] = "outbound.minQuantity";
+    const char I2CP_PARAM_OUTBOUND_TUNNELS_MAX_QUANTITY[] = "outbound.maxQuantity";
+    // speculative tunnel builds in flight
+    const char I2CP_PARAM_INBOUND_MAX_PENDING_BUILDS[] = "inbound.maxPendingBuilds";
+    const char I2CP_PARAM_OUTBOUND_MAX_PENDING_BUILDS[] = "outbound.maxPendingBuilds";
     const char I2CP_PARAM_EXPLICIT_PEERS[] = "explicitPeers";
+    const char I2CP_PARAM_STREAMING_SEND_BUFFER_SIZE[] = "i2p.streaming.sendBufferSize"; // in bytes, per stream
+    const char I2CP_PARAM_GZIP[] = "i2cp.gzip"; // false to send streams and datagrams uncompressed
     const int STREAM_REQUEST_TIMEOUT = 60; //in seconds
 
     typedef std::function<void (std::shared_ptr<i2p::stream::Stream> stream)> StreamRequestComplete;
@@ -87,6 +99,9 @@ namespace client
             i2p::datagram::DatagramDestination * GetDatagramDestination () const { return m_DatagramDestination; };
             i2p::datagram::DatagramDestination * CreateDatagramDestination ();
 
+            // compression of outgoing streaming and datagram payloads
+            bool IsGzip () const { return m_IsGzip; };
+
             // implements LocalDestination
             const i2p::data::PrivateKeys& GetPrivateKeys () const { return m_Keys; };
             const uint8_t * GetEncryptionPrivateKey () const { return m_EncryptionPrivateKey; };
@@ -102,6 +117,8 @@ namespace client
             void ProcessGarlicMessage (std::shared_ptr<I2NPMessage> msg);
             void ProcessDeliveryStatusMessage (std::shared_ptr<I2NPMessage> msg);   
             void SetLeaseSetUpdated ();
+            size_t GetSendQueueSize () const { return m_SendQueueSize; };
+            void SendQueueChanged (int64_t n) { m_SendQueueSize += n; }; // by streams
 
             // I2CP
             void HandleDataMessage (const uint8_t * buf, size_t len);
@@ -121,6 +138,8 @@ namespace client
             void HandleRequestTimoutTimer (const boost::system::error_code& ecode, const i2p::data::IdentHash& dest);
             void HandleCleanupTimer (const boost::system::error_code& ecode);
             void CleanupRemoteLeaseSets ();
+            void ScheduleLeaseSetRefresh ();
+            void HandleLeaseSetRefreshTimer (const boost::system::error_code& ecode);
             
         private:
 
@@ -130,7 +149,7 @@ namespace client
             boost::asio::io_service::work m_Work;
             i2p::data::PrivateKeys m_Keys;
             uint8_t m_EncryptionPublicKey[256], m_EncryptionPrivateKey[256];
-            std::map<i2p::data::IdentHash, std::shared_ptr<i2p::data::LeaseSet> > m_RemoteLeaseSets;
+            LeaseSetCache m_RemoteLeaseSets;
             std::map<i2p::data::IdentHash, LeaseSetRequest *> m_LeaseSetRequests;
 
             std::shared_ptr<i2p::tunnel::TunnelPool> m_Pool;
@@ -141,14 +160,17 @@ namespace client
             
             std::shared_ptr<i2p::stream::StreamingDestination> m_StreamingDestination; // default
             std::map<uint16_t, std::shared_ptr<i2p::stream::StreamingDestination> > m_StreamingDestinationsByPorts;
+            size_t m_StreamingSendBufferSize;
+            bool m_IsGzip;
+            std::atomic<int64_t> m_SendQueueSize; // bytes of unacknowledged packets of all streams, read by tunnels thread
             i2p::datagram::DatagramDestination * m_DatagramDestination;
     
-            boost::asio::deadline_timer m_PublishConfirmationTimer, m_CleanupTimer;
+            boost::asio::deadline_timer m_PublishConfirmationTimer, m_CleanupTimer, m_LeaseSetRefreshTimer;
 
         public:
             
             // for HTTP only
-            int GetNumRemoteLeaseSets () const { return m_RemoteLeaseSets.size (); };
+            int GetNumRemoteLeaseSets () const { return m_RemoteLeaseSets.GetSize (); };
     };  
 }   
 }   
@@ -2,11 +2,13 @@
 #include "util/I2PEndian.h"
 #include <map>
 #include <string>
+#include <chrono>
 #include "RouterContext.h"
 #include "I2NPProtocol.h"
 #include "tunnel/Tunnel.h"
 #include "tunnel/TunnelPool.h"
 #include "util/Timestamp.h"
+#include "util/Metrics.h"
 #include "Destination.h"
 #include "Garlic.h"
 
@@ -108,6 +110,13 @@ namespace garlic
     }
 
     std::shared_ptr<I2NPMessage> GarlicRoutingSession::WrapSingleMessage (std::shared_ptr<const I2NPMessage> msg)
+    {
+        std::vector<std::shared_ptr<const I2NPMessage> > msgs;
+        if (msg) msgs.push_back (msg);
+        return WrapMessages (msgs);
+    }
+
+    std::shared_ptr<I2NPMessage> GarlicRoutingSession::WrapMessages (const std::vector<std::shared_ptr<const I2NPMessage> >& msgs)
     {
         auto m = ToSharedI2NPMessage(NewI2NPMessage ());
         m->Align (12); // in order to get buf aligned to 16 (12 + 4)
@@ -164,14 +173,14 @@ namespace garlic
             len += 32;      
         }   
         // AES block
-        len += CreateAESBlock (buf, msg);
+        len += CreateAESBlock (buf, msgs);
         htobe32buf (m->GetPayload (), len);
         m->len += len + 4;
         m->FillI2NPMessageHeader (eI2NPGarlic);
         return m;
     }   
 
-    size_t GarlicRoutingSession::CreateAESBlock (uint8_t * buf, std::shared_ptr<const I2NPMessage> msg)
+    size_t GarlicRoutingSession::CreateAESBlock (uint8_t * buf, const std::vector<std::shared_ptr<const I2NPMessage> >& msgs)
     {
         size_t blockSize = 0;
         bool createNewTags = m_Owner && m_NumTags && ((int)m_SessionTags.size () <= m_NumTags*2/3);
@@ -192,7 +201,7 @@ namespace garlic
         blockSize += 32;
         buf[blockSize] = 0; // flag
         blockSize++;
-        size_t len = CreateGarlicPayload (buf + blockSize, msg, newTags);
+        size_t len = CreateGarlicPayload (buf + blockSize, msgs, newTags);
         htobe32buf (payloadSize, len);
         CryptoPP::SHA256().CalculateDigest(payloadHash, buf + blockSize, len);
         blockSize += len;
@@ -203,7 +212,7 @@ namespace garlic
         return blockSize;
     }   
 
-    size_t GarlicRoutingSession::CreateGarlicPayload (uint8_t * payload, std::shared_ptr<const I2NPMessage> msg, UnconfirmedTags * newTags)
+    size_t GarlicRoutingSession::CreateGarlicPayload (uint8_t * payload, const std::vector<std::shared_ptr<const I2NPMessage> >& msgs, UnconfirmedTags * newTags)
     {
         uint64_t ts = i2p::util::GetMillisecondsSinceEpoch () + 5000; // 5 sec
         uint32_t msgID = m_Rnd.GenerateWord32 ();   
@@ -247,7 +256,7 @@ namespace garlic
                 (*numCloves)++;
             }
         }   
-        if (msg) // clove message ifself if presented
+        for (auto msg: msgs) // clove per message itself
         {   
             size += CreateGarlicClove (payload + size, msg, m_Destination ? m_Destination->IsDestination () : false);
             (*numCloves)++;
@@ -372,6 +381,9 @@ namespace garlic
         if (it != m_Tags.end ())
         {
             // tag found. Use AES
+            static auto& numAESMessages = i2p::util::metrics.GetCounter ("i2pd_garlic_received_messages_total",
+                "Received garlic messages by decryption", "decryption=\"aes\"");
+            numAESMessages.Inc ();
             if (length >= 32)
             {   
                 uint8_t iv[32]; // IV is first 16 bytes
@@ -387,9 +399,24 @@ namespace garlic
         else
         {
             // tag not found. Use ElGamal
+            static auto& numElGamalMessages = i2p::util::metrics.GetCounter ("i2pd_garlic_received_messages_total",
+                "Received garlic messages by decryption", "decryption=\"elgamal\"");
+            static auto& numFailedMessages = i2p::util::metrics.GetCounter ("i2pd_garlic_received_messages_total",
+                "Received garlic messages by decryption", "decryption=\"failed\"");
+            static auto& elGamalDuration = i2p::util::metrics.GetHistogram ("i2pd_garlic_elgamal_decrypt_microseconds",
+                "Time of ElGamal decryption of garlic", i2p::util::ExponentialBuckets (250, 2, 10));
             ElGamalBlock elGamal;
-            if (length >= 514 && i2p::crypto::ElGamalDecrypt (GetEncryptionPrivateKey (), buf, (uint8_t *)&elGamal, true))
+            bool decrypted = false;
+            if (length >= 514)
+            {
+                auto start = std::chrono::steady_clock::now ();
+                decrypted = i2p::crypto::ElGamalDecrypt (GetEncryptionPrivateKey (), buf, (uint8_t *)&elGamal, true);
+                elGamalDuration.Observe (std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now () - start).count ());
+            }
+            if (decrypted)
             {   
+                numElGamalMessages.Inc ();
                 auto decryption = std::make_shared<i2p::crypto::CBCDecryption>();
                 decryption->SetKey (elGamal.sessionKey);
                 uint8_t iv[32]; // IV is first 16 bytes
@@ -399,7 +426,10 @@ namespace garlic
                 HandleAESBlock (buf + 514, length - 514, decryption, msg->from);
             }   
             else
+            {
+                numFailedMessages.Inc ();
                 LogPrint (eLogError, "Failed to decrypt garlic");
+            }
         }
 
         // cleanup expired tags
@@ -540,6 +570,13 @@ namespace garlic
         return session->WrapSingleMessage (msg);    
     }
 
+    std::shared_ptr<I2NPMessage> GarlicDestination::WrapMessages (std::shared_ptr<const i2p::data::RoutingDestination> destination, 
+        const std::vector<std::shared_ptr<const I2NPMessage> >& msgs, bool attachLeaseSet)  
+    {
+        auto session = GetRoutingSession (destination, attachLeaseSet);
+        return session->WrapMessages (msgs);    
+    }
+
     std::shared_ptr<GarlicRoutingSession> GarlicDestination::GetRoutingSession (
         std::shared_ptr<const i2p::data::RoutingDestination> destination, bool attachLeaseSet)
     {
@@ -4,6 +4,7 @@
 #include <inttypes.h>
 #include <map>
 #include <list>
+#include <vector>
 #include <string>
 #include <thread>
 #include <mutex>
@@ -81,6 +82,7 @@ namespace garlic
             GarlicRoutingSession (const uint8_t * sessionKey, const SessionTag& sessionTag); // one time encryption
             ~GarlicRoutingSession ();
             std::shared_ptr<I2NPMessage> WrapSingleMessage (std::shared_ptr<const I2NPMessage> msg);
+            std::shared_ptr<I2NPMessage> WrapMessages (const std::vector<std::shared_ptr<const I2NPMessage> >& msgs); // clove per message
             void MessageConfirmed (uint32_t msgID);
             bool CleanupExpiredTags (); // returns true if something left 
 
@@ -91,8 +93,8 @@ namespace garlic
             
         private:
 
-            size_t CreateAESBlock (uint8_t * buf, std::shared_ptr<const I2NPMessage> msg);
-            size_t CreateGarlicPayload (uint8_t * payload, std::shared_ptr<const I2NPMessage> msg, UnconfirmedTags * newTags);
+            size_t CreateAESBlock (uint8_t * buf, const std::vector<std::shared_ptr<const I2NPMessage> >& msgs);
+            size_t CreateGarlicPayload (uint8_t * payload, const std::vector<std::shared_ptr<const I2NPMessage> >& msgs, UnconfirmedTags * newTags);
             size_t CreateGarlicClove (uint8_t * buf, std::shared_ptr<const I2NPMessage> msg, bool isDestination);
             size_t CreateDeliveryStatusClove (uint8_t * buf, uint32_t msgID);
 
@@ -128,6 +130,8 @@ namespace garlic
             void RemoveCreatedSession (uint32_t msgID);
             std::shared_ptr<I2NPMessage> WrapMessage (std::shared_ptr<const i2p::data::RoutingDestination> destination, 
                 std::shared_ptr<I2NPMessage> msg, bool attachLeaseSet = false);
+            std::shared_ptr<I2NPMessage> WrapMessages (std::shared_ptr<const i2p::data::RoutingDestination> destination, 
+                const std::vector<std::shared_ptr<const I2NPMessage> >& msgs, bool attachLeaseSet = false); // into one garlic message
 
             void AddSessionKey (const uint8_t * key, const uint8_t * tag); // one tag
             virtual bool SubmitSessionKey (const uint8_t * key, const uint8_t * tag); // from different thread
@@ -136,6 +140,7 @@ namespace garlic
             virtual void ProcessGarlicMessage (std::shared_ptr<I2NPMessage> msg);
             virtual void ProcessDeliveryStatusMessage (std::shared_ptr<I2NPMessage> msg);           
             virtual void SetLeaseSetUpdated ();
+            virtual size_t GetSendQueueSize () const { return 0; }; // bytes of outgoing packets waiting for acknowledgement
             
             virtual std::shared_ptr<const i2p::data::LeaseSet> GetLeaseSet () = 0; // TODO
             virtual std::shared_ptr<i2p::tunnel::TunnelPool> GetTunnelPool () const = 0;
@@ -1,9 +1,9 @@
 #include <string.h>
 #include <atomic>
 #include "util/I2PEndian.h"
-#include <cryptopp/gzip.h>
 #include "crypto/ElGamal.h"
 #include "util/Timestamp.h"
+#include "util/Compression.h"
 #include "RouterContext.h"
 #include "NetworkDatabase.h"
 #include "tunnel/Tunnel.h"
@@ -229,10 +229,8 @@ namespace i2p
             buf += 32;
         }       
 
-        CryptoPP::Gzip compressor;
-        compressor.Put (router->GetBuffer (), router->GetBufferLen ());
-        compressor.MessageEnd();
-        auto size = compressor.MaxRetrievable ();
+        uint8_t compressed[i2p::data::MAX_RI_BUFFER_SIZE + 128]; // stored blocks are a bit longer
+        auto size = i2p::util::GzipCompress (router->GetBuffer (), router->GetBufferLen (), compressed, sizeof (compressed));
         htobe16buf (buf, size); // size
         buf += 2;
         m->len += (buf - payload); // payload size
@@ -244,7 +242,7 @@ namespace i2p
             m = newMsg;
             buf = m->buf + m->len;
         }   
-        compressor.Get (buf, size); 
+        memcpy (buf, compressed, size);
         m->len += size;
         m->FillI2NPMessageHeader (eI2NPDatabaseStore);
         
@@ -287,7 +285,7 @@ namespace i2p
             uint8_t * record = records + i*TUNNEL_BUILD_RECORD_SIZE;
             if (!memcmp (record + BUILD_REQUEST_RECORD_TO_PEER_OFFSET, (const uint8_t *)i2p::context.GetRouterInfo ().GetIdentHash (), 16))
             {   
-                LogPrint ("Record ",i," is ours");  
+                LogPrint (eLogDebug, "Record ",i," is ours");  
             
                 i2p::crypto::ElGamalDecrypt (i2p::context.GetEncryptionPrivateKey (), record + BUILD_REQUEST_RECORD_ENCRYPTED_OFFSET, clearText);
                 // replace record to reply          
@@ -328,6 +326,12 @@ namespace i2p
         return false;
     }
 
+    static void SendTransitMessage (const uint8_t * ident, std::shared_ptr<I2NPMessage> msg)
+    {
+        msg->trafficClass = eTrafficClassTransit; // forwarded build requests are shaped as transit
+        transports.SendMessage (ident, msg);
+    }
+
     void HandleVariableTunnelBuildMsg (uint32_t replyMsgID, uint8_t * buf, size_t len)
     {   
         int num = buf[0];
@@ -358,13 +362,13 @@ namespace i2p
                 if (clearText[BUILD_REQUEST_RECORD_FLAG_OFFSET] & 0x40) // we are endpoint of outboud tunnel
                 {
                     // so we send it to reply tunnel 
-                    transports.SendMessage (clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET, 
+                    SendTransitMessage (clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET, 
                         ToSharedI2NPMessage (CreateTunnelGatewayMsg (bufbe32toh (clearText + BUILD_REQUEST_RECORD_NEXT_TUNNEL_OFFSET),
                             eI2NPVariableTunnelBuildReply, buf, len, 
                             bufbe32toh (clearText + BUILD_REQUEST_RECORD_SEND_MSG_ID_OFFSET))));                         
                 }   
                 else    
-                    transports.SendMessage (clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET, 
+                    SendTransitMessage (clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET, 
                         ToSharedI2NPMessage (CreateI2NPMessage (eI2NPVariableTunnelBuild, buf, len, 
                             bufbe32toh (clearText + BUILD_REQUEST_RECORD_SEND_MSG_ID_OFFSET))));
             }   
@@ -379,13 +383,13 @@ namespace i2p
             if (clearText[BUILD_REQUEST_RECORD_FLAG_OFFSET] & 0x40) // we are endpoint of outbound tunnel
             {
                 // so we send it to reply tunnel 
-                transports.SendMessage (clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET, 
+                SendTransitMessage (clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET, 
                     ToSharedI2NPMessage (CreateTunnelGatewayMsg (bufbe32toh (clearText + BUILD_REQUEST_RECORD_NEXT_TUNNEL_OFFSET),
                         eI2NPTunnelBuildReply, buf, len, 
                         bufbe32toh (clearText + BUILD_REQUEST_RECORD_SEND_MSG_ID_OFFSET))));                         
             }   
             else    
-                transports.SendMessage (clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET, 
+                SendTransitMessage (clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET, 
                     ToSharedI2NPMessage (CreateI2NPMessage (eI2NPTunnelBuild, buf, len, 
                         bufbe32toh (clearText + BUILD_REQUEST_RECORD_SEND_MSG_ID_OFFSET))));
         } 
@@ -502,26 +506,26 @@ namespace i2p
     {
         uint8_t typeID = msg[I2NP_HEADER_TYPEID_OFFSET];
         uint32_t msgID = bufbe32toh (msg + I2NP_HEADER_MSGID_OFFSET);   
-        LogPrint ("I2NP msg received len=", len,", type=", (int)typeID, ", msgID=", (unsigned int)msgID);
+        LogPrint (eLogDebug, "I2NP msg received len=", len,", type=", (int)typeID, ", msgID=", (unsigned int)msgID);
 
         uint8_t * buf = msg + I2NP_HEADER_SIZE;
         int size = bufbe16toh (msg + I2NP_HEADER_SIZE_OFFSET);
         switch (typeID)
         {   
             case eI2NPVariableTunnelBuild:
-                LogPrint ("VariableTunnelBuild");
+                LogPrint (eLogDebug, "VariableTunnelBuild");
                 HandleVariableTunnelBuildMsg  (msgID, buf, size);
             break;  
             case eI2NPVariableTunnelBuildReply:
-                LogPrint ("VariableTunnelBuildReply");
+                LogPrint (eLogDebug, "VariableTunnelBuildReply");
                 HandleVariableTunnelBuildReplyMsg (msgID, buf, size);
             break;  
             case eI2NPTunnelBuild:
-                LogPrint ("TunnelBuild");
+                LogPrint (eLogDebug, "TunnelBuild");
                 HandleTunnelBuildMsg  (buf, size);
             break;  
             case eI2NPTunnelBuildReply:
-                LogPrint ("TunnelBuildReply");
+                LogPrint (eLogDebug, "TunnelBuildReply");
                 // TODO:
             break;  
             default:
@@ -536,16 +540,16 @@ namespace i2p
             switch (msg->GetTypeID ())
             {   
                 case eI2NPTunnelData:
-                    LogPrint ("TunnelData");
+                    LogPrint (eLogDebug, "TunnelData");
                     i2p::tunnel::tunnels.PostTunnelData (msg);
                 break;  
                 case eI2NPTunnelGateway:
-                    LogPrint ("TunnelGateway");
+                    LogPrint (eLogDebug, "TunnelGateway");
                     i2p::tunnel::tunnels.PostTunnelData (msg);
                 break;
                 case eI2NPGarlic:
                 {
-                    LogPrint ("Garlic");
+                    LogPrint (eLogDebug, "Garlic");
                     if (msg->from)
                     {
                         if (msg->from->GetTunnelPool ())
@@ -565,7 +569,7 @@ namespace i2p
                 break;
                 case eI2NPDeliveryStatus:
                 {
-                    LogPrint ("DeliveryStatus");
+                    LogPrint (eLogDebug, "DeliveryStatus");
                     if (msg->from && msg->from->GetTunnelPool ())
                         msg->from->GetTunnelPool ()->ProcessDeliveryStatus (msg);
                     else
@@ -105,6 +105,15 @@ namespace tunnel
     class TunnelPool;
 }
 
+    // traffic classes for bandwidth shaping
+    enum TrafficClass
+    {
+        eTrafficClassClient = 0, // our own tunnels
+        eTrafficClassTransit,
+        eTrafficClassNetDb,
+        eNumTrafficClasses
+    };  
+
     const size_t I2NP_MAX_MESSAGE_SIZE = 32768; 
     const size_t I2NP_MAX_SHORT_MESSAGE_SIZE = 4096; 
     struct I2NPMessage
@@ -112,9 +121,10 @@ namespace tunnel
         uint8_t * buf;  
         size_t len, offset, maxLen;
         std::shared_ptr<i2p::tunnel::InboundTunnel> from;
+        TrafficClass trafficClass;
         
         I2NPMessage (): buf (nullptr),len (I2NP_HEADER_SIZE + 2), 
-            offset(2), maxLen (0), from (nullptr) {};  // reserve 2 bytes for NTCP header
+            offset(2), maxLen (0), from (nullptr), trafficClass (eTrafficClassClient) {};  // reserve 2 bytes for NTCP header
     
         // header accessors
         uint8_t * GetHeader () { return GetBuffer (); };
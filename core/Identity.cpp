@@ -452,6 +452,12 @@ namespace data
             m_Signer->Sign (i2p::context.GetRandomNumberGenerator (), buf, len, signature);
     }           
 
+    void PrivateKeys::Sign (CryptoPP::RandomNumberGenerator& rnd, const uint8_t * buf, int len, uint8_t * signature) const
+    {
+        if (m_Signer)
+            m_Signer->Sign (rnd, buf, len, signature);
+    }
+
     void PrivateKeys::CreateSigner ()
     {
         switch (m_Public.GetSigningKeyType ())
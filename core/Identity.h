@@ -88,6 +88,11 @@ namespace data {
     };  
     typedef Tag<32> IdentHash;
 
+    struct IdentHashHasher // for unordered containers, ident hash is uniformly distributed already
+    {
+        size_t operator() (const IdentHash& ident) const { return ident.GetLL ()[0]; };
+    };  
+
 #pragma pack(1)
     struct Keys
     {
@@ -193,6 +198,8 @@ namespace data {
             const uint8_t * GetPrivateKey () const { return m_PrivateKey; };
             const uint8_t * GetSigningPrivateKey () const { return m_SigningPrivateKey; };
             void Sign (const uint8_t * buf, int len, uint8_t * signature) const;
+            // with caller's generator, for signing from other threads
+            void Sign (CryptoPP::RandomNumberGenerator& rnd, const uint8_t * buf, int len, uint8_t * signature) const;
 
             size_t GetFullLen () const { return m_Public.GetFullLen () + 256 + m_Public.GetSigningPrivateKeyLen (); };      
             size_t FromBuffer (const uint8_t * buf, size_t len);
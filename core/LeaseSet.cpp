@@ -153,5 +153,13 @@ namespace data
             if (ts < it.endDate) return true;
         return false;
     }   
+
+    uint64_t LeaseSet::GetExpirationTime () const
+    {
+        uint64_t expiration = 0;
+        for (auto& it: m_Leases)
+            if (it.endDate > expiration) expiration = it.endDate;
+        return expiration;
+    }
 }       
 }   
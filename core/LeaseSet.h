@@ -52,6 +52,7 @@ namespace data
             const std::vector<Lease> GetNonExpiredLeases (bool withThreshold = true) const;
             bool HasExpiredLeases () const;
             bool HasNonExpiredLeases () const;
+            uint64_t GetExpirationTime () const; // end date of latest lease, in milliseconds
             const uint8_t * GetEncryptionPublicKey () const { return m_EncryptionKey; };
             bool IsDestination () const { return true; };
 
@@ -0,0 +1,177 @@
+#include "util/Log.h"
+#include "util/Timestamp.h"
+#include "LeaseSetCache.h"
+
+namespace i2p
+{
+namespace client
+{
+    // not labelled by destination, series can't be unregistered when a transient destination goes away
+    LeaseSetCache::LeaseSetCache (size_t maxSize):
+        m_MaxShardSize ((maxSize + LEASESET_CACHE_NUM_SHARDS - 1)/LEASESET_CACHE_NUM_SHARDS),
+        m_NumHits (i2p::util::metrics.GetCounter ("i2pd_leaseset_cache_lookups_total",
+            "Remote LeaseSet lookups, all local destinations", "result=\"hit\"")),
+        m_NumMisses (i2p::util::metrics.GetCounter ("i2pd_leaseset_cache_lookups_total",
+            "Remote LeaseSet lookups, all local destinations", "result=\"miss\"")),
+        m_NumRefreshes (i2p::util::metrics.GetCounter ("i2pd_leaseset_refreshes_total",
+            "Remote LeaseSets requested before expiration")),
+        m_RefreshLatency (i2p::util::metrics.GetHistogram ("i2pd_leaseset_refresh_milliseconds",
+            "Time to receive refreshed remote LeaseSet", i2p::util::ExponentialBuckets (250, 2, 8))),
+        m_Size (i2p::util::metrics.GetGauge ("i2pd_leaseset_cache_size",
+            "Remote LeaseSets cached, all local destinations"))
+    {
+    }
+
+    LeaseSetCache::~LeaseSetCache ()
+    {
+        m_Size.Add (-(int64_t)GetSize ());
+    }
+
+    std::shared_ptr<i2p::data::LeaseSet> LeaseSetCache::Get (const i2p::data::IdentHash& ident)
+    {
+        return Get (ident, i2p::util::GetMillisecondsSinceEpoch ());
+    }
+
+    std::shared_ptr<i2p::data::LeaseSet> LeaseSetCache::Get (const i2p::data::IdentHash& ident, uint64_t ts)
+    {
+        auto& shard = GetShard (ident);
+        std::unique_lock<std::mutex> l(shard.mutex);
+        auto it = shard.entries.find (ident);
+        if (it != shard.entries.end () && ts < it->second.expiration)
+        {
+            it->second.lastAccessTime = ts;
+            m_NumHits.Inc ();
+            return it->second.leaseSet;
+        }
+        m_NumMisses.Inc ();
+        return nullptr;
+    }
+
+    bool LeaseSetCache::Put (std::shared_ptr<i2p::data::LeaseSet>& leaseSet)
+    {
+        return Put (leaseSet, i2p::util::GetMillisecondsSinceEpoch ());
+    }
+
+    bool LeaseSetCache::Put (std::shared_ptr<i2p::data::LeaseSet>& leaseSet, uint64_t ts)
+    {
+        auto& ident = leaseSet->GetIdentHash ();
+        auto& shard = GetShard (ident);
+        auto expiration = leaseSet->GetExpirationTime ();
+        std::unique_lock<std::mutex> l(shard.mutex);
+        auto it = shard.entries.find (ident);
+        if (it != shard.entries.end ())
+        {
+            auto& entry = it->second;
+            if (expiration < entry.expiration) // older copy, from floodfill
+            {
+                leaseSet = entry.leaseSet;
+                return false;
+            }
+            if (expiration > entry.expiration)
+                entry.refreshTime = 0; // new leases, refresh again when they expire soon
+            // otherwise same copy, keep retry interval
+            shard.byExpiration.erase (std::make_pair (entry.expiration, ident));
+            entry.leaseSet = leaseSet;
+            entry.expiration = expiration;
+        }
+        else
+        {
+            if (shard.entries.size () >= m_MaxShardSize)
+            {
+                // evict earliest expiring inactive, active peers stay
+                for (auto& it: shard.byExpiration)
+                {
+                    auto evicted = shard.entries.find (it.second);
+                    if (ts >= evicted->second.lastAccessTime + LEASESET_CACHE_ACTIVE_TIMEOUT*1000)
+                    {
+                        Erase (shard, evicted);
+                        break;
+                    }
+                }
+            }
+            shard.entries[ident] = { leaseSet, expiration, ts, 0 };
+            m_Size.Add (1);
+        }
+        shard.byExpiration.insert (std::make_pair (expiration, ident));
+        return true;
+    }
+
+    void LeaseSetCache::Remove (const i2p::data::IdentHash& ident)
+    {
+        auto& shard = GetShard (ident);
+        std::unique_lock<std::mutex> l(shard.mutex);
+        auto it = shard.entries.find (ident);
+        if (it != shard.entries.end ())
+            Erase (shard, it);
+    }
+
+    void LeaseSetCache::Erase (Shard& shard, std::map<i2p::data::IdentHash, Entry>::iterator it)
+    {
+        shard.byExpiration.erase (std::make_pair (it->second.expiration, it->first));
+        shard.entries.erase (it);
+        m_Size.Add (-1);
+    }
+
+    void LeaseSetCache::Cleanup ()
+    {
+        Cleanup (i2p::util::GetMillisecondsSinceEpoch ());
+    }
+
+    void LeaseSetCache::Cleanup (uint64_t ts)
+    {
+        for (auto& shard: m_Shards)
+        {
+            std::unique_lock<std::mutex> l(shard.mutex);
+            while (!shard.byExpiration.empty () && shard.byExpiration.begin ()->first <= ts)
+            {
+                LogPrint ("Remote LeaseSet ", shard.byExpiration.begin ()->second.ToBase64 (), " expired");
+                Erase (shard, shard.entries.find (shard.byExpiration.begin ()->second));
+            }
+        }
+    }
+
+    std::vector<i2p::data::IdentHash> LeaseSetCache::GetLeaseSetsToRefresh ()
+    {
+        return GetLeaseSetsToRefresh (i2p::util::GetMillisecondsSinceEpoch ());
+    }
+
+    std::vector<i2p::data::IdentHash> LeaseSetCache::GetLeaseSetsToRefresh (uint64_t ts)
+    {
+        std::vector<i2p::data::IdentHash> idents;
+        for (auto& shard: m_Shards)
+        {
+            std::unique_lock<std::mutex> l(shard.mutex);
+            // expiring soon come first
+            for (auto& it: shard.byExpiration)
+            {
+                if (it.first > ts + LEASESET_REFRESH_THRESHOLD*1000) break;
+                auto& entry = shard.entries[it.second];
+                if (ts < entry.lastAccessTime + LEASESET_CACHE_ACTIVE_TIMEOUT*1000 &&
+                    ts >= entry.refreshTime + LEASESET_REFRESH_RETRY_INTERVAL*1000)
+                {
+                    entry.refreshTime = ts;
+                    idents.push_back (it.second);
+                }
+            }
+        }
+        m_NumRefreshes.Inc (idents.size ());
+        return idents;
+    }
+
+    void LeaseSetCache::RefreshCompleted (uint64_t latency)
+    {
+        m_RefreshLatency.Observe (latency);
+    }
+
+    size_t LeaseSetCache::GetSize () const
+    {
+        size_t size = 0;
+        for (auto& shard: m_Shards)
+        {
+            std::unique_lock<std::mutex> l(shard.mutex);
+            size += shard.entries.size ();
+        }
+        return size;
+    }
+}
+}
@@ -0,0 +1,86 @@
+#ifndef LEASESET_CACHE_H__
+#define LEASESET_CACHE_H__
+
+#include <inttypes.h>
+#include <string>
+#include <memory>
+#include <map>
+#include <set>
+#include <vector>
+#include <mutex>
+#include "Identity.h"
+#include "LeaseSet.h"
+#include "util/Metrics.h"
+
+namespace i2p
+{
+namespace client
+{
+    const int LEASESET_CACHE_NUM_SHARDS = 8;
+    const size_t LEASESET_CACHE_MAX_SIZE = 512; // per destination, earliest expiring inactive are evicted above
+    const int LEASESET_CACHE_ACTIVE_TIMEOUT = 120; // in seconds since last lookup, only active are refreshed
+    const int LEASESET_REFRESH_THRESHOLD = 150; // in seconds before last lease expires
+    const int LEASESET_REFRESH_RETRY_INTERVAL = 30; // in seconds, if refreshed LeaseSet was the same
+    const int LEASESET_REFRESH_CHECK_INTERVAL = 15; // in seconds
+
+    /**
+     * Remote LeaseSets of a destination, looked up from any thread.
+     * Sharded by ident hash, so concurrent lookups rarely wait for each other.
+     * LeaseSets are never modified in place, an update replaces the whole object.
+     * Metrics are aggregated over all local destinations
+     */
+    class LeaseSetCache
+    {
+        public:
+
+            LeaseSetCache (size_t maxSize = LEASESET_CACHE_MAX_SIZE); // active peers are kept above maxSize
+            ~LeaseSetCache ();
+
+            // returns nullptr if missing or all leases expired, marks peer as active
+            std::shared_ptr<i2p::data::LeaseSet> Get (const i2p::data::IdentHash& ident);
+            std::shared_ptr<i2p::data::LeaseSet> Get (const i2p::data::IdentHash& ident, uint64_t ts); // ts in milliseconds
+            // returns false if LeaseSet with later expiration is cached already, leaseSet is set to cached one
+            bool Put (std::shared_ptr<i2p::data::LeaseSet>& leaseSet);
+            bool Put (std::shared_ptr<i2p::data::LeaseSet>& leaseSet, uint64_t ts);
+            void Remove (const i2p::data::IdentHash& ident);
+            void Cleanup (); // drops expired
+            void Cleanup (uint64_t ts);
+
+            // active peers whose last lease expires soon. Marks them as being refreshed
+            std::vector<i2p::data::IdentHash> GetLeaseSetsToRefresh ();
+            std::vector<i2p::data::IdentHash> GetLeaseSetsToRefresh (uint64_t ts);
+            void RefreshCompleted (uint64_t latency); // in milliseconds
+
+            size_t GetSize () const;
+
+        private:
+
+            struct Entry
+            {
+                std::shared_ptr<i2p::data::LeaseSet> leaseSet;
+                uint64_t expiration; // in milliseconds
+                uint64_t lastAccessTime, refreshTime; // in milliseconds
+            };
+
+            struct Shard
+            {
+                mutable std::mutex mutex;
+                std::map<i2p::data::IdentHash, Entry> entries;
+                std::set<std::pair<uint64_t, i2p::data::IdentHash> > byExpiration;
+            };
+
+            Shard& GetShard (const i2p::data::IdentHash& ident) { return m_Shards[ident[0] % LEASESET_CACHE_NUM_SHARDS]; };
+            void Erase (Shard& shard, std::map<i2p::data::IdentHash, Entry>::iterator it);
+
+        private:
+
+            size_t m_MaxShardSize;
+            Shard m_Shards[LEASESET_CACHE_NUM_SHARDS];
+            i2p::util::Counter& m_NumHits, & m_NumMisses, & m_NumRefreshes;
+            i2p::util::Histogram& m_RefreshLatency;
+            i2p::util::Gauge& m_Size;
+    };
+}
+}
+
+#endif
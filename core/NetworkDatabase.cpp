@@ -2,11 +2,13 @@
 #include "util/I2PEndian.h"
 #include <fstream>
 #include <vector>
+#include <algorithm>
 #include <boost/asio.hpp>
-#include <cryptopp/gzip.h>
 #include "util/base64.h"
 #include "util/Log.h"
 #include "util/Timestamp.h"
+#include "util/Metrics.h"
+#include "util/Compression.h"
 #include "I2NPProtocol.h"
 #include "tunnel/Tunnel.h"
 #include "transport/Transports.h"
@@ -24,7 +26,7 @@ namespace data
     const char NetDb::m_NetDbPath[] = "netDb";
     NetDb netdb;
 
-    NetDb::NetDb (): m_IsRunning (false), m_Thread (nullptr), m_Reseeder (nullptr)
+    NetDb::NetDb (): m_IsRunning (false), m_IsReseedEnabled (true), m_Thread (nullptr), m_Reseeder (nullptr)
     {
     }
     
@@ -36,8 +38,9 @@ namespace data
 
     void NetDb::Start ()
     {   
+        profileStorage.Open (i2p::util::filesystem::GetDataDir ());
         Load ();
-        if (m_RouterInfos.size () < 25) // reseed if # of router less than 50
+        if (m_RouterInfos.size () < 25 && m_IsReseedEnabled) // reseed if # of router less than 50
         {   
             // try SU3 first
             Reseed ();
@@ -57,6 +60,24 @@ namespace data
         }   
         m_IsRunning = true;
         m_Thread = new std::thread (std::bind (&NetDb::Run, this));
+        RegisterMetrics ();
+    }
+
+    void NetDb::RegisterMetrics ()
+    {
+        auto& metrics = i2p::util::metrics;
+        metrics.SetCallback ("i2pd_netdb_routers", "Known RouterInfos", i2p::util::eMetricGauge,
+            [this]() { return (int64_t)GetNumRouters (); });
+        metrics.SetCallback ("i2pd_netdb_floodfills", "Known floodfills", i2p::util::eMetricGauge,
+            [this]() { return (int64_t)GetNumFloodfills (); });
+        metrics.SetCallback ("i2pd_netdb_leasesets", "Known LeaseSets", i2p::util::eMetricGauge,
+            [this]() { return (int64_t)GetNumLeaseSets (); });
+        metrics.SetCallback ("i2pd_netdb_queue_size", "Messages waiting for netDb thread", i2p::util::eMetricGauge,
+            [this]() { return (int64_t)m_Queue.GetSize (); });
+        metrics.SetCallback ("i2pd_peer_tier_size", "Peers in selection tier", i2p::util::eMetricGauge,
+            [this]() { return (int64_t)GetPeerTier (ePeerTierFast).size (); }, "tier=\"fast\"");
+        metrics.SetCallback ("i2pd_peer_tier_size", "Peers in selection tier", i2p::util::eMetricGauge,
+            [this]() { return (int64_t)GetPeerTier (ePeerTierHighCapacity).size (); }, "tier=\"high_capacity\"");
     }
     
     void NetDb::Stop ()
@@ -66,6 +87,7 @@ namespace data
             for (auto it: m_RouterInfos)
                 it.second->SaveProfile ();
             DeleteObsoleteProfiles ();
+            profileStorage.Close ();
             m_RouterInfos.clear ();
             m_Floodfills.clear ();
             if (m_Thread)
@@ -76,7 +98,10 @@ namespace data
                 delete m_Thread;
                 m_Thread = 0;
             }
-            m_LeaseSets.clear();
+            {
+                std::unique_lock<std::mutex> l(m_LeaseSetsMutex);
+                m_LeaseSets.clear();
+            }
             m_Requests.Stop ();
         }   
     }   
@@ -84,6 +109,12 @@ namespace data
     void NetDb::Run ()
     {
         uint32_t lastSave = 0, lastPublish = 0, lastExploratory = 0, lastManageRequest = 0;
+        auto& numStores = i2p::util::metrics.GetCounter ("i2pd_netdb_messages_total",
+            "Messages handled by netDb", "type=\"store\"");
+        auto& numSearchReplies = i2p::util::metrics.GetCounter ("i2pd_netdb_messages_total",
+            "Messages handled by netDb", "type=\"search_reply\"");
+        auto& numLookups = i2p::util::metrics.GetCounter ("i2pd_netdb_messages_total",
+            "Messages handled by netDb", "type=\"lookup\"");
         while (m_IsRunning)
         {   
             try
@@ -97,15 +128,18 @@ namespace data
                         switch (msg->GetTypeID ()) 
                         {
                             case eI2NPDatabaseStore:    
-                                LogPrint ("DatabaseStore");
+                                LogPrint (eLogDebug, "DatabaseStore");
+                                numStores.Inc ();
                                 HandleDatabaseStoreMsg (msg);
                             break;
                             case eI2NPDatabaseSearchReply:
-                                LogPrint ("DatabaseSearchReply");
+                                LogPrint (eLogDebug, "DatabaseSearchReply");
+                                numSearchReplies.Inc ();
                                 HandleDatabaseSearchReplyMsg (msg);
                             break;
                             case eI2NPDatabaseLookup:
-                                LogPrint ("DatabaseLookup");
+                                LogPrint (eLogDebug, "DatabaseLookup");
+                                numLookups.Inc ();
                                 HandleDatabaseLookupMsg (msg);
                             break;  
                             default: // WTF?
@@ -132,6 +166,7 @@ namespace data
                         SaveUpdated ();
                         ManageLeaseSets ();
                     }   
+                    ReorganizePeerTiers ();
                     lastSave = ts;
                 }   
                 if (ts - lastPublish >= 2400) // publish every 40 minutes
@@ -200,12 +235,17 @@ namespace data
     {
         if (!from) // unsolicited LS must be received directly
         {   
+            // destinations might hold previous one, so it's replaced rather than updated
+            auto leaseSet = std::make_shared<LeaseSet> (buf, len);
+            std::unique_lock<std::mutex> l(m_LeaseSetsMutex);
             auto it = m_LeaseSets.find(ident);
             if (it != m_LeaseSets.end ())
             {
-                it->second->Update (buf, len); 
-                if (it->second->IsValid ())
+                if (leaseSet->IsValid ())
+                {
+                    it->second = leaseSet;
                     LogPrint (eLogInfo, "LeaseSet updated");
+                }
                 else
                 {
                     LogPrint (eLogInfo, "LeaseSet update failed");
@@ -214,7 +254,6 @@ namespace data
             }
             else
             {   
-                auto leaseSet = std::make_shared<LeaseSet> (buf, len);
                 if (leaseSet->IsValid ())
                 {
                     LogPrint (eLogInfo, "New LeaseSet added");
@@ -238,6 +277,7 @@ namespace data
 
     std::shared_ptr<LeaseSet> NetDb::FindLeaseSet (const IdentHash& destination) const
     {
+        std::unique_lock<std::mutex> l(m_LeaseSetsMutex);
         auto it = m_LeaseSets.find (destination);
         if (it != m_LeaseSets.end ())
             return it->second;
@@ -354,6 +394,7 @@ namespace data
         uint64_t ts = i2p::util::GetMillisecondsSinceEpoch ();
         for (auto it: m_RouterInfos)
         {   
+            it.second->SaveProfile (); // copied to storage only, if changed
             if (it.second->IsUpdated ())
             {
                 std::string f = GetFilePath(fullDirectory, it.second.get()).string();
@@ -414,6 +455,7 @@ namespace data
                 }
             }   
         }   
+        profileStorage.Flush ();
         if (count > 0)
             LogPrint (count," new/updated routers saved");
         if (deletedCount > 0)
@@ -505,12 +547,12 @@ namespace data
         
         if (buf[DATABASE_STORE_TYPE_OFFSET]) // type
         {
-            LogPrint ("LeaseSet");
+            LogPrint (eLogDebug, "LeaseSet");
             AddLeaseSet (ident, buf + offset, len - offset, m->from);
         }   
         else
         {
-            LogPrint ("RouterInfo");
+            LogPrint (eLogDebug, "RouterInfo");
             size_t size = bufbe16toh (buf + offset);
             offset += 2;
             if (size > 2048 || size > len - offset)
@@ -518,25 +560,12 @@ namespace data
                 LogPrint ("Invalid RouterInfo length ", (int)size);
                 return;
             }   
-            try
-            {   
-                CryptoPP::Gunzip decompressor;
-                decompressor.Put (buf + offset, size);
-                decompressor.MessageEnd();
-                uint8_t uncompressed[2048];
-                size_t uncomressedSize = decompressor.MaxRetrievable ();
-                if (uncomressedSize <= 2048)
-                {
-                    decompressor.Get (uncompressed, uncomressedSize);
-                    AddRouterInfo (ident, uncompressed, uncomressedSize);
-                }
-                else
-                    LogPrint ("Invalid RouterInfo uncomressed length ", (int)uncomressedSize);
-            }
-            catch (CryptoPP::Exception& ex)
-            {
-                LogPrint (eLogError, "DatabaseStore: ", ex.what ());
-            }
+            uint8_t uncompressed[2048];
+            size_t uncomressedSize = i2p::util::GzipDecompress (buf + offset, size, uncompressed, 2048);
+            if (uncomressedSize)
+                AddRouterInfo (ident, uncompressed, uncomressedSize);
+            else
+                LogPrint ("Invalid compressed RouterInfo");
         }   
     }   
 
@@ -547,7 +576,7 @@ namespace data
         int l = i2p::util::ByteStreamToBase64 (buf, 32, key, 48);
         key[l] = 0;
         int num = buf[32]; // num
-        LogPrint ("DatabaseSearchReply for ", key, " num=", num);
+        LogPrint (eLogDebug, "DatabaseSearchReply for ", key, " num=", num);
         IdentHash ident (buf);
         auto dest = m_Requests.FindRequest (ident); 
         if (dest)
@@ -615,7 +644,7 @@ namespace data
             char peerHash[48];
             int l1 = i2p::util::ByteStreamToBase64 (router, 32, peerHash, 48);
             peerHash[l1] = 0;
-            LogPrint (i,": ", peerHash);
+            LogPrint (eLogDebug, i,": ", peerHash);
 
             auto r = FindRouter (router); 
             if (!r || i2p::util::GetMillisecondsSinceEpoch () > r->GetTimestamp () + 3600*1000LL) 
@@ -642,7 +671,7 @@ namespace data
         int l = i2p::util::ByteStreamToBase64 (buf, 32, key, 48);
         key[l] = 0;
         uint8_t flag = buf[64];
-        LogPrint ("DatabaseLookup for ", key, " recieved flags=", (int)flag);
+        LogPrint (eLogDebug, "DatabaseLookup for ", key, " recieved flags=", (int)flag);
         uint8_t lookupType = flag & DATABASE_LOOKUP_TYPE_FLAGS_MASK;
         const uint8_t * excluded = buf + 65;        
         uint32_t replyTunnelID = 0;
@@ -865,6 +894,85 @@ namespace data
             });
     }   
     
+    std::shared_ptr<const RouterInfo> NetDb::GetTieredRandomRouter (std::shared_ptr<const RouterInfo> compatibleWith) const
+    {
+        auto& rnd = i2p::context.GetRandomNumberGenerator ();
+        int weight = rnd.GenerateWord32 (0, 99), tier = ePeerTierFast;
+        while (tier < ePeerTierStandard && weight >= PEER_TIER_WEIGHTS[tier])
+        {
+            weight -= PEER_TIER_WEIGHTS[tier];
+            tier++;
+        }
+        // weight of empty tier goes to next one
+        for (; tier < ePeerTierStandard; tier++)
+        {
+            std::unique_lock<std::mutex> l(m_PeerTiersMutex);
+            auto& peers = m_PeerTiers[tier];
+            if (peers.empty ()) continue;
+            size_t ind = rnd.GenerateWord32 (0, peers.size () - 1);
+            for (size_t i = 0; i < peers.size (); i++)
+            {
+                auto& router = peers[(ind + i) % peers.size ()];
+                if (router != compatibleWith && !router->IsUnreachable () && router->IsCompatible (*compatibleWith))
+                    return router;
+            }
+        }
+        return GetHighBandwidthRandomRouter (compatibleWith);
+    }
+
+    std::vector<std::shared_ptr<const RouterInfo> > NetDb::GetPeerTier (PeerTier tier) const
+    {
+        std::unique_lock<std::mutex> l(m_PeerTiersMutex);
+        if (tier >= ePeerTierStandard) return std::vector<std::shared_ptr<const RouterInfo> > ();
+        return m_PeerTiers[tier];
+    }
+
+    void NetDb::ReorganizePeerTiers ()
+    {
+        typedef std::pair<double, std::shared_ptr<const RouterInfo> > RatedRouter;
+        std::vector<std::shared_ptr<const RouterInfo> > routers;
+        {
+            std::unique_lock<std::mutex> l(m_RouterInfosMutex);
+            routers.reserve (m_RouterInfos.size ());
+            for (auto& it: m_RouterInfos)
+                if (!it.second->IsHidden () && !it.second->IsUnreachable ())
+                    routers.push_back (it.second);
+        }
+        // rank only routers we have dealt with, don't load profiles of all known routers
+        std::vector<RatedRouter> measured, capable;
+        for (auto& it: routers)
+        {
+            auto profile = it->GetLoadedProfile ();
+            if (!profile || profile->IsDeclining ()) continue;
+            auto latency = profile->GetLatency ();
+            if (latency) measured.push_back (RatedRouter (latency, it));
+            auto capacity = profile->GetCapacity ();
+            if (capacity > 0) capable.push_back (RatedRouter (capacity, it));
+        }
+        // fast are better half of measured, high capacity are the best of others
+        std::sort (measured.begin (), measured.end (), 
+            [](const RatedRouter& r1, const RatedRouter& r2) { return r1.first < r2.first; });
+        std::sort (capable.begin (), capable.end (), 
+            [](const RatedRouter& r1, const RatedRouter& r2) { return r1.first > r2.first; });
+        std::vector<std::shared_ptr<const RouterInfo> > fast, highCapacity;
+        std::set<const RouterInfo *> fastRouters;
+        for (size_t i = 0; i < (measured.size () + 1)/2 && fast.size () < PEER_TIER_MAX_FAST; i++)
+        {
+            fast.push_back (measured[i].second);
+            fastRouters.insert (measured[i].second.get ());
+        }
+        for (auto& it: capable)
+        {
+            if (highCapacity.size () >= PEER_TIER_MAX_HIGH_CAPACITY) break;
+            if (!fastRouters.count (it.second.get ()))
+                highCapacity.push_back (it.second);
+        }
+        LogPrint (eLogDebug, "Peer tiers: ", fast.size (), " fast, ", highCapacity.size (), " high capacity");
+        std::unique_lock<std::mutex> l(m_PeerTiersMutex);
+        m_PeerTiers[ePeerTierFast].swap (fast);
+        m_PeerTiers[ePeerTierHighCapacity].swap (highCapacity);
+    }
+
     template<typename Filter>
     std::shared_ptr<const RouterInfo> NetDb::GetRandomRouter (Filter filter) const
     {
@@ -992,6 +1100,7 @@ namespace data
     
     void NetDb::ManageLeaseSets ()
     {
+        std::unique_lock<std::mutex> l(m_LeaseSetsMutex);
         for (auto it = m_LeaseSets.begin (); it != m_LeaseSets.end ();)
         {
             if (!it->second->HasNonExpiredLeases ()) // all leases expired
@@ -10,6 +10,7 @@
 #include <set>
 #include <map>
 #include <list>
+#include <vector>
 #include <string>
 #include <thread>
 #include <mutex>
@@ -53,6 +54,7 @@ namespace data
             std::shared_ptr<const RouterInfo> GetRandomRouter () const;
             std::shared_ptr<const RouterInfo> GetRandomRouter (std::shared_ptr<const RouterInfo> compatibleWith) const;
             std::shared_ptr<const RouterInfo> GetHighBandwidthRandomRouter (std::shared_ptr<const RouterInfo> compatibleWith) const;
+            std::shared_ptr<const RouterInfo> GetTieredRandomRouter (std::shared_ptr<const RouterInfo> compatibleWith) const; // by PEER_TIER_WEIGHTS
             std::shared_ptr<const RouterInfo> GetRandomPeerTestRouter () const;
             std::shared_ptr<const RouterInfo> GetRandomIntroducer () const;
             std::shared_ptr<const RouterInfo> GetClosestFloodfill (const IdentHash& destination, const std::set<IdentHash>& excluded) const;
@@ -64,11 +66,13 @@ namespace data
             void PostI2NPMsg (std::shared_ptr<const I2NPMessage> msg);
 
             void Reseed ();
+            void SetReseed (bool reseed) { m_IsReseedEnabled = reseed; }; // off for private networks
 
             // for web interface
             int GetNumRouters () const { return m_RouterInfos.size (); };
             int GetNumFloodfills () const { return m_Floodfills.size (); };
-            int GetNumLeaseSets () const { return m_LeaseSets.size (); };
+            int GetNumLeaseSets () const { std::unique_lock<std::mutex> l(m_LeaseSetsMutex); return m_LeaseSets.size (); };
+            std::vector<std::shared_ptr<const RouterInfo> > GetPeerTier (PeerTier tier) const;
             
         private:
 
@@ -80,19 +84,24 @@ namespace data
             void Publish ();
             void ManageLeaseSets ();
             void ManageRequests ();
+            void RegisterMetrics ();
+            void ReorganizePeerTiers ();
 
             template<typename Filter>
             std::shared_ptr<const RouterInfo> GetRandomRouter (Filter filter) const;    
         
         private:
 
-            std::map<IdentHash, std::shared_ptr<LeaseSet> > m_LeaseSets;
+            mutable std::mutex m_LeaseSetsMutex;
+            std::map<IdentHash, std::shared_ptr<LeaseSet> > m_LeaseSets; // replaced on update, never modified
             mutable std::mutex m_RouterInfosMutex;
             std::map<IdentHash, std::shared_ptr<RouterInfo> > m_RouterInfos;
             mutable std::mutex m_FloodfillsMutex;
             std::list<std::shared_ptr<RouterInfo> > m_Floodfills;
+            mutable std::mutex m_PeerTiersMutex;
+            std::vector<std::shared_ptr<const RouterInfo> > m_PeerTiers[ePeerTierStandard]; // standard are all others
             
-            bool m_IsRunning;
+            bool m_IsRunning, m_IsReseedEnabled;
             std::thread * m_Thread; 
             i2p::util::Queue<std::shared_ptr<const I2NPMessage> > m_Queue; // of I2NPDatabaseStoreMsg
 
@@ -1,147 +1,468 @@
+#include <string.h>
+#include <fstream>
 #include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/ini_parser.hpp>
 #include "util/base64.h"
-#include "util/util.h"
+#include "util/Log.h"
 #include "Profiling.h"
 
 namespace i2p
 {
 namespace data
 {
-    RouterProfile::RouterProfile (const IdentHash& identHash):
-        m_IdentHash (identHash), m_LastUpdateTime (boost::posix_time::second_clock::local_time()),
-        m_NumTunnelsAgreed (0), m_NumTunnelsDeclined (0), m_NumTunnelsNonReplied (0),
-        m_NumTimesTaken (0), m_NumTimesRejected (0) 
+    const char PEER_PROFILES_MAGIC[8] = { 'i', '2', 'p', 'd', 'p', 'r', 'o', 'f' };
+    const uint32_t PEER_PROFILES_BYTE_ORDER = 0x01020304;
+
+    ProfileStorage profileStorage;
+
+    static uint64_t ToSeconds (const boost::posix_time::ptime& t)
     {
-    }
+        return (t - boost::posix_time::from_time_t (0)).total_seconds ();
+    }   
 
-    boost::posix_time::ptime RouterProfile::GetTime () const
+    // profile of previous versions, returns false if can't be read or expired 
+    static bool ReadINIProfile (const boost::filesystem::path& filename, ProfileRecord& record)
     {
-        return boost::posix_time::second_clock::local_time();
+        std::string name = filename.stem ().string ();
+        if (name.compare (0, strlen (PEER_PROFILE_PREFIX), PEER_PROFILE_PREFIX)) return false;
+        IdentHash identHash;
+        identHash.FromBase64 (name.substr (strlen (PEER_PROFILE_PREFIX)));
+        boost::property_tree::ptree pt;
+        try
+        {
+            boost::property_tree::read_ini (filename.string (), pt);
+            auto t = pt.get (PEER_PROFILE_LAST_UPDATE_TIME, "");
+            if (!t.length ()) return false;
+            auto lastUpdateTime = boost::posix_time::time_from_string (t);
+            if ((boost::posix_time::second_clock::local_time() - lastUpdateTime).hours () >= PEER_PROFILE_EXPIRATION_TIMEOUT)
+                return false;
+            memset (&record, 0, sizeof (record));
+            memcpy (record.identHash, identHash, 32);
+            record.lastUpdateTime = ToSeconds (lastUpdateTime);
+            record.numTunnelsAgreed = pt.get (std::string (PEER_PROFILE_SECTION_PARTICIPATION) + "." + PEER_PROFILE_PARTICIPATION_AGREED, 0);
+            record.numTunnelsDeclined = pt.get (std::string (PEER_PROFILE_SECTION_PARTICIPATION) + "." + PEER_PROFILE_PARTICIPATION_DECLINED, 0);
+            record.numTunnelsNonReplied = pt.get (std::string (PEER_PROFILE_SECTION_PARTICIPATION) + "." + PEER_PROFILE_PARTICIPATION_NON_REPLIED, 0);
+            record.numTimesTaken = pt.get (std::string (PEER_PROFILE_SECTION_USAGE) + "." + PEER_PROFILE_USAGE_TAKEN, 0);
+            record.numTimesRejected = pt.get (std::string (PEER_PROFILE_SECTION_USAGE) + "." + PEER_PROFILE_USAGE_REJECTED, 0);
+        }
+        catch (std::exception& ex)
+        {
+            LogPrint (eLogError, "Can't read ", filename, ": ", ex.what ());
+            return false;
+        }
+        return true;
     }   
+
+    // record of version 1 file, before measurements were added
+    struct ProfileRecordV1
+    {
+        uint8_t identHash[32];
+        uint64_t lastUpdateTime;
+        uint32_t numTunnelsAgreed;
+        uint32_t numTunnelsDeclined;
+        uint32_t numTunnelsNonReplied;
+        uint32_t numTimesTaken;
+        uint32_t numTimesRejected;
+        uint32_t reserved;
+    };
+
+    // used records of version 1 file, measurements are unknown
+    static bool ReadV1Profiles (const std::string& filename, std::vector<ProfileRecord>& records)
+    {
+        std::ifstream f (filename, std::ifstream::binary);
+        ProfileStorageHeader header;
+        if (!f.read ((char *)&header, sizeof (header)) || memcmp (header.magic, PEER_PROFILES_MAGIC, sizeof (header.magic)) ||
+            header.byteOrder != PEER_PROFILES_BYTE_ORDER || header.version != 1 || header.recordSize != sizeof (ProfileRecordV1))
+            return false;
+        ProfileRecordV1 v1;
+        for (uint32_t i = 0; i < header.capacity && f.read ((char *)&v1, sizeof (v1)); i++)
+        {
+            if (!v1.lastUpdateTime) continue; // free
+            ProfileRecord record;
+            memset (&record, 0, sizeof (record));
+            memcpy (record.identHash, v1.identHash, 32);
+            record.lastUpdateTime = v1.lastUpdateTime;
+            record.numTunnelsAgreed = v1.numTunnelsAgreed;
+            record.numTunnelsDeclined = v1.numTunnelsDeclined;
+            record.numTunnelsNonReplied = v1.numTunnelsNonReplied;
+            record.numTimesTaken = v1.numTimesTaken;
+            record.numTimesRejected = v1.numTimesRejected;
+            records.push_back (record);
+        }
+        return true;
+    }
+
+    ProfileStorage::ProfileStorage (): m_FirstDirty (1), m_LastDirty (0)
+    {
+    }
+
+    ProfileStorage::~ProfileStorage ()
+    {
+        Close ();
+    }
         
-    void RouterProfile::UpdateTime ()
+    bool ProfileStorage::Open (const boost::filesystem::path& dataDir)
     {
-        m_LastUpdateTime = GetTime ();
+        std::unique_lock<std::mutex> l(m_Mutex);
+        if (m_Region) return true;
+        m_FileName = (dataDir / PEER_PROFILES_FILE).string ();
+        std::vector<ProfileRecord> upgraded;
+        if (!boost::filesystem::exists (m_FileName) || !Map ())
+        {
+            if (boost::filesystem::exists (m_FileName) && ReadV1Profiles (m_FileName, upgraded))
+                LogPrint (eLogInfo, "Upgrading ", upgraded.size (), " peer profiles from version 1");
+            uint32_t capacity = PEER_PROFILES_INITIAL_CAPACITY;
+            while (capacity < upgraded.size ()) capacity *= 2;
+            if (!Create (capacity) || !Map ())
+            {
+                LogPrint (eLogError, "Can't create ", m_FileName);
+                return false;
+            }
+        }
+        BuildIndex ();
+        if (!upgraded.empty ())
+        {
+            for (auto& it: upgraded)
+                SaveRecord (it);
+            FlushRecords ();
+        }
+        auto directory = dataDir / PEER_PROFILES_DIRECTORY;
+        if (boost::filesystem::exists (directory))
+            MigrateINIProfiles (directory);
+        LogPrint (eLogInfo, m_Index.size (), " peer profiles loaded");
+        return true;
+    }
+
+    void ProfileStorage::Close ()
+    {
+        std::unique_lock<std::mutex> l(m_Mutex);
+        if (!m_Region) return;
+        FlushRecords ();
+        m_Region.reset ();
+        m_File.reset ();
+        m_Index.clear ();
+        m_FreeRecords.clear ();
     }   
-        
-    void RouterProfile::Save ()
+
+    bool ProfileStorage::Create (uint32_t capacity)
     {
-        // fill sections
-        boost::property_tree::ptree participation;
-        participation.put (PEER_PROFILE_PARTICIPATION_AGREED, m_NumTunnelsAgreed);
-        participation.put (PEER_PROFILE_PARTICIPATION_DECLINED, m_NumTunnelsDeclined);
-        participation.put (PEER_PROFILE_PARTICIPATION_NON_REPLIED, m_NumTunnelsNonReplied);
-        boost::property_tree::ptree usage;
-        usage.put (PEER_PROFILE_USAGE_TAKEN, m_NumTimesTaken);
-        usage.put (PEER_PROFILE_USAGE_REJECTED, m_NumTimesRejected);
-        // fill property tree
-        boost::property_tree::ptree pt;
-        pt.put (PEER_PROFILE_LAST_UPDATE_TIME, boost::posix_time::to_simple_string (m_LastUpdateTime));
-        pt.put_child (PEER_PROFILE_SECTION_PARTICIPATION, participation);
-        pt.put_child (PEER_PROFILE_SECTION_USAGE, usage);       
+        ProfileStorageHeader header;
+        memset (&header, 0, sizeof (header));
+        memcpy (header.magic, PEER_PROFILES_MAGIC, sizeof (header.magic));
+        header.byteOrder = PEER_PROFILES_BYTE_ORDER;
+        header.version = PEER_PROFILES_FILE_VERSION;
+        header.recordSize = sizeof (ProfileRecord);
+        header.capacity = capacity;
+        try
+        {
+            std::ofstream f (m_FileName, std::ofstream::binary | std::ofstream::out | std::ofstream::trunc);
+            if (!f.is_open ()) return false;
+            f.write ((const char *)&header, sizeof (header));
+            f.close ();
+            // zero records are free
+            boost::filesystem::resize_file (m_FileName, sizeof (header) + (uint64_t)capacity*sizeof (ProfileRecord));
+        }
+        catch (std::exception& ex)
+        {
+            LogPrint (eLogError, "Can't create ", m_FileName, ": ", ex.what ());
+            return false;
+        }
+        return true;
+    }
 
-        // save to file
-        auto path = i2p::util::filesystem::GetDefaultDataDir() / PEER_PROFILES_DIRECTORY;
-        if (!boost::filesystem::exists (path))
+    bool ProfileStorage::Map ()
+    {
+        try
         {
-            // Create directory is necessary
-            if (!boost::filesystem::create_directory (path))
-            {   
-                LogPrint (eLogError, "Failed to create directory ", path);
-                return;
-            }           
-            const char * chars = i2p::util::GetBase64SubstitutionTable (); // 64 bytes
-            for (int i = 0; i < 64; i++)
+            auto size = boost::filesystem::file_size (m_FileName);
+            if (size < sizeof (ProfileStorageHeader)) return false;
+            std::unique_ptr<boost::interprocess::file_mapping> file (
+                new boost::interprocess::file_mapping (m_FileName.c_str (), boost::interprocess::read_write));
+            std::unique_ptr<boost::interprocess::mapped_region> region (
+                new boost::interprocess::mapped_region (*file, boost::interprocess::read_write));
+            auto header = (const ProfileStorageHeader *)region->get_address ();
+            if (memcmp (header->magic, PEER_PROFILES_MAGIC, sizeof (header->magic)) || 
+                header->byteOrder != PEER_PROFILES_BYTE_ORDER || header->version != PEER_PROFILES_FILE_VERSION || 
+                header->recordSize != sizeof (ProfileRecord) || 
+                size < sizeof (ProfileStorageHeader) + (uint64_t)header->capacity*sizeof (ProfileRecord)) // larger if growth was interrupted
             {
-                auto path1 = path / (std::string ("p") + chars[i]);
-                if (!boost::filesystem::create_directory (path1)) 
-                {
-                    LogPrint (eLogError, "Failed to create directory ", path1);
-                    return;
-                }           
-            }               
-        }
-        std::string base64 = m_IdentHash.ToBase64 ();
-        path = path / (std::string ("p") + base64[0]);
-        auto filename = path / (std::string (PEER_PROFILE_PREFIX) + base64 + ".txt");
+                LogPrint (eLogWarning, m_FileName, " has unknown format");
+                return false;
+            }
+            m_File = std::move (file);
+            m_Region = std::move (region);
+        }
+        catch (std::exception& ex)
+        {
+            LogPrint (eLogError, "Can't map ", m_FileName, ": ", ex.what ());
+            return false;
+        }
+        return true;
+    }
+
+    bool ProfileStorage::Grow ()
+    {
+        uint32_t capacity = GetHeader ()->capacity, newCapacity = capacity*2;
+        m_Region.reset (); // unmapped pages are written by OS anyway
+        m_File.reset ();
+        bool isResized = true;
         try
         {
-            boost::property_tree::write_ini (filename.string (), pt);
+            boost::filesystem::resize_file (m_FileName, sizeof (ProfileStorageHeader) + (uint64_t)newCapacity*sizeof (ProfileRecord));
         }
         catch (std::exception& ex)
         {
-            LogPrint (eLogError, "Can't write ", filename, ": ", ex.what ());
+            LogPrint (eLogError, "Can't resize ", m_FileName, ": ", ex.what ());
+            isResized = false;
         }
-    }   
+        if (!Map ())
+        {
+            // profiles are kept in memory only until restart
+            LogPrint (eLogError, "Peer profiles are not saved anymore");
+            m_Index.clear ();
+            m_FreeRecords.clear ();
+            return false;
+        }
+        if (!isResized) return false; // existing records are still saved
+        // header is updated last, file stays valid if we crash before
+        GetHeader ()->capacity = newCapacity;
+        if (!m_Region->flush (0, sizeof (ProfileStorageHeader)))
+            LogPrint (eLogWarning, "Can't flush ", m_FileName);
+        for (uint32_t i = newCapacity; i > capacity; i--)
+            m_FreeRecords.push_back (i - 1);
+        LogPrint (eLogInfo, "Peer profiles storage grown to ", newCapacity, " records");
+        return true;
+    }
 
-    void RouterProfile::Load ()
+    void ProfileStorage::BuildIndex ()
     {
-        std::string base64 = m_IdentHash.ToBase64 ();
-        auto path = i2p::util::filesystem::GetDefaultDataDir() / PEER_PROFILES_DIRECTORY;
-        path /= std::string ("p") + base64[0];
-        auto filename = path / (std::string (PEER_PROFILE_PREFIX) + base64 + ".txt");
-        if (boost::filesystem::exists (filename))
-        {   
-            boost::property_tree::ptree pt;
-            try
+        m_Index.clear ();
+        m_FreeRecords.clear ();
+        auto records = GetRecords ();
+        // free records are taken from back, so lowest first
+        for (uint32_t i = GetHeader ()->capacity; i > 0; i--)
+        {
+            auto& record = records[i - 1];
+            if (record.lastUpdateTime)
+                m_Index[IdentHash (record.identHash)] = i - 1;
+            else
+                m_FreeRecords.push_back (i - 1);
+        }
+    }
+
+    void ProfileStorage::MigrateINIProfiles (const boost::filesystem::path& directory)
+    {
+        int num = 0;
+        try
+        {
+            boost::filesystem::directory_iterator end;
+            for (boost::filesystem::directory_iterator it (directory); it != end; ++it)
             {
-                boost::property_tree::read_ini (filename.string (), pt);
+                if (!boost::filesystem::is_directory (it->status ())) continue;
+                for (boost::filesystem::directory_iterator it1 (it->path ()); it1 != end; ++it1)
+                {
+                    ProfileRecord record;
+                    if (ReadINIProfile (it1->path (), record))
+                    {
+                        SaveRecord (record);
+                        num++;
+                    }
+                }
             }
-            catch (std::exception& ex)
+            FlushRecords ();
+            boost::filesystem::remove_all (directory);
+        }
+        catch (std::exception& ex)
+        {
+            LogPrint (eLogError, "Can't migrate ", directory, ": ", ex.what ());
+        }
+        LogPrint (eLogInfo, num, " peer profiles migrated from ", directory);
+    }
+
+    ProfileStorageHeader * ProfileStorage::GetHeader () const
+    {
+        return (ProfileStorageHeader *)m_Region->get_address ();
+    }
+
+    ProfileRecord * ProfileStorage::GetRecords () const
+    {
+        return (ProfileRecord *)((uint8_t *)m_Region->get_address () + sizeof (ProfileStorageHeader));
+    }
+
+    bool ProfileStorage::Load (const IdentHash& identHash, ProfileRecord& record) const
+    {
+        std::unique_lock<std::mutex> l(m_Mutex);
+        if (!m_Region) return false;
+        auto it = m_Index.find (identHash);
+        if (it == m_Index.end ()) return false;
+        record = GetRecords ()[it->second];
+        return true;
+    }
+
+    void ProfileStorage::Save (const ProfileRecord& record)
+    {
+        std::unique_lock<std::mutex> l(m_Mutex);
+        SaveRecord (record);
+    }
+
+    void ProfileStorage::SaveRecord (const ProfileRecord& record)
+    {
+        if (!m_Region || !record.lastUpdateTime) return; // zero time means free record
+        IdentHash identHash (record.identHash);
+        uint32_t ind;
+        auto it = m_Index.find (identHash);
+        if (it != m_Index.end ())
+            ind = it->second;
+        else
+        {
+            if (m_FreeRecords.empty () && !Grow ()) return;
+            ind = m_FreeRecords.back ();
+            m_FreeRecords.pop_back ();
+            m_Index[identHash] = ind;
+        }
+        GetRecords ()[ind] = record;
+        SetDirty (ind);
+    }
+
+    void ProfileStorage::SetDirty (uint32_t ind)
+    {
+        if (m_FirstDirty > m_LastDirty)
+            m_FirstDirty = m_LastDirty = ind;
+        else if (ind < m_FirstDirty)
+            m_FirstDirty = ind;
+        else if (ind > m_LastDirty)
+            m_LastDirty = ind;
+    }
+
+    void ProfileStorage::Flush ()
+    {
+        std::unique_lock<std::mutex> l(m_Mutex);
+        FlushRecords ();
+    }   
+
+    void ProfileStorage::FlushRecords ()
+    {
+        if (!m_Region || m_FirstDirty > m_LastDirty) return;
+        // msync requires page aligned address
+        size_t pageSize = boost::interprocess::mapped_region::get_page_size ();
+        size_t begin = sizeof (ProfileStorageHeader) + m_FirstDirty*sizeof (ProfileRecord),
+            end = sizeof (ProfileStorageHeader) + (m_LastDirty + 1)*sizeof (ProfileRecord);
+        begin -= begin % pageSize;
+        if (!m_Region->flush (begin, end - begin))
+            LogPrint (eLogWarning, "Can't flush ", m_FileName);
+        m_FirstDirty = 1; m_LastDirty = 0;
+    }   
+
+    int ProfileStorage::DeleteObsolete (uint64_t expirationTime)
+    {
+        std::unique_lock<std::mutex> l(m_Mutex);
+        if (!m_Region) return 0;
+        int num = 0;
+        auto records = GetRecords ();
+        for (auto it = m_Index.begin (); it != m_Index.end ();)
+        {
+            auto& record = records[it->second];
+            if (record.lastUpdateTime < expirationTime)
             {
-                LogPrint (eLogError, "Can't read ", filename, ": ", ex.what ());
-                return;
+                memset (&record, 0, sizeof (record));
+                SetDirty (it->second);
+                m_FreeRecords.push_back (it->second);
+                it = m_Index.erase (it);
+                num++;
             }
-            try
+            else
+                it++;
+        }
+        return num;
+    }
+
+    size_t ProfileStorage::GetNumProfiles () const
+    {
+        std::unique_lock<std::mutex> l(m_Mutex);
+        return m_Index.size ();
+    }
+
+    RouterProfile::RouterProfile (const IdentHash& identHash):
+        m_IdentHash (identHash), m_LastUpdateTime (boost::posix_time::second_clock::local_time()),
+        m_NumTunnelsAgreed (0), m_NumTunnelsDeclined (0), m_NumTunnelsNonReplied (0),
+        m_NumTimesTaken (0), m_NumTimesRejected (0), m_NumTestsFailed (0), 
+        m_BuildLatency (0), m_TestRTT (0), m_BytesPerTunnel (0), m_NumBytesCarried (0), m_IsUpdated (false)
+    {
+    }
+
+    boost::posix_time::ptime RouterProfile::GetTime () const
+    {
+        return boost::posix_time::second_clock::local_time();
+    }   
+        
+    void RouterProfile::UpdateTime ()
+    {
+        m_LastUpdateTime = GetTime ();
+        m_IsUpdated = true;
+    }   
+        
+    void RouterProfile::Save ()
+    {
+        if (!m_IsUpdated) return;
+        ProfileRecord record;
+        memset (&record, 0, sizeof (record));
+        memcpy (record.identHash, m_IdentHash, 32);
+        record.lastUpdateTime = ToSeconds (m_LastUpdateTime);
+        record.numTunnelsAgreed = m_NumTunnelsAgreed;
+        record.numTunnelsDeclined = m_NumTunnelsDeclined;
+        record.numTunnelsNonReplied = m_NumTunnelsNonReplied;
+        record.numTimesTaken = m_NumTimesTaken;
+        record.numTimesRejected = m_NumTimesRejected;
+        record.numTestsFailed = m_NumTestsFailed;
+        record.buildLatency = m_BuildLatency;
+        record.testRTT = m_TestRTT;
+        record.bytesPerTunnel = m_BytesPerTunnel;
+        record.numBytesCarried = m_NumBytesCarried;
+        profileStorage.Save (record);
+        m_IsUpdated = false;
+    }   
+
+    void RouterProfile::Load ()
+    {
+        ProfileRecord record;
+        if (profileStorage.Load (m_IdentHash, record))
+        {   
+            m_LastUpdateTime = boost::posix_time::from_time_t (record.lastUpdateTime);
+            if ((GetTime () - m_LastUpdateTime).hours () < PEER_PROFILE_EXPIRATION_TIMEOUT) 
             {   
-                auto t = pt.get (PEER_PROFILE_LAST_UPDATE_TIME, "");
-                if (t.length () > 0)
-                    m_LastUpdateTime = boost::posix_time::time_from_string (t);
-                if ((GetTime () - m_LastUpdateTime).hours () < PEER_PROFILE_EXPIRATION_TIMEOUT) 
-                {   
-                    try
-                    {   
-                        // read participations
-                        auto participations = pt.get_child (PEER_PROFILE_SECTION_PARTICIPATION);
-                        m_NumTunnelsAgreed = participations.get (PEER_PROFILE_PARTICIPATION_AGREED, 0);
-                        m_NumTunnelsDeclined = participations.get (PEER_PROFILE_PARTICIPATION_DECLINED, 0);
-                        m_NumTunnelsNonReplied = participations.get (PEER_PROFILE_PARTICIPATION_NON_REPLIED, 0);
-                    }   
-                    catch (boost::property_tree::ptree_bad_path& ex)
-                    {
-                        LogPrint (eLogWarning, "Missing section ", PEER_PROFILE_SECTION_PARTICIPATION);
-                    }   
-                    try
-                    {   
-                        // read usage
-                        auto usage = pt.get_child (PEER_PROFILE_SECTION_USAGE);
-                        m_NumTimesTaken = usage.get (PEER_PROFILE_USAGE_TAKEN, 0);
-                        m_NumTimesRejected = usage.get (PEER_PROFILE_USAGE_REJECTED, 0);
-                    }   
-                    catch (boost::property_tree::ptree_bad_path& ex)
-                    {
-                        LogPrint (eLogWarning, "Missing section ", PEER_PROFILE_SECTION_USAGE);
-                    }   
-                }   
-                else
-                    *this = RouterProfile (m_IdentHash);
-            }   
-            catch (std::exception& ex)
-            {
-                LogPrint (eLogError, "Can't read profile ", base64, " :", ex.what ());
+                m_NumTunnelsAgreed = record.numTunnelsAgreed;
+                m_NumTunnelsDeclined = record.numTunnelsDeclined;
+                m_NumTunnelsNonReplied = record.numTunnelsNonReplied;
+                m_NumTimesTaken = record.numTimesTaken;
+                m_NumTimesRejected = record.numTimesRejected;
+                m_NumTestsFailed = record.numTestsFailed;
+                m_BuildLatency = record.buildLatency;
+                m_TestRTT = record.testRTT;
+                m_BytesPerTunnel = record.bytesPerTunnel;
+                m_NumBytesCarried = record.numBytesCarried;
             }   
+            else
+                *this = RouterProfile (m_IdentHash);
         }   
     }   
         
-    void RouterProfile::TunnelBuildResponse (uint8_t ret)
+    static uint32_t Smooth (uint32_t average, uint32_t value)
+    {
+        if (!average) return value;
+        return ((uint64_t)average*(PEER_PROFILE_SMOOTHING - 1) + value)/PEER_PROFILE_SMOOTHING;
+    }   
+
+    void RouterProfile::TunnelBuildResponse (uint8_t ret, uint32_t latency)
     {
         UpdateTime ();
         if (ret > 0)
             m_NumTunnelsDeclined++;
         else
             m_NumTunnelsAgreed++;
+        if (latency) m_BuildLatency = Smooth (m_BuildLatency, latency);
     }   
 
     void RouterProfile::TunnelNonReplied ()
@@ -150,6 +471,45 @@ namespace data
         UpdateTime ();
     }   
 
+    void RouterProfile::TunnelTested (uint32_t rtt)
+    {
+        if (!rtt) rtt = 1; // 0 means unknown
+        m_TestRTT = Smooth (m_TestRTT, rtt);
+        UpdateTime ();
+    }   
+
+    void RouterProfile::TunnelTestFailed ()
+    {
+        m_NumTestsFailed++;
+        UpdateTime ();
+    }   
+
+    void RouterProfile::TunnelExpired (uint64_t numBytes)
+    {
+        m_NumBytesCarried += numBytes;
+        m_BytesPerTunnel = Smooth (m_BytesPerTunnel, numBytes < 0xFFFFFFFF ? numBytes : 0xFFFFFFFF);
+        UpdateTime ();
+    }   
+
+    uint32_t RouterProfile::GetLatency () const
+    {
+        return m_TestRTT ? m_TestRTT : m_BuildLatency;
+    }   
+
+    double RouterProfile::GetCapacity () const
+    {
+        // agreed tunnels minus failures, traffic carried by every tunnel adds to it
+        double capacity = (double)m_NumTunnelsAgreed - m_NumTunnelsDeclined - m_NumTestsFailed - m_NumTunnelsNonReplied/2.0;
+        if (capacity <= 0) return 0;
+        return capacity*(1.0 + (double)m_BytesPerTunnel/PEER_PROFILE_CAPACITY_UNIT);
+    }   
+
+    double RouterProfile::GetBuildSuccessProbability () const
+    {
+        return (double)(m_NumTunnelsAgreed + PEER_PROFILE_PRIOR_AGREED)/
+            (m_NumTunnelsAgreed + m_NumTunnelsDeclined + m_NumTunnelsNonReplied + PEER_PROFILE_PRIOR_REQUESTS);
+    }   
+
     bool RouterProfile::IsLowPartcipationRate () const
     {
         return 4*m_NumTunnelsAgreed < m_NumTunnelsDeclined; // < 20% rate
@@ -173,6 +533,7 @@ namespace data
             isBad = false;
         }       
         if (isBad) m_NumTimesRejected++; else m_NumTimesTaken++;
+        m_IsUpdated = true;
         return isBad;   
     }
         
@@ -185,28 +546,8 @@ namespace data
 
     void DeleteObsoleteProfiles ()
     {
-        int num = 0;
-        auto ts = boost::posix_time::second_clock::local_time();
-        boost::filesystem::path p (i2p::util::filesystem::GetDataDir()/PEER_PROFILES_DIRECTORY);
-        if (boost::filesystem::exists (p))
-        {
-            boost::filesystem::directory_iterator end;
-            for (boost::filesystem::directory_iterator it (p); it != end; ++it)
-            {
-                if (boost::filesystem::is_directory (it->status()))
-                {
-                    for (boost::filesystem::directory_iterator it1 (it->path ()); it1 != end; ++it1)
-                    {
-                        auto lastModified = boost::posix_time::from_time_t (boost::filesystem::last_write_time (it1->path ()));
-                        if ((ts - lastModified).hours () >= PEER_PROFILE_EXPIRATION_TIMEOUT)
-                        {   
-                            boost::filesystem::remove (it1->path ());
-                            num++;
-                        }   
-                    }   
-                }
-            }   
-        }
+        auto ts = ToSeconds (boost::posix_time::second_clock::local_time());
+        int num = profileStorage.DeleteObsolete (ts - PEER_PROFILE_EXPIRATION_TIMEOUT*3600);
         LogPrint (eLogInfo, num, " obsolete profiles deleted");
     }   
 }       
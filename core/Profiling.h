@@ -1,14 +1,32 @@
 #ifndef PROFILING_H__
 #define PROFILING_H__
 
+#include <inttypes.h>
 #include <memory>
+#include <mutex>
+#include <map>
+#include <vector>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/filesystem.hpp>
 #include "Identity.h"
 
+namespace boost
+{
+namespace interprocess
+{
+    class file_mapping;
+    class mapped_region;
+}
+}
+
 namespace i2p
 {
 namespace data
 {   
+    const char PEER_PROFILES_FILE[] = "peerProfiles.dat";
+    const uint32_t PEER_PROFILES_FILE_VERSION = 2;
+    const uint32_t PEER_PROFILES_INITIAL_CAPACITY = 4096; // records, grows twice if full
+    // INI profiles of previous versions, migrated to PEER_PROFILES_FILE
     const char PEER_PROFILES_DIRECTORY[] = "peerProfiles";
     const char PEER_PROFILE_PREFIX[] = "profile-";
     // sections
@@ -23,7 +41,98 @@ namespace data
     const char PEER_PROFILE_USAGE_REJECTED[] = "rejected";
 
     const int PEER_PROFILE_EXPIRATION_TIMEOUT = 72; // in hours (3 days)
+    const int PEER_PROFILE_SMOOTHING = 8; // new measurement counts as 1/8 of average
+    const uint32_t PEER_PROFILE_CAPACITY_UNIT = 65536; // every 64K of average traffic per tunnel counts agreed tunnels once more
+    // unknown peer agreed 3 of 4 build requests, for success probability
+    const int PEER_PROFILE_PRIOR_AGREED = 3;
+    const int PEER_PROFILE_PRIOR_REQUESTS = 4;
+
+    enum PeerTier
+    {
+        ePeerTierFast = 0, // lowest tunnel test RTT or build latency
+        ePeerTierHighCapacity, // most tunnels agreed and traffic carried
+        ePeerTierStandard, // any high bandwidth router
+        eNumPeerTiers
+    };
+    const int PEER_TIER_WEIGHTS[eNumPeerTiers] = { 60, 30, 10 }; // in percents, for hops of client tunnels
+    const size_t PEER_TIER_MAX_FAST = 30;
+    const size_t PEER_TIER_MAX_HIGH_CAPACITY = 75;
     
+    // fixed size record of PEER_PROFILES_FILE, in host byte order
+    struct ProfileRecord
+    {
+        uint8_t identHash[32];
+        uint64_t lastUpdateTime; // seconds since epoch, 0 if slot is free
+        uint64_t numBytesCarried;
+        uint32_t numTunnelsAgreed;
+        uint32_t numTunnelsDeclined;
+        uint32_t numTunnelsNonReplied;
+        uint32_t numTimesTaken;
+        uint32_t numTimesRejected;
+        uint32_t numTestsFailed;
+        uint32_t buildLatency; // in milliseconds
+        uint32_t testRTT; // in milliseconds
+        uint32_t bytesPerTunnel;
+        uint32_t reserved[3];
+    };  
+
+    struct ProfileStorageHeader
+    {
+        char magic[8];
+        uint32_t byteOrder; // detects file from other architecture
+        uint32_t version;
+        uint32_t recordSize;
+        uint32_t capacity; // number of records after header
+        uint8_t reserved[8];
+    };  
+
+    // profiles of all routers in one memory mapped file, indexed by ident hash in memory.
+    // Save only copies record, dirty records are written to disk by Flush
+    class ProfileStorage
+    {
+        public:
+
+            ProfileStorage ();
+            ~ProfileStorage ();
+
+            bool Open (const boost::filesystem::path& dataDir); // migrates INI profiles if presented
+            void Close ();
+            bool IsOpen () const { return m_Region != nullptr; };
+
+            bool Load (const IdentHash& identHash, ProfileRecord& record) const;
+            void Save (const ProfileRecord& record);
+            void Flush ();
+            int DeleteObsolete (uint64_t expirationTime); // older than expirationTime in seconds since epoch
+            
+            size_t GetNumProfiles () const;
+
+        private:
+
+            // called with m_Mutex locked
+            bool Map ();
+            bool Create (uint32_t capacity);
+            bool Grow ();
+            void BuildIndex ();
+            void MigrateINIProfiles (const boost::filesystem::path& directory);
+            void SaveRecord (const ProfileRecord& record);
+            void SetDirty (uint32_t ind);
+            void FlushRecords ();
+            ProfileRecord * GetRecords () const;
+            ProfileStorageHeader * GetHeader () const;
+
+        private:
+
+            mutable std::mutex m_Mutex;
+            std::string m_FileName;
+            std::unique_ptr<boost::interprocess::file_mapping> m_File;
+            std::unique_ptr<boost::interprocess::mapped_region> m_Region;
+            std::map<IdentHash, uint32_t> m_Index; // ident hash -> record
+            std::vector<uint32_t> m_FreeRecords;
+            uint32_t m_FirstDirty, m_LastDirty; // range of records to flush, first > last if nothing
+    };
+
+    extern ProfileStorage profileStorage;
+
     class RouterProfile
     {
         public:
@@ -31,13 +140,30 @@ namespace data
             RouterProfile (const IdentHash& identHash);
             RouterProfile& operator= (const RouterProfile& ) = default;
             
-            void Save ();
+            void Save (); // if updated
             void Load ();
 
             bool IsBad ();
+            bool IsDeclining () const { return IsAlwaysDeclining () || IsLowPartcipationRate (); };
             
-            void TunnelBuildResponse (uint8_t ret);
+            void TunnelBuildResponse (uint8_t ret, uint32_t latency); // latency of reply in milliseconds
             void TunnelNonReplied ();
+            void TunnelTested (uint32_t rtt); // in milliseconds
+            void TunnelTestFailed ();
+            void TunnelExpired (uint64_t numBytes); // carried by tunnel through this peer
+
+            // smoothed measurements, 0 if unknown
+            uint32_t GetBuildLatency () const { return m_BuildLatency; };
+            uint32_t GetTestRTT () const { return m_TestRTT; };
+            uint32_t GetBytesPerTunnel () const { return m_BytesPerTunnel; };
+            uint64_t GetNumBytesCarried () const { return m_NumBytesCarried; };
+            uint32_t GetNumTunnelsAgreed () const { return m_NumTunnelsAgreed; };
+            uint32_t GetNumTunnelsDeclined () const { return m_NumTunnelsDeclined; };
+            uint32_t GetNumTestsFailed () const { return m_NumTestsFailed; };
+            // for tiers
+            uint32_t GetLatency () const; // test RTT if known, build latency otherwise
+            double GetCapacity () const;
+            double GetBuildSuccessProbability () const; // of agreeing to build request
 
         private:
 
@@ -59,6 +185,11 @@ namespace data
             // usage
             uint32_t m_NumTimesTaken;
             uint32_t m_NumTimesRejected;    
+            // measurements
+            uint32_t m_NumTestsFailed;
+            uint32_t m_BuildLatency, m_TestRTT, m_BytesPerTunnel;
+            uint64_t m_NumBytesCarried;
+            bool m_IsUpdated; // since last Save
     };  
 
     std::shared_ptr<RouterProfile> GetRouterProfile (const IdentHash& identHash); 
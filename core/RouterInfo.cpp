@@ -658,9 +658,15 @@ namespace data
 
     std::shared_ptr<RouterProfile> RouterInfo::GetProfile () const 
     {
-        if (!m_Profile)
-            m_Profile = GetRouterProfile (GetIdentHash ());
-        return m_Profile;
+        auto profile = GetLoadedProfile ();
+        if (!profile)
+        {
+            profile = GetRouterProfile (GetIdentHash ());
+            std::shared_ptr<RouterProfile> expected;
+            if (!std::atomic_compare_exchange_strong (&m_Profile, &expected, profile))
+                profile = expected; // loaded by another thread meanwhile
+        }
+        return profile;
     }   
 }
 }
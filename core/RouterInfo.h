@@ -4,6 +4,7 @@
 #include <inttypes.h>
 #include <string>
 #include <map>
+#include <memory>
 #include <vector>
 #include <iostream>
 #include <boost/asio.hpp>
@@ -139,8 +140,9 @@ namespace data
             void SetUpdated (bool updated) { m_IsUpdated = updated; }; 
             void SaveToFile (const std::string& fullPath);
 
-            std::shared_ptr<RouterProfile> GetProfile () const;
-            void SaveProfile () { if (m_Profile) m_Profile->Save (); };
+            std::shared_ptr<RouterProfile> GetProfile () const; // loads profile if not loaded yet, thread-safe
+            std::shared_ptr<RouterProfile> GetLoadedProfile () const { return std::atomic_load (&m_Profile); }; // nullptr if not loaded
+            void SaveProfile () { auto profile = GetLoadedProfile (); if (profile) profile->Save (); };
             
             void Update (const uint8_t * buf, int len);
             void DeleteBuffer () { delete[] m_Buffer; m_Buffer = nullptr; };
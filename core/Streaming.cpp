@@ -1,9 +1,11 @@
-#include <cryptopp/gzip.h>
 #include "util/Log.h"
 #include "RouterInfo.h"
 #include "RouterContext.h"
 #include "tunnel/Tunnel.h"
 #include "util/Timestamp.h"
+#include "util/Metrics.h"
+#include "util/Compression.h"
+#include "util/util.h"
 #include "Destination.h"
 #include "Streaming.h"
 
@@ -11,48 +13,79 @@ namespace i2p
 {
 namespace stream
 {
+    struct StreamingMetrics
+    {
+        i2p::util::Gauge& numStreams;
+        i2p::util::Counter& numSentPackets, & numResentPackets, & numReceivedPackets, & numDuplicatePackets;
+        i2p::util::Counter& numTimedOutStreams, & numDroppedPackets;
+        i2p::util::Histogram& rtt;
+    };
+
+    static StreamingMetrics& GetStreamingMetrics ()
+    {
+        auto& metrics = i2p::util::metrics;
+        static StreamingMetrics streamingMetrics
+        {
+            metrics.GetGauge ("i2pd_streaming_streams", "Streams of all local destinations"),
+            metrics.GetCounter ("i2pd_streaming_sent_packets_total", "Streaming packets sent including resends"),
+            metrics.GetCounter ("i2pd_streaming_resent_packets_total", "Streaming packets sent again after RTO"),
+            metrics.GetCounter ("i2pd_streaming_received_packets_total", "Streaming packets received"),
+            metrics.GetCounter ("i2pd_streaming_duplicate_packets_total", "Streaming packets received twice"),
+            metrics.GetCounter ("i2pd_streaming_timed_out_streams_total", "Streams reset after max resend attempts"),
+            metrics.GetCounter ("i2pd_streaming_dropped_packets_total", "Streaming packets dropped unacked because receive queue is full"),
+            metrics.GetHistogram ("i2pd_streaming_rtt_milliseconds", "Round trip time of acknowledged packets",
+                i2p::util::ExponentialBuckets (50, 2, 10))
+        };
+        return streamingMetrics;
+    }
+
     Stream::Stream (boost::asio::io_service& service, StreamingDestination& local, 
         std::shared_ptr<const i2p::data::LeaseSet> remote, int port): m_Service (service),
         m_SendStreamID (0), m_SequenceNumber (0), m_LastReceivedSequenceNumber (-1), 
         m_Status (eStreamStatusNew), m_IsAckSendScheduled (false), m_LocalDestination (local), 
-        m_RemoteLeaseSet (remote), m_ReceiveTimer (m_Service), m_ResendTimer (m_Service), 
+        m_RemoteLeaseSet (remote), m_ReceiveQueueSize (0), m_ReceiveTimer (m_Service), m_ResendTimer (m_Service), 
         m_AckSendTimer (m_Service),  m_NumSentBytes (0), m_NumReceivedBytes (0), m_Port (port), 
-        m_WindowSize (MIN_WINDOW_SIZE), m_RTT (INITIAL_RTT), m_RTO (INITIAL_RTO),
-        m_LastWindowSizeIncreaseTime (0), m_NumResendAttempts (0)
+        m_MaxSendBufferSize (local.GetMaxSendBufferSize ()), m_WindowSize (MIN_WINDOW_SIZE), m_RTT (INITIAL_RTT), m_RTO (INITIAL_RTO),
+        m_LastWindowSizeIncreaseTime (0), m_NumResendAttempts (0), m_RebalanceTime (0)
     {
         m_RecvStreamID = i2p::context.GetRandomNumberGenerator ().GenerateWord32 ();
         m_RemoteIdentity = remote->GetIdentity ();
         m_CurrentRemoteLease.endDate = 0;
+        GetStreamingMetrics ().numStreams.Add (1);
     }   
 
     Stream::Stream (boost::asio::io_service& service, StreamingDestination& local):
         m_Service (service), m_SendStreamID (0), m_SequenceNumber (0), m_LastReceivedSequenceNumber (-1), 
         m_Status (eStreamStatusNew), m_IsAckSendScheduled (false), m_LocalDestination (local),
-        m_ReceiveTimer (m_Service), m_ResendTimer (m_Service), m_AckSendTimer (m_Service), 
-        m_NumSentBytes (0), m_NumReceivedBytes (0), m_Port (0),  m_WindowSize (MIN_WINDOW_SIZE), 
-        m_RTT (INITIAL_RTT), m_RTO (INITIAL_RTO), m_LastWindowSizeIncreaseTime (0), m_NumResendAttempts (0)
+        m_ReceiveQueueSize (0), m_ReceiveTimer (m_Service), m_ResendTimer (m_Service), m_AckSendTimer (m_Service), 
+        m_NumSentBytes (0), m_NumReceivedBytes (0), m_Port (0),
+        m_MaxSendBufferSize (local.GetMaxSendBufferSize ()), m_WindowSize (MIN_WINDOW_SIZE), 
+        m_RTT (INITIAL_RTT), m_RTO (INITIAL_RTO), m_LastWindowSizeIncreaseTime (0), m_NumResendAttempts (0),
+        m_RebalanceTime (0)
     {
         m_RecvStreamID = i2p::context.GetRandomNumberGenerator ().GenerateWord32 ();
+        GetStreamingMetrics ().numStreams.Add (1);
     }
 
     Stream::~Stream ()
     {   
         Terminate ();
         while (!m_ReceiveQueue.empty ())
-        {
-            auto packet = m_ReceiveQueue.front ();
-            m_ReceiveQueue.pop ();
-            delete packet;
-        }
+            delete PopReceivedPacket ();
         
         for (auto it: m_SentPackets)
+        {
+            m_LocalDestination.GetOwner ().SendQueueChanged (-(int64_t)it->GetLength ());
             delete it;
+        }
         m_SentPackets.clear ();
         
         for (auto it: m_SavedPackets)
             delete it;
         m_SavedPackets.clear ();
-            
+
+        m_LocalDestination.SendBufferChanged (-(int64_t)m_SendBuffer.GetSize ());
+        GetStreamingMetrics ().numStreams.Add (-1);
         LogPrint (eLogDebug, "Stream deleted");
     }   
 
@@ -61,17 +94,19 @@ namespace stream
         m_AckSendTimer.cancel ();
         m_ReceiveTimer.cancel ();
         m_ResendTimer.cancel ();
-        if (m_SendHandler) 
+        std::vector<SendHandler> handlers;
         {
-            auto handler = m_SendHandler;
-            m_SendHandler = nullptr;
-            handler (boost::asio::error::make_error_code (boost::asio::error::operation_aborted));
+            std::unique_lock<std::mutex> l(m_SendBufferMutex);
+            m_SendBuffer.TakeAllSendHandlers (handlers);
         }
+        for (auto& it: handlers)
+            it (boost::asio::error::make_error_code (boost::asio::error::operation_aborted));
     }   
         
     void Stream::HandleNextPacket (Packet * packet)
     {
         m_NumReceivedBytes += packet->GetLength ();
+        GetStreamingMetrics ().numReceivedPackets.Inc ();
         if (!m_SendStreamID) 
             m_SendStreamID = packet->GetReceiveStreamID ();     
 
@@ -89,6 +124,14 @@ namespace stream
         }
 
         LogPrint (eLogDebug, "Received seqn=", receivedSeqn); 
+        if (!isSyn && receivedSeqn > m_LastReceivedSequenceNumber && m_ReceiveQueueSize >= STREAM_MAX_RECEIVE_QUEUE_SIZE)
+        {
+            // reader is behind, don't ack new data. Remote resends it after its RTO with smaller window
+            LogPrint (eLogDebug, "Receive queue is full, seqn=", receivedSeqn, " dropped");
+            GetStreamingMetrics ().numDroppedPackets.Inc ();
+            delete packet;
+            return;
+        }
         if (isSyn || receivedSeqn == m_LastReceivedSequenceNumber + 1)
         {           
             // we have received next in sequence message
@@ -129,6 +172,7 @@ namespace stream
             {
                 // we have received duplicate
                 LogPrint (eLogWarning, "Duplicate message ", receivedSeqn, " received");
+                GetStreamingMetrics ().numDuplicatePackets.Inc ();
                 SendQuickAck (); // resend ack for previous message again
                 delete packet; // packet dropped
             }   
@@ -216,6 +260,7 @@ namespace stream
         if (packet->GetLength () > 0)
         {   
             m_ReceiveQueue.push (packet);
+            m_ReceiveQueueSize += packet->GetLength ();
             m_ReceiveTimer.cancel ();
         }   
         else
@@ -234,6 +279,7 @@ namespace stream
     void Stream::ProcessAck (Packet * packet)
     {
         bool acknowledged = false;
+        uint64_t minRTT = 0;
         auto ts = i2p::util::GetMillisecondsSinceEpoch ();
         uint32_t ackThrough = packet->GetAckThrough ();
         int nackCount = packet->GetNACKCount ();
@@ -263,7 +309,10 @@ namespace stream
                 m_RTT = (m_RTT*seqn + rtt)/(seqn + 1);
                 m_RTO = m_RTT*1.5; // TODO: implement it better
                 LogPrint (eLogDebug, "Packet ", seqn, " acknowledged rtt=", rtt);
+                GetStreamingMetrics ().rtt.Observe (rtt);
+                if (!minRTT || rtt < minRTT) minRTT = rtt;
                 m_SentPackets.erase (it++);
+                m_LocalDestination.GetOwner ().SendQueueChanged (-(int64_t)sentPacket->GetLength ());
                 delete sentPacket;  
                 acknowledged = true;
                 if (m_WindowSize < WINDOW_SIZE)
@@ -286,6 +335,8 @@ namespace stream
             m_ResendTimer.cancel ();
         if (acknowledged)
         {
+            if (m_CurrentRemoteLease.endDate)
+                m_LocalDestination.RemoteLeaseMeasured (m_CurrentRemoteLease, minRTT);
             m_NumResendAttempts = 0;
             SendBuffer ();
         }   
@@ -298,8 +349,8 @@ namespace stream
         if (len > 0 && buf)
         {
             std::unique_lock<std::mutex> l(m_SendBufferMutex);
-            m_SendBuffer.clear ();
-            m_SendBuffer.write ((const char *)buf, len);
+            m_SendBuffer.Add (buf, len);
+            m_LocalDestination.SendBufferChanged (len);
         }   
         m_Service.post (std::bind (&Stream::SendBuffer, shared_from_this ()));
         return len;
@@ -307,11 +358,72 @@ namespace stream
 
     void Stream::AsyncSend (const uint8_t * buf, size_t len, SendHandler handler)
     {
-        if (m_SendHandler) 
-            handler (boost::asio::error::make_error_code (boost::asio::error::in_progress));
-        else
-            m_SendHandler = handler;
-        Send (buf, len);
+        if (m_Status == eStreamStatusReset || m_Status == eStreamStatusClosed)
+        {
+            m_Service.post (std::bind (handler, boost::asio::error::make_error_code (boost::asio::error::operation_aborted)));
+            return;
+        }
+        bool fits = true;
+        if (len > 0 && buf)
+        {
+            std::unique_lock<std::mutex> l(m_SendBufferMutex);
+            m_SendBuffer.Add (buf, len);
+            m_LocalDestination.SendBufferChanged (len);
+            fits = !m_SendBuffer.AddSendHandler (m_MaxSendBufferSize, handler); // wait until enough is taken from buffer
+        }
+        if (fits)
+            m_Service.post (std::bind (handler, boost::system::error_code ()));
+        m_Service.post (std::bind (&Stream::SendBuffer, shared_from_this ()));
+    }
+
+    void SendBufferQueue::Add (const uint8_t * buf, size_t len)
+    {
+        m_Buffers.push_back (std::vector<uint8_t> (buf, buf + len));
+        m_Size += len;
+    }
+
+    size_t SendBufferQueue::Get (uint8_t * buf, size_t len)
+    {
+        size_t pos = 0;
+        while (pos < len && !m_Buffers.empty ())
+        {
+            auto& front = m_Buffers.front ();
+            size_t l = std::min (front.size () - m_Offset, len - pos);
+            memcpy (buf + pos, front.data () + m_Offset, l);
+            pos += l;
+            m_Offset += l;
+            if (m_Offset >= front.size ())
+            {
+                m_Buffers.pop_front ();
+                m_Offset = 0;
+            }
+        }
+        m_Size -= pos;
+        m_NumTakenBytes += pos;
+        return pos;
+    }
+
+    bool SendBufferQueue::AddSendHandler (size_t maxSize, SendHandler handler)
+    {
+        if (m_Size <= maxSize) return false;
+        m_SendHandlers.push_back (std::make_pair (m_NumTakenBytes + m_Size - maxSize, handler));
+        return true;
+    }
+
+    void SendBufferQueue::TakeCompletedSendHandlers (std::vector<SendHandler>& handlers)
+    {
+        while (!m_SendHandlers.empty () && m_SendHandlers.front ().first <= m_NumTakenBytes)
+        {
+            handlers.push_back (m_SendHandlers.front ().second);
+            m_SendHandlers.pop_front ();
+        }
+    }
+
+    void SendBufferQueue::TakeAllSendHandlers (std::vector<SendHandler>& handlers)
+    {
+        for (auto& it: m_SendHandlers)
+            handlers.push_back (it.second);
+        m_SendHandlers.clear ();
     }
 
     void Stream::SendBuffer ()
@@ -321,9 +433,11 @@ namespace stream
         
         bool isNoAck = m_LastReceivedSequenceNumber < 0; // first packet
         std::vector<Packet *> packets;
+        std::vector<SendHandler> handlers;
         {
             std::unique_lock<std::mutex> l(m_SendBufferMutex);
-            while ((m_Status == eStreamStatusNew) || (IsEstablished () && !m_SendBuffer.eof () && numMsgs > 0))
+            size_t bufferSize = m_SendBuffer.GetSize ();
+            while ((m_Status == eStreamStatusNew) || (IsEstablished () && !m_SendBuffer.IsEmpty () && numMsgs > 0))
             {
                 Packet * p = new Packet ();
                 uint8_t * packet = p->GetBuffer ();
@@ -364,8 +478,7 @@ namespace stream
                     uint8_t * signature = packet + size; // set it later
                     memset (signature, 0, signatureLen); // zeroes for now
                     size += signatureLen; // signature
-                    m_SendBuffer.read ((char *)(packet + size), STREAMING_MTU - size);
-                    size += m_SendBuffer.gcount (); // payload
+                    size += m_SendBuffer.Get (packet + size, STREAMING_MTU - size); // payload
                     m_LocalDestination.GetOwner ().Sign (packet, size, signature);
                 }   
                 else
@@ -375,19 +488,17 @@ namespace stream
                     size += 2; // flags
                     htobuf16 (packet + size, 0); // no options
                     size += 2; // options size
-                    m_SendBuffer.read((char *)(packet + size), STREAMING_MTU - size);  
-                    size += m_SendBuffer.gcount (); // payload
+                    size += m_SendBuffer.Get (packet + size, STREAMING_MTU - size); // payload
                 }   
                 p->len = size;
                 packets.push_back (p);
                 numMsgs--;
             }
-            if (m_SendBuffer.eof () && m_SendHandler)
-            {
-                m_SendHandler (boost::system::error_code ());
-                m_SendHandler = nullptr;
-            }
+            m_LocalDestination.SendBufferChanged (-(int64_t)(bufferSize - m_SendBuffer.GetSize ()));
+            m_SendBuffer.TakeCompletedSendHandlers (handlers);
         }   
+        for (auto& it: handlers)
+            it (boost::system::error_code ());
         if (packets.size () > 0)
         {
             m_IsAckSendScheduled = false;   
@@ -398,9 +509,10 @@ namespace stream
             {
                 it->sendTime = ts;
                 m_SentPackets.insert (it);
+                m_LocalDestination.GetOwner ().SendQueueChanged (it->GetLength ());
             }
             SendPackets (packets);
-            if (m_Status == eStreamStatusClosing && m_SendBuffer.eof ())
+            if (m_Status == eStreamStatusClosing && m_SendBuffer.IsEmpty ())
                 SendClose ();
             if (isEmpty)
                 ScheduleResend ();
@@ -480,6 +592,24 @@ namespace stream
     {
         switch (m_Status)
         {
+            case eStreamStatusNew:
+            {
+                bool isEmpty;
+                {
+                    std::unique_lock<std::mutex> l(m_SendBufferMutex);
+                    isEmpty = m_SendBuffer.IsEmpty ();
+                }
+                if (isEmpty)
+                {
+                    // SYN has not been sent, nothing to tell the peer
+                    m_Status = eStreamStatusClosed;
+                    Terminate ();
+                    m_LocalDestination.DeleteStream (shared_from_this ());
+                }
+                else // data is queued, close after posted SendBuffer has sent SYN with it
+                    m_Service.post (std::bind (&Stream::Close, shared_from_this ()));
+            break;
+            }
             case eStreamStatusOpen:
                 m_Status = eStreamStatusClosing;
                 Close (); // recursion
@@ -492,7 +622,7 @@ namespace stream
                 m_LocalDestination.DeleteStream (shared_from_this ());  
             break;
             case eStreamStatusClosing:
-                if (m_SentPackets.empty () && m_SendBuffer.eof ()) // nothing to send
+                if (m_SentPackets.empty () && m_SendBuffer.IsEmpty ()) // nothing to send
                 {
                     m_Status = eStreamStatusClosed;
                     SendClose ();
@@ -551,6 +681,7 @@ namespace stream
             memcpy (buf + pos, packet->GetBuffer (), l);
             pos += l;
             packet->offset += l;
+            m_ReceiveQueueSize -= l;
             if (!packet->GetLength ())
             {
                 m_ReceiveQueue.pop ();
@@ -560,6 +691,47 @@ namespace stream
         return pos; 
     }
 
+    Packet * Stream::PopReceivedPacket ()
+    {
+        Packet * packet = m_ReceiveQueue.front ();
+        m_ReceiveQueue.pop ();
+        m_ReceiveQueueSize -= packet->GetLength ();
+        return packet;
+    }
+
+    void Stream::AsyncReceivePacket (ReceivePacketHandler handler, int timeout)
+    {
+        auto s = shared_from_this();
+        m_Service.post ([s, handler, timeout](void)
+        {
+            if (!s->m_ReceiveQueue.empty () || s->m_Status == eStreamStatusReset)
+                s->HandleReceivePacketTimer (boost::asio::error::make_error_code (boost::asio::error::operation_aborted), handler);
+            else
+            {
+                s->m_ReceiveTimer.expires_from_now (boost::posix_time::seconds(timeout));
+                s->m_ReceiveTimer.async_wait ([s, handler](const boost::system::error_code& ecode)
+                    { s->HandleReceivePacketTimer (ecode, handler); });
+            }
+        });
+    }
+
+    void Stream::HandleReceivePacketTimer (const boost::system::error_code& ecode, ReceivePacketHandler handler)
+    {
+        if (!m_ReceiveQueue.empty ())
+            handler (boost::system::error_code (), PopReceivedPacket ());
+        else if (ecode == boost::asio::error::operation_aborted)
+        {
+            // timeout not expired
+            if (m_Status == eStreamStatusReset)
+                handler (boost::asio::error::make_error_code (boost::asio::error::connection_reset), nullptr);
+            else
+                handler (boost::asio::error::make_error_code (boost::asio::error::operation_aborted), nullptr);
+        }
+        else
+            // timeout expired
+            handler (boost::asio::error::make_error_code (boost::asio::error::timed_out), nullptr);
+    }
+
     bool Stream::SendPacket (Packet * packet)
     {
         if (packet)
@@ -574,6 +746,7 @@ namespace stream
             {   
                 bool isEmpty = m_SentPackets.empty ();
                 m_SentPackets.insert (packet);
+                m_LocalDestination.GetOwner ().SendQueueChanged (packet->GetLength ());
                 if (isEmpty)
                     ScheduleResend ();
             }   
@@ -596,15 +769,28 @@ namespace stream
                 return;
             }
         }
+        auto ts = i2p::util::GetMillisecondsSinceEpoch ();      
+        auto pool = m_LocalDestination.GetOwner ().GetTunnelPool ();
         if (!m_CurrentOutboundTunnel || !m_CurrentOutboundTunnel->IsEstablished ())
-            m_CurrentOutboundTunnel = m_LocalDestination.GetOwner ().GetTunnelPool ()->GetNewOutboundTunnel (m_CurrentOutboundTunnel);
+            m_CurrentOutboundTunnel = pool->GetNewOutboundTunnel (m_CurrentOutboundTunnel);
+        else if (ts >= m_RebalanceTime)
+        {
+            // stream stays on its tunnel unless the tunnel is overloaded. 
+            // Random interval keeps streams from moving at once
+            if (m_RebalanceTime)
+                m_CurrentOutboundTunnel = pool->RebalanceOutboundTunnel (m_CurrentOutboundTunnel);
+            m_RebalanceTime = ts + STREAM_REBALANCE_INTERVAL*1000 + 
+                i2p::context.GetRandomNumberGenerator ().GenerateWord32 (0, STREAM_REBALANCE_INTERVAL*1000);
+            // lookup keeps remote active in LeaseSet cache, so it's refreshed before leases expire
+            auto leaseSet = m_LocalDestination.GetOwner ().FindLeaseSet (m_RemoteIdentity.GetIdentHash ());
+            if (leaseSet) m_RemoteLeaseSet = leaseSet;
+        }
         if (!m_CurrentOutboundTunnel)
         {
             LogPrint (eLogError, "No outbound tunnels in the pool");
             return;
         }
 
-        auto ts = i2p::util::GetMillisecondsSinceEpoch ();      
         if (!m_CurrentRemoteLease.endDate || ts >= m_CurrentRemoteLease.endDate - i2p::tunnel::TUNNEL_EXPIRATION_THRESHOLD*1000)
             UpdateCurrentRemoteLease (true);
         if (ts < m_CurrentRemoteLease.endDate)
@@ -612,7 +798,9 @@ namespace stream
             std::vector<i2p::tunnel::TunnelMessageBlock> msgs;
             for (auto it: packets)
             { 
-                auto msg = m_RoutingSession->WrapSingleMessage (CreateDataMessage (it->GetBuffer (), it->GetLength ()));
+                auto dataMsg = CreateDataMessage (it->GetBuffer (), it->GetLength ());
+                if (!dataMsg) continue;
+                auto msg = m_RoutingSession->WrapSingleMessage (dataMsg);
                 msgs.push_back (i2p::tunnel::TunnelMessageBlock 
                     { 
                         i2p::tunnel::eDeliveryTypeTunnel,
@@ -621,7 +809,9 @@ namespace stream
                     }); 
                 m_NumSentBytes += it->GetLength ();
             }
-            m_CurrentOutboundTunnel->SendTunnelDataMsg (msgs);
+            if (!msgs.empty ())
+                m_CurrentOutboundTunnel->SendTunnelDataMsg (msgs);
+            GetStreamingMetrics ().numSentPackets.Inc (msgs.size ());
         }   
         else
             LogPrint (eLogWarning, "All leases are expired");
@@ -644,6 +834,7 @@ namespace stream
             if (m_NumResendAttempts >= MAX_NUM_RESEND_ATTEMPTS)
             {
                 LogPrint (eLogWarning, "Stream packet was not ACKed after ", MAX_NUM_RESEND_ATTEMPTS,  " attempts. Terminate");
+                GetStreamingMetrics ().numTimedOutStreams.Inc ();
                 m_Status = eStreamStatusReset;
                 Close ();
                 return;
@@ -666,6 +857,7 @@ namespace stream
             {
                 m_NumResendAttempts++;
                 m_RTO *= 2;
+                GetStreamingMetrics ().numResentPackets.Inc (packets.size ());
                 switch (m_NumResendAttempts)
                 {   
                     case 1: // congesion avoidance
@@ -676,6 +868,8 @@ namespace stream
                         m_RTO = INITIAL_RTO; // drop RTO to initial upon tunnels pair change first time
                         // no break here
                     case 4: 
+                        if (m_CurrentRemoteLease.endDate)
+                            m_LocalDestination.RemoteLeaseFailed (m_CurrentRemoteLease);
                         UpdateCurrentRemoteLease (); // pick another lease
                         LogPrint (eLogWarning, "Another remote lease has been selected for stream");
                     break;  
@@ -711,12 +905,12 @@ namespace stream
 
     void Stream::UpdateCurrentRemoteLease (bool expired)
     {
-        if (!m_RemoteLeaseSet)
-        {
-            m_RemoteLeaseSet = m_LocalDestination.GetOwner ().FindLeaseSet (m_RemoteIdentity.GetIdentHash ());
-            if (!m_RemoteLeaseSet)      
-                LogPrint ("LeaseSet ", m_RemoteIdentity.GetIdentHash ().ToBase64 (), " not found");
-        }
+        // cached LeaseSet is replaced when refreshed, take the latest
+        auto leaseSet = m_LocalDestination.GetOwner ().FindLeaseSet (m_RemoteIdentity.GetIdentHash ());
+        if (leaseSet)
+            m_RemoteLeaseSet = leaseSet;
+        else if (!m_RemoteLeaseSet)     
+            LogPrint ("LeaseSet ", m_RemoteIdentity.GetIdentHash ().ToBase64 (), " not found");
         if (m_RemoteLeaseSet)
         {
             if (!m_RoutingSession)
@@ -743,11 +937,10 @@ namespace stream
                 }
                 if (!updated)
                 {
-                    uint32_t i = i2p::context.GetRandomNumberGenerator ().GenerateWord32 (0, leases.size () - 1);
-                    if (m_CurrentRemoteLease.endDate && leases[i].tunnelID == m_CurrentRemoteLease.tunnelID)
-                        // make sure we don't select previous   
-                        i = (i + 1) % leases.size (); // if so, pick next
-                    m_CurrentRemoteLease = leases[i];       
+                    // make sure we don't select previous   
+                    auto lease = m_LocalDestination.SelectRemoteLease (leases, 
+                        m_CurrentRemoteLease.endDate ? &m_CurrentRemoteLease : nullptr);
+                    m_CurrentRemoteLease = *lease;      
                 }
             }   
             else
@@ -764,18 +957,18 @@ namespace stream
     std::shared_ptr<I2NPMessage> Stream::CreateDataMessage (const uint8_t * payload, size_t len)
     {
         auto msg = ToSharedI2NPMessage (NewI2NPShortMessage ());
-        CryptoPP::Gzip compressor;
-        if (len <= i2p::stream::COMPRESSION_THRESHOLD_SIZE)
-            compressor.SetDeflateLevel (CryptoPP::Gzip::MIN_DEFLATE_LEVEL);
-        else
-            compressor.SetDeflateLevel (CryptoPP::Gzip::DEFAULT_DEFLATE_LEVEL);
-        compressor.Put (payload, len);
-        compressor.MessageEnd();
-        int size = compressor.MaxRetrievable ();
+        int level = i2p::util::GZIP_STORED_LEVEL;
+        if (len > i2p::stream::COMPRESSION_THRESHOLD_SIZE && m_LocalDestination.GetOwner ().IsGzip ())
+            level = i2p::util::GetGzipLevel (payload, len, i2p::util::GZIP_DEFAULT_LEVEL);
         uint8_t * buf = msg->GetPayload ();
+        size_t size = i2p::util::GzipCompress (payload, len, buf + 4, msg->maxLen - msg->len - 4, level);
+        if (!size)
+        {
+            LogPrint (eLogError, "Streaming packet of ", len, " bytes doesn't fit data message");
+            return nullptr;
+        }
         htobe32buf (buf, size); // length
         buf += 4;
-        compressor.Get (buf, size);
         htobe16buf (buf + 4, m_LocalDestination.GetLocalPort ()); // source port
         htobe16buf (buf + 6, m_Port); // destination port 
         buf[9] = i2p::client::PROTOCOL_TYPE_STREAMING; // streaming protocol
@@ -785,6 +978,12 @@ namespace stream
         return msg;
     }   
         
+    StreamingDestination::StreamingDestination (i2p::client::ClientDestination& owner, uint16_t localPort):
+        m_Owner (owner), m_LocalPort (localPort), m_MaxSendBufferSize (STREAM_DEFAULT_SEND_BUFFER_SIZE),
+        m_SendBufferSize (0)
+    {
+    }
+
     void StreamingDestination::Start ()
     {   
     }
@@ -870,23 +1069,86 @@ namespace stream
         }   
     }       
 
+    void StreamingDestination::SendBufferChanged (int64_t n)
+    {
+        m_SendBufferSize += n;
+        // not by destination, series of transient destinations would stay forever
+        static auto& sendBufferBytes = i2p::util::metrics.GetGauge ("i2pd_streaming_send_buffer_bytes",
+            "Stream data waiting to be sent, all local destinations");
+        sendBufferBytes.Add (n);
+    }
+
+    void StreamingDestination::RemoteLeaseMeasured (const i2p::data::Lease& lease, int rtt)
+    {
+        auto ts = i2p::util::GetSecondsSinceEpoch ();
+        std::unique_lock<std::mutex> l(m_RemoteLeasesMutex);
+        auto& stats = m_RemoteLeases[std::make_pair (lease.tunnelGateway, lease.tunnelID)];
+        if (!rtt) rtt = 1; // 0 means not measured
+        stats.rtt = stats.rtt ? (stats.rtt*3 + rtt)/4 : rtt;
+        stats.updateTime = ts;
+    }
+
+    void StreamingDestination::CleanupRemoteLeases ()
+    {
+        // lease stats live as long as remote tunnels do
+        auto ts = i2p::util::GetSecondsSinceEpoch ();
+        std::unique_lock<std::mutex> l(m_RemoteLeasesMutex);
+        for (auto it = m_RemoteLeases.begin (); it != m_RemoteLeases.end ();)
+            if (ts > it->second.updateTime + REMOTE_LEASE_STATS_TIMEOUT)
+                it = m_RemoteLeases.erase (it);
+            else
+                it++;
+    }
+
+    double StreamingDestination::GetRemoteLeaseWeight (int rtt, int numFailures)
+    {
+        return 1.0/((double)(rtt ? rtt : REMOTE_LEASE_DEFAULT_RTT)*(1 + numFailures));
+    }
+
+    void StreamingDestination::RemoteLeaseFailed (const i2p::data::Lease& lease)
+    {
+        std::unique_lock<std::mutex> l(m_RemoteLeasesMutex);
+        auto& stats = m_RemoteLeases[std::make_pair (lease.tunnelGateway, lease.tunnelID)];
+        stats.numFailures++;
+        stats.updateTime = i2p::util::GetSecondsSinceEpoch ();
+    }
+
+    const i2p::data::Lease * StreamingDestination::SelectRemoteLease (const std::vector<i2p::data::Lease>& leases,
+        const i2p::data::Lease * excluded)
+    {
+        // probability of lease is inverse to RTT and failures seen by all streams
+        std::vector<double> weights (leases.size ());
+        double totalWeight = 0;
+        {
+            std::unique_lock<std::mutex> l(m_RemoteLeasesMutex);
+            for (size_t i = 0; i < leases.size (); i++)
+            {
+                if (excluded && leases.size () > 1 && leases[i].tunnelID == excluded->tunnelID &&
+                    leases[i].tunnelGateway == excluded->tunnelGateway)
+                    continue;
+                auto it = m_RemoteLeases.find (std::make_pair (leases[i].tunnelGateway, leases[i].tunnelID));
+                if (it != m_RemoteLeases.end ())
+                    weights[i] = GetRemoteLeaseWeight (it->second.rtt, it->second.numFailures);
+                else
+                    weights[i] = GetRemoteLeaseWeight (0, 0);
+                totalWeight += weights[i];
+            }
+        }
+        double r = totalWeight*i2p::context.GetRandomNumberGenerator ().GenerateWord32 ()/4294967296.0;
+        return &leases[i2p::util::SelectWeighted (weights, r)];
+    }
+
     void StreamingDestination::HandleDataMessagePayload (const uint8_t * buf, size_t len)
     {
         // unzip it
-        CryptoPP::Gunzip decompressor;
-        decompressor.Put (buf, len);
-        decompressor.MessageEnd();
         Packet * uncompressed = new Packet;
         uncompressed->offset = 0;
-        uncompressed->len = decompressor.MaxRetrievable ();
-        if (uncompressed->len <= MAX_PACKET_SIZE)
-        {
-            decompressor.Get (uncompressed->buf, uncompressed->len);
+        uncompressed->len = i2p::util::GzipDecompress (buf, len, uncompressed->buf, MAX_PACKET_SIZE);
+        if (uncompressed->len)
             HandleNextPacket (uncompressed); 
-        }
         else
         {
-            LogPrint ("Received packet size ", uncompressed->len,  " exceeds max packet size. Skipped");
+            LogPrint ("Received packet is invalid or exceeds max packet size. Skipped");
             delete uncompressed;
         }   
     }
@@ -5,13 +5,18 @@
 #include <string>
 #include <sstream>
 #include <map>
+#include <vector>
 #include <set>
 #include <queue>
+#include <deque>
+#include <list>
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <atomic>
 #include <boost/asio.hpp>
 #include "util/I2PEndian.h"
+#include "util/Metrics.h"
 #include "Identity.h"
 #include "LeaseSet.h"
 #include "I2NPProtocol.h"
@@ -48,6 +53,11 @@ namespace stream
     const int MAX_WINDOW_SIZE = 128;        
     const int INITIAL_RTT = 8000; // in milliseconds
     const int INITIAL_RTO = 9000; // in milliseconds
+    const int STREAM_REBALANCE_INTERVAL = 30; // in seconds, randomly up to twice, outbound tunnel is checked for load
+    const int REMOTE_LEASE_DEFAULT_RTT = INITIAL_RTT/4; // in milliseconds, for leases not measured yet
+    const int REMOTE_LEASE_STATS_TIMEOUT = 11*60; // in seconds, remote tunnels are expired by then
+    const size_t STREAM_DEFAULT_SEND_BUFFER_SIZE = 64*1024; // in bytes, AsyncSend waits while more is buffered
+    const size_t STREAM_MAX_RECEIVE_QUEUE_SIZE = 256*1024; // in bytes, new packets are dropped unacked while more is not read
     
     struct Packet
     {
@@ -83,6 +93,37 @@ namespace stream
         };
     };  
 
+    /**
+     * Data passed to Send waiting to be put into packets.
+     * Kept in chunks as written, memory is released once a chunk is taken
+     */
+    class SendBufferQueue
+    {
+        public:
+
+            typedef std::function<void (const boost::system::error_code& ecode)> SendHandler;
+
+            SendBufferQueue (): m_Offset (0), m_Size (0), m_NumTakenBytes (0) {};
+
+            void Add (const uint8_t * buf, size_t len);
+            size_t Get (uint8_t * buf, size_t len); // takes up to len bytes
+            size_t GetSize () const { return m_Size; };
+            bool IsEmpty () const { return !m_Size; };
+            uint64_t GetNumTakenBytes () const { return m_NumTakenBytes; }; // since creation
+
+            // handler waits until no more than maxSize bytes are left, returns false if it's so already
+            bool AddSendHandler (size_t maxSize, SendHandler handler);
+            void TakeCompletedSendHandlers (std::vector<SendHandler>& handlers); // in order they were added
+            void TakeAllSendHandlers (std::vector<SendHandler>& handlers);
+
+        private:
+
+            std::deque<std::vector<uint8_t> > m_Buffers;
+            size_t m_Offset, m_Size; // offset in front chunk
+            uint64_t m_NumTakenBytes;
+            std::list<std::pair<uint64_t, SendHandler> > m_SendHandlers; // called when that many bytes are taken
+    };
+
     enum StreamStatus
     {
         eStreamStatusNew = 0,
@@ -97,7 +138,8 @@ namespace stream
     {   
         public:
 
-            typedef std::function<void (const boost::system::error_code& ecode)> SendHandler;
+            typedef SendBufferQueue::SendHandler SendHandler;
+            typedef std::function<void (const boost::system::error_code& ecode, Packet * packet)> ReceivePacketHandler;
 
             Stream (boost::asio::io_service& service, StreamingDestination& local, 
                 std::shared_ptr<const i2p::data::LeaseSet> remote, int port = 0); // outgoing
@@ -115,11 +157,15 @@ namespace stream
             
             void HandleNextPacket (Packet * packet);
             size_t Send (const uint8_t * buf, size_t len);
+            // data is taken at once, handler is called when no more than send buffer size is left
+            // ahead of it, several calls may be outstanding
             void AsyncSend (const uint8_t * buf, size_t len, SendHandler handler);
             
             template<typename Buffer, typename ReceiveHandler>
             void AsyncReceive (const Buffer& buffer, ReceiveHandler handler, int timeout = 0);
             size_t ReadSome (uint8_t * buf, size_t len) { return ConcatenatePackets (buf, len); };
+            // hands next received packet over instead of copying, payload is GetBuffer (), handler deletes it
+            void AsyncReceivePacket (ReceivePacketHandler handler, int timeout = 0);
             
             void Close ();
             void Cancel () { m_ReceiveTimer.cancel (); };
@@ -128,7 +174,8 @@ namespace stream
             size_t GetNumReceivedBytes () const { return m_NumReceivedBytes; };
             size_t GetSendQueueSize () const { return m_SentPackets.size (); };
             size_t GetReceiveQueueSize () const { return m_ReceiveQueue.size (); };
-            size_t GetSendBufferSize () const { return m_SendBuffer.rdbuf ()->in_avail (); };
+            size_t GetReceiveQueueBytes () const { return m_ReceiveQueueSize; };
+            size_t GetSendBufferSize () const { return m_SendBuffer.GetSize (); };
             int GetWindowSize () const { return m_WindowSize; };
             int GetRTT () const { return m_RTT; };
             
@@ -144,6 +191,7 @@ namespace stream
 
             void SavePacket (Packet * packet);
             void ProcessPacket (Packet * packet);
+            Packet * PopReceivedPacket ();
             void ProcessAck (Packet * packet);
             size_t ConcatenatePackets (uint8_t * buf, size_t len);
 
@@ -151,6 +199,7 @@ namespace stream
             
             template<typename Buffer, typename ReceiveHandler>
             void HandleReceiveTimer (const boost::system::error_code& ecode, const Buffer& buffer, ReceiveHandler handler);
+            void HandleReceivePacketTimer (const boost::system::error_code& ecode, ReceivePacketHandler handler);
             
             void ScheduleResend ();
             void HandleResendTimer (const boost::system::error_code& ecode);
@@ -172,6 +221,7 @@ namespace stream
             i2p::data::Lease m_CurrentRemoteLease;
             std::shared_ptr<i2p::tunnel::OutboundTunnel> m_CurrentOutboundTunnel;
             std::queue<Packet *> m_ReceiveQueue;
+            size_t m_ReceiveQueueSize; // in bytes
             std::set<Packet *, PacketCmp> m_SavedPackets;
             std::set<Packet *, PacketCmp> m_SentPackets;
             boost::asio::deadline_timer m_ReceiveTimer, m_ResendTimer, m_AckSendTimer;
@@ -179,11 +229,19 @@ namespace stream
             uint16_t m_Port;
 
             std::mutex m_SendBufferMutex;
-            std::stringstream m_SendBuffer;
+            SendBufferQueue m_SendBuffer;
+            size_t m_MaxSendBufferSize;
             int m_WindowSize, m_RTT, m_RTO;
             uint64_t m_LastWindowSizeIncreaseTime;
             int m_NumResendAttempts;
-            SendHandler m_SendHandler;
+            uint64_t m_RebalanceTime; // in milliseconds, of next outbound tunnel check
+    };
+
+    struct RemoteLeaseStats
+    {
+        int rtt; // in milliseconds, smoothed, 0 if not measured
+        int numFailures;
+        uint64_t updateTime; // in seconds
     };
 
     class StreamingDestination
@@ -192,8 +250,7 @@ namespace stream
 
             typedef std::function<void (std::shared_ptr<Stream>)> Acceptor;
 
-            StreamingDestination (i2p::client::ClientDestination& owner, uint16_t localPort = 0): 
-                m_Owner (owner), m_LocalPort (localPort) {};
+            StreamingDestination (i2p::client::ClientDestination& owner, uint16_t localPort = 0);
             ~StreamingDestination () {};    
 
             void Start ();
@@ -206,9 +263,21 @@ namespace stream
             bool IsAcceptorSet () const { return m_Acceptor != nullptr; };  
             i2p::client::ClientDestination& GetOwner () { return m_Owner; };
             uint16_t GetLocalPort () const { return m_LocalPort; };
+            void SetMaxSendBufferSize (size_t size) { m_MaxSendBufferSize = size; }; // per stream
+            size_t GetMaxSendBufferSize () const { return m_MaxSendBufferSize; };
+            void SendBufferChanged (int64_t n); // by streams
+            size_t GetSendBufferSize () const { return m_SendBufferSize; }; // bytes not sent yet by all streams
 
             void HandleDataMessagePayload (const uint8_t * buf, size_t len);
 
+            // remote leases, shared by streams to same destination
+            void RemoteLeaseMeasured (const i2p::data::Lease& lease, int rtt);
+            void RemoteLeaseFailed (const i2p::data::Lease& lease);
+            const i2p::data::Lease * SelectRemoteLease (const std::vector<i2p::data::Lease>& leases,
+                const i2p::data::Lease * excluded); // weighted by RTT and failures
+            void CleanupRemoteLeases (); // drops stats of expired remote tunnels, by owner's cleanup timer
+            static double GetRemoteLeaseWeight (int rtt, int numFailures); // RTT in milliseconds, 0 if not measured
+
         private:        
     
             void HandleNextPacket (Packet * packet);
@@ -218,9 +287,13 @@ namespace stream
 
             i2p::client::ClientDestination& m_Owner;
             uint16_t m_LocalPort;
+            size_t m_MaxSendBufferSize;
+            std::atomic<int64_t> m_SendBufferSize;
             std::mutex m_StreamsMutex;
             std::map<uint32_t, std::shared_ptr<Stream> > m_Streams;
             Acceptor m_Acceptor;
+            std::mutex m_RemoteLeasesMutex;
+            std::map<std::pair<i2p::data::IdentHash, uint32_t>, RemoteLeaseStats> m_RemoteLeases; // by gateway and tunnelID
             
         public:
 
@@ -0,0 +1,73 @@
+#include "util/Metrics.h"
+#include "ElGamal.h"
+
+namespace i2p
+{
+namespace crypto
+{
+    ElGamalPrecomputation elGamalPrecomputation;
+
+    void ElGamalPrecomputation::Start ()
+    {
+        if (m_IsRunning) return;
+        m_IsRunning = true;
+        m_Thread = new std::thread (std::bind (&ElGamalPrecomputation::Run, this));
+    }
+
+    void ElGamalPrecomputation::Stop ()
+    {
+        {
+            std::unique_lock<std::mutex> l(m_PrecomputedMutex);
+            m_IsRunning = false;
+            m_NotFull.notify_all ();
+        }
+        if (m_Thread)
+        {
+            m_Thread->join ();
+            delete m_Thread;
+            m_Thread = nullptr;
+        }
+    }
+
+    void ElGamalPrecomputation::Get (CryptoPP::Integer& k, CryptoPP::Integer& a)
+    {
+        {
+            std::unique_lock<std::mutex> l(m_PrecomputedMutex);
+            if (!m_Precomputed.empty ())
+            {
+                k = m_Precomputed.front ().first;
+                a = m_Precomputed.front ().second;
+                m_Precomputed.pop ();
+                m_NotFull.notify_one ();
+                return;
+            }
+        }
+        static auto& numMisses = i2p::util::metrics.GetCounter ("i2pd_elgamal_precomputed_misses_total",
+            "ElGamal encryptions computed g^k inline");
+        numMisses.Inc ();
+        CryptoPP::AutoSeededRandomPool rnd;
+        k = CryptoPP::Integer (rnd, CryptoPP::Integer::One (), elgp - 1);
+        a = a_exp_b_mod_c (elgg, k, elgp);
+    }
+
+    size_t ElGamalPrecomputation::GetNumPrecomputed ()
+    {
+        std::unique_lock<std::mutex> l(m_PrecomputedMutex);
+        return m_Precomputed.size ();
+    }
+
+    void ElGamalPrecomputation::Run ()
+    {
+        CryptoPP::AutoSeededRandomPool rnd;
+        while (m_IsRunning)
+        {
+            CryptoPP::Integer k (rnd, CryptoPP::Integer::One (), elgp - 1);
+            auto a = a_exp_b_mod_c (elgg, k, elgp);
+            std::unique_lock<std::mutex> l(m_PrecomputedMutex);
+            m_Precomputed.push (std::make_pair (k, a));
+            while (m_IsRunning && m_Precomputed.size () >= ELGAMAL_PRECOMPUTED_POOL_SIZE)
+                m_NotFull.wait (l);
+        }
+    }
+}
+}
@@ -2,6 +2,12 @@
 #define EL_GAMAL_H__
 
 #include <inttypes.h>
+#include <string.h>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
 #include <cryptopp/integer.h>
 #include <cryptopp/osrng.h>
 #include <cryptopp/dh.h>
@@ -14,26 +20,57 @@ namespace i2p
 namespace crypto
 {
 
+    const size_t ELGAMAL_PRECOMPUTED_POOL_SIZE = 128; // (k, g^k) pairs, about 40 tunnel builds
+
+    /**
+     * Generates random k and a = g^k mod p in background thread ahead of time,
+     * so encryption has only y^k of recipient's key on critical path.
+     * Pairs are computed inline if pool is exhausted or not started
+     */
+    class ElGamalPrecomputation
+    {
+        public:
+
+            ElGamalPrecomputation (): m_IsRunning (false), m_Thread (nullptr) {};
+            ~ElGamalPrecomputation () { Stop (); };
+            void Start ();
+            void Stop ();
+
+            void Get (CryptoPP::Integer& k, CryptoPP::Integer& a); // every pair is used once
+            size_t GetNumPrecomputed ();
+
+        private:
+
+            void Run ();
+
+        private:
+
+            std::atomic<bool> m_IsRunning;
+            std::thread * m_Thread;
+            std::queue<std::pair<CryptoPP::Integer, CryptoPP::Integer> > m_Precomputed; // (k, a)
+            std::mutex m_PrecomputedMutex;
+            std::condition_variable m_NotFull;
+    };
+
+    extern ElGamalPrecomputation elGamalPrecomputation;
+
     class ElGamalEncryption
     {
         public:
 
-            ElGamalEncryption (const uint8_t * key)
-            {
-                CryptoPP::AutoSeededRandomPool rnd; 
-                CryptoPP::Integer y (key, 256), k (rnd, CryptoPP::Integer::One(), elgp-1);
-                a = a_exp_b_mod_c (elgg, k, elgp);
-                b1 = a_exp_b_mod_c (y, k, elgp);
-            }
+            ElGamalEncryption (const uint8_t * key): y (key, 256) {};
 
             void Encrypt (const uint8_t * data, int len, uint8_t * encrypted, bool zeroPadding = false) const
             {
-                // calculate b = b1*m mod p
+                // fresh k for every message, a = g^k is precomputed
+                CryptoPP::Integer k, a;
+                elGamalPrecomputation.Get (k, a);
+                // calculate b = y^k*m mod p
                 uint8_t m[255];
                 m[0] = 0xFF;
                 memcpy (m+33, data, len);
                 CryptoPP::SHA256().CalculateDigest(m+1, m+33, 222);
-                CryptoPP::Integer b (a_times_b_mod_c (b1, CryptoPP::Integer (m, 255), elgp));
+                CryptoPP::Integer b (a_times_b_mod_c (a_exp_b_mod_c (y, k, elgp), CryptoPP::Integer (m, 255), elgp));
 
                 // copy a and b
                 if (zeroPadding)
@@ -52,7 +89,7 @@ namespace crypto
 
         private:
 
-            CryptoPP::Integer a, b1;    
+            CryptoPP::Integer y;    
     };
 
     inline bool ElGamalDecrypt (const uint8_t * key, const uint8_t * encrypted, 
@@ -0,0 +1,160 @@
+#include "util/Log.h"
+#include "util/Timestamp.h"
+#include "BandwidthLimiter.h"
+
+namespace i2p
+{
+namespace transport
+{
+    void TokenBucket::SetRate (uint32_t rate, uint32_t burst)
+    {
+        m_Rate = rate;
+        if (!burst) burst = rate; // one second by default
+        if (rate && burst < I2NP_MAX_MESSAGE_SIZE)
+            burst = I2NP_MAX_MESSAGE_SIZE; // otherwise big messages never fit
+        m_Burst = burst;
+        m_Tokens = burst;
+        m_LastUpdateTime = 0;
+    }
+
+    void TokenBucket::Update (uint64_t ts)
+    {
+        if (!m_Rate) return;
+        if (m_LastUpdateTime && ts > m_LastUpdateTime)
+        {
+            uint64_t tokens = (ts - m_LastUpdateTime)*m_Rate/1000;
+            if (!tokens) return; // less than a byte yet, keep the time for next update
+            m_Tokens += tokens;
+            if (m_Tokens >= m_Burst)
+            {
+                m_Tokens = m_Burst;
+                m_LastUpdateTime = ts;
+            }
+            else // advance by credited time only, remainder goes to next update
+                m_LastUpdateTime += (tokens*1000 + m_Rate - 1)/m_Rate;
+        }
+        else
+            m_LastUpdateTime = ts;
+    }
+
+    void BandwidthLimiter::SetTotalLimit (uint32_t rate, uint32_t burst)
+    {
+        std::unique_lock<std::mutex> l(m_BucketsMutex);
+        m_TotalBucket.SetRate (rate, burst);
+        m_IsLimited = !m_TotalBucket.IsUnlimited ();
+        if (m_IsLimited)
+            LogPrint (eLogInfo, "Bandwidth limit set to ", rate, " Bps, burst ", m_TotalBucket.GetBurst (), " bytes");
+    }
+
+    void BandwidthLimiter::SetClassLimit (TrafficClass trafficClass, uint32_t rate, uint32_t burst)
+    {
+        std::unique_lock<std::mutex> l(m_BucketsMutex);
+        m_ClassBuckets[trafficClass].SetRate (rate, burst);
+        uint32_t assured = 0;
+        for (int i = 0; i < eNumTrafficClasses; i++)
+            assured += m_ClassBuckets[i].GetRate ();
+        if (!m_TotalBucket.IsUnlimited () && assured > m_TotalBucket.GetRate ())
+            LogPrint (eLogWarning, "Assured traffic class rates ", assured, " Bps exceed total bandwidth limit ", m_TotalBucket.GetRate (), " Bps");
+    }
+
+    bool BandwidthLimiter::Consume (TrafficClass trafficClass, size_t len)
+    {
+        return Consume (trafficClass, len, i2p::util::GetMillisecondsSinceEpoch ());
+    }
+
+    bool BandwidthLimiter::Consume (TrafficClass trafficClass, size_t len, uint64_t ts)
+    {
+        auto& stats = m_Stats[trafficClass];
+        if (m_IsLimited)
+        {
+            std::unique_lock<std::mutex> l(m_BucketsMutex);
+            auto& bucket = m_ClassBuckets[trafficClass];
+            bucket.Update (ts);
+            m_TotalBucket.Update (ts);
+            if (!bucket.IsUnlimited () && bucket.HasTokens (len))
+            {
+                // within assured rate, we don't care about total
+                bucket.Consume (len);
+                m_TotalBucket.Consume (len);
+            }
+            else if (m_TotalBucket.HasTokens (len))
+                m_TotalBucket.Consume (len); // borrow spare bandwidth
+            else
+                return false;
+        }
+        stats.sentBytes += len;
+        return true;
+    }
+
+    void BandwidthLimiter::MessageDropped (TrafficClass trafficClass, size_t len)
+    {
+        auto& stats = m_Stats[trafficClass];
+        stats.numDroppedMessages++;
+        stats.droppedBytes += len;
+        LogPrint (eLogWarning, "Shaped queue of traffic class ", (int)trafficClass, " is full. Message dropped");
+    }
+
+    TrafficClass BandwidthLimiter::GetTrafficClass (std::shared_ptr<const I2NPMessage> msg)
+    {
+        if (msg->trafficClass != eTrafficClassClient)
+            return msg->trafficClass;
+        switch (msg->GetTypeID ())
+        {
+            case eI2NPDatabaseStore:
+            case eI2NPDatabaseLookup:
+            case eI2NPDatabaseSearchReply:
+                return eTrafficClassNetDb;
+            default:
+                return eTrafficClassClient;
+        }
+    }
+
+    void ShapedMessagesQueue::Put (const std::vector<std::shared_ptr<I2NPMessage> >& msgs,
+        std::vector<std::shared_ptr<I2NPMessage> >& allowed)
+    {
+        for (auto it: msgs)
+        {
+            if (!it) continue;
+            auto trafficClass = BandwidthLimiter::GetTrafficClass (it);
+            auto& queue = m_Queues[trafficClass];
+            if (queue.empty () && m_Limiter.Consume (trafficClass, it->GetLength ()))
+                allowed.push_back (it);
+            else if (queue.size () < MAX_NUM_SHAPED_MESSAGES)
+            {
+                queue.push_back (it);
+                m_Limiter.MessageDelayed (trafficClass);
+            }
+            else
+                m_Limiter.MessageDropped (trafficClass, it->GetLength ());
+        }
+    }
+
+    void ShapedMessagesQueue::Fetch (std::vector<std::shared_ptr<I2NPMessage> >& allowed)
+    {
+        // our own messages first
+        static const TrafficClass order[] = { eTrafficClassClient, eTrafficClassNetDb, eTrafficClassTransit };
+        for (auto trafficClass: order)
+        {
+            auto& queue = m_Queues[trafficClass];
+            while (!queue.empty () && m_Limiter.Consume (trafficClass, queue.front ()->GetLength ()))
+            {
+                allowed.push_back (queue.front ());
+                queue.pop_front ();
+            }
+        }
+    }
+
+    bool ShapedMessagesQueue::IsEmpty () const
+    {
+        for (int i = 0; i < eNumTrafficClasses; i++)
+            if (!m_Queues[i].empty ()) return false;
+        return true;
+    }
+
+    void ShapedMessagesQueue::Clear ()
+    {
+        for (int i = 0; i < eNumTrafficClasses; i++)
+            m_Queues[i].clear ();
+    }
+}
+}
@@ -0,0 +1,109 @@
+#ifndef BANDWIDTH_LIMITER_H__
+#define BANDWIDTH_LIMITER_H__
+
+#include <inttypes.h>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include "I2NPProtocol.h"
+
+namespace i2p
+{
+namespace transport
+{
+    const int BANDWIDTH_SHAPING_INTERVAL = 50; // in milliseconds
+    const size_t MAX_NUM_SHAPED_MESSAGES = 256; // per session and traffic class
+
+    class TokenBucket
+    {
+        public:
+
+            TokenBucket (): m_Rate (0), m_Burst (0), m_Tokens (0), m_LastUpdateTime (0) {};
+
+            void SetRate (uint32_t rate, uint32_t burst); // bytes per second, bytes. 0 means unlimited
+            uint32_t GetRate () const { return m_Rate; };
+            uint32_t GetBurst () const { return m_Burst; };
+            bool IsUnlimited () const { return !m_Rate; };
+
+            void Update (uint64_t ts); // in milliseconds
+            bool HasTokens (size_t len) const { return !m_Rate || m_Tokens >= (int64_t)len; };
+            void Consume (size_t len) { if (m_Rate) m_Tokens -= len; }; // might go below zero
+
+        private:
+
+            uint32_t m_Rate, m_Burst;
+            int64_t m_Tokens;
+            uint64_t m_LastUpdateTime;
+    };
+
+    struct TrafficClassStats
+    {
+        std::atomic<uint64_t> sentBytes, numDelayedMessages, numDroppedMessages, droppedBytes;
+
+        TrafficClassStats (): sentBytes (0), numDelayedMessages (0), numDroppedMessages (0), droppedBytes (0) {};
+    };
+
+    /**
+     * Hierarchical token bucket. Every traffic class has an assured rate it can always use,
+     * and borrows spare tokens from the total bucket above that
+     */
+    class BandwidthLimiter
+    {
+        public:
+
+            BandwidthLimiter (): m_IsLimited (false) {};
+
+            void SetTotalLimit (uint32_t rate, uint32_t burst = 0);
+            void SetClassLimit (TrafficClass trafficClass, uint32_t rate, uint32_t burst = 0);
+            bool IsLimited () const { return m_IsLimited; };
+
+            bool Consume (TrafficClass trafficClass, size_t len); // true if len bytes can be sent now
+            bool Consume (TrafficClass trafficClass, size_t len, uint64_t ts); // ts in milliseconds
+            void MessageDelayed (TrafficClass trafficClass) { m_Stats[trafficClass].numDelayedMessages++; };
+            void MessageDropped (TrafficClass trafficClass, size_t len);
+
+            static TrafficClass GetTrafficClass (std::shared_ptr<const I2NPMessage> msg);
+
+        private:
+
+            std::mutex m_BucketsMutex;
+            TokenBucket m_TotalBucket;
+            TokenBucket m_ClassBuckets[eNumTrafficClasses];
+            bool m_IsLimited;
+            TrafficClassStats m_Stats[eNumTrafficClasses];
+
+        public:
+
+            // for HTTP only
+            const TokenBucket& GetTotalBucket () const { return m_TotalBucket; };
+            const TokenBucket& GetClassBucket (TrafficClass trafficClass) const { return m_ClassBuckets[trafficClass]; };
+            const TrafficClassStats& GetStats (TrafficClass trafficClass) const { return m_Stats[trafficClass]; };
+    };
+
+    /**
+     * Per session queue of messages which don't fit bandwidth limits yet.
+     * Classes are queued separately, so transit bursts don't delay our own messages
+     */
+    class ShapedMessagesQueue
+    {
+        public:
+
+            ShapedMessagesQueue (BandwidthLimiter& limiter): m_Limiter (limiter) {};
+
+            // messages allowed to be sent now are appended to allowed, the rest are queued
+            void Put (const std::vector<std::shared_ptr<I2NPMessage> >& msgs, std::vector<std::shared_ptr<I2NPMessage> >& allowed);
+            void Fetch (std::vector<std::shared_ptr<I2NPMessage> >& allowed); // queued messages fitting limits now
+            bool IsEmpty () const;
+            void Clear ();
+
+        private:
+
+            BandwidthLimiter& m_Limiter;
+            std::deque<std::shared_ptr<I2NPMessage> > m_Queues[eNumTrafficClasses];
+    };
+}
+}
+
+#endif
@@ -0,0 +1,150 @@
+#include <algorithm>
+#include "util/Log.h"
+#include "util/Timestamp.h"
+#include "HandshakeWorkers.h"
+
+namespace i2p
+{
+namespace transport
+{
+    void HandshakeLatency::AddSample (uint64_t latency)
+    {
+        std::unique_lock<std::mutex> l(m_SamplesMutex);
+        if (m_Samples.size () < HANDSHAKE_MAX_NUM_LATENCY_SAMPLES)
+            m_Samples.push_back (latency);
+        else
+            m_Samples[m_NextSample] = latency;
+        m_NextSample = (m_NextSample + 1) % HANDSHAKE_MAX_NUM_LATENCY_SAMPLES;
+        m_NumHandshakes++;
+    }
+
+    uint64_t HandshakeLatency::GetPercentile (int percentile) const
+    {
+        std::vector<uint64_t> samples;
+        {
+            std::unique_lock<std::mutex> l(m_SamplesMutex);
+            samples = m_Samples;
+        }
+        if (samples.empty ()) return 0;
+        size_t ind = (samples.size () - 1)*percentile/100;
+        std::nth_element (samples.begin (), samples.begin () + ind, samples.end ());
+        return samples[ind];
+    }
+
+    HandshakeWorkers::HandshakeWorkers ():
+        m_IsRunning (false), m_LastRatesCleanupTime (0),
+        m_MaxRatePerIP (HANDSHAKE_DEFAULT_MAX_RATE_PER_IP), m_NumRejected (0), m_NumRateLimited (0)
+    {
+    }
+
+    HandshakeWorkers::~HandshakeWorkers ()
+    {
+        Stop ();
+    }
+
+    void HandshakeWorkers::Start (int numWorkers)
+    {
+        if (m_IsRunning || numWorkers <= 0) return; // run inline
+        m_IsRunning = true;
+        for (int i = 0; i < numWorkers; i++)
+            m_Threads.push_back (new std::thread (std::bind (&HandshakeWorkers::Run, this)));
+        LogPrint (eLogInfo, numWorkers, " handshake workers started");
+    }
+
+    void HandshakeWorkers::Stop ()
+    {
+        {
+            std::unique_lock<std::mutex> l(m_JobsMutex);
+            m_IsRunning = false;
+            m_JobsCondition.notify_all ();
+        }
+        for (auto it: m_Threads)
+        {
+            it->join ();
+            delete it;
+        }
+        m_Threads.clear ();
+        std::unique_lock<std::mutex> l(m_JobsMutex);
+        while (!m_Jobs.empty ()) m_Jobs.pop (); // sessions are being destroyed anyway
+    }
+
+    bool HandshakeWorkers::Submit (boost::asio::io_service& service, std::function<bool ()> work,
+        std::function<void (bool)> completion)
+    {
+        if (!m_IsRunning)
+        {
+            bool result = work ();
+            service.post (std::bind (completion, result));
+            return true;
+        }
+        std::unique_lock<std::mutex> l(m_JobsMutex);
+        if (m_Jobs.size () >= HANDSHAKE_MAX_QUEUE_SIZE)
+        {
+            m_NumRejected++;
+            return false;
+        }
+        m_Jobs.push ({ &service, work, completion });
+        m_JobsCondition.notify_one ();
+        return true;
+    }
+
+    void HandshakeWorkers::Run ()
+    {
+        while (m_IsRunning)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> l(m_JobsMutex);
+                while (m_IsRunning && m_Jobs.empty ())
+                    m_JobsCondition.wait (l);
+                if (!m_IsRunning) break;
+                job = m_Jobs.front ();
+                m_Jobs.pop ();
+            }
+            bool result = false;
+            try
+            {
+                result = job.work ();
+            }
+            catch (std::exception& ex)
+            {
+                LogPrint (eLogError, "Handshake worker: ", ex.what ());
+            }
+            job.service->post (std::bind (job.completion, result));
+        }
+    }
+
+    bool HandshakeWorkers::IsHandshakeAllowed (const boost::asio::ip::address& addr)
+    {
+        if (m_MaxRatePerIP <= 0) return true;
+        uint32_t ts = i2p::util::GetSecondsSinceEpoch ();
+        std::unique_lock<std::mutex> l(m_RatesMutex);
+        if (ts > m_LastRatesCleanupTime + HANDSHAKE_RATE_INTERVAL)
+        {
+            for (auto it = m_Rates.begin (); it != m_Rates.end ();)
+            {
+                if (ts > it->second.first + HANDSHAKE_RATE_INTERVAL)
+                    it = m_Rates.erase (it);
+                else
+                    it++;
+            }
+            m_LastRatesCleanupTime = ts;
+        }
+        auto& rate = m_Rates[addr];
+        if (ts > rate.first + HANDSHAKE_RATE_INTERVAL)
+        {
+            // new interval
+            rate.first = ts;
+            rate.second = 0;
+        }
+        if (rate.second >= m_MaxRatePerIP)
+        {
+            m_NumRateLimited++;
+            LogPrint (eLogWarning, "Too many handshakes from ", addr, ". Dropped");
+            return false;
+        }
+        rate.second++;
+        return true;
+    }
+}
+}
@@ -0,0 +1,103 @@
+#ifndef HANDSHAKE_WORKERS_H__
+#define HANDSHAKE_WORKERS_H__
+
+#include <inttypes.h>
+#include <map>
+#include <queue>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <boost/asio.hpp>
+
+namespace i2p
+{
+namespace transport
+{
+    const int HANDSHAKE_DEFAULT_NUM_WORKERS = 2;
+    const size_t HANDSHAKE_MAX_QUEUE_SIZE = 256; // pending jobs
+    const int HANDSHAKE_RATE_INTERVAL = 60; // in seconds
+    const int HANDSHAKE_DEFAULT_MAX_RATE_PER_IP = 20; // per interval
+    const size_t HANDSHAKE_MAX_NUM_LATENCY_SAMPLES = 1024;
+
+    class HandshakeLatency
+    {
+        public:
+
+            HandshakeLatency (): m_NextSample (0), m_NumHandshakes (0) {};
+            void AddSample (uint64_t latency); // in milliseconds
+            uint64_t GetPercentile (int percentile) const; // of last samples, 0 if no samples
+            uint64_t GetNumHandshakes () const { return m_NumHandshakes; };
+
+        private:
+
+            mutable std::mutex m_SamplesMutex;
+            std::vector<uint64_t> m_Samples; // ring buffer
+            size_t m_NextSample;
+            std::atomic<uint64_t> m_NumHandshakes;
+    };
+
+    /**
+     * Runs DH agreement and signature verification of transport handshakes
+     * off I/O threads. Completion is posted back to the session's io_service
+     */
+    class HandshakeWorkers
+    {
+        public:
+
+            HandshakeWorkers ();
+            ~HandshakeWorkers ();
+            void Start (int numWorkers = HANDSHAKE_DEFAULT_NUM_WORKERS);
+            void Stop ();
+
+            // returns false if queue is full. Runs work inline if not started
+            bool Submit (boost::asio::io_service& service, std::function<bool ()> work,
+                std::function<void (bool)> completion);
+            bool IsHandshakeAllowed (const boost::asio::ip::address& addr); // per IP rate limit
+            void SetMaxRatePerIP (int maxRate) { m_MaxRatePerIP = maxRate; }; // before Start, 0 means no limit
+
+            HandshakeLatency& GetNTCPLatency () { return m_NTCPLatency; };
+            HandshakeLatency& GetSSULatency () { return m_SSULatency; };
+
+        private:
+
+            void Run ();
+
+            struct Job
+            {
+                boost::asio::io_service * service;
+                std::function<bool ()> work;
+                std::function<void (bool)> completion;
+            };
+
+        private:
+
+            bool m_IsRunning;
+            std::vector<std::thread *> m_Threads;
+            std::queue<Job> m_Jobs;
+            mutable std::mutex m_JobsMutex;
+            std::condition_variable m_JobsCondition;
+
+            std::mutex m_RatesMutex;
+            std::map<boost::asio::ip::address, std::pair<uint32_t, int> > m_Rates; // IP -> (interval start, count)
+            uint32_t m_LastRatesCleanupTime;
+            int m_MaxRatePerIP;
+
+            HandshakeLatency m_NTCPLatency, m_SSULatency;
+            std::atomic<uint64_t> m_NumRejected, m_NumRateLimited;
+
+        public:
+
+            // for HTTP only
+            const HandshakeLatency& GetNTCPLatency () const { return m_NTCPLatency; };
+            const HandshakeLatency& GetSSULatency () const { return m_SSULatency; };
+            uint64_t GetNumRejected () const { return m_NumRejected; };
+            uint64_t GetNumRateLimited () const { return m_NumRateLimited; };
+            size_t GetQueueSize () const { std::unique_lock<std::mutex> l(m_JobsMutex); return m_Jobs.size (); };
+    };
+}
+}
+
+#endif
@@ -6,6 +6,7 @@
 #include "util/base64.h"
 #include "util/Log.h"
 #include "util/Timestamp.h"
+#include "util/Metrics.h"
 #include "crypto/CryptoConst.h"
 #include "I2NPProtocol.h"
 #include "RouterContext.h"
@@ -20,9 +21,12 @@ namespace i2p
 namespace transport
 {
     NTCPSession::NTCPSession (NTCPServer& server, std::shared_ptr<const i2p::data::RouterInfo> in_RemoteRouter): 
-        TransportSession (in_RemoteRouter), m_Server (server), m_Socket (m_Server.GetService ()), 
-        m_TerminationTimer (m_Server.GetService ()), m_IsEstablished (false), m_IsTerminated (false),
-        m_ReceiveBufferOffset (0), m_NextMessage (nullptr), m_IsSending (false)
+        TransportSession (in_RemoteRouter), m_Server (server), m_ThreadIndex (server.GetNextThreadIndex ()), 
+        m_Service (server.GetService (m_ThreadIndex)), m_Socket (m_Service), 
+        m_TerminationTimer (m_Service), m_ShapingTimer (m_Service), 
+        m_IsEstablished (false), m_IsTerminated (false), m_HandshakeStartTime (0), m_ReceiveBufferOffset (0), 
+        m_NextMessage (nullptr), m_IsSending (false), m_ShapedQueue (transports.GetBandwidthLimiter ()), 
+        m_IsShapingScheduled (false)
     {       
         m_DHKeysPair = transports.GetNextDHKeysPair ();
         m_Establisher = new Establisher;
@@ -33,15 +37,14 @@ namespace transport
         delete m_Establisher;
     }
 
-    void NTCPSession::CreateAESKey (uint8_t * pubKey, i2p::crypto::AESKey& key)
+    bool NTCPSession::CreateAESKey (const DHKeysPair& keys, const uint8_t * pubKey, i2p::crypto::AESKey& key)
     {
         CryptoPP::DH dh (elgp, elgg);
         uint8_t sharedKey[256];
-        if (!dh.Agree (sharedKey, m_DHKeysPair->privateKey, pubKey))
+        if (!dh.Agree (sharedKey, keys.privateKey, pubKey))
         {    
             LogPrint (eLogError, "Couldn't create shared key");
-            Terminate ();
-            return;
+            return false;
         };
 
         uint8_t * aesKey = key;
@@ -62,16 +65,61 @@ namespace transport
                 if (nonZero - sharedKey > 32)
                 {
                     LogPrint (eLogWarning, "First 32 bytes of shared key is all zeros. Ignored");
-                    return;
+                    return false;
                 }   
             }
             memcpy (aesKey, nonZero, 32);
         }
+        return true;
+    }   
+
+    // work may only read state the session doesn't change until completion, like received phase data.
+    // Submit's queue mutex and the completion post order it with session's thread
+    void NTCPSession::RunHandshakeCrypto (std::function<bool ()> work, std::function<void ()> completion)
+    {
+        auto s = shared_from_this ();
+        if (!transports.GetHandshakeWorkers ().Submit (m_Service, work,
+            [s, completion](bool success)
+            {
+                if (s->m_IsTerminated) return;
+                if (success)
+                    completion ();
+                else
+                    s->Terminate ();
+            }))
+        {
+            LogPrint (eLogWarning, "Handshake workers are busy. NTCP session dropped");
+            Terminate ();
+        }   
     }   
 
+    void NTCPSession::AgreeAESKey (const uint8_t * pubKey, std::function<void ()> completion)
+    {
+        // worker works on copies, key is set on session's thread in completion
+        struct Agreement
+        {
+            DHKeysPair keys;
+            uint8_t pubKey[256];
+            i2p::crypto::AESKey aesKey;
+        };
+        auto agreement = std::make_shared<Agreement> ();
+        agreement->keys = *m_DHKeysPair;
+        memcpy (agreement->pubKey, pubKey, 256);
+        auto s = shared_from_this ();
+        RunHandshakeCrypto ([agreement]()
+            {
+                return CreateAESKey (agreement->keys, agreement->pubKey, agreement->aesKey);
+            },
+            [s, agreement, completion]()
+            {
+                s->m_Establisher->aesKey = agreement->aesKey;
+                completion ();
+            });
+    }
+
     void NTCPSession::Done ()
     {
-        m_Server.GetService ().post (std::bind (&NTCPSession::Terminate, shared_from_this ()));  
+        m_Service.post (std::bind (&NTCPSession::Terminate, shared_from_this ()));  
     }   
         
     void NTCPSession::Terminate ()
@@ -79,13 +127,17 @@ namespace transport
         if (!m_IsTerminated)
         {   
             m_IsTerminated = true;
+            if (m_IsEstablished)
+                m_Server.UpdateNumSessions (m_ThreadIndex, -1);
             m_IsEstablished = false;
             m_Socket.close ();
             transports.PeerDisconnected (shared_from_this ());
             m_Server.RemoveNTCPSession (shared_from_this ());
             m_SendQueue.clear ();
+            m_ShapedQueue.Clear ();
             m_NextMessage = nullptr;
             m_TerminationTimer.cancel ();
+            m_ShapingTimer.cancel ();
             LogPrint (eLogInfo, "NTCP session terminated");
         }   
     }   
@@ -93,6 +145,12 @@ namespace transport
     void NTCPSession::Connected ()
     {
         m_IsEstablished = true;
+        m_Server.UpdateNumSessions (m_ThreadIndex, 1);
+        auto latency = i2p::util::GetMillisecondsSinceEpoch () - m_HandshakeStartTime;
+        transports.GetHandshakeWorkers ().GetNTCPLatency ().AddSample (latency);
+        static auto& handshakeDuration = i2p::util::metrics.GetHistogram ("i2pd_transport_handshake_duration_milliseconds",
+            "Time from connect to established session", i2p::util::ExponentialBuckets (10, 2, 12), "transport=\"ntcp\"");
+        handshakeDuration.Observe (latency);
 
         delete m_Establisher;
         m_Establisher = nullptr;
@@ -100,6 +158,12 @@ namespace transport
         delete m_DHKeysPair;
         m_DHKeysPair = nullptr; 
 
+        // we coalesce messages ourselves, don't let Nagle delay the last frame of a batch
+        boost::system::error_code ec;
+        m_Socket.set_option (boost::asio::ip::tcp::no_delay (true), ec);
+        if (ec)
+            LogPrint (eLogWarning, "Couldn't set TCP_NODELAY: ", ec.message ());
+
         SendTimeSyncMessage ();
         m_SendQueue.push_back (CreateDatabaseStoreMsg ()); // we tell immediately who we are        
 
@@ -108,6 +172,7 @@ namespace transport
         
     void NTCPSession::ClientLogin ()
     {
+        m_HandshakeStartTime = i2p::util::GetMillisecondsSinceEpoch ();
         if (!m_DHKeysPair)
             m_DHKeysPair = transports.GetNextDHKeysPair ();
         // send Phase1
@@ -125,6 +190,7 @@ namespace transport
 
     void NTCPSession::ServerLogin ()
     {
+        m_HandshakeStartTime = i2p::util::GetMillisecondsSinceEpoch ();
         boost::system::error_code ec;
         auto ep = m_Socket.remote_endpoint(ec); 
         if (!ec)
@@ -196,17 +262,20 @@ namespace transport
         m_Establisher->phase2.encrypted.timestamp = tsB;
         // TODO: fill filler
 
-        i2p::crypto::AESKey aesKey;
-        CreateAESKey (m_Establisher->phase1.pubKey, aesKey);
+        AgreeAESKey (m_Establisher->phase1.pubKey, std::bind (&NTCPSession::SendPhase2Encrypted, shared_from_this (), tsB));
+    }   
+
+    void NTCPSession::SendPhase2Encrypted (uint32_t tsB)
+    {
+        const i2p::crypto::AESKey& aesKey = m_Establisher->aesKey;
         m_Encryption.SetKey (aesKey);
-        m_Encryption.SetIV (y + 240);
+        m_Encryption.SetIV (m_Establisher->phase2.pubKey + 240); // y
         m_Decryption.SetKey (aesKey);
         m_Decryption.SetIV (m_Establisher->phase1.HXxorHI + 16);
         
         m_Encryption.Encrypt ((uint8_t *)&m_Establisher->phase2.encrypted, sizeof(m_Establisher->phase2.encrypted), (uint8_t *)&m_Establisher->phase2.encrypted);
         boost::asio::async_write (m_Socket, boost::asio::buffer (&m_Establisher->phase2, sizeof (NTCPPhase2)), boost::asio::transfer_all (),
             std::bind(&NTCPSession::HandlePhase2Sent, shared_from_this (), std::placeholders::_1, std::placeholders::_2, tsB));
-
     }   
         
     void NTCPSession::HandlePhase2Sent (const boost::system::error_code& ecode, std::size_t, uint32_t tsB)
@@ -241,28 +310,32 @@ namespace transport
         }
         else
         {   
-            i2p::crypto::AESKey aesKey;
-            CreateAESKey (m_Establisher->phase2.pubKey, aesKey);
-            m_Decryption.SetKey (aesKey);
-            m_Decryption.SetIV (m_Establisher->phase2.pubKey + 240);
-            m_Encryption.SetKey (aesKey);
-            m_Encryption.SetIV (m_Establisher->phase1.HXxorHI + 16);
-            
-            m_Decryption.Decrypt((uint8_t *)&m_Establisher->phase2.encrypted, sizeof(m_Establisher->phase2.encrypted), (uint8_t *)&m_Establisher->phase2.encrypted);
-            // verify
-            uint8_t xy[512];
-            memcpy (xy, m_DHKeysPair->publicKey, 256);
-            memcpy (xy + 256, m_Establisher->phase2.pubKey, 256);
-            if (!CryptoPP::SHA256().VerifyDigest(m_Establisher->phase2.encrypted.hxy, xy, 512)) 
-            {
-                LogPrint (eLogError, "Incorrect hash");
-                transports.ReuseDHKeysPair (m_DHKeysPair);
-                m_DHKeysPair = nullptr;
-                Terminate ();
-                return ;
-            }   
-            SendPhase3 ();
+            AgreeAESKey (m_Establisher->phase2.pubKey, std::bind (&NTCPSession::HandlePhase2, shared_from_this ()));
+        }   
+    }   
+
+    void NTCPSession::HandlePhase2 ()
+    {
+        const i2p::crypto::AESKey& aesKey = m_Establisher->aesKey;
+        m_Decryption.SetKey (aesKey);
+        m_Decryption.SetIV (m_Establisher->phase2.pubKey + 240);
+        m_Encryption.SetKey (aesKey);
+        m_Encryption.SetIV (m_Establisher->phase1.HXxorHI + 16);
+        
+        m_Decryption.Decrypt((uint8_t *)&m_Establisher->phase2.encrypted, sizeof(m_Establisher->phase2.encrypted), (uint8_t *)&m_Establisher->phase2.encrypted);
+        // verify
+        uint8_t xy[512];
+        memcpy (xy, m_DHKeysPair->publicKey, 256);
+        memcpy (xy + 256, m_Establisher->phase2.pubKey, 256);
+        if (!CryptoPP::SHA256().VerifyDigest(m_Establisher->phase2.encrypted.hxy, xy, 512)) 
+        {
+            LogPrint (eLogError, "Incorrect hash");
+            transports.ReuseDHKeysPair (m_DHKeysPair);
+            m_DHKeysPair = nullptr;
+            Terminate ();
+            return ;
         }   
+        SendPhase3 ();
     }   
 
     void NTCPSession::SendPhase3 ()
@@ -376,21 +449,27 @@ namespace transport
         buf += 4;
         buf += paddingLen;  
 
-        SignedData s;
-        s.Insert (m_Establisher->phase1.pubKey, 256); // x
-        s.Insert (m_Establisher->phase2.pubKey, 256); // y
-        s.Insert (i2p::context.GetRouterInfo ().GetIdentHash (), 32); // ident
-        s.Insert (tsA); // tsA
-        s.Insert (tsB); // tsB          
-        if (!s.Verify (m_RemoteIdentity, buf))
-        {   
-            LogPrint (eLogError, "signature verification failed");
-            Terminate ();
-            return;
-        }   
-        m_RemoteIdentity.DropVerifier (); 
-
-        SendPhase4 (tsA, tsB);
+        auto s = std::make_shared<SignedData> ();
+        s->Insert (m_Establisher->phase1.pubKey, 256); // x
+        s->Insert (m_Establisher->phase2.pubKey, 256); // y
+        s->Insert (i2p::context.GetRouterInfo ().GetIdentHash (), 32); // ident
+        s->Insert (tsA); // tsA
+        s->Insert (tsB); // tsB          
+        auto session = shared_from_this ();
+        RunHandshakeCrypto ([session, s, buf]()
+            {
+                if (!s->Verify (session->m_RemoteIdentity, buf))
+                {   
+                    LogPrint (eLogError, "signature verification failed");
+                    return false;
+                }   
+                return true;
+            }, 
+            [session, tsA, tsB]()
+            {
+                session->m_RemoteIdentity.DropVerifier (); 
+                session->SendPhase4 (tsA, tsB);
+            });
     }
 
     void NTCPSession::SendPhase4 (uint32_t tsA, uint32_t tsB)
@@ -449,29 +528,38 @@ namespace transport
             m_Decryption.Decrypt(m_ReceiveBuffer, bytes_transferred, m_ReceiveBuffer);
 
             // verify signature
-            SignedData s;
-            s.Insert (m_Establisher->phase1.pubKey, 256); // x
-            s.Insert (m_Establisher->phase2.pubKey, 256); // y
-            s.Insert (i2p::context.GetRouterInfo ().GetIdentHash (), 32); // ident
-            s.Insert (tsA); // tsA
-            s.Insert (m_Establisher->phase2.encrypted.timestamp); // tsB
-
-            if (!s.Verify (m_RemoteIdentity, m_ReceiveBuffer))
-            {   
-                LogPrint (eLogError, "signature verification failed");
-                Terminate ();
-                return;
-            }   
-            m_RemoteIdentity.DropVerifier (); 
-            LogPrint (eLogInfo, "NTCP session to ", m_Socket.remote_endpoint (), " connected");
-            Connected ();
-                        
-            m_ReceiveBufferOffset = 0;
-            m_NextMessage = nullptr;
-            Receive ();
+            auto s = std::make_shared<SignedData> ();
+            s->Insert (m_Establisher->phase1.pubKey, 256); // x
+            s->Insert (m_Establisher->phase2.pubKey, 256); // y
+            s->Insert (i2p::context.GetRouterInfo ().GetIdentHash (), 32); // ident
+            s->Insert (tsA); // tsA
+            s->Insert (m_Establisher->phase2.encrypted.timestamp); // tsB
+
+            auto session = shared_from_this ();
+            RunHandshakeCrypto ([session, s]()
+                {
+                    if (!s->Verify (session->m_RemoteIdentity, session->m_ReceiveBuffer))
+                    {   
+                        LogPrint (eLogError, "signature verification failed");
+                        return false;
+                    }   
+                    return true;
+                }, 
+                std::bind (&NTCPSession::HandlePhase4, session));
         }
     }
 
+    void NTCPSession::HandlePhase4 ()
+    {
+        m_RemoteIdentity.DropVerifier (); 
+        LogPrint (eLogInfo, "NTCP session to ", m_Socket.remote_endpoint (), " connected");
+        Connected ();
+                    
+        m_ReceiveBufferOffset = 0;
+        m_NextMessage = nullptr;
+        Receive ();
+    }
+
     void NTCPSession::Receive ()
     {
         m_Socket.async_read_some (boost::asio::buffer(m_ReceiveBuffer + m_ReceiveBufferOffset, NTCP_BUFFER_SIZE - m_ReceiveBufferOffset),                
@@ -502,13 +590,14 @@ namespace transport
                     uint8_t * nextBlock = m_ReceiveBuffer;
                     while (m_ReceiveBufferOffset >= 16)
                     {
-                        if (!DecryptNextBlock (nextBlock)) // 16 bytes
+                        size_t numBytes = DecryptNextBlocks (nextBlock, m_ReceiveBufferOffset & ~0x0F); 
+                        if (!numBytes)
                         {
                             Terminate ();
                             return; 
                         }   
-                        nextBlock += 16;
-                        m_ReceiveBufferOffset -= 16;
+                        nextBlock += numBytes;
+                        m_ReceiveBufferOffset -= numBytes;
                     }   
                     if (m_ReceiveBufferOffset > 0)
                         memcpy (m_ReceiveBuffer, nextBlock, m_ReceiveBufferOffset);
@@ -544,8 +633,9 @@ namespace transport
         }   
     }   
 
-    bool NTCPSession::DecryptNextBlock (const uint8_t * encrypted) // 16 bytes
+    size_t NTCPSession::DecryptNextBlocks (const uint8_t * encrypted, size_t len) 
     {
+        size_t numConsumed = 0;
         if (!m_NextMessage) // new message, header expected
         {   
             // descrypt header and extract length
@@ -558,7 +648,7 @@ namespace transport
                 if (dataSize > NTCP_MAX_MESSAGE_SIZE)
                 {
                     LogPrint (eLogError, "NTCP data size ", dataSize, " exceeds max size");
-                    return false;
+                    return 0;
                 }
                 auto msg = dataSize <= I2NP_MAX_SHORT_MESSAGE_SIZE - 2 ? NewI2NPShortMessage () : NewI2NPMessage ();
                 m_NextMessage = ToSharedI2NPMessage (msg);  
@@ -566,21 +656,28 @@ namespace transport
                 m_NextMessageOffset = 16;
                 m_NextMessage->offset = 2; // size field
                 m_NextMessage->len = dataSize + 2; 
+                encrypted += 16; len -= 16; numConsumed = 16;
             }   
             else
             {   
                 // timestamp
                 LogPrint ("Timestamp"); 
-                return true;
+                return 16;
             }   
         }   
-        else // message continues
-        {   
-            m_Decryption.Decrypt (encrypted, m_NextMessage->buf + m_NextMessageOffset);
-            m_NextMessageOffset += 16;
-        }       
         
-        if (m_NextMessageOffset >= m_NextMessage->len + 4) // +checksum
+        // decrypt the rest of the frame, or as much of it as we have, directly into the message
+        size_t frameSize = (m_NextMessage->len + 4 + 15) & ~0x0F; // size + data + padding + checksum
+        size_t numBytes = frameSize - m_NextMessageOffset;
+        if (numBytes > len) numBytes = len;
+        if (numBytes > 0)
+        {
+            m_Decryption.Decrypt (encrypted, numBytes, m_NextMessage->buf + m_NextMessageOffset);
+            m_NextMessageOffset += numBytes;
+            numConsumed += numBytes;
+        }   
+        
+        if (m_NextMessageOffset >= frameSize)
         {   
             // we have a complete I2NP message
             if (CryptoPP::Adler32().VerifyDigest (m_NextMessage->buf + m_NextMessageOffset - 4, m_NextMessage->buf, m_NextMessageOffset - 4))   
@@ -589,7 +686,7 @@ namespace transport
                 LogPrint (eLogWarning, "Incorrect adler checksum of NTCP message. Dropped");
             m_NextMessage = nullptr;
         }
-        return true;    
+        return numConsumed;    
     }   
 
     void NTCPSession::Send (std::shared_ptr<i2p::I2NPMessage> msg)
@@ -637,13 +734,31 @@ namespace transport
     {
         m_IsSending = true;
         std::vector<boost::asio::const_buffer> bufs;
+        bufs.reserve (msgs.size ());
         for (auto it: msgs)
             bufs.push_back (CreateMsgBuffer (it));
         boost::asio::async_write (m_Socket, bufs, boost::asio::transfer_all (),                      
             std::bind(&NTCPSession::HandleSent, shared_from_this (), std::placeholders::_1, std::placeholders::_2, msgs));
     }
         
-    void NTCPSession::HandleSent (const boost::system::error_code& ecode, std::size_t bytes_transferred, std::vector<std::shared_ptr<I2NPMessage> >)
+    void NTCPSession::SendQueued ()
+    {
+        // coalesce queued messages into one vectored write up to NTCP_MAX_WRITE_SIZE
+        std::vector<std::shared_ptr<I2NPMessage> > msgs;
+        size_t len = 0;
+        while (!m_SendQueue.empty ())
+        {
+            auto msg = m_SendQueue.front ();
+            size_t frameLen = msg ? msg->GetLength () + 6 : 16; // size + data + adler32 without padding
+            if (!msgs.empty () && len + frameLen > NTCP_MAX_WRITE_SIZE) break;
+            msgs.push_back (msg);
+            len += frameLen;
+            m_SendQueue.pop_front ();
+        }
+        Send (msgs);
+    }   
+
+    void NTCPSession::HandleSent (const boost::system::error_code& ecode, std::size_t bytes_transferred, std::vector<std::shared_ptr<I2NPMessage> > msgs)
     {
         m_IsSending = false;
         if (ecode)
@@ -657,11 +772,9 @@ namespace transport
         {   
             m_NumSentBytes += bytes_transferred;
             i2p::transport::transports.UpdateSentBytes (bytes_transferred);
+            m_Server.GetWriteStats ().Update (bytes_transferred, msgs.size ());
             if (!m_SendQueue.empty())
-            {
-                Send (m_SendQueue);
-                m_SendQueue.clear ();
-            }   
+                SendQueued ();
             else
                 ScheduleTermination (); // reset termination timer
         }   
@@ -676,19 +789,25 @@ namespace transport
 
     void NTCPSession::SendI2NPMessages (const std::vector<std::shared_ptr<I2NPMessage> >& msgs)
     {
-        m_Server.GetService ().post (std::bind (&NTCPSession::PostI2NPMessages, shared_from_this (), msgs));  
+        m_Service.post (std::bind (&NTCPSession::PostI2NPMessages, shared_from_this (), msgs));  
     }   
 
     void NTCPSession::PostI2NPMessages (std::vector<std::shared_ptr<I2NPMessage> > msgs)
     {
         if (m_IsTerminated) return;
-        if (m_IsSending)
-        {
-            for (auto it: msgs)
-                m_SendQueue.push_back (it);
-        }   
-        else    
-            Send (msgs);
+        std::vector<std::shared_ptr<I2NPMessage> > allowed;
+        m_ShapedQueue.Put (msgs, allowed);
+        SendOrQueue (allowed);
+        if (!m_ShapedQueue.IsEmpty ())
+            ScheduleShaping ();
+    }   
+
+    void NTCPSession::SendOrQueue (const std::vector<std::shared_ptr<I2NPMessage> >& msgs)
+    {
+        if (msgs.empty ()) return;
+        m_SendQueue.insert (m_SendQueue.end (), msgs.begin (), msgs.end ());
+        if (!m_IsSending)
+            SendQueued ();
     }   
         
     void NTCPSession::ScheduleTermination ()
@@ -709,16 +828,54 @@ namespace transport
         }   
     }   
 
+    void NTCPSession::ScheduleShaping ()
+    {
+        if (m_IsShapingScheduled) return;
+        m_IsShapingScheduled = true;
+        m_ShapingTimer.expires_from_now (boost::posix_time::milliseconds(BANDWIDTH_SHAPING_INTERVAL));
+        m_ShapingTimer.async_wait (std::bind (&NTCPSession::HandleShapingTimer,
+            shared_from_this (), std::placeholders::_1));
+    }
+
+    void NTCPSession::HandleShapingTimer (const boost::system::error_code& ecode)
+    {
+        m_IsShapingScheduled = false;
+        if (ecode != boost::asio::error::operation_aborted && !m_IsTerminated)
+        {
+            std::vector<std::shared_ptr<I2NPMessage> > allowed;
+            m_ShapedQueue.Fetch (allowed);
+            SendOrQueue (allowed);
+            if (!m_ShapedQueue.IsEmpty ())
+                ScheduleShaping ();
+        }   
+    }   
+
+//-----------------------------------------
+    void NTCPWriteStats::Update (size_t bytes, size_t numMessages)
+    {
+        numWrites++;
+        numWrittenMessages += numMessages;
+        size_t i = 0;
+        while (i < NTCP_WRITE_HISTOGRAM_SIZE - 1 && bytes >= (NTCP_WRITE_HISTOGRAM_MIN_SIZE << i)) i++;
+        histogram[i]++;
+    }   
+
 //-----------------------------------------
-    NTCPServer::NTCPServer (int):
-        m_IsRunning (false), m_Thread (nullptr), m_Work (m_Service), 
-        m_NTCPAcceptor (nullptr), m_NTCPV6Acceptor (nullptr)
+    NTCPServer::NTCPServer (int, int numThreads):
+        m_IsRunning (false), m_NextThreadIndex (0)
     {
+        if (numThreads < 1) numThreads = 1;
+        if (numThreads > NTCP_MAX_NUM_THREADS) numThreads = NTCP_MAX_NUM_THREADS;
+        for (int i = 0; i < numThreads; i++)
+            m_ServiceThreads.push_back (new ServiceThread ());
     }
         
     NTCPServer::~NTCPServer ()
     {
         Stop ();
+        for (auto it: m_ServiceThreads)
+            delete it;
+        m_ServiceThreads.clear ();
     }   
 
     void NTCPServer::Start ()
@@ -726,33 +883,31 @@ namespace transport
         if (!m_IsRunning)
         {   
             m_IsRunning = true;
-            m_Thread = new std::thread (std::bind (&NTCPServer::Run, this));
+            for (auto it: m_ServiceThreads)
+                it->thread = new std::thread (std::bind (&NTCPServer::Run, this, it));
+            // every thread has own listener if kernel distributes connections between them
+            bool reusePort = false;
+#ifdef SO_REUSEPORT
+            reusePort = m_ServiceThreads.size () > 1;
+#endif
+            size_t numAcceptors = reusePort ? m_ServiceThreads.size () : 1;
             // create acceptors
             auto addresses = context.GetRouterInfo ().GetAddresses ();
             for (auto& address : addresses)
             {
                 if (address.transportStyle == i2p::data::RouterInfo::eTransportNTCP && address.host.is_v4 ())
                 {   
-                    m_NTCPAcceptor = new boost::asio::ip::tcp::acceptor (m_Service,
-                        boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), address.port));
-
-                    LogPrint (eLogInfo, "Start listening TCP port ", address.port); 
-                    auto conn = std::make_shared<NTCPSession>(*this);
-                    m_NTCPAcceptor->async_accept(conn->GetSocket (), std::bind (&NTCPServer::HandleAccept, this, 
-                        conn, std::placeholders::_1));  
+                    for (size_t i = 0; i < numAcceptors; i++)
+                        Accept (CreateAcceptor (m_ServiceThreads[i]->service, 
+                            boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), address.port), reusePort));
+                    LogPrint (eLogInfo, "Start listening TCP port ", address.port, " with ", m_ServiceThreads.size (), " threads"); 
                 
                     if (context.SupportsV6 ())
                     {
-                        m_NTCPV6Acceptor = new boost::asio::ip::tcp::acceptor (m_Service);
-                        m_NTCPV6Acceptor->open (boost::asio::ip::tcp::v6());
-                        m_NTCPV6Acceptor->set_option (boost::asio::ip::v6_only (true));
-                        m_NTCPV6Acceptor->bind (boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v6(), address.port));
-                        m_NTCPV6Acceptor->listen ();
-
+                        for (size_t i = 0; i < numAcceptors; i++)
+                            Accept (CreateAcceptor (m_ServiceThreads[i]->service, 
+                                boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v6(), address.port), reusePort));
                         LogPrint (eLogInfo, "Start listening V6 TCP port ", address.port);  
-                        auto conn = std::make_shared<NTCPSession> (*this);
-                        m_NTCPV6Acceptor->async_accept(conn->GetSocket (), std::bind (&NTCPServer::HandleAcceptV6,
-                            this, conn, std::placeholders::_1));
                     }   
                 }   
             }   
@@ -761,34 +916,40 @@ namespace transport
         
     void NTCPServer::Stop ()
     {   
-        m_NTCPSessions.clear ();
+        {
+            std::unique_lock<std::mutex> l(m_NTCPSessionsMutex);    
+            m_NTCPSessions.clear ();
+        }
 
         if (m_IsRunning)
         {   
             m_IsRunning = false;
-            delete m_NTCPAcceptor;
-            m_NTCPAcceptor = nullptr;
-            delete m_NTCPV6Acceptor;
-            m_NTCPV6Acceptor = nullptr;
+            for (auto it: m_NTCPAcceptors)
+                delete it;
+            m_NTCPAcceptors.clear ();
 
-            m_Service.stop ();
-            if (m_Thread)
+            for (auto it: m_ServiceThreads)
+                it->service.stop ();
+            for (auto it: m_ServiceThreads)
             {   
-                m_Thread->join (); 
-                delete m_Thread;
-                m_Thread = nullptr;
+                if (it->thread)
+                {   
+                    it->thread->join (); 
+                    delete it->thread;
+                    it->thread = nullptr;
+                }   
             }   
         }   
     }   
 
         
-    void NTCPServer::Run () 
+    void NTCPServer::Run (ServiceThread * serviceThread) 
     { 
         while (m_IsRunning)
         {
             try
             {   
-                m_Service.run ();
+                serviceThread->service.run ();
             }
             catch (std::exception& ex)
             {
@@ -797,6 +958,11 @@ namespace transport
         }   
     }   
 
+    int NTCPServer::GetNextThreadIndex ()
+    {
+        return (m_NextThreadIndex++) % m_ServiceThreads.size ();
+    }   
+
     void NTCPServer::AddNTCPSession (std::shared_ptr<NTCPSession> session)
     {
         if (session)
@@ -823,45 +989,35 @@ namespace transport
             return it->second;
         return nullptr;
     }   
-        
-    void NTCPServer::HandleAccept (std::shared_ptr<NTCPSession> conn, const boost::system::error_code& error)
-    {       
-        if (!error)
-        {
-            boost::system::error_code ec;
-            auto ep = conn->GetSocket ().remote_endpoint(ec);   
-            if (!ec)
-            {
-                LogPrint (eLogInfo, "Connected from ", ep);
-                auto it = m_BanList.find (ep.address ());
-                if (it != m_BanList.end ())
-                {
-                    uint32_t ts = i2p::util::GetSecondsSinceEpoch ();
-                    if (ts < it->second)
-                    {
-                        LogPrint (eLogInfo, ep.address (), " is banned for ", it->second - ts, " more seconds");
-                        conn = nullptr;
-                    }
-                    else
-                        m_BanList.erase (it);
-                }
-                if (conn)
-                    conn->ServerLogin ();
-            }
-            else
-                LogPrint (eLogError, "Connected from error ", ec.message ());
-        }
-        
 
-        if (error != boost::asio::error::operation_aborted)
-        {
-            conn = std::make_shared<NTCPSession> (*this);
-            m_NTCPAcceptor->async_accept(conn->GetSocket (), std::bind (&NTCPServer::HandleAccept, this, 
-                conn, std::placeholders::_1));
-        }   
-    }
+    boost::asio::ip::tcp::acceptor * NTCPServer::CreateAcceptor (boost::asio::io_service& service, 
+        const boost::asio::ip::tcp::endpoint& endpoint, bool reusePort)
+    {
+        auto acceptor = new boost::asio::ip::tcp::acceptor (service);
+        m_NTCPAcceptors.push_back (acceptor);
+        acceptor->open (endpoint.protocol ());
+        acceptor->set_option (boost::asio::ip::tcp::acceptor::reuse_address (true));
+#ifdef SO_REUSEPORT
+        if (reusePort)
+            acceptor->set_option (boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> (true));
+#endif
+        if (endpoint.protocol () == boost::asio::ip::tcp::v6 ())
+            acceptor->set_option (boost::asio::ip::v6_only (true));
+        acceptor->bind (endpoint);
+        acceptor->listen ();
+        return acceptor;
+    }   
 
-    void NTCPServer::HandleAcceptV6 (std::shared_ptr<NTCPSession> conn, const boost::system::error_code& error)
+    void NTCPServer::Accept (boost::asio::ip::tcp::acceptor * acceptor)
+    {
+        // new session might belong to another thread
+        auto conn = std::make_shared<NTCPSession> (*this);
+        acceptor->async_accept(conn->GetSocket (), std::bind (&NTCPServer::HandleAccept, this, 
+            acceptor, conn, std::placeholders::_1));
+    }   
+
+    void NTCPServer::HandleAccept (boost::asio::ip::tcp::acceptor * acceptor, std::shared_ptr<NTCPSession> conn, 
+        const boost::system::error_code& error)
     {       
         if (!error)
         {
@@ -870,37 +1026,21 @@ namespace transport
             if (!ec)
             {
                 LogPrint (eLogInfo, "Connected from ", ep);
-                auto it = m_BanList.find (ep.address ());
-                if (it != m_BanList.end ())
-                {
-                    uint32_t ts = i2p::util::GetSecondsSinceEpoch ();
-                    if (ts < it->second)
-                    {
-                        LogPrint (eLogInfo, ep.address (), " is banned for ", it->second - ts, " more seconds");
-                        conn = nullptr;
-                    }
-                    else
-                        m_BanList.erase (it);
-                }
-                if (conn)
-                    conn->ServerLogin ();
+                if (!IsBanned (ep.address ()) && transports.GetHandshakeWorkers ().IsHandshakeAllowed (ep.address ()))
+                    conn->GetService ().post (std::bind (&NTCPSession::ServerLogin, conn));
             }
             else
                 LogPrint (eLogError, "Connected from error ", ec.message ());
         }
 
         if (error != boost::asio::error::operation_aborted)
-        {
-            conn = std::make_shared<NTCPSession> (*this);
-            m_NTCPV6Acceptor->async_accept(conn->GetSocket (), std::bind (&NTCPServer::HandleAcceptV6, this, 
-                conn, std::placeholders::_1));
-        }   
-    }   
+            Accept (acceptor);
+    }
 
     void NTCPServer::Connect (const boost::asio::ip::address& address, int port, std::shared_ptr<NTCPSession> conn)
     {
         LogPrint (eLogInfo, "Connecting to ", address ,":",  port);
-        m_Service.post([conn, this]()
+        conn->GetService ().post([conn, this]()
             {           
                 this->AddNTCPSession (conn);
             }); 
@@ -929,8 +1069,27 @@ namespace transport
     void NTCPServer::Ban (const boost::asio::ip::address& addr)
     {
         uint32_t ts = i2p::util::GetSecondsSinceEpoch ();   
+        std::unique_lock<std::mutex> l(m_BanListMutex);    
         m_BanList[addr] = ts + NTCP_BAN_EXPIRATION_TIMEOUT;
         LogPrint (eLogInfo, addr, " has been banned for ", NTCP_BAN_EXPIRATION_TIMEOUT, " seconds");
     }
+
+    bool NTCPServer::IsBanned (const boost::asio::ip::address& addr)
+    {
+        std::unique_lock<std::mutex> l(m_BanListMutex);    
+        auto it = m_BanList.find (addr);
+        if (it != m_BanList.end ())
+        {
+            uint32_t ts = i2p::util::GetSecondsSinceEpoch ();
+            if (ts < it->second)
+            {
+                LogPrint (eLogInfo, addr, " is banned for ", it->second - ts, " more seconds");
+                return true;
+            }
+            else
+                m_BanList.erase (it);
+        }
+        return false;
+    }   
 }   
 }   
@@ -3,7 +3,11 @@
 
 #include <inttypes.h>
 #include <map>
+#include <unordered_map>
+#include <deque>
+#include <atomic>
 #include <memory>
+#include <functional>
 #include <thread>
 #include <mutex>
 #include <boost/asio.hpp>
@@ -14,6 +18,7 @@
 #include "RouterInfo.h"
 #include "I2NPProtocol.h"
 #include "TransportSession.h"
+#include "BandwidthLimiter.h"
 
 namespace i2p
 {
@@ -42,9 +47,13 @@ namespace transport
 
     const size_t NTCP_MAX_MESSAGE_SIZE = 16384; 
     const size_t NTCP_BUFFER_SIZE = 4160; // fits 4 tunnel messages (4*1028)
+    const size_t NTCP_MAX_WRITE_SIZE = 65536; // coalesced frames per write, at least one message
+    const size_t NTCP_WRITE_HISTOGRAM_SIZE = 10; // <256, <512, ... <64K, >=64K 
+    const size_t NTCP_WRITE_HISTOGRAM_MIN_SIZE = 256;
     const int NTCP_TERMINATION_TIMEOUT = 120; // 2 minutes
     const size_t NTCP_DEFAULT_PHASE3_SIZE = 2/*size*/ + i2p::data::DEFAULT_IDENTITY_SIZE/*387*/ + 4/*ts*/ + 15/*padding*/ + 40/*signature*/; // 448     
     const int NTCP_BAN_EXPIRATION_TIMEOUT = 70; // in second
+    const int NTCP_MAX_NUM_THREADS = 32;
 
     class NTCPServer;
     class NTCPSession: public TransportSession, public std::enable_shared_from_this<NTCPSession>
@@ -57,6 +66,7 @@ namespace transport
             void Done ();
 
             boost::asio::ip::tcp::socket& GetSocket () { return m_Socket; };
+            boost::asio::io_service& GetService () { return m_Service; };
             bool IsEstablished () const { return m_IsEstablished; };
             
             void ClientLogin ();
@@ -70,17 +80,22 @@ namespace transport
             void SendTimeSyncMessage ();
             void SetIsEstablished (bool isEstablished) { m_IsEstablished = isEstablished; }
 
-            void CreateAESKey (uint8_t * pubKey, i2p::crypto::AESKey& key);
+            static bool CreateAESKey (const DHKeysPair& keys, const uint8_t * pubKey, i2p::crypto::AESKey& key); // thread-safe
+            void RunHandshakeCrypto (std::function<bool ()> work, std::function<void ()> completion); // terminate if work fails
+            void AgreeAESKey (const uint8_t * pubKey, std::function<void ()> completion); // sets establisher's aesKey
                 
             // client
             void SendPhase3 ();
             void HandlePhase1Sent (const boost::system::error_code& ecode,  std::size_t bytes_transferred);
             void HandlePhase2Received (const boost::system::error_code& ecode, std::size_t bytes_transferred);
+            void HandlePhase2 ();
             void HandlePhase3Sent (const boost::system::error_code& ecode, std::size_t bytes_transferred, uint32_t tsA);
             void HandlePhase4Received (const boost::system::error_code& ecode, std::size_t bytes_transferred, uint32_t tsA);
+            void HandlePhase4 ();
 
             //server
             void SendPhase2 ();
+            void SendPhase2Encrypted (uint32_t tsB);
             void SendPhase4 (uint32_t tsA, uint32_t tsB);
             void HandlePhase1Received (const boost::system::error_code& ecode, std::size_t bytes_transferred);
             void HandlePhase2Sent (const boost::system::error_code& ecode, std::size_t bytes_transferred, uint32_t tsB);
@@ -92,23 +107,28 @@ namespace transport
             // common
             void Receive ();
             void HandleReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred);
-            bool DecryptNextBlock (const uint8_t * encrypted);  
+            size_t DecryptNextBlocks (const uint8_t * encrypted, size_t len); // returns number of bytes consumed, 0 if failed
         
             void Send (std::shared_ptr<i2p::I2NPMessage> msg);
             boost::asio::const_buffers_1 CreateMsgBuffer (std::shared_ptr<I2NPMessage> msg);
             void Send (const std::vector<std::shared_ptr<I2NPMessage> >& msgs);
             void HandleSent (const boost::system::error_code& ecode, std::size_t bytes_transferred, std::vector<std::shared_ptr<I2NPMessage> > msgs);
-            
+            void SendQueued ();
+            void SendOrQueue (const std::vector<std::shared_ptr<I2NPMessage> >& msgs);
             
             // timer
             void ScheduleTermination ();
             void HandleTerminationTimer (const boost::system::error_code& ecode);
+            void ScheduleShaping ();
+            void HandleShapingTimer (const boost::system::error_code& ecode);
             
         private:
 
             NTCPServer& m_Server;
+            int m_ThreadIndex;
+            boost::asio::io_service& m_Service;
             boost::asio::ip::tcp::socket m_Socket;
-            boost::asio::deadline_timer m_TerminationTimer;
+            boost::asio::deadline_timer m_TerminationTimer, m_ShapingTimer;
             bool m_IsEstablished, m_IsTerminated;
             
             i2p::crypto::CBCDecryption m_Decryption;
@@ -118,7 +138,9 @@ namespace transport
             {   
                 NTCPPhase1 phase1;
                 NTCPPhase2 phase2;
+                i2p::crypto::AESKey aesKey; // set by handshake worker
             } * m_Establisher;  
+            uint64_t m_HandshakeStartTime; // in milliseconds
             
             i2p::crypto::AESAlignedBuffer<NTCP_BUFFER_SIZE + 16> m_ReceiveBuffer;
             i2p::crypto::AESAlignedBuffer<16> m_TimeSyncBuffer;
@@ -129,17 +151,31 @@ namespace transport
             i2p::I2NPMessagesHandler m_Handler;
 
             bool m_IsSending;
-            std::vector<std::shared_ptr<I2NPMessage> > m_SendQueue;
+            std::deque<std::shared_ptr<I2NPMessage> > m_SendQueue;
+            ShapedMessagesQueue m_ShapedQueue;
+            bool m_IsShapingScheduled;
             
             boost::asio::ip::address m_ConnectedFrom; // for ban
     };  
 
+    struct NTCPWriteStats
+    {
+        std::atomic<uint64_t> numWrites, numWrittenMessages;
+        std::atomic<uint64_t> histogram[NTCP_WRITE_HISTOGRAM_SIZE]; // bytes per write
+
+        NTCPWriteStats (): numWrites (0), numWrittenMessages (0) 
+        { 
+            for (auto& it: histogram) it = 0; 
+        };
+        void Update (size_t bytes, size_t numMessages);
+    };  
+
     // TODO: move to NTCP.h/.cpp
     class NTCPServer
     {
         public:
 
-            NTCPServer (int port);
+            NTCPServer (int port, int numThreads = 1);
             ~NTCPServer ();
 
             void Start ();
@@ -150,32 +186,54 @@ namespace transport
             std::shared_ptr<NTCPSession> FindNTCPSession (const i2p::data::IdentHash& ident);
             void Connect (const boost::asio::ip::address& address, int port, std::shared_ptr<NTCPSession> conn);
             
-            boost::asio::io_service& GetService () { return m_Service; };
+            // new sessions are distributed between threads round-robin
+            int GetNextThreadIndex ();
+            boost::asio::io_service& GetService (int threadIndex) { return m_ServiceThreads[threadIndex]->service; };
+            void UpdateNumSessions (int threadIndex, int delta) { m_ServiceThreads[threadIndex]->numSessions += delta; };
+            NTCPWriteStats& GetWriteStats () { return m_WriteStats; };
             void Ban (const boost::asio::ip::address& addr);            
 
         private:
 
-            void Run ();
-            void HandleAccept (std::shared_ptr<NTCPSession> conn, const boost::system::error_code& error);
-            void HandleAcceptV6 (std::shared_ptr<NTCPSession> conn, const boost::system::error_code& error);
+            struct ServiceThread
+            {
+                boost::asio::io_service service;
+                boost::asio::io_service::work work;
+                std::thread * thread;
+                std::atomic<int> numSessions; // established 
+
+                ServiceThread (): work (service), thread (nullptr), numSessions (0) {};
+            };  
+
+            void Run (ServiceThread * serviceThread);
+            boost::asio::ip::tcp::acceptor * CreateAcceptor (boost::asio::io_service& service, 
+                const boost::asio::ip::tcp::endpoint& endpoint, bool reusePort);
+            void Accept (boost::asio::ip::tcp::acceptor * acceptor);
+            void HandleAccept (boost::asio::ip::tcp::acceptor * acceptor, std::shared_ptr<NTCPSession> conn, 
+                const boost::system::error_code& error);
+            bool IsBanned (const boost::asio::ip::address& addr);
 
             void HandleConnect (const boost::system::error_code& ecode, std::shared_ptr<NTCPSession> conn);
             
         private:    
 
             bool m_IsRunning;
-            std::thread * m_Thread; 
-            boost::asio::io_service m_Service;
-            boost::asio::io_service::work m_Work;
-            boost::asio::ip::tcp::acceptor * m_NTCPAcceptor, * m_NTCPV6Acceptor;
+            std::vector<ServiceThread *> m_ServiceThreads; 
+            std::atomic<unsigned int> m_NextThreadIndex;
+            std::vector<boost::asio::ip::tcp::acceptor *> m_NTCPAcceptors; // V4 and V6
             std::mutex m_NTCPSessionsMutex;
-            std::map<i2p::data::IdentHash, std::shared_ptr<NTCPSession> > m_NTCPSessions;
+            std::unordered_map<i2p::data::IdentHash, std::shared_ptr<NTCPSession>, i2p::data::IdentHashHasher> m_NTCPSessions;
+            std::mutex m_BanListMutex;
             std::map<boost::asio::ip::address, uint32_t> m_BanList; // IP -> ban expiration time in seconds
+            NTCPWriteStats m_WriteStats;
 
         public:
 
             // for HTTP/I2PControl
             const decltype(m_NTCPSessions)& GetNTCPSessions () const { return m_NTCPSessions; };
+            const NTCPWriteStats& GetWriteStats () const { return m_WriteStats; };
+            int GetNumThreads () const { return m_ServiceThreads.size (); };
+            int GetNumSessions (int threadIndex) const { return m_ServiceThreads[threadIndex]->numSessions; };
     };  
 }   
 }   
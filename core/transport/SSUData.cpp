@@ -4,6 +4,7 @@
 #include "util/Timestamp.h"
 #include "NetworkDatabase.h"
 #include "SSU.h"
+#include "Transports.h"
 #include "SSUData.h"
 
 namespace i2p
@@ -26,7 +27,8 @@ namespace transport
 
     SSUData::SSUData (SSUSession& session):
         m_Session (session), m_ResendTimer (session.GetService ()), m_DecayTimer (session.GetService ()),
-        m_IncompleteMessagesCleanupTimer (session.GetService ())
+        m_IncompleteMessagesCleanupTimer (session.GetService ()), m_ShapingTimer (session.GetService ()),
+        m_ShapedQueue (transports.GetBandwidthLimiter ()), m_IsShapingScheduled (false)
     {
         m_MaxPacketSize = session.IsV6 () ? SSU_V6_MAX_PACKET_SIZE : SSU_V4_MAX_PACKET_SIZE;
         m_PacketSize = m_MaxPacketSize;
@@ -49,6 +51,8 @@ namespace transport
         m_ResendTimer.cancel ();
         m_DecayTimer.cancel ();
         m_IncompleteMessagesCleanupTimer.cancel ();
+        m_ShapingTimer.cancel ();
+        m_ShapedQueue.Clear ();
     }   
         
     void SSUData::AdjustPacketSize (const i2p::data::RouterInfo& remoteRouter)
@@ -364,6 +368,16 @@ namespace transport
         }   
     }       
 
+    void SSUData::Send (const std::vector<std::shared_ptr<i2p::I2NPMessage> >& msgs)
+    {
+        std::vector<std::shared_ptr<i2p::I2NPMessage> > allowed;
+        m_ShapedQueue.Put (msgs, allowed);
+        for (auto it: allowed)
+            Send (it);
+        if (!m_ShapedQueue.IsEmpty ())
+            ScheduleShaping ();
+    }   
+
     void SSUData::SendMsgAck (uint32_t msgID)
     {
         uint8_t buf[48 + 18]; // actual length is 44 = 37 + 7 but pad it to multiple of 16
@@ -502,6 +516,28 @@ namespace transport
             ScheduleIncompleteMessagesCleanup ();
         }   
     }   
+    void SSUData::ScheduleShaping ()
+    {
+        if (m_IsShapingScheduled) return;
+        m_IsShapingScheduled = true;
+        m_ShapingTimer.expires_from_now (boost::posix_time::milliseconds(BANDWIDTH_SHAPING_INTERVAL));
+        auto s = m_Session.shared_from_this();
+        m_ShapingTimer.async_wait ([s](const boost::system::error_code& ecode)
+            { s->m_Data.HandleShapingTimer (ecode); });
+    }
+
+    void SSUData::HandleShapingTimer (const boost::system::error_code& ecode)
+    {
+        m_IsShapingScheduled = false;
+        if (ecode != boost::asio::error::operation_aborted)
+        {
+            std::vector<std::shared_ptr<i2p::I2NPMessage> > allowed;
+            m_ShapedQueue.Fetch (allowed);
+            for (auto it: allowed)
+                Send (it);
+            if (!m_ShapedQueue.IsEmpty ())
+                ScheduleShaping ();
+        }   
+    }   
 }
 }
-
@@ -11,6 +11,7 @@
 #include "I2NPProtocol.h"
 #include "Identity.h"
 #include "RouterInfo.h"
+#include "BandwidthLimiter.h"
 
 namespace i2p
 {
@@ -89,6 +90,7 @@ namespace transport
             void ProcessMessage (uint8_t * buf, size_t len);
             void FlushReceivedMessage ();
             void Send (std::shared_ptr<i2p::I2NPMessage> msg);
+            void Send (const std::vector<std::shared_ptr<i2p::I2NPMessage> >& msgs); // shaped
 
             void UpdatePacketSize (const i2p::data::IdentHash& remoteIdent);
 
@@ -108,6 +110,9 @@ namespace transport
 
             void ScheduleIncompleteMessagesCleanup ();
             void HandleIncompleteMessagesCleanupTimer (const boost::system::error_code& ecode); 
+
+            void ScheduleShaping ();
+            void HandleShapingTimer (const boost::system::error_code& ecode);
             
             void AdjustPacketSize (const i2p::data::RouterInfo& remoteRouter);  
             
@@ -117,9 +122,11 @@ namespace transport
             std::map<uint32_t, std::unique_ptr<IncompleteMessage> > m_IncompleteMessages;
             std::map<uint32_t, std::unique_ptr<SentMessage> > m_SentMessages;
             std::set<uint32_t> m_ReceivedMessages;
-            boost::asio::deadline_timer m_ResendTimer, m_DecayTimer, m_IncompleteMessagesCleanupTimer;
+            boost::asio::deadline_timer m_ResendTimer, m_DecayTimer, m_IncompleteMessagesCleanupTimer, m_ShapingTimer;
             int m_MaxPacketSize, m_PacketSize;
             i2p::I2NPMessagesHandler m_Handler;
+            ShapedMessagesQueue m_ShapedQueue;
+            bool m_IsShapingScheduled;
     };  
 }
 }
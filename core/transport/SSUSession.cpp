@@ -4,6 +4,7 @@
 #include "crypto/CryptoConst.h"
 #include "util/Log.h"
 #include "util/Timestamp.h"
+#include "util/Metrics.h"
 #include "RouterContext.h"
 #include "Transports.h"
 #include "SSU.h"
@@ -17,7 +18,8 @@ namespace transport
         std::shared_ptr<const i2p::data::RouterInfo> router, bool peerTest ): TransportSession (router), 
         m_Server (server), m_RemoteEndpoint (remoteEndpoint), m_Timer (GetService ()), 
         m_PeerTest (peerTest),m_State (eSessionStateUnknown), m_IsSessionKey (false), 
-        m_RelayTag (0),m_Data (*this), m_IsDataReceived (false)
+        m_RelayTag (0),m_Data (*this), m_IsDataReceived (false), m_IsHandshakeCryptoPending (false),
+        m_HandshakeStartTime (0)
     {
         m_CreationTime = i2p::util::GetSecondsSinceEpoch ();
     }
@@ -31,17 +33,17 @@ namespace transport
         return IsV6 () ? m_Server.GetServiceV6 () : m_Server.GetService (); 
     }
     
-    void SSUSession::CreateAESandMacKey (const uint8_t * pubKey)
+    bool SSUSession::CreateAESandMacKey (const DHKeysPair& keys, const uint8_t * pubKey, i2p::crypto::AESKey& aesKey, i2p::crypto::MACKey& hmacKey)
     {
         CryptoPP::DH dh (i2p::crypto::elgp, i2p::crypto::elgg);
         uint8_t sharedKey[256];
-        if (!dh.Agree (sharedKey, m_DHKeysPair->privateKey, pubKey))
+        if (!dh.Agree (sharedKey, keys.privateKey, pubKey))
         {    
             LogPrint (eLogError, "Couldn't create shared key");
-            return;
+            return false;
         };
 
-        uint8_t * sessionKey = m_SessionKey, * macKey = m_MacKey;
+        uint8_t * sessionKey = aesKey, * macKey = hmacKey;
         if (sharedKey[0] & 0x80)
         {
             sessionKey[0] = 0;
@@ -63,17 +65,45 @@ namespace transport
                 if (nonZero - sharedKey > 32)
                 {
                     LogPrint ("First 32 bytes of shared key is all zeros. Ignored");
-                    return;
+                    return false;
                 }   
             }
             
             memcpy (sessionKey, nonZero, 32);
             CryptoPP::SHA256().CalculateDigest(macKey, nonZero, 64 - (nonZero - sharedKey));
         }
+        return true;
+    }       
+
+    void SSUSession::SetSessionKeys (const i2p::crypto::AESKey& aesKey, const i2p::crypto::MACKey& macKey)
+    {
+        m_SessionKey = aesKey;
+        m_MacKey = macKey;
         m_IsSessionKey = true;
         m_SessionKeyEncryption.SetKey (m_SessionKey);
         m_SessionKeyDecryption.SetKey (m_SessionKey);
-    }       
+    }   
+
+    void SSUSession::RunHandshakeCrypto (std::function<bool ()> work, std::function<void ()> completion)
+    {
+        m_IsHandshakeCryptoPending = true;
+        auto s = shared_from_this ();
+        if (!transports.GetHandshakeWorkers ().Submit (GetService (), work,
+            [s, completion](bool success)
+            {
+                s->m_IsHandshakeCryptoPending = false;
+                if (s->m_State == eSessionStateClosed || s->m_State == eSessionStateFailed) return;
+                if (success)
+                    completion ();
+                else
+                    s->Failed ();
+            }))
+        {
+            m_IsHandshakeCryptoPending = false;
+            LogPrint (eLogWarning, "Handshake workers are busy. SSU session dropped");
+            Failed ();
+        }   
+    }   
 
     void SSUSession::ProcessNextMessage (uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& senderEndpoint)
     {
@@ -175,14 +205,34 @@ namespace transport
     void SSUSession::ProcessSessionRequest (uint8_t * buf, size_t, const boost::asio::ip::udp::endpoint& senderEndpoint)
     {
         LogPrint (eLogDebug, "Session request received");   
+        if (m_IsHandshakeCryptoPending) return; // retransmission, previous one is being processed
+        if (!transports.GetHandshakeWorkers ().IsHandshakeAllowed (senderEndpoint.address ()))
+        {
+            Failed ();
+            return;
+        }   
+        if (!m_HandshakeStartTime)
+            m_HandshakeStartTime = i2p::util::GetMillisecondsSinceEpoch ();
         m_RemoteEndpoint = senderEndpoint;
         if (!m_DHKeysPair)
             m_DHKeysPair = transports.GetNextDHKeysPair ();
-        CreateAESandMacKey (buf + sizeof (SSUHeader));
-        SendSessionCreated (buf + sizeof (SSUHeader));
+        // buf is reused by receiver, copy x
+        auto x = std::make_shared<std::vector<uint8_t> > (buf + sizeof (SSUHeader), buf + sizeof (SSUHeader) + 256);
+        auto keys = std::make_shared<HandshakeKeys> ();
+        keys->dhKeys = *m_DHKeysPair;
+        auto s = shared_from_this ();
+        RunHandshakeCrypto ([x, keys]()
+            {
+                return CreateAESandMacKey (keys->dhKeys, x->data (), keys->sessionKey, keys->macKey);
+            },
+            [s, x, keys]()
+            {
+                s->SetSessionKeys (keys->sessionKey, keys->macKey);
+                s->SendSessionCreated (x->data ());
+            });
     }
 
-    void SSUSession::ProcessSessionCreated (uint8_t * buf, size_t)
+    void SSUSession::ProcessSessionCreated (uint8_t * buf, size_t len)
     {
         if (!m_RemoteRouter || !m_DHKeysPair)
         {
@@ -190,14 +240,18 @@ namespace transport
             return;
         }
 
+        if (m_IsHandshakeCryptoPending) return; // duplicate, previous one is being processed
+
         LogPrint (eLogDebug, "Session created received");   
         m_Timer.cancel (); // connect timer
-        SignedData s; // x,y, our IP, our port, remote IP, remote port, relayTag, signed on time 
+        // buf is reused by receiver, handshake worker needs own copy 
+        auto packet = std::make_shared<std::vector<uint8_t> > (buf, buf + len);
+        buf = packet->data ();
+        auto s = std::make_shared<SignedData> (); // x,y, our IP, our port, remote IP, remote port, relayTag, signed on time 
         uint8_t * payload = buf + sizeof (SSUHeader);   
         uint8_t * y = payload;
-        CreateAESandMacKey (y);
-        s.Insert (m_DHKeysPair->publicKey, 256); // x
-        s.Insert (y, 256); // y
+        s->Insert (m_DHKeysPair->publicKey, 256); // x
+        s->Insert (y, 256); // y
         payload += 256;
         uint8_t addressSize = *payload;
         payload += 1; // size
@@ -215,19 +269,19 @@ namespace transport
             memcpy (bytes.data (), ourAddress, 16);
             ourIP = boost::asio::ip::address_v6 (bytes);
         }   
-        s.Insert (ourAddress, addressSize); // our IP 
+        s->Insert (ourAddress, addressSize); // our IP 
         payload += addressSize; // address
         uint16_t ourPort = bufbe16toh (payload);
-        s.Insert (payload, 2); // our port
+        s->Insert (payload, 2); // our port
         payload += 2; // port
         LogPrint ("Our external address is ", ourIP.to_string (), ":", ourPort);
         i2p::context.UpdateAddress (ourIP);
         if (m_RemoteEndpoint.address ().is_v4 ())
-            s.Insert (m_RemoteEndpoint.address ().to_v4 ().to_bytes ().data (), 4); // remote IP v4
+            s->Insert (m_RemoteEndpoint.address ().to_v4 ().to_bytes ().data (), 4); // remote IP v4
         else
-            s.Insert (m_RemoteEndpoint.address ().to_v6 ().to_bytes ().data (), 16); // remote IP v6
-        s.Insert<uint16_t> (htobe16 (m_RemoteEndpoint.port ())); // remote port
-        s.Insert (payload, 8); // relayTag and signed on time 
+            s->Insert (m_RemoteEndpoint.address ().to_v6 ().to_bytes ().data (), 16); // remote IP v6
+        s->Insert<uint16_t> (htobe16 (m_RemoteEndpoint.port ())); // remote port
+        s->Insert (payload, 8); // relayTag and signed on time 
         m_RelayTag = bufbe32toh (payload);
         payload += 4; // relayTag
         payload += 4; // signed on time
@@ -236,14 +290,29 @@ namespace transport
         size_t paddingSize = signatureLen & 0x0F; // %16
         if (paddingSize > 0) signatureLen += (16 - paddingSize);
         //TODO: since we are accessing a uint8_t this is unlikely to crash due to alignment but should be improved
-        m_SessionKeyDecryption.SetIV (((SSUHeader *)buf)->iv);
-        m_SessionKeyDecryption.Decrypt (payload, signatureLen, payload);
-        // verify
-        if (!s.Verify (m_RemoteIdentity, payload))
-            LogPrint (eLogError, "SSU signature verification failed");
-        m_RemoteIdentity.DropVerifier ();   
-        
-        SendSessionConfirmed (y, ourAddress, addressSize + 2);
+        const uint8_t * iv = ((SSUHeader *)buf)->iv;
+        auto keys = std::make_shared<HandshakeKeys> ();
+        keys->dhKeys = *m_DHKeysPair;
+        auto session = shared_from_this ();
+        RunHandshakeCrypto ([session, packet, s, keys, y, iv, payload, signatureLen]()
+            {
+                if (!CreateAESandMacKey (keys->dhKeys, y, keys->sessionKey, keys->macKey))
+                    return false;
+                i2p::crypto::CBCDecryption decryption;
+                decryption.SetKey (keys->sessionKey);
+                decryption.SetIV (iv);
+                decryption.Decrypt (payload, signatureLen, payload);
+                // verify
+                if (!s->Verify (session->m_RemoteIdentity, payload))
+                    LogPrint (eLogError, "SSU signature verification failed");
+                return true;
+            },
+            [session, packet, keys, y, ourAddress, addressSize]()
+            {
+                session->SetSessionKeys (keys->sessionKey, keys->macKey);
+                session->m_RemoteIdentity.DropVerifier ();   
+                session->SendSessionConfirmed (y, ourAddress, addressSize + 2);
+            });
     }   
 
     void SSUSession::ProcessSessionConfirmed (uint8_t * buf, size_t)
@@ -706,6 +775,7 @@ namespace transport
         {   
             // set connect timer
             ScheduleConnectTimer ();
+            m_HandshakeStartTime = i2p::util::GetMillisecondsSinceEpoch ();
             m_DHKeysPair = transports.GetNextDHKeysPair ();
             SendSessionRequest ();
         }   
@@ -775,6 +845,14 @@ namespace transport
     void SSUSession::Established ()
     {
         m_State = eSessionStateEstablished;
+        if (m_HandshakeStartTime)
+        {
+            auto latency = i2p::util::GetMillisecondsSinceEpoch () - m_HandshakeStartTime;
+            transports.GetHandshakeWorkers ().GetSSULatency ().AddSample (latency);
+            static auto& handshakeDuration = i2p::util::metrics.GetHistogram ("i2pd_transport_handshake_duration_milliseconds",
+                "Time from connect to established session", i2p::util::ExponentialBuckets (10, 2, 12), "transport=\"ssu\"");
+            handshakeDuration.Observe (latency);
+        }
         if (m_DHKeysPair)
         {
             delete m_DHKeysPair;
@@ -838,10 +916,7 @@ namespace transport
     void SSUSession::PostI2NPMessages (std::vector<std::shared_ptr<I2NPMessage> > msgs)
     {
         if (m_State == eSessionStateEstablished)
-        {
-            for (auto it: msgs)
-                if (it) m_Data.Send (it);
-        }
+            m_Data.Send (msgs);
     }   
 
     void SSUSession::ProcessData (uint8_t * buf, size_t len)
@@ -4,6 +4,8 @@
 #include <inttypes.h>
 #include <set>
 #include <memory>
+#include <vector>
+#include <functional>
 #include "crypto/aes.h"
 #include "crypto/hmac.h"
 #include "I2NPProtocol.h"
@@ -94,7 +96,9 @@ namespace transport
         private:
 
             boost::asio::io_service& GetService ();
-            void CreateAESandMacKey (const uint8_t * pubKey); 
+            static bool CreateAESandMacKey (const DHKeysPair& keys, const uint8_t * pubKey, i2p::crypto::AESKey& aesKey, i2p::crypto::MACKey& macKey); // thread-safe 
+            void SetSessionKeys (const i2p::crypto::AESKey& aesKey, const i2p::crypto::MACKey& macKey);
+            void RunHandshakeCrypto (std::function<bool ()> work, std::function<void ()> completion); // fail if work fails
 
             void PostI2NPMessages (std::vector<std::shared_ptr<I2NPMessage> > msgs);
             void ProcessMessage (uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& senderEndpoint); // call for established session
@@ -149,6 +153,15 @@ namespace transport
             uint32_t m_CreationTime; // seconds since epoch
             SSUData m_Data;
             bool m_IsDataReceived;
+            
+            struct HandshakeKeys
+            {
+                DHKeysPair dhKeys; // copy, session's pair might be deleted while worker runs
+                i2p::crypto::AESKey sessionKey;
+                i2p::crypto::MACKey macKey;
+            };  
+            bool m_IsHandshakeCryptoPending;
+            uint64_t m_HandshakeStartTime; // in milliseconds
     };
 
 
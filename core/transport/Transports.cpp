@@ -1,5 +1,6 @@
 #include <cryptopp/dh.h>
 #include "util/Log.h"
+#include "util/Metrics.h"
 #include "crypto/CryptoConst.h"
 #include "RouterContext.h"
 #include "I2NPProtocol.h"
@@ -96,9 +97,10 @@ namespace transport
     
     Transports::Transports (): 
         m_IsRunning (false), m_Thread (nullptr), m_Work (m_Service), m_PeerCleanupTimer (m_Service),
-        m_NTCPServer (nullptr), m_SSUServer (nullptr), m_DHKeysPairSupplier (5), // 5 pre-generated keys
+        m_NTCPServer (nullptr), m_NumNTCPThreads (1), m_SSUServer (nullptr), m_DHKeysPairSupplier (5), // 5 pre-generated keys
         m_TotalSentBytes(0), m_TotalReceivedBytes(0), m_InBandwidth (0), m_OutBandwidth (0),
-        m_LastInBandwidthUpdateBytes (0), m_LastOutBandwidthUpdateBytes (0), m_LastBandwidthUpdateTime (0)  
+        m_LastInBandwidthUpdateBytes (0), m_LastOutBandwidthUpdateBytes (0), m_LastBandwidthUpdateTime (0),
+        m_NumHandshakeWorkers (HANDSHAKE_DEFAULT_NUM_WORKERS)
     {       
     }
         
@@ -114,6 +116,7 @@ namespace transport
         LogPrint(eLogInfo, "UPnP started");
 #endif
         m_DHKeysPairSupplier.Start ();
+        m_HandshakeWorkers.Start (m_NumHandshakeWorkers);
         m_IsRunning = true;
         m_Thread = new std::thread (std::bind (&Transports::Run, this));
         // create acceptors
@@ -122,7 +125,7 @@ namespace transport
         {
             if (!m_NTCPServer)
             {   
-                m_NTCPServer = new NTCPServer (address.port);
+                m_NTCPServer = new NTCPServer (address.port, m_NumNTCPThreads);
                 m_NTCPServer->Start ();
             }   
             
@@ -141,6 +144,40 @@ namespace transport
         }   
         m_PeerCleanupTimer.expires_from_now (boost::posix_time::seconds(5*SESSION_CREATION_TIMEOUT));
         m_PeerCleanupTimer.async_wait (std::bind (&Transports::HandlePeerCleanupTimer, this, std::placeholders::_1));
+        RegisterMetrics ();
+    }
+
+    void Transports::RegisterMetrics ()
+    {
+        auto& metrics = i2p::util::metrics;
+        metrics.SetCallback ("i2pd_transport_received_bytes_total", "Bytes received by all transports",
+            i2p::util::eMetricCounter, [this]() { return (int64_t)GetTotalReceivedBytes (); });
+        metrics.SetCallback ("i2pd_transport_sent_bytes_total", "Bytes sent by all transports",
+            i2p::util::eMetricCounter, [this]() { return (int64_t)GetTotalSentBytes (); });
+        metrics.SetCallback ("i2pd_transport_bandwidth_bytes_per_second", "Current bandwidth",
+            i2p::util::eMetricGauge, [this]() { return (int64_t)GetInBandwidth (); }, "direction=\"in\"");
+        metrics.SetCallback ("i2pd_transport_bandwidth_bytes_per_second", "Current bandwidth",
+            i2p::util::eMetricGauge, [this]() { return (int64_t)GetOutBandwidth (); }, "direction=\"out\"");
+        metrics.SetCallback ("i2pd_transport_peers", "Connected and connecting peers",
+            i2p::util::eMetricGauge, [this]() { return (int64_t)GetNumPeers (); });
+        metrics.SetCallback ("i2pd_transport_handshake_queue_size", "Handshakes waiting for a crypto worker",
+            i2p::util::eMetricGauge, [this]() { return (int64_t)m_HandshakeWorkers.GetQueueSize (); });
+        metrics.SetCallback ("i2pd_transport_handshakes_rejected_total", "Handshakes rejected because of full queue",
+            i2p::util::eMetricCounter, [this]() { return (int64_t)m_HandshakeWorkers.GetNumRejected (); });
+        metrics.SetCallback ("i2pd_transport_handshakes_rate_limited_total", "Handshakes dropped by per IP limit",
+            i2p::util::eMetricCounter, [this]() { return (int64_t)m_HandshakeWorkers.GetNumRateLimited (); });
+        static const char * trafficClasses[eNumTrafficClasses] = { "client", "transit", "netdb" };
+        for (int i = 0; i < eNumTrafficClasses; i++)
+        {
+            auto& stats = m_BandwidthLimiter.GetStats ((TrafficClass)i);
+            std::string labels = std::string ("class=\"") + trafficClasses[i] + "\"";
+            metrics.SetCallback ("i2pd_transport_shaped_sent_bytes_total", "Bytes passed bandwidth limiter",
+                i2p::util::eMetricCounter, [&stats]() { return (int64_t)stats.sentBytes; }, labels);
+            metrics.SetCallback ("i2pd_transport_delayed_messages_total", "Messages delayed by bandwidth limiter",
+                i2p::util::eMetricCounter, [&stats]() { return (int64_t)stats.numDelayedMessages; }, labels);
+            metrics.SetCallback ("i2pd_transport_dropped_messages_total", "Messages dropped by bandwidth limiter",
+                i2p::util::eMetricCounter, [&stats]() { return (int64_t)stats.numDroppedMessages; }, labels);
+        }
     }
         
     void Transports::Stop ()
@@ -151,6 +188,7 @@ namespace transport
 #endif
         m_PeerCleanupTimer.cancel ();   
         m_Peers.clear ();
+        m_HandshakeWorkers.Stop (); // before servers, completions are posted to their services
         if (m_SSUServer)
         {
             m_SSUServer->Stop ();
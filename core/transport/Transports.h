@@ -16,6 +16,8 @@
 #include "TransportSession.h"
 #include "NTCPSession.h"
 #include "SSU.h"
+#include "BandwidthLimiter.h"
+#include "HandshakeWorkers.h"
 #include "RouterInfo.h"
 #include "I2NPProtocol.h"
 #include "Identity.h"
@@ -102,6 +104,10 @@ namespace transport
             uint32_t GetInBandwidth () const { return m_InBandwidth; }; // bytes per second
             uint32_t GetOutBandwidth () const { return m_OutBandwidth; }; // bytes per second
             bool IsBandwidthExceeded () const;
+            BandwidthLimiter& GetBandwidthLimiter () { return m_BandwidthLimiter; };
+            void SetNumNTCPThreads (int numThreads) { m_NumNTCPThreads = numThreads; }; // before Start
+            void SetNumHandshakeWorkers (int numWorkers) { m_NumHandshakeWorkers = numWorkers; }; // before Start
+            HandshakeWorkers& GetHandshakeWorkers () { return m_HandshakeWorkers; };
             size_t GetNumPeers () const { return m_Peers.size (); };
             std::shared_ptr<const i2p::data::RouterInfo> GetRandomPeer () const;
 
@@ -121,6 +127,7 @@ namespace transport
 
             void UpdateBandwidth ();
             void DetectExternalIP ();
+            void RegisterMetrics ();
             
         private:
 
@@ -131,6 +138,7 @@ namespace transport
             boost::asio::deadline_timer m_PeerCleanupTimer;
 
             NTCPServer * m_NTCPServer;
+            int m_NumNTCPThreads;
             SSUServer * m_SSUServer;
             std::map<i2p::data::IdentHash, Peer> m_Peers;
             
@@ -139,7 +147,10 @@ namespace transport
             std::atomic<uint64_t> m_TotalSentBytes, m_TotalReceivedBytes;
             uint32_t m_InBandwidth, m_OutBandwidth;
             uint64_t m_LastInBandwidthUpdateBytes, m_LastOutBandwidthUpdateBytes;   
-            uint64_t m_LastBandwidthUpdateTime;     
+            uint64_t m_LastBandwidthUpdateTime;
+            BandwidthLimiter m_BandwidthLimiter;
+            HandshakeWorkers m_HandshakeWorkers;
+            int m_NumHandshakeWorkers;     
 
 #ifdef USE_UPNP
             UPnP m_UPnP;
@@ -150,6 +161,7 @@ namespace transport
             // for HTTP only
             const NTCPServer * GetNTCPServer () const { return m_NTCPServer; };
             const SSUServer * GetSSUServer () const { return m_SSUServer; };
+            const HandshakeWorkers& GetHandshakeWorkers () const { return m_HandshakeWorkers; };
             const decltype(m_Peers)& GetPeers () const { return m_Peers; };
     };  
 
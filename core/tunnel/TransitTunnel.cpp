@@ -37,6 +37,7 @@ namespace tunnel
         m_NumTransmittedBytes += tunnelMsg->GetLength ();
         htobe32buf (newMsg->GetPayload (), GetNextTunnelID ());
         newMsg->FillI2NPMessageHeader (eI2NPTunnelData); 
+        newMsg->trafficClass = eTrafficClassTransit;
         m_TunnelDataMsgs.push_back (newMsg);
     }
 
@@ -71,7 +71,7 @@ namespace tunnel
                 const uint8_t * nextIdent, uint32_t nextTunnelID, 
                 const uint8_t * layerKey,const uint8_t * ivKey):
                 TransitTunnel (receiveTunnelID, nextIdent, nextTunnelID, 
-                layerKey, ivKey), m_Gateway(this) {};
+                layerKey, ivKey), m_Gateway(this, eTrafficClassTransit) {};
 
             void SendTunnelDataMsg (std::shared_ptr<i2p::I2NPMessage> msg);
             void FlushTunnelDataMsgs ();
@@ -4,9 +4,12 @@
 #include <algorithm>
 #include <vector> 
 #include <cryptopp/sha.h>
+#include <cryptopp/osrng.h>
+#include "crypto/ElGamal.h"
 #include "RouterContext.h"
 #include "util/Log.h"
 #include "util/Timestamp.h"
+#include "util/Metrics.h"
 #include "I2NPProtocol.h"
 #include "transport/Transports.h"
 #include "NetworkDatabase.h"
@@ -18,7 +21,8 @@ namespace tunnel
 {       
     
     Tunnel::Tunnel (std::shared_ptr<const TunnelConfig> config): 
-        m_Config (config), m_Pool (nullptr), m_State (eTunnelStatePending), m_IsRecreated (false)
+        m_Config (config), m_Pool (nullptr), m_State (eTunnelStatePending), m_IsRecreated (false),
+        m_BuildTime (0), m_TestRTT (0)
     {
     }   
 
@@ -26,11 +30,28 @@ namespace tunnel
     {
     }   
 
+    // std::shuffle takes generator by value
+    struct TunnelBuildRandomGenerator
+    {
+        typedef uint32_t result_type;
+        static constexpr result_type min () { return 0; };
+        static constexpr result_type max () { return 0xFFFFFFFF; };
+        result_type operator() () { return rnd.GenerateWord32 (); };
+
+        CryptoPP::RandomNumberGenerator& rnd;
+    };
+
     void Tunnel::Build (uint32_t replyMsgID, std::shared_ptr<OutboundTunnel> outboundTunnel)
     {
-        CryptoPP::RandomNumberGenerator& rnd = i2p::context.GetRandomNumberGenerator ();
+        Build (replyMsgID, outboundTunnel, i2p::context.GetRandomNumberGenerator ());
+    }
+
+    void Tunnel::Build (uint32_t replyMsgID, std::shared_ptr<OutboundTunnel> outboundTunnel,
+        CryptoPP::RandomNumberGenerator& rnd)
+    {
         auto numHops = m_Config->GetNumHops ();
         int numRecords = numHops <= STANDARD_NUM_RECORDS ? STANDARD_NUM_RECORDS : numHops; 
+        m_BuildTime = i2p::util::GetMillisecondsSinceEpoch ();
         auto msg = NewI2NPShortMessage ();
         *msg->GetPayload () = numRecords;
         msg->len += numRecords*TUNNEL_BUILD_RECORD_SIZE + 1;        
@@ -38,7 +59,7 @@ namespace tunnel
         // shuffle records
         std::vector<int> recordIndicies;
         for (int i = 0; i < numRecords; i++) recordIndicies.push_back(i);
-        std::random_shuffle (recordIndicies.begin(), recordIndicies.end());
+        std::shuffle (recordIndicies.begin(), recordIndicies.end(), TunnelBuildRandomGenerator { rnd });
 
         // create real records
         uint8_t * records = msg->GetPayload () + 1; 
@@ -88,7 +109,7 @@ namespace tunnel
         
     bool Tunnel::HandleTunnelBuildResponse (uint8_t * msg, size_t)
     {
-        LogPrint ("TunnelBuildResponse ", (int)msg[0], " records.");
+        LogPrint (eLogDebug, "TunnelBuildResponse ", (int)msg[0], " records.");
         
         i2p::crypto::CBCDecryption decryption;
         TunnelHopConfig * hop = m_Config->GetLastHop (); 
@@ -114,13 +135,14 @@ namespace tunnel
         }
 
         bool established = true;
+        uint32_t latency = m_BuildTime ? i2p::util::GetMillisecondsSinceEpoch () - m_BuildTime : 0;
         hop = m_Config->GetFirstHop ();
         while (hop)
         {           
             const uint8_t * record = msg + 1 + hop->recordIndex*TUNNEL_BUILD_RECORD_SIZE;
             uint8_t ret = record[BUILD_RESPONSE_RECORD_RET_OFFSET];
-            LogPrint ("Ret code=", (int)ret);
-            hop->router->GetProfile ()->TunnelBuildResponse (ret);
+            LogPrint (eLogDebug, "Ret code=", (int)ret);
+            hop->router->GetProfile ()->TunnelBuildResponse (ret, latency);
             if (ret) 
                 // if any of participants declined the tunnel is not established
                 established = false; 
@@ -197,6 +219,22 @@ namespace tunnel
         m_Gateway.SendBuffer ();
     }   
     
+    void Tunnel::TunnelTested (uint32_t rtt)
+    {
+        if (!rtt) rtt = 1; // 0 means not measured
+        uint32_t testRTT = m_TestRTT.load ();
+        m_TestRTT.store (testRTT ? (testRTT + rtt)/2 : rtt);
+    }   
+
+    void OutboundTunnel::UpdateThroughput (uint64_t interval)
+    {
+        if (!interval) return;
+        size_t numSentBytes = GetNumSentBytes ();
+        uint32_t throughput = (numSentBytes - m_LastNumSentBytes)*1000/interval;
+        m_LastNumSentBytes = numSentBytes;
+        m_Throughput.store ((m_Throughput.load () + throughput)/2);
+    }   
+
     void OutboundTunnel::HandleTunnelDataMsg (std::shared_ptr<const i2p::I2NPMessage>)
     {
         LogPrint (eLogError, "Incoming message for outbound tunnel ", GetTunnelID ());
@@ -204,7 +242,8 @@ namespace tunnel
 
     Tunnels tunnels;
     
-    Tunnels::Tunnels (): m_IsRunning (false), m_Thread (nullptr),
+    Tunnels::Tunnels (): m_IsRunning (false), m_Thread (nullptr), m_BuildThread (nullptr),
+        m_NumInboundTunnels (0), m_NumOutboundTunnels (0),
         m_NumSuccesiveTunnelCreations (0), m_NumFailedTunnelCreations (0)
     {
     }
@@ -311,6 +350,7 @@ namespace tunnel
     {
         if (pool)
         {
+            std::unique_lock<std::mutex> l(m_PoolsMutex); // against pools management on tunnels thread
             pool->SetActive (false);
             pool->DetachTunnels ();
         }   
@@ -328,27 +368,59 @@ namespace tunnel
 
     void Tunnels::Start ()
     {
+        i2p::crypto::elGamalPrecomputation.Start ();
         m_IsRunning = true;
+        m_BuildThread = new std::thread (std::bind (&Tunnels::RunBuilds, this));
         m_Thread = new std::thread (std::bind (&Tunnels::Run, this));
+        RegisterMetrics ();
+    }
+
+    void Tunnels::RegisterMetrics ()
+    {
+        auto& metrics = i2p::util::metrics;
+        metrics.SetCallback ("i2pd_tunnels_queue_size", "Tunnel messages waiting for tunnels thread",
+            i2p::util::eMetricGauge, [this]() { return (int64_t)GetQueueSize (); });
+        metrics.SetCallback ("i2pd_tunnels_build_queue_size", "Tunnel builds waiting for records encryption",
+            i2p::util::eMetricGauge, [this]() { return (int64_t)GetBuildQueueSize (); });
+        metrics.SetCallback ("i2pd_elgamal_precomputed", "Precomputed ElGamal (k, g^k) pairs",
+            i2p::util::eMetricGauge, []() { return (int64_t)i2p::crypto::elGamalPrecomputation.GetNumPrecomputed (); });
+        metrics.SetCallback ("i2pd_tunnels", "Established and pending tunnels", i2p::util::eMetricGauge,
+            [this]() { return (int64_t)m_NumInboundTunnels; }, "direction=\"inbound\"");
+        metrics.SetCallback ("i2pd_tunnels", "Established and pending tunnels", i2p::util::eMetricGauge,
+            [this]() { return (int64_t)m_NumOutboundTunnels; }, "direction=\"outbound\"");
+        metrics.SetCallback ("i2pd_tunnels", "Established and pending tunnels", i2p::util::eMetricGauge,
+            [this]()
+            {
+                std::unique_lock<std::mutex> l(m_TransitTunnelsMutex);
+                return (int64_t)m_TransitTunnels.size ();
+            }, "direction=\"transit\"");
     }
     
     void Tunnels::Stop ()
     {
         m_IsRunning = false;
         m_Queue.WakeUp ();
+        m_BuildQueue.WakeUp ();
         if (m_Thread)
         {   
             m_Thread->join (); 
             delete m_Thread;
             m_Thread = 0;
         }   
+        if (m_BuildThread)
+        {   
+            m_BuildThread->join (); 
+            delete m_BuildThread;
+            m_BuildThread = 0;
+        }   
+        i2p::crypto::elGamalPrecomputation.Stop ();
     }   
 
     void Tunnels::Run ()
     {
         std::this_thread::sleep_for (std::chrono::seconds(1)); // wait for other parts are ready
         
-        uint64_t lastTs = 0;
+        uint64_t lastTs = 0, lastBuildsTs = 0;
         while (m_IsRunning)
         {
             try
@@ -414,7 +486,14 @@ namespace tunnel
                 if (ts - lastTs >= 15) // manage tunnels every 15 seconds
                 {
                     ManageTunnels ();
-                    lastTs = ts;
+                    lastTs = lastBuildsTs = ts;
+                }
+                else if (ts - lastBuildsTs >= TUNNEL_POOL_BUILDS_CHECK_INTERVAL) 
+                {
+                    // replace failed builds without waiting for next management
+                    ManagePendingTunnels ();
+                    ManageTunnelPoolBuilds ();
+                    lastBuildsTs = ts;
                 }
             }
             catch (std::exception& ex)
@@ -490,6 +569,9 @@ namespace tunnel
                         // delete
                         it = pendingTunnels.erase (it);
                         m_NumFailedTunnelCreations++;
+                        static auto& numTimeouts = i2p::util::metrics.GetCounter ("i2pd_tunnel_builds_total",
+                            "Completed tunnel build requests", "result=\"timeout\"");
+                        numTimeouts.Inc ();
                     }
                     else
                         it++;
@@ -498,6 +580,9 @@ namespace tunnel
                     LogPrint ("Pending tunnel build request ", it->first, " failed. Deleted");
                     it = pendingTunnels.erase (it);
                     m_NumFailedTunnelCreations++;
+                    static auto& numFailed = i2p::util::metrics.GetCounter ("i2pd_tunnel_builds_total",
+                        "Completed tunnel build requests", "result=\"failed\"");
+                    numFailed.Inc ();
                 break;
                 case eTunnelStateBuildReplyReceived:
                     // intermediate state, will be either established of build failed
@@ -507,6 +592,9 @@ namespace tunnel
                     // success
                     it = pendingTunnels.erase (it);
                     m_NumSuccesiveTunnelCreations++;
+                    static auto& numSucceeded = i2p::util::metrics.GetCounter ("i2pd_tunnel_builds_total",
+                        "Completed tunnel build requests", "result=\"success\"");
+                    numSucceeded.Inc ();
             }   
         }   
     }
@@ -521,10 +609,13 @@ namespace tunnel
                 if (ts > tunnel->GetCreationTime () + TUNNEL_EXPIRATION_TIMEOUT)
                 {
                     LogPrint ("Tunnel ", tunnel->GetTunnelID (), " expired");
+                    for (auto& peer: tunnel->GetTunnelConfig ()->GetPeers ())
+                        peer->GetProfile ()->TunnelExpired (tunnel->GetNumSentBytes ());
                     auto pool = tunnel->GetTunnelPool ();
                     if (pool)
                         pool->TunnelExpired (tunnel);
                     it = m_OutboundTunnels.erase (it);
+                    m_NumOutboundTunnels = m_OutboundTunnels.size ();
                 }   
                 else 
                 {
@@ -569,10 +660,13 @@ namespace tunnel
                 if (ts > tunnel->GetCreationTime () + TUNNEL_EXPIRATION_TIMEOUT)
                 {
                     LogPrint ("Tunnel ", tunnel->GetTunnelID (), " expired");
+                    for (auto& peer: tunnel->GetTunnelConfig ()->GetPeers ())
+                        peer->GetProfile ()->TunnelExpired (tunnel->GetNumReceivedBytes ());
                     auto pool = tunnel->GetTunnelPool ();
                     if (pool)
                         pool->TunnelExpired (tunnel);
                     it = m_InboundTunnels.erase (it);
+                    m_NumInboundTunnels = m_InboundTunnels.size ();
                 }   
                 else 
                 {
@@ -634,6 +728,14 @@ namespace tunnel
         }
     }   
 
+    void Tunnels::ManageTunnelPoolBuilds ()
+    {
+        std::unique_lock<std::mutex> l(m_PoolsMutex);
+        for (auto it: m_Pools)
+            if (it && it->IsActive ())
+                it->CreateTunnels ();
+    }
+
     void Tunnels::ManageTunnelPools ()
     {
         std::unique_lock<std::mutex> l(m_PoolsMutex);
@@ -642,6 +744,8 @@ namespace tunnel
             auto pool = it;
             if (pool && pool->IsActive ())
             {   
+                pool->UpdateTunnelsLoad ();
+                pool->AdjustNumTunnels ();
                 pool->CreateTunnels ();
                 pool->TestTunnels ();
             }       
@@ -664,10 +768,40 @@ namespace tunnel
         auto newTunnel = std::make_shared<TTunnel> (config);
         uint32_t replyMsgID = i2p::context.GetRandomNumberGenerator ().GenerateWord32 ();
         AddPendingTunnel (replyMsgID, newTunnel); 
-        newTunnel->Build (replyMsgID, outboundTunnel);
+        if (m_BuildThread)
+        {
+            // encryption keys of hops are created lazily, not thread-safe
+            for (auto hop = config->GetFirstHop (); hop; hop = hop->next)
+                hop->router->GetElGamalEncryption ();
+            // pending tunnel is not touched until reply comes, which is after records are sent
+            m_BuildQueue.Put ([newTunnel, replyMsgID, outboundTunnel](CryptoPP::RandomNumberGenerator& rnd)
+                {
+                    newTunnel->Build (replyMsgID, outboundTunnel, rnd);
+                });
+        }
+        else
+            newTunnel->Build (replyMsgID, outboundTunnel);
         return newTunnel;
     }   
 
+    void Tunnels::RunBuilds ()
+    {
+        CryptoPP::AutoSeededRandomPool rnd; // context's one belongs to tunnels thread
+        while (m_IsRunning)
+        {
+            try
+            {
+                auto build = m_BuildQueue.GetNext ();
+                if (build)
+                    build (rnd);
+            }
+            catch (std::exception& ex)
+            {
+                LogPrint (eLogError, "Tunnels build: ", ex.what ());
+            }
+        }
+    }
+
     void Tunnels::AddPendingTunnel (uint32_t replyMsgID, std::shared_ptr<InboundTunnel> tunnel)
     {
         m_PendingInboundTunnels[replyMsgID] = tunnel; 
@@ -681,6 +815,7 @@ namespace tunnel
     void Tunnels::AddOutboundTunnel (std::shared_ptr<OutboundTunnel> newTunnel)
     {
         m_OutboundTunnels.push_back (newTunnel);
+        m_NumOutboundTunnels = m_OutboundTunnels.size ();
         auto pool = newTunnel->GetTunnelPool ();
         if (pool && pool->IsActive ())
             pool->TunnelCreated (newTunnel);
@@ -691,6 +826,7 @@ namespace tunnel
     void Tunnels::AddInboundTunnel (std::shared_ptr<InboundTunnel> newTunnel)
     {
         m_InboundTunnels[newTunnel->GetTunnelID ()] = newTunnel;
+        m_NumInboundTunnels = m_InboundTunnels.size ();
         auto pool = newTunnel->GetTunnelPool ();
         if (!pool)
         {       
@@ -8,7 +8,9 @@
 #include <string>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <memory>
+#include <functional>
 #include "util/Queue.h"
 #include "TunnelConfig.h"
 #include "TunnelPool.h"
@@ -49,6 +51,8 @@ namespace tunnel
             ~Tunnel ();
 
             void Build (uint32_t replyMsgID, std::shared_ptr<OutboundTunnel> outboundTunnel = nullptr);
+            void Build (uint32_t replyMsgID, std::shared_ptr<OutboundTunnel> outboundTunnel,
+                CryptoPP::RandomNumberGenerator& rnd); // rnd of calling thread
             
             std::shared_ptr<const TunnelConfig> GetTunnelConfig () const { return m_Config; }
             TunnelState GetState () const { return m_State; };
@@ -68,6 +72,10 @@ namespace tunnel
             void EncryptTunnelMsg (std::shared_ptr<const I2NPMessage> in, std::shared_ptr<I2NPMessage> out); 
             uint32_t GetNextTunnelID () const { return m_Config->GetFirstHop ()->tunnelID; };
             const i2p::data::IdentHash& GetNextIdentHash () const { return m_Config->GetFirstHop ()->router->GetIdentHash (); };
+
+            // smoothed, 0 if not measured yet
+            uint32_t GetTestRTT () const { return m_TestRTT; }; // in milliseconds
+            void TunnelTested (uint32_t rtt); // by tunnels thread only
             
         private:
 
@@ -75,19 +83,24 @@ namespace tunnel
             std::shared_ptr<TunnelPool> m_Pool; // pool, tunnel belongs to, or null
             TunnelState m_State;
             bool m_IsRecreated;
+            uint64_t m_BuildTime; // in milliseconds, for reply latency
+            std::atomic<uint32_t> m_TestRTT; // read by streams and HTTP
     };  
 
     class OutboundTunnel: public Tunnel 
     {
         public:
 
-            OutboundTunnel (std::shared_ptr<const TunnelConfig> config): Tunnel (config), m_Gateway (this) {};
+            OutboundTunnel (std::shared_ptr<const TunnelConfig> config): 
+                Tunnel (config), m_Gateway (this), m_LastNumSentBytes (0), m_Throughput (0) {};
 
             void SendTunnelDataMsg (const uint8_t * gwHash, uint32_t gwTunnel, std::shared_ptr<i2p::I2NPMessage> msg);
             void SendTunnelDataMsg (const std::vector<TunnelMessageBlock>& msgs); // multiple messages
             std::shared_ptr<const i2p::data::RouterInfo> GetEndpointRouter () const 
                 { return GetTunnelConfig ()->GetLastHop ()->router; }; 
             size_t GetNumSentBytes () const { return m_Gateway.GetNumSentBytes (); };
+            void UpdateThroughput (uint64_t interval); // in milliseconds since last update, by tunnels thread only
+            uint32_t GetThroughput () const { return m_Throughput; }; // bytes per second, smoothed
 
             // implements TunnelBase
             void HandleTunnelDataMsg (std::shared_ptr<const i2p::I2NPMessage> tunnelMsg);
@@ -97,6 +110,8 @@ namespace tunnel
 
             std::mutex m_SendMutex;
             TunnelGateway m_Gateway; 
+            size_t m_LastNumSentBytes;
+            std::atomic<uint32_t> m_Throughput; // read by streams and HTTP
     };
     
     class InboundTunnel: public Tunnel, public std::enable_shared_from_this<InboundTunnel>
@@ -153,6 +168,7 @@ namespace tunnel
             void HandleTunnelGatewayMsg (TunnelBase * tunnel, std::shared_ptr<I2NPMessage> msg);
 
             void Run ();    
+            void RunBuilds ();
             void ManageTunnels ();
             void ManageOutboundTunnels ();
             void ManageInboundTunnels ();
@@ -161,17 +177,21 @@ namespace tunnel
             template<class PendingTunnels>
             void ManagePendingTunnels (PendingTunnels& pendingTunnels);
             void ManageTunnelPools ();
+            void ManageTunnelPoolBuilds ();
             
             void CreateZeroHopsInboundTunnel ();
+            void RegisterMetrics ();
             
         private:
 
             bool m_IsRunning;
-            std::thread * m_Thread; 
+            std::thread * m_Thread, * m_BuildThread; 
+            i2p::util::Queue<std::function<void (CryptoPP::RandomNumberGenerator&)> > m_BuildQueue; // records encryption off tunnels thread
             std::map<uint32_t, std::shared_ptr<InboundTunnel> > m_PendingInboundTunnels; // by replyMsgID
             std::map<uint32_t, std::shared_ptr<OutboundTunnel> > m_PendingOutboundTunnels; // by replyMsgID
             std::map<uint32_t, std::shared_ptr<InboundTunnel> > m_InboundTunnels;
             std::list<std::shared_ptr<OutboundTunnel> > m_OutboundTunnels;
+            std::atomic<size_t> m_NumInboundTunnels, m_NumOutboundTunnels; // updated by tunnels thread, for metrics
             std::mutex m_TransitTunnelsMutex;
             std::map<uint32_t, TransitTunnel *> m_TransitTunnels;
             std::mutex m_PoolsMutex;
@@ -189,6 +209,7 @@ namespace tunnel
             const decltype(m_InboundTunnels)& GetInboundTunnels () const { return m_InboundTunnels; };
             const decltype(m_TransitTunnels)& GetTransitTunnels () const { return m_TransitTunnels; };
             int GetQueueSize () { return m_Queue.GetSize (); };
+            int GetBuildQueueSize () { return m_BuildQueue.GetSize (); };
             int GetTunnelCreationSuccessRate () const // in percents
             { 
                 int totalNum = m_NumSuccesiveTunnelCreations + m_NumFailedTunnelCreations;
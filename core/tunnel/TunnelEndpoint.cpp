@@ -231,8 +231,13 @@ namespace tunnel
                 i2p::HandleI2NPMessage (msg.data);
             break;
             case eDeliveryTypeTunnel:
-                i2p::transport::transports.SendMessage (msg.hash, i2p::CreateTunnelGatewayMsg (msg.tunnelID, msg.data));
-            break;
+            {
+                auto gatewayMsg = i2p::CreateTunnelGatewayMsg (msg.tunnelID, msg.data);
+                if (!m_IsInbound) // outbound transit tunnel
+                    gatewayMsg->trafficClass = eTrafficClassTransit;
+                i2p::transport::transports.SendMessage (msg.hash, gatewayMsg);
+                break;
+            }
             case eDeliveryTypeRouter:
                 if (msg.hash == i2p::context.GetRouterInfo ().GetIdentHash ()) // check if message is sent to us
                     i2p::HandleI2NPMessage (msg.data);
@@ -245,6 +250,7 @@ namespace tunnel
                         if (typeID == eI2NPDatabaseStore || typeID == eI2NPDatabaseSearchReply )
                             // catch RI or reply with new list of routers
                             i2p::data::netdb.PostI2NPMsg (msg.data);*/
+                        msg.data->trafficClass = eTrafficClassTransit;
                         i2p::transport::transports.SendMessage (msg.hash, msg.data);
                     }
                     else // we shouldn't send this message. possible leakage 
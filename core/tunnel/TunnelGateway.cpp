@@ -202,6 +202,7 @@ namespace tunnel
         {   
             m_Tunnel->EncryptTunnelMsg (tunnelMsg, tunnelMsg); 
             tunnelMsg->FillI2NPMessageHeader (eI2NPTunnelData); 
+            tunnelMsg->trafficClass = m_TrafficClass;
             m_NumSentBytes += TUNNEL_DATA_MSG_SIZE;
         }   
         i2p::transport::transports.SendMessages (m_Tunnel->GetNextIdentHash (), tunnelMsgs);
@@ -38,8 +38,9 @@ namespace tunnel
     {
         public:
 
-            TunnelGateway (TunnelBase * tunnel):
-                m_Tunnel (tunnel), m_Buffer (tunnel->GetNextTunnelID ()), m_NumSentBytes (0) {};
+            TunnelGateway (TunnelBase * tunnel, TrafficClass trafficClass = eTrafficClassClient):
+                m_Tunnel (tunnel), m_Buffer (tunnel->GetNextTunnelID ()), m_NumSentBytes (0),
+                m_TrafficClass (trafficClass) {};
             void SendTunnelDataMsg (const TunnelMessageBlock& block);   
             void PutTunnelDataMsg (const TunnelMessageBlock& block);
             void SendBuffer ();         
@@ -50,6 +51,7 @@ namespace tunnel
             TunnelBase * m_Tunnel;
             TunnelGatewayBuffer m_Buffer;
             size_t m_NumSentBytes;
+            TrafficClass m_TrafficClass;
     };  
 }       
 }   
@@ -4,6 +4,8 @@
 #include "Tunnel.h"
 #include "NetworkDatabase.h"
 #include "util/Timestamp.h"
+#include "util/Metrics.h"
+#include "util/util.h"
 #include "Garlic.h"
 #include "transport/Transports.h"
 #include "TunnelPool.h"
@@ -14,7 +16,13 @@ namespace tunnel
 {
     TunnelPool::TunnelPool (i2p::garlic::GarlicDestination * localDestination, int numInboundHops, int numOutboundHops, int numInboundTunnels, int numOutboundTunnels):
         m_LocalDestination (localDestination), m_NumInboundHops (numInboundHops), m_NumOutboundHops (numOutboundHops),
-        m_NumInboundTunnels (numInboundTunnels), m_NumOutboundTunnels (numOutboundTunnels), m_IsActive (true)
+        m_NumInboundTunnels (numInboundTunnels), m_NumOutboundTunnels (numOutboundTunnels), m_IsActive (true),
+        m_IsAdaptive (false), m_MinInboundTunnels (numInboundTunnels), m_MaxInboundTunnels (numInboundTunnels),
+        m_MinOutboundTunnels (numOutboundTunnels), m_MaxOutboundTunnels (numOutboundTunnels), m_LastAdjustmentTime (0),
+        m_NumRetiredInboundBytes (0), m_NumRetiredOutboundBytes (0), m_LastNumInboundBytes (0), m_LastNumOutboundBytes (0),
+        m_NumInboundTestsFailed (0), m_NumOutboundTestsFailed (0), m_NumIdleInboundAdjustments (0), m_NumIdleOutboundAdjustments (0),
+        m_LastLoadUpdateTime (0), m_MaxPendingInboundBuilds (TUNNEL_POOL_MAX_PENDING_BUILDS),
+        m_MaxPendingOutboundBuilds (TUNNEL_POOL_MAX_PENDING_BUILDS), m_StartTime (0), m_TimeToReady (0)
     {
     }
 
@@ -41,9 +49,29 @@ namespace tunnel
             } 
             m_NumInboundTunnels = 1;
             m_NumOutboundTunnels = 1;
+            m_IsAdaptive = false;
         }   
     }
 
+    void TunnelPool::SetQuantityRange (int minInbound, int maxInbound, int minOutbound, int maxOutbound)
+    {
+        if (m_ExplicitPeers) return;
+        m_MinInboundTunnels = minInbound; m_MaxInboundTunnels = maxInbound;
+        m_MinOutboundTunnels = minOutbound; m_MaxOutboundTunnels = maxOutbound;
+        m_NumInboundTunnels = std::min (std::max (m_NumInboundTunnels, minInbound), maxInbound);
+        m_NumOutboundTunnels = std::min (std::max (m_NumOutboundTunnels, minOutbound), maxOutbound);
+        m_IsAdaptive = maxInbound > minInbound || maxOutbound > minOutbound;
+        if (m_IsAdaptive)
+            LogPrint (eLogInfo, "Adaptive tunnels quantity inbound ", minInbound, "-", maxInbound, 
+                ", outbound ", minOutbound, "-", maxOutbound);
+    }
+
+    void TunnelPool::SetMaxPendingBuilds (int inbound, int outbound)
+    {
+        if (inbound > 0) m_MaxPendingInboundBuilds = inbound;
+        if (outbound > 0) m_MaxPendingOutboundBuilds = outbound;
+    }
+
     void TunnelPool::DetachTunnels ()
     {
         {
@@ -59,6 +87,9 @@ namespace tunnel
             m_OutboundTunnels.clear ();
         }
         m_Tests.clear ();
+        std::unique_lock<std::mutex> l(m_PendingBuildsMutex);
+        m_PendingInboundBuilds.clear ();
+        m_PendingOutboundBuilds.clear ();
     }   
         
     void TunnelPool::TunnelCreated (std::shared_ptr<InboundTunnel> createdTunnel)
@@ -66,8 +97,16 @@ namespace tunnel
         if (!m_IsActive) return;
         {
             std::unique_lock<std::mutex> l(m_InboundTunnelsMutex);
+            if (GetNumActiveTunnels (m_InboundTunnels) >= m_NumInboundTunnels)
+            {
+                // enough of speculative builds have succeeded already
+                LogPrint (eLogDebug, "Surplus inbound tunnel ", createdTunnel->GetTunnelID (), " dropped");
+                createdTunnel->SetTunnelPool (nullptr);
+                return;
+            }
             m_InboundTunnels.insert (createdTunnel);
         }
+        CheckReady ();
         if (m_LocalDestination)
             m_LocalDestination->SetLeaseSetUpdated ();
     }
@@ -81,7 +120,8 @@ namespace tunnel
                 if (it.second.second == expiredTunnel) it.second.second = nullptr;
 
             std::unique_lock<std::mutex> l(m_InboundTunnelsMutex);
-            m_InboundTunnels.erase (expiredTunnel);
+            if (m_InboundTunnels.erase (expiredTunnel))
+                m_NumRetiredInboundBytes += expiredTunnel->GetNumReceivedBytes ();
         }   
     }   
 
@@ -90,8 +130,15 @@ namespace tunnel
         if (!m_IsActive) return;
         {
             std::unique_lock<std::mutex> l(m_OutboundTunnelsMutex);
+            if (GetNumActiveTunnels (m_OutboundTunnels) >= m_NumOutboundTunnels)
+            {
+                LogPrint (eLogDebug, "Surplus outbound tunnel ", createdTunnel->GetTunnelID (), " dropped");
+                createdTunnel->SetTunnelPool (nullptr);
+                return;
+            }
             m_OutboundTunnels.insert (createdTunnel);
         }
+        CheckReady ();
         //CreatePairedInboundTunnel (createdTunnel);
     }
 
@@ -104,7 +151,8 @@ namespace tunnel
                 if (it.second.first == expiredTunnel) it.second.first = nullptr;
 
             std::unique_lock<std::mutex> l(m_OutboundTunnelsMutex);
-            m_OutboundTunnels.erase (expiredTunnel);
+            if (m_OutboundTunnels.erase (expiredTunnel))
+                m_NumRetiredOutboundBytes += expiredTunnel->GetNumSentBytes ();
         }
     }
         
@@ -125,10 +173,58 @@ namespace tunnel
         return v;
     }
 
+    double TunnelPool::GetTunnelCost (std::shared_ptr<const OutboundTunnel> tunnel)
+    {
+        return GetTunnelCost (tunnel->GetTestRTT (), tunnel->GetThroughput ());
+    }   
+
+    double TunnelPool::GetTunnelCost (uint32_t rtt, uint32_t throughput)
+    {
+        return (double)(rtt ? rtt : TUNNEL_DEFAULT_RTT)*(1.0 + (double)throughput/TUNNEL_LOAD_UNIT);
+    }   
+
     std::shared_ptr<OutboundTunnel> TunnelPool::GetNextOutboundTunnel (std::shared_ptr<OutboundTunnel> excluded) const
     {
-        std::unique_lock<std::mutex> l(m_OutboundTunnelsMutex); 
-        return GetNextTunnel (m_OutboundTunnels, excluded);
+        // probability of tunnel is inverse to its cost
+        std::vector<std::shared_ptr<OutboundTunnel> > candidates;
+        std::vector<double> weights;
+        double totalWeight = 0;
+        {
+            std::unique_lock<std::mutex> l(m_OutboundTunnelsMutex); 
+            for (auto it: m_OutboundTunnels)
+                if (it->IsEstablished () && it != excluded)
+                {
+                    candidates.push_back (it);
+                    weights.push_back (1.0/GetTunnelCost (it));
+                    totalWeight += weights.back ();
+                }   
+        }
+        if (candidates.empty ())
+            return (excluded && excluded->IsEstablished ()) ? excluded : nullptr;
+        double r = totalWeight*i2p::context.GetRandomNumberGenerator ().GenerateWord32 ()/4294967296.0;
+        return candidates[i2p::util::SelectWeighted (weights, r)];
+    }   
+
+    std::shared_ptr<OutboundTunnel> TunnelPool::RebalanceOutboundTunnel (std::shared_ptr<OutboundTunnel> current) const
+    {
+        if (!current || !current->IsEstablished ()) return GetNextOutboundTunnel (current);
+        double totalCost = 0;
+        int num = 0;
+        {
+            std::unique_lock<std::mutex> l(m_OutboundTunnelsMutex); 
+            for (auto it: m_OutboundTunnels)
+                if (it->IsEstablished ())
+                {
+                    totalCost += GetTunnelCost (it);
+                    num++;
+                }
+        }
+        if (num > 1 && GetTunnelCost (current)*num > TUNNEL_REBALANCE_RATIO*totalCost)
+        {
+            LogPrint (eLogDebug, "Outbound tunnel ", current->GetTunnelID (), " is overloaded. Rebalanced");
+            return GetNextOutboundTunnel (current);
+        }
+        return current;
     }   
 
     std::shared_ptr<InboundTunnel> TunnelPool::GetNextInboundTunnel (std::shared_ptr<InboundTunnel> excluded) const
@@ -177,25 +273,188 @@ namespace tunnel
         return tunnel;
     }
 
-    void TunnelPool::CreateTunnels ()
+    template<class TTunnels>
+    int TunnelPool::GetNumEstablishedTunnels (const TTunnels& tunnels) const
     {
         int num = 0;
+        for (auto it : tunnels)
+            if (it->IsEstablished ()) num++;
+        return num;
+    }
+
+    template<class TTunnels>
+    int TunnelPool::GetNumActiveTunnels (const TTunnels& tunnels) const
+    {
+        int num = 0;
+        for (auto it : tunnels)
+            if (it->IsEstablished () && !it->IsRecreated ()) num++;
+        return num;
+    }
+
+    int TunnelPool::AdjustQuantity (int quantity, int minQuantity, int maxQuantity, int numEstablished, 
+        uint64_t bytesPerSecond, bool isOverloaded, int& numIdleAdjustments)
+    {
+        if (isOverloaded || bytesPerSecond > TUNNEL_POOL_HIGH_TRAFFIC*std::max (numEstablished, 1))
+        {
+            numIdleAdjustments = 0;
+            if (quantity < maxQuantity) quantity++;
+        }
+        else if (quantity > minQuantity && bytesPerSecond < TUNNEL_POOL_LOW_TRAFFIC*(quantity - 1))
+        {
+            numIdleAdjustments++;
+            if (numIdleAdjustments >= TUNNEL_POOL_NUM_IDLE_ADJUSTMENTS)
+            {
+                numIdleAdjustments = 0;
+                quantity--;
+            }
+        }
+        else
+            numIdleAdjustments = 0;
+        return quantity;
+    }
+
+    void TunnelPool::AdjustNumTunnels ()
+    {
+        if (!m_IsAdaptive) return;
+        uint64_t ts = i2p::util::GetSecondsSinceEpoch ();
+        if (ts < m_LastAdjustmentTime + TUNNEL_POOL_ADJUSTMENT_INTERVAL) return;
+        uint64_t interval = m_LastAdjustmentTime ? ts - m_LastAdjustmentTime : 0;
+        m_LastAdjustmentTime = ts;
+
+        int numInbound, numOutbound;
+        uint64_t numInboundBytes, numOutboundBytes;
         {
             std::unique_lock<std::mutex> l(m_InboundTunnelsMutex);
+            numInbound = GetNumEstablishedTunnels (m_InboundTunnels);
+            numInboundBytes = m_NumRetiredInboundBytes;
             for (auto it : m_InboundTunnels)
-                if (it->IsEstablished ()) num++;
+                numInboundBytes += it->GetNumReceivedBytes ();
+        }
+        {
+            std::unique_lock<std::mutex> l(m_OutboundTunnelsMutex);
+            numOutbound = GetNumEstablishedTunnels (m_OutboundTunnels);
+            numOutboundBytes = m_NumRetiredOutboundBytes;
+            for (auto it : m_OutboundTunnels)
+                numOutboundBytes += it->GetNumSentBytes ();
+        }
+        if (interval) // first call only starts counting
+        {
+            uint64_t inboundRate = (numInboundBytes - m_LastNumInboundBytes)/interval,
+                outboundRate = (numOutboundBytes - m_LastNumOutboundBytes)/interval;
+            size_t sendQueueSize = m_LocalDestination ? m_LocalDestination->GetSendQueueSize () : 0;
+            // losing more than half of tests means tunnels are missing
+            bool inboundOverloaded = 2*m_NumInboundTestsFailed > numInbound;
+            bool outboundOverloaded = 2*m_NumOutboundTestsFailed > numOutbound ||
+                sendQueueSize > TUNNEL_POOL_HIGH_SEND_QUEUE*std::max (numOutbound, 1);
+            int numInboundTunnels = AdjustQuantity (m_NumInboundTunnels, m_MinInboundTunnels, m_MaxInboundTunnels, 
+                numInbound, inboundRate, inboundOverloaded, m_NumIdleInboundAdjustments);
+            int numOutboundTunnels = AdjustQuantity (m_NumOutboundTunnels, m_MinOutboundTunnels, m_MaxOutboundTunnels,
+                numOutbound, outboundRate, outboundOverloaded, m_NumIdleOutboundAdjustments);
+            if (numInboundTunnels != m_NumInboundTunnels || numOutboundTunnels != m_NumOutboundTunnels)
+                LogPrint (eLogInfo, "Tunnels quantity changed to inbound ", numInboundTunnels, ", outbound ", numOutboundTunnels,
+                    ". Traffic ", inboundRate, "/", outboundRate, " Bps, send queue ", sendQueueSize);
+            m_NumInboundTunnels = numInboundTunnels;
+            m_NumOutboundTunnels = numOutboundTunnels;
+        }
+        m_LastNumInboundBytes = numInboundBytes;
+        m_LastNumOutboundBytes = numOutboundBytes;
+        m_NumInboundTestsFailed = 0;
+        m_NumOutboundTestsFailed = 0;
+    }
+
+    double TunnelPool::GetBuildSuccessProbability (std::shared_ptr<const TunnelConfig> config) const
+    {
+        double probability = 1.0;
+        for (auto& peer: config->GetPeers ())
+            probability *= peer->GetProfile ()->GetBuildSuccessProbability ();
+        return probability;
+    }
+
+    double TunnelPool::GetExpectedNumBuilds (std::list<PendingBuild>& builds)
+    {
+        uint64_t ts = i2p::util::GetSecondsSinceEpoch ();
+        double expected = 0;
+        std::unique_lock<std::mutex> l(m_PendingBuildsMutex);
+        for (auto it = builds.begin (); it != builds.end ();)
+        {
+            auto state = it->tunnel->GetState ();
+            if ((state != eTunnelStatePending && state != eTunnelStateBuildReplyReceived) || 
+                ts > it->tunnel->GetCreationTime () + TUNNEL_CREATION_TIMEOUT)
+                it = builds.erase (it);
+            else
+            {
+                // late reply is less likely, so next build doesn't wait for timeout
+                expected += (ts > it->tunnel->GetCreationTime () + TUNNEL_BUILD_EXPECTED_REPLY_TIME) ? 
+                    it->probability/4 : it->probability;
+                it++;
+            }
+        }
+        return expected;
+    }
+
+    double TunnelPool::AddPendingBuild (std::list<PendingBuild>& builds, std::shared_ptr<Tunnel> tunnel)
+    {
+        double probability = GetBuildSuccessProbability (tunnel->GetTunnelConfig ());
+        std::unique_lock<std::mutex> l(m_PendingBuildsMutex);
+        builds.push_back ({ tunnel, probability });
+        return probability;
+    }
+
+    int TunnelPool::GetNumPendingBuilds (const std::list<PendingBuild>& builds) const
+    {
+        std::unique_lock<std::mutex> l(m_PendingBuildsMutex);
+        return builds.size ();
+    }
+
+    void TunnelPool::CreateTunnels ()
+    {
+        if (!m_StartTime) m_StartTime = i2p::util::GetMillisecondsSinceEpoch ();
+        int num = 0;
+        {
+            std::unique_lock<std::mutex> l(m_InboundTunnelsMutex);
+            num = GetNumActiveTunnels (m_InboundTunnels);
+        }
+        double expected = GetExpectedNumBuilds (m_PendingInboundBuilds), 
+            required = (m_NumInboundTunnels - num)*TUNNEL_BUILD_OVERPROVISION;
+        while (expected < required && GetNumPendingBuilds (m_PendingInboundBuilds) < m_MaxPendingInboundBuilds)
+        {
+            double probability = CreateInboundTunnel ();
+            if (probability <= 0) break;
+            expected += probability;
         }
-        for (int i = num; i < m_NumInboundTunnels; i++)
-            CreateInboundTunnel (); 
         
-        num = 0;
         {
             std::unique_lock<std::mutex> l(m_OutboundTunnelsMutex); 
-            for (auto it : m_OutboundTunnels)
-                if (it->IsEstablished ()) num++;
+            num = GetNumActiveTunnels (m_OutboundTunnels);
+        }
+        expected = GetExpectedNumBuilds (m_PendingOutboundBuilds); 
+        required = (m_NumOutboundTunnels - num)*TUNNEL_BUILD_OVERPROVISION;
+        while (expected < required && GetNumPendingBuilds (m_PendingOutboundBuilds) < m_MaxPendingOutboundBuilds)
+        {
+            double probability = CreateOutboundTunnel ();
+            if (probability <= 0) break;
+            expected += probability;
         }
-        for (int i = num; i < m_NumOutboundTunnels; i++)
-            CreateOutboundTunnel ();    
+    }
+
+    void TunnelPool::CheckReady ()
+    {
+        if (m_TimeToReady || !m_StartTime) return;
+        {
+            std::unique_lock<std::mutex> l(m_InboundTunnelsMutex);
+            if (m_InboundTunnels.empty ()) return;
+        }
+        {
+            std::unique_lock<std::mutex> l(m_OutboundTunnelsMutex);
+            if (m_OutboundTunnels.empty ()) return;
+        }
+        m_TimeToReady = i2p::util::GetMillisecondsSinceEpoch () - m_StartTime;
+        if (!m_TimeToReady) m_TimeToReady = 1; // 0 means not ready
+        LogPrint (eLogInfo, "Tunnel pool is ready in ", m_TimeToReady, " milliseconds");
+        static auto& timeToReady = i2p::util::metrics.GetHistogram ("i2pd_tunnel_pool_ready_milliseconds",
+            "Time from start of tunnel pool to first inbound and outbound tunnels", 
+            i2p::util::ExponentialBuckets (1000, 2, 8));
+        timeToReady.Observe (m_TimeToReady);
     }
 
     void TunnelPool::TestTunnels ()
@@ -204,6 +463,18 @@ namespace tunnel
         for (auto it: m_Tests)
         {
             LogPrint ("Tunnel test ", (int)it.first, " failed"); 
+            static auto& numTestsFailed = i2p::util::metrics.GetCounter ("i2pd_tunnel_tests_failed_total",
+                "Tunnel tests without reply");
+            numTestsFailed.Inc ();
+            if (it.second.first) m_NumOutboundTestsFailed++;
+            if (it.second.second) m_NumInboundTestsFailed++;
+            // can't tell which hop lost it
+            if (it.second.first)
+                for (auto& peer: it.second.first->GetTunnelConfig ()->GetPeers ())
+                    peer->GetProfile ()->TunnelTestFailed ();
+            if (it.second.second)
+                for (auto& peer: it.second.second->GetTunnelConfig ()->GetPeers ())
+                    peer->GetProfile ()->TunnelTestFailed ();
             // if test failed again with another tunnel we consider it failed
             if (it.second.first)
             {   
@@ -211,7 +482,8 @@ namespace tunnel
                 {   
                     it.second.first->SetState (eTunnelStateFailed);
                     std::unique_lock<std::mutex> l(m_OutboundTunnelsMutex);
-                    m_OutboundTunnels.erase (it.second.first);
+                    if (m_OutboundTunnels.erase (it.second.first))
+                        m_NumRetiredOutboundBytes += it.second.first->GetNumSentBytes ();
                 }
                 else
                     it.second.first->SetState (eTunnelStateTestFailed);
@@ -223,7 +495,8 @@ namespace tunnel
                     it.second.second->SetState (eTunnelStateFailed);
                     {
                         std::unique_lock<std::mutex> l(m_InboundTunnelsMutex);
-                        m_InboundTunnels.erase (it.second.second);
+                        if (m_InboundTunnels.erase (it.second.second))
+                            m_NumRetiredInboundBytes += it.second.second->GetNumReceivedBytes ();
                     }
                     if (m_LocalDestination)
                         m_LocalDestination->SetLeaseSetUpdated ();
@@ -260,6 +533,16 @@ namespace tunnel
         }
     }
 
+    void TunnelPool::UpdateTunnelsLoad ()
+    {
+        uint64_t ts = i2p::util::GetMillisecondsSinceEpoch ();
+        uint64_t interval = m_LastLoadUpdateTime ? ts - m_LastLoadUpdateTime : 0;
+        m_LastLoadUpdateTime = ts;
+        std::unique_lock<std::mutex> l(m_OutboundTunnelsMutex); 
+        for (auto it: m_OutboundTunnels)
+            it->UpdateThroughput (interval);
+    }   
+
     void TunnelPool::ProcessGarlicMessage (std::shared_ptr<I2NPMessage> msg)
     {
         if (m_LocalDestination)
@@ -283,7 +566,17 @@ namespace tunnel
                 it->second.first->SetState (eTunnelStateEstablished);
             if (it->second.second->GetState () == eTunnelStateTestFailed)
                 it->second.second->SetState (eTunnelStateEstablished);
-            LogPrint ("Tunnel test ", it->first, " successive. ", i2p::util::GetMillisecondsSinceEpoch () - timestamp, " milliseconds");
+            auto rtt = i2p::util::GetMillisecondsSinceEpoch () - timestamp;
+            LogPrint (eLogDebug, "Tunnel test ", it->first, " successive. ", rtt, " milliseconds");
+            static auto& testRTT = i2p::util::metrics.GetHistogram ("i2pd_tunnel_test_rtt_milliseconds",
+                "Round trip time of tunnel tests", i2p::util::ExponentialBuckets (50, 2, 10));
+            testRTT.Observe (rtt);
+            it->second.first->TunnelTested (rtt);
+            it->second.second->TunnelTested (rtt);
+            for (auto& peer: it->second.first->GetTunnelConfig ()->GetPeers ())
+                peer->GetProfile ()->TunnelTested (rtt);
+            for (auto& peer: it->second.second->GetTunnelConfig ()->GetPeers ())
+                peer->GetProfile ()->TunnelTested (rtt);
             m_Tests.erase (it);
         }
         else
@@ -298,8 +591,9 @@ namespace tunnel
     std::shared_ptr<const i2p::data::RouterInfo> TunnelPool::SelectNextHop (std::shared_ptr<const i2p::data::RouterInfo> prevHop) const
     {
         bool isExploratory = (m_LocalDestination == &i2p::context); // TODO: implement it better
+        // exploratory tunnels don't depend on profiles, otherwise we would never measure other peers
         auto hop = isExploratory ? i2p::data::netdb.GetRandomRouter (prevHop): 
-            i2p::data::netdb.GetHighBandwidthRandomRouter (prevHop);
+            i2p::data::netdb.GetTieredRandomRouter (prevHop);
 
         if (!hop || hop->GetProfile ()->IsBad ())
             hop = i2p::data::netdb.GetRandomRouter ();
@@ -360,7 +654,7 @@ namespace tunnel
         return true;
     }
     
-    void TunnelPool::CreateInboundTunnel ()
+    double TunnelPool::CreateInboundTunnel ()
     {
         auto outboundTunnel = GetNextOutboundTunnel ();
         if (!outboundTunnel)
@@ -372,22 +666,33 @@ namespace tunnel
             std::reverse (hops.begin (), hops.end ());  
             auto tunnel = tunnels.CreateTunnel<InboundTunnel> (std::make_shared<TunnelConfig> (hops), outboundTunnel);
             tunnel->SetTunnelPool (shared_from_this ());
+            return AddPendingBuild (m_PendingInboundBuilds, tunnel);
         }   
         else
             LogPrint (eLogError, "Can't create inbound tunnel. No peers available");
+        return 0;
     }
 
     void TunnelPool::RecreateInboundTunnel (std::shared_ptr<InboundTunnel> tunnel)
     {
+        {
+            std::unique_lock<std::mutex> l(m_InboundTunnelsMutex);
+            if (GetNumActiveTunnels (m_InboundTunnels) >= m_NumInboundTunnels)
+            {
+                LogPrint (eLogDebug, "Inbound tunnel ", tunnel->GetTunnelID (), " is not re-created, quantity reduced");
+                return;
+            }
+        }
         auto outboundTunnel = GetNextOutboundTunnel ();
         if (!outboundTunnel)
             outboundTunnel = tunnels.GetNextOutboundTunnel ();
         LogPrint ("Re-creating destination inbound tunnel...");
         auto newTunnel = tunnels.CreateTunnel<InboundTunnel> (tunnel->GetTunnelConfig ()->Clone (), outboundTunnel);
         newTunnel->SetTunnelPool (shared_from_this());
+        AddPendingBuild (m_PendingInboundBuilds, newTunnel);
     }   
         
-    void TunnelPool::CreateOutboundTunnel ()
+    double TunnelPool::CreateOutboundTunnel ()
     {
         auto inboundTunnel = GetNextInboundTunnel ();
         if (!inboundTunnel)
@@ -401,16 +706,26 @@ namespace tunnel
                 auto tunnel = tunnels.CreateTunnel<OutboundTunnel> (
                     std::make_shared<TunnelConfig> (hops, inboundTunnel->GetTunnelConfig ()));
                 tunnel->SetTunnelPool (shared_from_this ());
+                return AddPendingBuild (m_PendingOutboundBuilds, tunnel);
             }   
             else
                 LogPrint (eLogError, "Can't create outbound tunnel. No peers available");
         }   
         else
             LogPrint (eLogError, "Can't create outbound tunnel. No inbound tunnels found");
+        return 0;
     }   
         
     void TunnelPool::RecreateOutboundTunnel (std::shared_ptr<OutboundTunnel> tunnel)
     {
+        {
+            std::unique_lock<std::mutex> l(m_OutboundTunnelsMutex);
+            if (GetNumActiveTunnels (m_OutboundTunnels) >= m_NumOutboundTunnels)
+            {
+                LogPrint (eLogDebug, "Outbound tunnel ", tunnel->GetTunnelID (), " is not re-created, quantity reduced");
+                return;
+            }
+        }
         auto inboundTunnel = GetNextInboundTunnel ();
         if (!inboundTunnel)
             inboundTunnel = tunnels.GetNextInboundTunnel ();
@@ -420,6 +735,7 @@ namespace tunnel
             auto newTunnel = tunnels.CreateTunnel<OutboundTunnel> (
                 tunnel->GetTunnelConfig ()->Clone (inboundTunnel->GetTunnelConfig ()));
             newTunnel->SetTunnelPool (shared_from_this ());
+            AddPendingBuild (m_PendingOutboundBuilds, newTunnel);
         }   
         else
             LogPrint ("Can't re-create outbound tunnel. No inbound tunnels found");
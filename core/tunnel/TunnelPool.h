@@ -3,6 +3,7 @@
 
 #include <inttypes.h>
 #include <set>
+#include <list>
 #include <vector>
 #include <utility>
 #include <mutex>
@@ -19,7 +20,25 @@ namespace i2p
 {
 namespace tunnel
 {
+    // adaptive quantity of tunnels, if range is set
+    const int TUNNEL_POOL_ADJUSTMENT_INTERVAL = 60; // in seconds
+    const uint64_t TUNNEL_POOL_HIGH_TRAFFIC = 16*1024; // bytes per second per tunnel, add tunnel above
+    const uint64_t TUNNEL_POOL_LOW_TRAFFIC = 1024; // bytes per second per tunnel, drop tunnel below
+    const size_t TUNNEL_POOL_HIGH_SEND_QUEUE = 64*1024; // bytes of unacknowledged streaming packets per outbound tunnel
+    const int TUNNEL_POOL_NUM_IDLE_ADJUSTMENTS = 5; // drop tunnel after load stays low that many intervals
+    // load balancing of outbound tunnels, cost is test RTT growing with throughput
+    const uint32_t TUNNEL_LOAD_UNIT = 16*1024; // bytes per second, doubles cost of tunnel
+    const uint32_t TUNNEL_DEFAULT_RTT = 2000; // in milliseconds, for tunnels not tested yet
+    const int TUNNEL_REBALANCE_RATIO = 2; // stream moves off tunnel costing that many times more than average
+
+    // pipelined building, builds are added until expected number of successes covers missing tunnels
+    const int TUNNEL_POOL_MAX_PENDING_BUILDS = 6; // per direction
+    const double TUNNEL_BUILD_OVERPROVISION = 1.25; // expected successes per missing tunnel
+    const int TUNNEL_BUILD_EXPECTED_REPLY_TIME = 10; // in seconds, later reply counts a quarter 
+    const int TUNNEL_POOL_BUILDS_CHECK_INTERVAL = 2; // in seconds
+
     class Tunnel;
+    class TunnelConfig;
     class InboundTunnel;
     class OutboundTunnel;
 
@@ -33,7 +52,10 @@ namespace tunnel
             i2p::garlic::GarlicDestination * GetLocalDestination () const { return m_LocalDestination; };
             void SetLocalDestination (i2p::garlic::GarlicDestination * destination) { m_LocalDestination = destination; };
             void SetExplicitPeers (std::shared_ptr<std::vector<i2p::data::IdentHash> > explicitPeers);
+            void SetQuantityRange (int minInbound, int maxInbound, int minOutbound, int maxOutbound);
+            void SetMaxPendingBuilds (int inbound, int outbound);
 
+            void AdjustNumTunnels (); // by traffic, if adaptive
             void CreateTunnels ();
             void TunnelCreated (std::shared_ptr<InboundTunnel> createdTunnel);
             void TunnelExpired (std::shared_ptr<InboundTunnel> expiredTunnel);
@@ -42,28 +64,51 @@ namespace tunnel
             void RecreateInboundTunnel (std::shared_ptr<InboundTunnel> tunnel);
             void RecreateOutboundTunnel (std::shared_ptr<OutboundTunnel> tunnel);
             std::vector<std::shared_ptr<InboundTunnel> > GetInboundTunnels (int num) const;
-            std::shared_ptr<OutboundTunnel> GetNextOutboundTunnel (std::shared_ptr<OutboundTunnel> excluded = nullptr) const;
+            std::shared_ptr<OutboundTunnel> GetNextOutboundTunnel (std::shared_ptr<OutboundTunnel> excluded = nullptr) const; // weighted by load
+            std::shared_ptr<OutboundTunnel> RebalanceOutboundTunnel (std::shared_ptr<OutboundTunnel> current) const; // current if not overloaded
             std::shared_ptr<InboundTunnel> GetNextInboundTunnel (std::shared_ptr<InboundTunnel> excluded = nullptr) const;      
             std::shared_ptr<OutboundTunnel> GetNewOutboundTunnel (std::shared_ptr<OutboundTunnel> old) const;
 
             void TestTunnels ();
+            void UpdateTunnelsLoad ();
             void ProcessGarlicMessage (std::shared_ptr<I2NPMessage> msg);
             void ProcessDeliveryStatus (std::shared_ptr<I2NPMessage> msg);
 
             bool IsActive () const { return m_IsActive; };
             void SetActive (bool isActive) { m_IsActive = isActive; };
             void DetachTunnels ();
+
+            static double GetTunnelCost (uint32_t rtt, uint32_t throughput); // RTT in milliseconds, bytes per second
+            // one step at most, more tunnels as soon as load is high, less only after it stays low
+            static int AdjustQuantity (int quantity, int minQuantity, int maxQuantity, int numEstablished,
+                uint64_t bytesPerSecond, bool isOverloaded, int& numIdleAdjustments);
             
         private:
 
-            void CreateInboundTunnel ();    
-            void CreateOutboundTunnel ();
+            // return predicted probability of success, 0 if not created
+            double CreateInboundTunnel ();  
+            double CreateOutboundTunnel ();
+            double GetBuildSuccessProbability (std::shared_ptr<const TunnelConfig> config) const;
             void CreatePairedInboundTunnel (std::shared_ptr<OutboundTunnel> outboundTunnel);
             template<class TTunnels>
             typename TTunnels::value_type GetNextTunnel (TTunnels& tunnels, typename TTunnels::value_type excluded) const;
             std::shared_ptr<const i2p::data::RouterInfo> SelectNextHop (std::shared_ptr<const i2p::data::RouterInfo> prevHop) const;
             bool SelectPeers (std::vector<std::shared_ptr<const i2p::data::RouterInfo> >& hops, bool isInbound);
             bool SelectExplicitPeers (std::vector<std::shared_ptr<const i2p::data::RouterInfo> >& hops, bool isInbound);            
+            template<class TTunnels>
+            int GetNumEstablishedTunnels (const TTunnels& tunnels) const;
+            template<class TTunnels>
+            int GetNumActiveTunnels (const TTunnels& tunnels) const; // established and not re-created yet
+            struct PendingBuild
+            {
+                std::shared_ptr<Tunnel> tunnel;
+                double probability; 
+            };
+            double GetExpectedNumBuilds (std::list<PendingBuild>& builds); // removes completed
+            double AddPendingBuild (std::list<PendingBuild>& builds, std::shared_ptr<Tunnel> tunnel); // returns probability
+            int GetNumPendingBuilds (const std::list<PendingBuild>& builds) const;
+            void CheckReady ();
+            static double GetTunnelCost (std::shared_ptr<const OutboundTunnel> tunnel);
 
         private:
 
@@ -76,10 +121,30 @@ namespace tunnel
             std::set<std::shared_ptr<OutboundTunnel>, TunnelCreationTimeCmp> m_OutboundTunnels;
             std::map<uint32_t, std::pair<std::shared_ptr<OutboundTunnel>, std::shared_ptr<InboundTunnel> > > m_Tests;
             bool m_IsActive;
+            // adaptive quantity
+            bool m_IsAdaptive;
+            int m_MinInboundTunnels, m_MaxInboundTunnels, m_MinOutboundTunnels, m_MaxOutboundTunnels;
+            uint64_t m_LastAdjustmentTime;
+            uint64_t m_NumRetiredInboundBytes, m_NumRetiredOutboundBytes; // of tunnels removed from pool
+            uint64_t m_LastNumInboundBytes, m_LastNumOutboundBytes;
+            int m_NumInboundTestsFailed, m_NumOutboundTestsFailed; // since last adjustment
+            int m_NumIdleInboundAdjustments, m_NumIdleOutboundAdjustments;
+            uint64_t m_LastLoadUpdateTime; // in milliseconds
+            // pipelined building
+            mutable std::mutex m_PendingBuildsMutex;
+            std::list<PendingBuild> m_PendingInboundBuilds, m_PendingOutboundBuilds;
+            int m_MaxPendingInboundBuilds, m_MaxPendingOutboundBuilds;
+            uint64_t m_StartTime, m_TimeToReady; // in milliseconds
 
         public:
 
             // for HTTP only
+            int GetNumInboundTunnels () const { return m_NumInboundTunnels; };
+            int GetNumOutboundTunnels () const { return m_NumOutboundTunnels; };
+            bool IsAdaptive () const { return m_IsAdaptive; };
+            int GetNumPendingInboundBuilds () const { return GetNumPendingBuilds (m_PendingInboundBuilds); };
+            int GetNumPendingOutboundBuilds () const { return GetNumPendingBuilds (m_PendingOutboundBuilds); };
+            uint64_t GetTimeToReady () const { return m_TimeToReady; }; // 0 if not ready yet
             const decltype(m_OutboundTunnels)& GetOutboundTunnels () const { return m_OutboundTunnels; };
             const decltype(m_InboundTunnels)& GetInboundTunnels () const { return m_InboundTunnels; };
 
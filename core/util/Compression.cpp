@@ -0,0 +1,96 @@
+#include <math.h>
+#include <memory>
+#include <cryptopp/gzip.h>
+#include "Log.h"
+#include "Metrics.h"
+#include "Compression.h"
+
+namespace i2p
+{
+namespace util
+{
+    bool IsIncompressible (const uint8_t * buf, size_t len)
+    {
+        if (len < GZIP_ENTROPY_SAMPLE_SIZE) return false; // let deflate decide
+        int counts[256] = {};
+        for (size_t i = 0; i < GZIP_ENTROPY_SAMPLE_SIZE; i++)
+            counts[buf[i]]++;
+        double entropy = 0;
+        for (auto count: counts)
+        {
+            if (!count) continue;
+            double p = (double)count/GZIP_ENTROPY_SAMPLE_SIZE;
+            entropy -= p*log2 (p);
+        }
+        return entropy > GZIP_INCOMPRESSIBLE_ENTROPY;
+    }
+
+    int GetGzipLevel (const uint8_t * buf, size_t len, int level)
+    {
+        if (level != GZIP_STORED_LEVEL && IsIncompressible (buf, len))
+        {
+            static auto& numStored = i2p::util::metrics.GetCounter ("i2pd_gzip_incompressible_total",
+                "Payloads stored without compression because they look compressed or encrypted");
+            numStored.Inc ();
+            return GZIP_STORED_LEVEL;
+        }
+        return level;
+    }
+
+    struct GzipContexts
+    {
+        std::unique_ptr<CryptoPP::Gzip> compressor;
+        std::unique_ptr<CryptoPP::Gunzip> decompressor;
+    };
+    static thread_local GzipContexts gzipContexts;
+
+    size_t GzipCompress (const uint8_t * in, size_t inLen, uint8_t * out, size_t outLen, int level)
+    {
+        auto& compressor = gzipContexts.compressor;
+        try
+        {
+            if (!compressor) compressor.reset (new CryptoPP::Gzip ());
+            compressor->SetDeflateLevel (level);
+            compressor->Put (in, inLen);
+            compressor->MessageEnd ();
+            size_t size = compressor->MaxRetrievable ();
+            if (size <= outLen)
+                compressor->Get (out, size);
+            else
+                size = 0;
+            compressor->Skip (compressor->MaxRetrievable ()); // if didn't fit
+            compressor->GetNextMessage (); // ready for next message
+            return size;
+        }
+        catch (CryptoPP::Exception& ex)
+        {
+            LogPrint (eLogError, "Gzip compression: ", ex.what ());
+            compressor.reset (); // state is unknown
+        }
+        return 0;
+    }
+
+    size_t GzipDecompress (const uint8_t * in, size_t inLen, uint8_t * out, size_t outLen)
+    {
+        auto& decompressor = gzipContexts.decompressor;
+        try
+        {
+            if (!decompressor) decompressor.reset (new CryptoPP::Gunzip ());
+            decompressor->Initialize (); // back to stream start, drops previous output, keeps window
+            decompressor->Put (in, inLen);
+            decompressor->MessageEnd ();
+            size_t size = decompressor->MaxRetrievable ();
+            if (size <= outLen)
+                decompressor->Get (out, size);
+            else
+                size = 0;
+            return size;
+        }
+        catch (CryptoPP::Exception& ex)
+        {
+            LogPrint (eLogError, "Gzip decompression: ", ex.what ());
+        }
+        return 0;
+    }
+}
+}
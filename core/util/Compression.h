@@ -0,0 +1,32 @@
+#ifndef COMPRESSION_H__
+#define COMPRESSION_H__
+
+#include <inttypes.h>
+#include <stddef.h>
+
+namespace i2p
+{
+namespace util
+{
+    const int GZIP_STORED_LEVEL = 0; // no compression, deflate stored blocks
+    const int GZIP_FAST_LEVEL = 1;
+    const int GZIP_DEFAULT_LEVEL = 6;
+    const size_t GZIP_ENTROPY_SAMPLE_SIZE = 512; // shorter data is never considered incompressible
+    const double GZIP_INCOMPRESSIBLE_ENTROPY = 7.2; // bits per byte, random data of sample size gives ~7.6
+
+    // already compressed or encrypted, judged by entropy of first bytes
+    bool IsIncompressible (const uint8_t * buf, size_t len);
+    // level, or stored if buf looks incompressible
+    int GetGzipLevel (const uint8_t * buf, size_t len, int level);
+
+    /**
+     * Deflate and inflate contexts are created once per thread and reused,
+     * so tables and window are not allocated for every message.
+     * Both return 0 if out is too small or input is invalid
+     */
+    size_t GzipCompress (const uint8_t * in, size_t inLen, uint8_t * out, size_t outLen, int level = GZIP_DEFAULT_LEVEL);
+    size_t GzipDecompress (const uint8_t * in, size_t inLen, uint8_t * out, size_t outLen);
+}
+}
+
+#endif
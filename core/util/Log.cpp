@@ -1,7 +1,12 @@
+#include <stdio.h>
+#include <streambuf>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include "Log.h"
 
 Log * g_Log = nullptr;
+LogLevel g_LogLevel = eLogDebug;
+
+static std::atomic<int> g_LogGeneration (0);
 
 static const char * g_LogLevelStr[eNumLogLevels] =
 {
@@ -11,15 +16,207 @@ static const char * g_LogLevelStr[eNumLogLevels] =
 	"debug"	 // eLogDebug
 };
 
-void LogMsg::Process()
+void SetLogLevel (const std::string& level)
+{
+	for (int i = 0; i < eNumLogLevels; i++)
+		if (level == g_LogLevelStr[i])
+		{
+			g_LogLevel = (LogLevel)i;
+			return;
+		}
+	LogPrint (eLogError, "Unknown log level ", level);
+}
+
+LogMsg * LogBuffer::Acquire ()
+{
+	auto head = m_Head.load (std::memory_order_relaxed);
+	if (head - m_Tail.load (std::memory_order_acquire) >= LOG_THREAD_BUFFER_SIZE)
+		return nullptr;
+	return m_Msgs + head % LOG_THREAD_BUFFER_SIZE;
+}
+
+const LogMsg * LogBuffer::Front () const
+{
+	auto tail = m_Tail.load (std::memory_order_relaxed);
+	if (tail == m_Head.load (std::memory_order_acquire))
+		return nullptr;
+	return m_Msgs + tail % LOG_THREAD_BUFFER_SIZE;
+}
+
+// writes into LogMsg's text, the rest of long message is cut off
+class LogStreamBuf: public std::streambuf
+{
+	public:
+
+		void Reset (LogMsg * msg)
+		{
+			setp (msg->text, msg->text + LOG_MAX_MESSAGE_SIZE);
+		}
+
+		size_t GetLength () const { return pptr () - pbase (); };
+
+	protected:
+
+		int_type overflow (int_type) { return traits_type::eof (); };
+};
+
+struct LogFormatter
 {
-	auto& output = (log && log->GetLogStream ()) ? *log->GetLogStream () : std::cerr;
+	LogStreamBuf streamBuf;
+	std::ostream stream;
+	std::shared_ptr<LogBuffer> buffer;
+	LogMsg * msg;
+	LogMsg unbuffered; // if log is not started
+
+	LogFormatter (): stream (&streamBuf), msg (nullptr) {};
+};
+
+static LogFormatter& GetLogFormatter ()
+{
+	static thread_local LogFormatter formatter;
+	return formatter;
+}
+
+std::ostream * BeginLogMsg (LogLevel level)
+{
+	auto& formatter = GetLogFormatter ();
+	auto log = g_Log;
 	if (log)
-		output << log->GetTimestamp ();
+	{
+		if (!formatter.buffer || formatter.buffer->GetGeneration () != log->GetGeneration ())
+			formatter.buffer = log->CreateBuffer ();
+		formatter.msg = formatter.buffer->Acquire ();
+		if (!formatter.msg)
+		{
+			formatter.buffer->Dropped ();
+			log->WakeUp ();
+			return nullptr;
+		}
+	}
 	else
-		output << boost::posix_time::second_clock::local_time().time_of_day ();
-	output << "/" << g_LogLevelStr[level] << " - ";
-	output << s.str();
+		formatter.msg = &formatter.unbuffered;
+	formatter.msg->level = level;
+	formatter.streamBuf.Reset (formatter.msg);
+	formatter.stream.clear ();
+	return &formatter.stream;
+}
+
+void EndLogMsg ()
+{
+	auto& formatter = GetLogFormatter ();
+	formatter.msg->len = formatter.streamBuf.GetLength ();
+	if (formatter.msg == &formatter.unbuffered)
+	{
+		std::cerr << boost::posix_time::second_clock::local_time().time_of_day ()
+			<< "/" << g_LogLevelStr[formatter.msg->level] << " - ";
+		std::cerr.write (formatter.msg->text, formatter.msg->len) << std::endl;
+	}
+	else
+	{
+		formatter.buffer->Commit ();
+		if (formatter.buffer->GetSize () > LOG_THREAD_BUFFER_SIZE/2)
+		{
+			auto log = g_Log;
+			if (log) log->WakeUp ();
+		}
+	}
+	formatter.msg = nullptr;
+}
+
+Log::Log (): m_LogStream (nullptr), m_Generation (++g_LogGeneration), m_IsRunning (true),
+	m_Thread (nullptr), m_NumDropped (0)
+{
+	m_Thread = new std::thread (std::bind (&Log::Run, this));
+}
+
+Log::~Log ()
+{
+	Stop ();
+	delete m_LogStream;
+}
+
+void Log::Stop ()
+{
+	if (m_IsRunning)
+	{
+		{
+			std::unique_lock<std::mutex> l(m_WakeUpMutex);
+			m_IsRunning = false;
+			m_WakeUp.notify_one ();
+		}
+		if (m_Thread)
+		{
+			m_Thread->join ();
+			delete m_Thread;
+			m_Thread = nullptr;
+		}
+	}
+}
+
+std::shared_ptr<LogBuffer> Log::CreateBuffer ()
+{
+	auto buffer = std::make_shared<LogBuffer> (m_Generation);
+	std::unique_lock<std::mutex> l(m_BuffersMutex);
+	m_Buffers.push_back (buffer);
+	return buffer;
+}
+
+void Log::Run ()
+{
+	while (m_IsRunning)
+	{
+		{
+			std::unique_lock<std::mutex> l(m_WakeUpMutex);
+			if (m_IsRunning)
+				m_WakeUp.wait_for (l, std::chrono::milliseconds (LOG_FLUSH_INTERVAL));
+		}
+		WriteBuffers ();
+	}
+	WriteBuffers (); // the rest
+}
+
+void Log::WriteBuffers ()
+{
+	uint64_t numDropped = 0;
+	bool written = false;
+	std::unique_lock<std::mutex> l(m_BuffersMutex);
+	for (auto it = m_Buffers.begin (); it != m_Buffers.end ();)
+	{
+		auto& buffer = *it;
+		while (auto msg = buffer->Front ())
+		{
+			Write (*msg);
+			buffer->Pop ();
+			written = true;
+		}
+		numDropped += buffer->TakeNumDropped ();
+		if (buffer.unique ()) // owner thread has finished
+			it = m_Buffers.erase (it);
+		else
+			it++;
+	}
+	if (numDropped)
+	{
+		m_NumDropped += numDropped;
+		LogMsg msg;
+		msg.level = eLogWarning;
+		msg.len = snprintf (msg.text, LOG_MAX_MESSAGE_SIZE, "%llu log messages dropped", (unsigned long long)numDropped);
+		Write (msg);
+		written = true;
+	}
+	if (written)
+	{
+		auto& output = m_LogStream ? *m_LogStream : std::cerr;
+		output.flush ();
+	}
+}
+
+void Log::Write (const LogMsg& msg)
+{
+	auto& output = m_LogStream ? *m_LogStream : std::cerr;
+	output << GetTimestamp () << "/" << g_LogLevelStr[msg.level] << " - ";
+	output.write (msg.text, msg.len);
+	output << '\n';
 }
 
 const std::string& Log::GetTimestamp ()
@@ -37,12 +234,6 @@ const std::string& Log::GetTimestamp ()
 	return m_Timestamp;
 }
 
-void Log::Flush ()
-{
-    if (m_LogStream)
-        m_LogStream->flush();
-}
-
 void Log::SetLogFile (const std::string& fullFilePath)
 {
 	auto logFile = new std::ofstream (fullFilePath, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
@@ -57,6 +248,7 @@ void Log::SetLogFile (const std::string& fullFilePath)
 
 void Log::SetLogStream (std::ostream * logStream)
 {
+	std::unique_lock<std::mutex> l(m_BuffersMutex); // not while writing
 	if (m_LogStream) delete m_LogStream;
 	m_LogStream = logStream;
 }
@@ -7,7 +7,12 @@
 #include <fstream>
 #include <functional>
 #include <chrono>
-#include "Queue.h"
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
 
 enum LogLevel
 {
@@ -18,33 +23,83 @@ enum LogLevel
 	eNumLogLevels
 };
 
-class Log;
+// debug messages are compiled out of release builds unless LOG_MAX_LEVEL is set explicitly
+#ifndef LOG_MAX_LEVEL
+#ifdef NDEBUG
+#define LOG_MAX_LEVEL eLogInfo
+#else
+#define LOG_MAX_LEVEL eLogDebug
+#endif
+#endif
+
+const size_t LOG_MAX_MESSAGE_SIZE = 512; // longer messages are truncated
+const size_t LOG_THREAD_BUFFER_SIZE = 256; // messages per thread
+const int LOG_FLUSH_INTERVAL = 100; // in milliseconds
+
+extern LogLevel g_LogLevel; // runtime threshold
+inline bool IsLogLevelEnabled (LogLevel level) { return level <= LOG_MAX_LEVEL && level <= g_LogLevel; }
+void SetLogLevel (const std::string& level); // error, warn, info or debug
+
 struct LogMsg
 {
-	std::stringstream s;
-	Log * log;
 	LogLevel level;
+	size_t len;
+	char text[LOG_MAX_MESSAGE_SIZE];
+};
+
+/**
+ * Ring of formatted messages of one thread.
+ * Written by owner thread only and read by log writer only, so no locks
+ */
+class LogBuffer
+{
+	public:
 
-	LogMsg (Log * l = nullptr, LogLevel lv = eLogInfo): log (l), level (lv) {};
+		LogBuffer (int generation): m_Generation (generation), m_Head (0), m_Tail (0), m_NumDropped (0) {};
+		int GetGeneration () const { return m_Generation; };
 
-	void Process();
+		// owner
+		LogMsg * Acquire (); // nullptr if full
+		void Commit () { m_Head.store (m_Head.load (std::memory_order_relaxed) + 1, std::memory_order_release); };
+		size_t GetSize () const { return m_Head.load (std::memory_order_relaxed) - m_Tail.load (std::memory_order_acquire); };
+		void Dropped () { m_NumDropped++; };
+
+		// writer
+		const LogMsg * Front () const; // nullptr if empty
+		void Pop () { m_Tail.store (m_Tail.load (std::memory_order_relaxed) + 1, std::memory_order_release); };
+		uint64_t TakeNumDropped () { return m_NumDropped.exchange (0); };
+
+	private:
+
+		int m_Generation;
+		LogMsg m_Msgs[LOG_THREAD_BUFFER_SIZE];
+		std::atomic<size_t> m_Head, m_Tail;
+		std::atomic<uint64_t> m_NumDropped;
 };
 
-class Log: public i2p::util::MsgQueue<LogMsg>
+class Log
 {
-    public:
+	public:
 
-        Log (): m_LogStream (nullptr) { SetOnEmpty (std::bind (&Log::Flush, this)); };
-        ~Log () { delete m_LogStream; };
+		Log ();
+		~Log ();
 
+		void Stop ();
 		void SetLogFile (const std::string& fullFilePath);
 		void SetLogStream (std::ostream * logStream);
 		std::ostream * GetLogStream () const { return m_LogStream; };
 		const std::string& GetTimestamp ();
 
-    private:
+		int GetGeneration () const { return m_Generation; };
+		std::shared_ptr<LogBuffer> CreateBuffer (); // for calling thread
+		void WakeUp () { m_WakeUp.notify_one (); };
+		uint64_t GetNumDropped () const { return m_NumDropped; };
 
-        void Flush ();
+	private:
+
+		void Run ();
+		void WriteBuffers ();
+		void Write (const LogMsg& msg);
 
 	private:
 
@@ -55,6 +110,14 @@ class Log: public i2p::util::MsgQueue<LogMsg>
 #else
 		std::chrono::steady_clock::time_point m_LastTimestampUpdate;
 #endif
+		int m_Generation;
+		bool m_IsRunning;
+		std::thread * m_Thread;
+		std::mutex m_BuffersMutex;
+		std::vector<std::shared_ptr<LogBuffer> > m_Buffers;
+		std::mutex m_WakeUpMutex;
+		std::condition_variable m_WakeUp;
+		std::atomic<uint64_t> m_NumDropped;
 };
 
 extern Log * g_Log;
@@ -92,36 +155,37 @@ inline void StopLog ()
 	}
 }
 
+// formatting into calling thread's buffer, nullptr if message must be dropped
+std::ostream * BeginLogMsg (LogLevel level);
+void EndLogMsg ();
+
 template<typename TValue>
-void LogPrint (std::stringstream& s, TValue arg)
+void LogPrint (std::ostream& s, const TValue& arg)
 {
     s << arg;
 }
 
 template<typename TValue, typename... TArgs>
-void LogPrint (std::stringstream& s, TValue arg, TArgs... args)
+void LogPrint (std::ostream& s, const TValue& arg, const TArgs&... args)
 {
     LogPrint (s, arg);
     LogPrint (s, args...);
 }
 
 template<typename... TArgs>
-void LogPrint (LogLevel level, TArgs... args)
+void LogPrint (LogLevel level, const TArgs&... args)
 {
-	LogMsg * msg = new LogMsg (g_Log, level);
-	LogPrint (msg->s, args...);
-	msg->s << std::endl;
-	if (g_Log)
-		g_Log->Put (msg);
-	else
+	if (!IsLogLevelEnabled (level)) return; // nothing is formatted
+	auto s = BeginLogMsg (level);
+	if (s)
 	{
-		msg->Process ();
-		delete msg;
+		LogPrint (*s, args...);
+		EndLogMsg ();
 	}
 }
 
 template<typename... TArgs>
-void LogPrint (TArgs... args)
+void LogPrint (const TArgs&... args)
 {
 	LogPrint (eLogInfo, args...);
 }
@@ -0,0 +1,177 @@
+#include <algorithm>
+#include "Log.h"
+#include "Metrics.h"
+
+namespace i2p
+{
+namespace util
+{
+    std::atomic<int> g_NextMetricsShard (0);
+    MetricsRegistry metrics;
+
+    static const char * g_MetricTypeStr[] =
+    {
+        "counter", // eMetricCounter
+        "gauge", // eMetricGauge
+        "histogram" // eMetricHistogram
+    };
+
+    Counter::Counter ()
+    {
+        for (auto& it: m_Shards)
+            it.value = 0;
+    }
+
+    uint64_t Counter::GetValue () const
+    {
+        uint64_t value = 0;
+        for (auto& it: m_Shards)
+            value += it.value.load (std::memory_order_relaxed);
+        return value;
+    }
+
+    Histogram::Histogram (const std::vector<uint64_t>& bounds): m_Bounds (bounds)
+    {
+        if (m_Bounds.size () > METRICS_MAX_HISTOGRAM_BUCKETS)
+            m_Bounds.resize (METRICS_MAX_HISTOGRAM_BUCKETS);
+        for (auto& it: m_Shards)
+        {
+            for (auto& count: it.counts)
+                count = 0;
+            it.sum = 0;
+        }
+    }
+
+    void Histogram::Observe (uint64_t value)
+    {
+        // first bucket with bound >= value, last bucket otherwise
+        size_t ind = std::lower_bound (m_Bounds.begin (), m_Bounds.end (), value) - m_Bounds.begin ();
+        auto& shard = m_Shards[GetMetricsShard ()];
+        shard.counts[ind].fetch_add (1, std::memory_order_relaxed);
+        shard.sum.fetch_add (value, std::memory_order_relaxed);
+    }
+
+    void Histogram::GetValues (std::vector<uint64_t>& counts, uint64_t& sum) const
+    {
+        counts.assign (m_Bounds.size () + 1, 0);
+        sum = 0;
+        for (auto& it: m_Shards)
+        {
+            for (size_t i = 0; i < counts.size (); i++)
+                counts[i] += it.counts[i].load (std::memory_order_relaxed);
+            sum += it.sum.load (std::memory_order_relaxed);
+        }
+    }
+
+    std::vector<uint64_t> ExponentialBuckets (uint64_t start, uint64_t factor, size_t num)
+    {
+        std::vector<uint64_t> bounds;
+        for (size_t i = 0; i < num; i++)
+        {
+            bounds.push_back (start);
+            start *= factor;
+        }
+        return bounds;
+    }
+
+    MetricsRegistry::Metric& MetricsRegistry::GetMetric (const std::string& name, const std::string& help,
+        MetricType type, const std::string& labels)
+    {
+        auto it = m_Families.find (name);
+        if (it == m_Families.end ())
+            it = m_Families.insert (std::make_pair (name, Family{ help, type, {} })).first;
+        else if (it->second.type != type)
+            LogPrint (eLogError, "Metric ", name, " is registered as ", g_MetricTypeStr[it->second.type]);
+        return it->second.metrics[labels];
+    }
+
+    Counter& MetricsRegistry::GetCounter (const std::string& name, const std::string& help, const std::string& labels)
+    {
+        std::unique_lock<std::mutex> l(m_FamiliesMutex);
+        auto& metric = GetMetric (name, help, eMetricCounter, labels);
+        if (!metric.counter) metric.counter.reset (new Counter ());
+        return *metric.counter;
+    }
+
+    Gauge& MetricsRegistry::GetGauge (const std::string& name, const std::string& help, const std::string& labels)
+    {
+        std::unique_lock<std::mutex> l(m_FamiliesMutex);
+        auto& metric = GetMetric (name, help, eMetricGauge, labels);
+        if (!metric.gauge) metric.gauge.reset (new Gauge ());
+        return *metric.gauge;
+    }
+
+    Histogram& MetricsRegistry::GetHistogram (const std::string& name, const std::string& help,
+        const std::vector<uint64_t>& bounds, const std::string& labels)
+    {
+        std::unique_lock<std::mutex> l(m_FamiliesMutex);
+        auto& metric = GetMetric (name, help, eMetricHistogram, labels);
+        if (!metric.histogram) metric.histogram.reset (new Histogram (bounds));
+        return *metric.histogram;
+    }
+
+    void MetricsRegistry::SetCallback (const std::string& name, const std::string& help, MetricType type,
+        std::function<int64_t ()> callback, const std::string& labels)
+    {
+        std::unique_lock<std::mutex> l(m_FamiliesMutex);
+        GetMetric (name, help, type, labels).callback = callback;
+    }
+
+    void MetricsRegistry::Write (std::ostream& s) const
+    {
+        std::unique_lock<std::mutex> l(m_FamiliesMutex);
+        for (auto& it: m_Families)
+        {
+            auto& name = it.first;
+            s << "# HELP " << name << " " << it.second.help << "\n";
+            s << "# TYPE " << name << " " << g_MetricTypeStr[it.second.type] << "\n";
+            for (auto& it1: it.second.metrics)
+            {
+                auto& labels = it1.first;
+                auto& metric = it1.second;
+                if (metric.histogram)
+                {
+                    WriteHistogram (s, name, labels, *metric.histogram);
+                    continue;
+                }
+                s << name;
+                if (!labels.empty ()) s << "{" << labels << "}";
+                s << " ";
+                if (metric.counter)
+                    s << metric.counter->GetValue ();
+                else if (metric.gauge)
+                    s << metric.gauge->GetValue ();
+                else if (metric.callback)
+                    s << metric.callback ();
+                else
+                    s << 0;
+                s << "\n";
+            }
+        }
+    }
+
+    void MetricsRegistry::WriteHistogram (std::ostream& s, const std::string& name, const std::string& labels,
+        const Histogram& histogram) const
+    {
+        std::vector<uint64_t> counts;
+        uint64_t sum;
+        histogram.GetValues (counts, sum);
+        std::string prefix = labels.empty () ? "" : labels + ",";
+        auto& bounds = histogram.GetBounds ();
+        uint64_t total = 0; // buckets are cumulative
+        for (size_t i = 0; i < counts.size (); i++)
+        {
+            total += counts[i];
+            s << name << "_bucket{" << prefix << "le=\"";
+            if (i < bounds.size ())
+                s << bounds[i];
+            else
+                s << "+Inf";
+            s << "\"} " << total << "\n";
+        }
+        std::string suffix = labels.empty () ? "" : "{" + labels + "}";
+        s << name << "_sum" << suffix << " " << sum << "\n";
+        s << name << "_count" << suffix << " " << total << "\n";
+    }
+}
+}
@@ -0,0 +1,152 @@
+#ifndef METRICS_H__
+#define METRICS_H__
+
+#include <inttypes.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <ostream>
+
+namespace i2p
+{
+namespace util
+{
+    const int METRICS_NUM_SHARDS = 16; // threads are spread over shards
+    const size_t METRICS_MAX_HISTOGRAM_BUCKETS = 16;
+    const size_t METRICS_CACHE_LINE_SIZE = 64;
+
+    extern std::atomic<int> g_NextMetricsShard;
+    inline int GetMetricsShard () // of calling thread
+    {
+        static thread_local int shard = g_NextMetricsShard++ % METRICS_NUM_SHARDS;
+        return shard;
+    }
+
+    /**
+     * Monotonic counter. Every thread increments its own cache line,
+     * shards are summed up on read only
+     */
+    class Counter
+    {
+        public:
+
+            Counter ();
+            void Inc (uint64_t n = 1) { m_Shards[GetMetricsShard ()].value.fetch_add (n, std::memory_order_relaxed); };
+            uint64_t GetValue () const;
+
+        private:
+
+            struct Shard
+            {
+                std::atomic<uint64_t> value;
+                char padding[METRICS_CACHE_LINE_SIZE - sizeof (std::atomic<uint64_t>)];
+            };
+
+            Shard m_Shards[METRICS_NUM_SHARDS];
+    };
+
+    class Gauge
+    {
+        public:
+
+            Gauge (): m_Value (0) {};
+            void Set (int64_t value) { m_Value.store (value, std::memory_order_relaxed); };
+            void Add (int64_t n) { m_Value.fetch_add (n, std::memory_order_relaxed); };
+            int64_t GetValue () const { return m_Value.load (std::memory_order_relaxed); };
+
+        private:
+
+            std::atomic<int64_t> m_Value;
+    };
+
+    /**
+     * Distribution of values over fixed buckets, sharded like Counter
+     */
+    class Histogram
+    {
+        public:
+
+            Histogram (const std::vector<uint64_t>& bounds); // upper bounds in ascending order
+            void Observe (uint64_t value);
+            const std::vector<uint64_t>& GetBounds () const { return m_Bounds; };
+            // counts per bucket, the last one is for values above all bounds
+            void GetValues (std::vector<uint64_t>& counts, uint64_t& sum) const;
+
+        private:
+
+            struct Shard
+            {
+                std::atomic<uint64_t> counts[METRICS_MAX_HISTOGRAM_BUCKETS + 1];
+                std::atomic<uint64_t> sum;
+                char padding[METRICS_CACHE_LINE_SIZE];
+            };
+
+            std::vector<uint64_t> m_Bounds;
+            Shard m_Shards[METRICS_NUM_SHARDS];
+    };
+
+    std::vector<uint64_t> ExponentialBuckets (uint64_t start, uint64_t factor, size_t num);
+
+    enum MetricType
+    {
+        eMetricCounter = 0,
+        eMetricGauge,
+        eMetricHistogram
+    };
+
+    /**
+     * Named metrics of all subsystems. Lookup is locked, so hot paths keep the returned
+     * reference, which stays valid for the lifetime of the registry.
+     * Labels are passed as Prometheus label list, e.g. transport="ntcp"
+     */
+    class MetricsRegistry
+    {
+        public:
+
+            Counter& GetCounter (const std::string& name, const std::string& help, const std::string& labels = "");
+            Gauge& GetGauge (const std::string& name, const std::string& help, const std::string& labels = "");
+            Histogram& GetHistogram (const std::string& name, const std::string& help,
+                const std::vector<uint64_t>& bounds, const std::string& labels = "");
+            // value is sampled by scrape, for statistics kept by subsystems themselves.
+            // Callback must stay valid until shutdown
+            void SetCallback (const std::string& name, const std::string& help, MetricType type,
+                std::function<int64_t ()> callback, const std::string& labels = "");
+
+            void Write (std::ostream& s) const; // Prometheus text format
+
+        private:
+
+            struct Metric
+            {
+                std::unique_ptr<Counter> counter;
+                std::unique_ptr<Gauge> gauge;
+                std::unique_ptr<Histogram> histogram;
+                std::function<int64_t ()> callback;
+            };
+
+            struct Family
+            {
+                std::string help;
+                MetricType type;
+                std::map<std::string, Metric> metrics; // labels -> metric
+            };
+
+            Metric& GetMetric (const std::string& name, const std::string& help, MetricType type, const std::string& labels);
+            void WriteHistogram (std::ostream& s, const std::string& name, const std::string& labels,
+                const Histogram& histogram) const;
+
+        private:
+
+            mutable std::mutex m_FamiliesMutex;
+            std::map<std::string, Family> m_Families;
+    };
+
+    extern MetricsRegistry metrics;
+}
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include <cstdlib>
+#include <cstring>
 #include <string>
 #include <algorithm>
 #include <cctype>
@@ -145,12 +146,11 @@ namespace filesystem
     {
         static boost::filesystem::path path;
 
-        // TODO: datadir parameter is useless because GetDataDir is called before OptionParser
-        // and mapArgs is not initialized yet
-        /*if (i2p::util::config::mapArgs.count("-datadir")) 
+        // datadir is taken into account only after OptionParser, so it must not be called before
+        if (i2p::util::config::mapArgs.count("-datadir")) 
             path = boost::filesystem::system_complete(i2p::util::config::mapArgs["-datadir"]);
-        else */
-        path = GetDefaultDataDir();
+        else
+            path = GetDefaultDataDir();
 
         if(!boost::filesystem::exists(path)) {
             // Create data directory
@@ -459,8 +459,302 @@ namespace http
         }
         return res;
     }
+
+    enum HTTPChunkState {
+        eChunkSize = 0,
+        eChunkExtension,
+        eChunkData,
+        eChunkDataEnd,
+        eChunkTrailer
+    };
+
+    HTTPParser::HTTPParser(bool isResponse)
+        : m_IsResponse(isResponse)
+    {
+        Reset();
+    }
+
+    void HTTPParser::Reset(bool isHeadRequest)
+    {
+        m_IsHeadRequest = isHeadRequest;
+        m_State = eHead;
+        m_Head.clear(); // capacity is kept for next message
+        m_LineStart = 0;
+        for(auto& it: m_StartLine)
+            it = { 0, 0 };
+        m_Headers.clear();
+        m_BodyType = eNoBody;
+        m_Remaining = 0;
+        m_ChunkState = eChunkSize;
+        m_IsEmptyLine = true;
+    }
+
+    size_t HTTPParser::Parse(const char* buf, size_t len)
+    {
+        if(m_State == eHead) {
+            size_t consumed = 0;
+            while(consumed < len) {
+                const char* eol = (const char*)memchr(buf + consumed, '\n', len - consumed);
+                size_t n = eol ? eol - (buf + consumed) + 1 : len - consumed;
+                if(m_Head.size() + n > HTTP_MAX_HEAD_SIZE) {
+                    m_State = eError;
+                    break;
+                }
+                m_Head.append(buf + consumed, n);
+                consumed += n;
+                if(!eol)
+                    break;
+                size_t lineLen = m_Head.size() - 1 - m_LineStart;
+                if(lineLen > 0 && m_Head[m_Head.size() - 2] == '\r')
+                    lineLen--;
+                if(lineLen)
+                    m_LineStart = m_Head.size();
+                else if(!m_LineStart)
+                    m_Head.clear(); // empty lines before start line are ignored
+                else {
+                    if(!ParseHead())
+                        m_State = eError;
+                    else
+                        m_State = m_BodyType == eNoBody ? eComplete : eBody;
+                    break; // caller handles head before body
+                }
+            }
+            return consumed;
+        }
+        if(m_State != eBody)
+            return 0;
+        switch(m_BodyType) {
+            case eLengthBody: {
+                size_t n = len < m_Remaining ? len : m_Remaining;
+                m_Remaining -= n;
+                if(!m_Remaining)
+                    m_State = eComplete;
+                return n;
+            }
+            case eChunkedBody:
+                return ParseChunked(buf, len);
+            default:
+                return len; // until connection is closed
+        }
+    }
+
+    bool HTTPParser::ParseHead()
+    {
+        // start line, reason phrase of response may contain spaces
+        size_t end = m_Head.find('\n'), lineEnd = end, pos = 0;
+        if(lineEnd > 0 && m_Head[lineEnd - 1] == '\r')
+            lineEnd--;
+        int numFields = 0;
+        while(numFields < 3 && pos <= lineEnd) {
+            size_t next = numFields < 2 ? m_Head.find(' ', pos) : std::string::npos;
+            if(next == std::string::npos || next > lineEnd)
+                next = lineEnd;
+            m_StartLine[numFields++] = { pos, next - pos };
+            pos = next + 1;
+        }
+        if(numFields < (m_IsResponse ? 2 : 3) || !m_StartLine[0].len || !m_StartLine[1].len)
+            return false;
+        if(GetVersion().compare(0, 5, "HTTP/"))
+            return false;
+
+        // headers
+        for(pos = end + 1; pos < m_Head.size(); pos = end + 1) {
+            end = m_Head.find('\n', pos);
+            lineEnd = end;
+            if(lineEnd > pos && m_Head[lineEnd - 1] == '\r')
+                lineEnd--;
+            if(lineEnd == pos)
+                break; // empty line
+            size_t colon = m_Head.find(':', pos);
+            if(colon == std::string::npos || colon >= lineEnd || colon == pos
+                    || m_Head[pos] == ' ' || m_Head[pos] == '\t')
+                return false; // folded lines are obsolete
+            size_t valueStart = colon + 1, valueEnd = lineEnd;
+            while(valueStart < valueEnd && (m_Head[valueStart] == ' ' || m_Head[valueStart] == '\t'))
+                valueStart++;
+            while(valueEnd > valueStart && (m_Head[valueEnd - 1] == ' ' || m_Head[valueEnd - 1] == '\t'))
+                valueEnd--;
+            m_Headers.push_back(std::make_pair(Field { pos, colon - pos }, Field { valueStart, valueEnd - valueStart }));
+        }
+
+        // body framing
+        if(m_IsResponse) {
+            int code = GetStatusCode();
+            if(code < 100)
+                return false;
+            if(m_IsHeadRequest || code < 200 || code == 204 || code == 304)
+                return true; // no body
+        }
+        // messages are forwarded over shared streams, ambiguous framing is rejected (RFC 7230 3.3.3)
+        std::string encoding, length;
+        bool hasLength = false;
+        for(size_t i = 0; i < m_Headers.size(); i++) {
+            std::string value = Get(m_Headers[i].second);
+            if(IsHeader(i, TRANSFER_ENCODING))
+                encoding += encoding.empty() ? value : ", " + value;
+            else if(IsHeader(i, "Content-Length")) {
+                if(value.empty() || value.find_first_not_of("0123456789") != std::string::npos
+                        || value.size() > 19)
+                    return false;
+                if(hasLength && value != length)
+                    return false; // conflicting lengths
+                length = value;
+                hasLength = true;
+            }
+        }
+        if(!encoding.empty()) {
+            // chunked must be the last coding
+            size_t last = encoding.find_last_of(',');
+            std::string coding = encoding.substr(last == std::string::npos ? 0 : last + 1);
+            boost::algorithm::trim(coding);
+            if(boost::algorithm::iequals(coding, "chunked"))
+                m_BodyType = eChunkedBody;
+            else if(m_IsResponse)
+                m_BodyType = eUntilCloseBody;
+            else
+                return false;
+            if(hasLength) {
+                // Transfer-Encoding overrides Content-Length, don't forward it
+                std::vector<std::pair<Field, Field> > headers;
+                for(size_t i = 0; i < m_Headers.size(); i++)
+                    if(!IsHeader(i, "Content-Length"))
+                        headers.push_back(m_Headers[i]);
+                m_Headers.swap(headers);
+            }
+        } else if(hasLength) {
+            m_Remaining = std::strtoull(length.c_str(), nullptr, 10);
+            m_BodyType = m_Remaining ? eLengthBody : eNoBody;
+        } else if(m_IsResponse)
+            m_BodyType = eUntilCloseBody;
+        return true;
+    }
+
+    size_t HTTPParser::ParseChunked(const char* buf, size_t len)
+    {
+        size_t consumed = 0;
+        while(consumed < len && m_State == eBody) {
+            if(m_ChunkState == eChunkData) {
+                size_t n = len - consumed < m_Remaining ? len - consumed : m_Remaining;
+                m_Remaining -= n;
+                consumed += n;
+                if(!m_Remaining)
+                    m_ChunkState = eChunkDataEnd;
+                continue;
+            }
+            unsigned char c = buf[consumed++]; // ctype functions require unsigned char
+            switch(m_ChunkState) {
+                case eChunkSize:
+                case eChunkExtension:
+                    if(c == '\n') {
+                        if(m_IsEmptyLine) // no chunk size
+                            m_State = eError;
+                        else if(m_Remaining)
+                            m_ChunkState = eChunkData;
+                        else
+                            m_ChunkState = eChunkTrailer; // last chunk
+                        m_IsEmptyLine = true;
+                    } else if(m_ChunkState == eChunkExtension)
+                        break;
+                    else if(std::isxdigit(c)) {
+                        if(m_Remaining >> 56) {
+                            m_State = eError; // too large
+                            break;
+                        }
+                        m_Remaining = (m_Remaining << 4) + (std::isdigit(c) ? c - '0' : std::tolower(c) - 'a' + 10);
+                        m_IsEmptyLine = false;
+                    } else if(c == '\r' || c == ';' || c == ' ' || c == '\t')
+                        m_ChunkState = eChunkExtension;
+                    else
+                        m_State = eError;
+                break;
+                case eChunkDataEnd:
+                    if(c == '\n')
+                        m_ChunkState = eChunkSize;
+                    else if(c != '\r')
+                        m_State = eError;
+                break;
+                case eChunkTrailer:
+                    if(c == '\n') {
+                        if(m_IsEmptyLine)
+                            m_State = eComplete;
+                        m_IsEmptyLine = true;
+                    } else if(c != '\r')
+                        m_IsEmptyLine = false;
+                break;
+            }
+        }
+        return consumed;
+    }
+
+    int HTTPParser::GetStatusCode() const
+    {
+        return std::atoi(Get(m_StartLine[1]).c_str());
+    }
+
+    bool HTTPParser::GetHeader(const char* name, std::string& value) const
+    {
+        for(size_t i = 0; i < m_Headers.size(); i++)
+            if(IsHeader(i, name)) {
+                value = Get(m_Headers[i].second);
+                return true;
+            }
+        return false;
+    }
+
+    bool HTTPParser::IsHeader(size_t i, const char* name) const
+    {
+        const Field& field = m_Headers[i].first;
+        if(strlen(name) != field.len)
+            return false;
+        for(size_t j = 0; j < field.len; j++)
+            if(std::tolower((unsigned char)m_Head[field.offset + j]) != std::tolower((unsigned char)name[j]))
+                return false;
+        return true;
+    }
+
+    void HTTPParser::AppendHeader(size_t i, std::string& out) const
+    {
+        out.append(m_Head, m_Headers[i].first.offset, m_Headers[i].first.len);
+        out.append(": ");
+        out.append(m_Head, m_Headers[i].second.offset, m_Headers[i].second.len);
+        out.append("\r\n");
+    }
+
+    bool HTTPParser::IsKeepAlive() const
+    {
+        std::string connection;
+        if(!GetHeader("Connection", connection) && !m_IsResponse)
+            GetHeader("Proxy-Connection", connection);
+        if(boost::algorithm::icontains(connection, "close"))
+            return false;
+        if(GetVersion() == "HTTP/1.1")
+            return true; // persistent by default
+        return boost::algorithm::icontains(connection, "keep-alive");
+    }
+
+    bool HTTPParser::IsUpgrade() const
+    {
+        std::string value;
+        return GetHeader("Upgrade", value) && GetHeader("Connection", value)
+            && boost::algorithm::icontains(value, "upgrade");
+    }
 } 
 
+size_t SelectWeighted(const std::vector<double>& weights, double r)
+{
+    for(size_t i = 0; i < weights.size(); i++) {
+        if(weights[i] <= 0)
+            continue;
+        r -= weights[i];
+        if(r < 0)
+            return i;
+    }
+    for(size_t i = weights.size(); i > 0; i--)
+        if(weights[i - 1] > 0)
+            return i - 1;
+    return 0;
+}
+
 namespace net {
 
 #if defined(__linux__) || defined(__FreeBSD_kernel__) || defined(__APPLE__) || defined(__OpenBSD__)
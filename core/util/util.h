@@ -3,6 +3,7 @@
 
 #include <map>
 #include <string>
+#include <vector>
 #include <iostream>
 #include <boost/asio.hpp>
 #include <boost/filesystem.hpp>
@@ -146,8 +147,76 @@ namespace util
             std::string user_;
             std::string pass_;
         };
+
+        const size_t HTTP_MAX_HEAD_SIZE = 16384;
+
+        /**
+         * Incremental parser of HTTP/1.x request or response.
+         * Bytes are fed as they come, head is kept in one buffer reused by next
+         * message of same connection, and end of message is found from body framing.
+         */
+        class HTTPParser {
+        public:
+            enum State { eHead, eBody, eComplete, eError };
+            enum BodyType { eNoBody, eLengthBody, eChunkedBody, eUntilCloseBody };
+
+            HTTPParser(bool isResponse);
+
+            /**
+             * Prepares for next message. Response to HEAD request has no body.
+             */
+            void Reset(bool isHeadRequest = false);
+
+            /**
+             * @return number of bytes consumed, stops at the end of head and at the end of message
+             */
+            size_t Parse(const char* buf, size_t len);
+
+            State GetState() const { return m_State; }
+            BodyType GetBodyType() const { return m_BodyType; }
+
+            // valid once head is parsed
+            std::string GetMethod() const { return Get(m_StartLine[0]); } // request only
+            std::string GetURL() const { return Get(m_StartLine[1]); } // request only
+            std::string GetVersion() const { return Get(m_StartLine[m_IsResponse ? 0 : 2]); }
+            int GetStatusCode() const; // response only
+            std::string GetReason() const { return Get(m_StartLine[2]); } // response only
+            bool GetHeader(const char* name, std::string& value) const;
+            size_t GetNumHeaders() const { return m_Headers.size(); }
+            bool IsHeader(size_t i, const char* name) const; // case insensitive
+            void AppendHeader(size_t i, std::string& out) const; // as "name: value\r\n"
+            bool IsKeepAlive() const; // by version and Connection header
+            bool IsUpgrade() const; // by Upgrade and Connection headers, connection is switched after 101 response
+
+        private:
+            struct Field {
+                size_t offset, len;
+            };
+
+            std::string Get(const Field& field) const { return m_Head.substr(field.offset, field.len); }
+            bool ParseHead();
+            size_t ParseChunked(const char* buf, size_t len);
+
+        private:
+            bool m_IsResponse, m_IsHeadRequest;
+            State m_State;
+            std::string m_Head;
+            size_t m_LineStart;
+            Field m_StartLine[3];
+            std::vector<std::pair<Field, Field> > m_Headers;
+            BodyType m_BodyType;
+            uint64_t m_Remaining; // of body or current chunk
+            int m_ChunkState;
+            bool m_IsEmptyLine;
+        };
     }
 
+    /**
+     * @return index of weight that r, from 0 to sum of weights, falls to.
+     * Zero weights are never chosen, last non-zero one is if r is out of range
+     */
+    size_t SelectWeighted(const std::vector<double>& weights, double r);
+
     namespace net
     {
         /**
@@ -0,0 +1,106 @@
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+#include <string.h>
+#include <string>
+#include <fstream>
+#include "AddressBookIndex.h"
+
+BOOST_AUTO_TEST_SUITE(AddressBookIndexTests)
+
+using namespace i2p::client;
+
+static i2p::data::IdentHash MakeIdent (uint8_t b)
+{
+    uint8_t buf[32];
+    memset (buf, b, 32);
+    return i2p::data::IdentHash (buf);
+}
+
+BOOST_AUTO_TEST_CASE(MergeAndFindCaseInsensitive)
+{
+    auto path = boost::filesystem::temp_directory_path () / boost::filesystem::unique_path ();
+    {
+        AddressBookIndex index;
+        BOOST_CHECK(!index.Open (path.string ()));
+        AddressBookIndex::Addresses addresses = { { "Zzz.i2p", MakeIdent (1) },
+            { "aaa.i2p", MakeIdent (2) }, { "mmm.i2p", MakeIdent (3) }, { "AAA.i2p", MakeIdent (4) } };
+        BOOST_CHECK_EQUAL(index.Merge (addresses), 3);
+        BOOST_CHECK_EQUAL(index.GetNumAddresses (), 3);
+        i2p::data::IdentHash ident;
+        BOOST_CHECK(index.Find ("zzz.I2P", 7, ident));
+        BOOST_CHECK(ident == MakeIdent (1));
+        BOOST_CHECK(index.Find ("aaa.i2p", 7, ident));
+        BOOST_CHECK(ident == MakeIdent (4)); // last one wins
+        BOOST_CHECK(!index.Find ("bbb.i2p", 7, ident));
+        BOOST_CHECK(!index.Find ("aaa.i2", 6, ident));
+    }
+    {
+        AddressBookIndex index;
+        BOOST_REQUIRE(index.Open (path.string ()));
+        BOOST_CHECK_EQUAL(index.GetNumAddresses (), 3);
+        AddressBookIndex::Addresses same = { { "mmm.i2p", MakeIdent (3) } };
+        BOOST_CHECK_EQUAL(index.Merge (same), 0);
+        AddressBookIndex::Addresses changed = { { "mmm.i2p", MakeIdent (5) }, { "bbb.i2p", MakeIdent (6) } };
+        BOOST_CHECK_EQUAL(index.Merge (changed), 2);
+        BOOST_CHECK_EQUAL(index.GetNumAddresses (), 4);
+        i2p::data::IdentHash ident;
+        BOOST_CHECK(index.Find ("MMM.i2p", 7, ident));
+        BOOST_CHECK(ident == MakeIdent (5));
+        BOOST_CHECK(index.Find ("bbb.i2p", 7, ident));
+        BOOST_CHECK(ident == MakeIdent (6));
+        BOOST_CHECK(index.Find ("zzz.i2p", 7, ident));
+        BOOST_CHECK(ident == MakeIdent (1));
+    }
+    boost::filesystem::remove (path);
+}
+
+BOOST_AUTO_TEST_CASE(MergeInSteps)
+{
+    auto path = boost::filesystem::temp_directory_path () / boost::filesystem::unique_path ();
+    AddressBookIndex index;
+    BOOST_CHECK(!index.Open (path.string ()));
+    AddressBookIndex::Addresses addresses = { { "aaa.i2p", MakeIdent (1) } };
+    std::vector<uint8_t> image;
+    BOOST_CHECK_EQUAL(index.Merge (addresses, image), 1);
+    i2p::data::IdentHash ident;
+    BOOST_CHECK(!index.Find ("aaa.i2p", 7, ident)); // not replaced yet
+    BOOST_REQUIRE(index.Write (image));
+    BOOST_CHECK(!index.Find ("aaa.i2p", 7, ident));
+    index.Replace (image, true);
+    BOOST_CHECK(index.Find ("aaa.i2p", 7, ident));
+    BOOST_CHECK(ident == MakeIdent (1));
+
+    AddressBookIndex::Addresses same = { { "AAA.i2p", MakeIdent (1) } };
+    BOOST_CHECK_EQUAL(index.Merge (same, image), 0);
+    BOOST_CHECK(image.empty ());
+
+    // not written, kept in memory
+    AddressBookIndex::Addresses added = { { "bbb.i2p", MakeIdent (2) } };
+    BOOST_CHECK_EQUAL(index.Merge (added, image), 1);
+    index.Replace (image, false);
+    BOOST_CHECK_EQUAL(index.GetNumAddresses (), 2);
+    BOOST_CHECK(index.Find ("bbb.i2p", 7, ident));
+    BOOST_CHECK(ident == MakeIdent (2));
+    AddressBookIndex reopened;
+    BOOST_REQUIRE(reopened.Open (path.string ()));
+    BOOST_CHECK_EQUAL(reopened.GetNumAddresses (), 1);
+    boost::filesystem::remove (path);
+}
+
+BOOST_AUTO_TEST_CASE(RejectsInvalidFile)
+{
+    auto path = boost::filesystem::temp_directory_path () / boost::filesystem::unique_path ();
+    {
+        std::ofstream f (path.string ().c_str (), std::ofstream::binary);
+        f << "I2PDABI1\xff\xff\xff\xff" << "garbage";
+    }
+    AddressBookIndex index;
+    BOOST_CHECK(!index.Open (path.string ()));
+    i2p::data::IdentHash ident;
+    BOOST_CHECK(!index.Find ("aaa.i2p", 7, ident));
+    boost::filesystem::remove (path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,173 @@
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+#include <memory>
+#include <vector>
+#include "transport/BandwidthLimiter.h"
+
+BOOST_AUTO_TEST_SUITE(BandwidthLimiterTests)
+
+using namespace i2p;
+using namespace i2p::transport;
+
+static std::shared_ptr<I2NPMessage> CreateMessage (size_t len, TrafficClass trafficClass,
+    I2NPMessageType typeID = eI2NPData)
+{
+    auto msg = std::make_shared<I2NPMessageBuffer<I2NP_MAX_MESSAGE_SIZE> > ();
+    msg->len = msg->offset + len;
+    msg->SetTypeID (typeID);
+    msg->trafficClass = trafficClass;
+    return msg;
+}
+
+BOOST_AUTO_TEST_CASE(TokenBucketUnlimited)
+{
+    TokenBucket bucket;
+    bucket.SetRate (0, 0);
+    BOOST_CHECK(bucket.IsUnlimited ());
+    bucket.Consume (1000000);
+    BOOST_CHECK(bucket.HasTokens (1000000));
+}
+
+BOOST_AUTO_TEST_CASE(TokenBucketRefill)
+{
+    TokenBucket bucket;
+    bucket.SetRate (100000, 50000);
+    BOOST_CHECK(bucket.HasTokens (50000)); // starts full
+    bucket.Consume (50000);
+    BOOST_CHECK(!bucket.HasTokens (1));
+    bucket.Update (1000); // first update only sets time
+    BOOST_CHECK(!bucket.HasTokens (1));
+    bucket.Update (1100); // 100 ms at 100000 Bps
+    BOOST_CHECK(bucket.HasTokens (10000));
+    BOOST_CHECK(!bucket.HasTokens (10001));
+    bucket.Update (1050); // clock going back doesn't add tokens
+    BOOST_CHECK(!bucket.HasTokens (10001));
+}
+
+BOOST_AUTO_TEST_CASE(TokenBucketFrequentUpdates)
+{
+    TokenBucket bucket;
+    bucket.SetRate (500, 0); // less than a byte per millisecond
+    bucket.Consume (I2NP_MAX_MESSAGE_SIZE);
+    bucket.Update (1000);
+    for (uint64_t ts = 1001; ts <= 3000; ts++)
+        bucket.Update (ts);
+    BOOST_CHECK(bucket.HasTokens (1000));
+    BOOST_CHECK(!bucket.HasTokens (1001));
+    bucket.Update (3003); // remainder is carried
+    BOOST_CHECK(bucket.HasTokens (1001));
+    BOOST_CHECK(!bucket.HasTokens (1002));
+}
+
+BOOST_AUTO_TEST_CASE(TokenBucketBurstCap)
+{
+    TokenBucket bucket;
+    bucket.SetRate (100000, 50000);
+    bucket.Update (1000);
+    bucket.Update (60000);
+    BOOST_CHECK(bucket.HasTokens (50000));
+    BOOST_CHECK(!bucket.HasTokens (50001));
+
+    bucket.SetRate (1000, 0); // burst can't be less than max message size
+    BOOST_CHECK_EQUAL(bucket.GetBurst (), I2NP_MAX_MESSAGE_SIZE);
+    BOOST_CHECK(bucket.HasTokens (I2NP_MAX_MESSAGE_SIZE));
+    BOOST_CHECK(!bucket.HasTokens (I2NP_MAX_MESSAGE_SIZE + 1));
+    bucket.SetRate (100000, 0); // one second by default
+    BOOST_CHECK_EQUAL(bucket.GetBurst (), 100000);
+}
+
+BOOST_AUTO_TEST_CASE(TokenBucketDebt)
+{
+    TokenBucket bucket;
+    bucket.SetRate (1000, 0);
+    bucket.Consume (I2NP_MAX_MESSAGE_SIZE + 1000); // 1000 bytes of debt
+    bucket.Update (1000);
+    bucket.Update (1900);
+    BOOST_CHECK(!bucket.HasTokens (1)); // still 100 bytes below zero
+    bucket.Update (2100);
+    BOOST_CHECK(bucket.HasTokens (100));
+    BOOST_CHECK(!bucket.HasTokens (101));
+}
+
+BOOST_AUTO_TEST_CASE(LimiterBorrowsFromTotal)
+{
+    BandwidthLimiter limiter;
+    BOOST_CHECK(!limiter.IsLimited ());
+    BOOST_CHECK(limiter.Consume (eTrafficClassTransit, 1000000, 1000));
+
+    limiter.SetTotalLimit (10000, 40000);
+    limiter.SetClassLimit (eTrafficClassClient, 1000, 0);
+    BOOST_CHECK(limiter.IsLimited ());
+    BOOST_CHECK(limiter.Consume (eTrafficClassTransit, 40000, 1000)); // spare bandwidth
+    BOOST_CHECK(!limiter.Consume (eTrafficClassTransit, 1, 1000));
+    BOOST_CHECK(limiter.Consume (eTrafficClassClient, I2NP_MAX_MESSAGE_SIZE, 1000)); // assured
+    BOOST_CHECK(!limiter.Consume (eTrafficClassClient, 1, 1000));
+    // total bucket is in debt now, so transit waits longer than 1 second
+    BOOST_CHECK(!limiter.Consume (eTrafficClassTransit, 1000, 2000));
+    BOOST_CHECK(limiter.Consume (eTrafficClassClient, 1000, 2000));
+    BOOST_CHECK(limiter.Consume (eTrafficClassTransit, 1000, 6000));
+    BOOST_CHECK_EQUAL(limiter.GetStats (eTrafficClassTransit).sentBytes, 1000000 + 40000 + 1000);
+}
+
+BOOST_AUTO_TEST_CASE(TrafficClassOfMessage)
+{
+    BOOST_CHECK_EQUAL(BandwidthLimiter::GetTrafficClass (CreateMessage (100, eTrafficClassClient)), eTrafficClassClient);
+    BOOST_CHECK_EQUAL(BandwidthLimiter::GetTrafficClass (CreateMessage (100, eTrafficClassClient, eI2NPDatabaseStore)), eTrafficClassNetDb);
+    BOOST_CHECK_EQUAL(BandwidthLimiter::GetTrafficClass (CreateMessage (100, eTrafficClassTransit, eI2NPDatabaseStore)), eTrafficClassTransit);
+}
+
+// 1 Bps doesn't refill anything during the test, so only the burst counts
+BOOST_AUTO_TEST_CASE(ShapedQueueOrdering)
+{
+    BandwidthLimiter limiter;
+    limiter.SetTotalLimit (1, I2NP_MAX_MESSAGE_SIZE);
+    ShapedMessagesQueue queue (limiter);
+    auto transit1 = CreateMessage (30000, eTrafficClassTransit),
+        transit2 = CreateMessage (5000, eTrafficClassTransit),
+        client1 = CreateMessage (5000, eTrafficClassClient),
+        netdb = CreateMessage (1000, eTrafficClassClient, eI2NPDatabaseStore),
+        client2 = CreateMessage (1000, eTrafficClassClient);
+    std::vector<std::shared_ptr<I2NPMessage> > allowed;
+    queue.Put ({ transit1, transit2, client1, netdb, client2 }, allowed);
+    // client2 would fit, but must not overtake client1
+    BOOST_REQUIRE_EQUAL(allowed.size (), 2);
+    BOOST_CHECK(allowed[0] == transit1);
+    BOOST_CHECK(allowed[1] == netdb);
+    BOOST_CHECK(!queue.IsEmpty ());
+    BOOST_CHECK_EQUAL(limiter.GetStats (eTrafficClassClient).numDelayedMessages, 2);
+
+    allowed.clear ();
+    queue.Fetch (allowed);
+    BOOST_CHECK(allowed.empty ());
+
+    limiter.SetTotalLimit (1, I2NP_MAX_MESSAGE_SIZE); // refill
+    queue.Fetch (allowed);
+    // own messages go before transit
+    BOOST_REQUIRE_EQUAL(allowed.size (), 3);
+    BOOST_CHECK(allowed[0] == client1);
+    BOOST_CHECK(allowed[1] == client2);
+    BOOST_CHECK(allowed[2] == transit2);
+    BOOST_CHECK(queue.IsEmpty ());
+}
+
+BOOST_AUTO_TEST_CASE(ShapedQueueOverflow)
+{
+    BandwidthLimiter limiter;
+    limiter.SetTotalLimit (1, I2NP_MAX_MESSAGE_SIZE);
+    ShapedMessagesQueue queue (limiter);
+    std::vector<std::shared_ptr<I2NPMessage> > msgs, allowed;
+    msgs.push_back (CreateMessage (I2NP_MAX_MESSAGE_SIZE, eTrafficClassTransit));
+    for (size_t i = 0; i < MAX_NUM_SHAPED_MESSAGES + 1; i++)
+        msgs.push_back (CreateMessage (100, eTrafficClassTransit));
+    queue.Put (msgs, allowed);
+    BOOST_CHECK_EQUAL(allowed.size (), 1);
+    const auto& stats = limiter.GetStats (eTrafficClassTransit);
+    BOOST_CHECK_EQUAL(stats.numDelayedMessages, MAX_NUM_SHAPED_MESSAGES);
+    BOOST_CHECK_EQUAL(stats.numDroppedMessages, 1);
+    BOOST_CHECK_EQUAL(stats.droppedBytes, 100);
+    queue.Clear ();
+    BOOST_CHECK(queue.IsEmpty ());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
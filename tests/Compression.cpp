@@ -0,0 +1,62 @@
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+#include <string>
+#include <vector>
+#include <cryptopp/osrng.h>
+#include "util/Compression.h"
+
+BOOST_AUTO_TEST_SUITE(CompressionTests)
+
+using namespace i2p::util;
+
+BOOST_AUTO_TEST_CASE(GzipRoundTripReusesContexts)
+{
+    std::string text;
+    for (int i = 0; i < 100; i++)
+        text += "GET /index.html HTTP/1.1\r\nHost: example.i2p\r\n\r\n";
+    const uint8_t * in = (const uint8_t *)text.data ();
+    std::vector<uint8_t> compressed (text.size () + 64), uncompressed (text.size ());
+    for (int level: { GZIP_DEFAULT_LEVEL, GZIP_STORED_LEVEL, GZIP_FAST_LEVEL, GZIP_DEFAULT_LEVEL })
+    {
+        size_t size = GzipCompress (in, text.size (), compressed.data (), compressed.size (), level);
+        BOOST_REQUIRE(size > 0);
+        if (level != GZIP_STORED_LEVEL)
+            BOOST_CHECK(size < text.size ());
+        BOOST_CHECK_EQUAL(GzipDecompress (compressed.data (), size, uncompressed.data (), uncompressed.size ()), text.size ());
+        BOOST_CHECK(std::string ((const char *)uncompressed.data (), text.size ()) == text);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(GzipRejectsShortOutputAndInvalidInput)
+{
+    std::string text (1000, 'a');
+    uint8_t compressed[64], uncompressed[100];
+    size_t size = GzipCompress ((const uint8_t *)text.data (), text.size (), compressed, sizeof (compressed));
+    BOOST_REQUIRE(size > 0);
+    BOOST_CHECK_EQUAL(GzipDecompress (compressed, size, uncompressed, sizeof (uncompressed)), 0);
+    compressed[0] = 0; // broken header
+    BOOST_CHECK_EQUAL(GzipDecompress (compressed, size, uncompressed, sizeof (uncompressed)), 0);
+    // next valid message is still decompressed
+    std::string shortText (50, 'b');
+    size = GzipCompress ((const uint8_t *)shortText.data (), shortText.size (), compressed, sizeof (compressed));
+    BOOST_CHECK_EQUAL(GzipDecompress (compressed, size, uncompressed, sizeof (uncompressed)), shortText.size ());
+}
+
+BOOST_AUTO_TEST_CASE(RandomDataIsIncompressible)
+{
+    std::vector<uint8_t> buf (GZIP_ENTROPY_SAMPLE_SIZE);
+    CryptoPP::AutoSeededRandomPool rnd;
+    rnd.GenerateBlock (buf.data (), buf.size ());
+    BOOST_CHECK(IsIncompressible (buf.data (), buf.size ()));
+    BOOST_CHECK_EQUAL(GetGzipLevel (buf.data (), buf.size (), GZIP_DEFAULT_LEVEL), GZIP_STORED_LEVEL);
+    BOOST_CHECK(!IsIncompressible (buf.data (), buf.size () - 1)); // too short to judge
+
+    std::string text;
+    while (text.size () < GZIP_ENTROPY_SAMPLE_SIZE)
+        text += "<html><body>Hello, I2P! 0123456789</body></html>\n";
+    BOOST_CHECK(!IsIncompressible ((const uint8_t *)text.data (), text.size ()));
+    BOOST_CHECK_EQUAL(GetGzipLevel ((const uint8_t *)text.data (), text.size (), GZIP_FAST_LEVEL), GZIP_FAST_LEVEL);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,125 @@
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+#include <string.h>
+#include <memory>
+#include <vector>
+#include "LeaseSetCache.h"
+#include "util/I2PEndian.h"
+
+BOOST_AUTO_TEST_SUITE(LeaseSetCacheTests)
+
+using namespace i2p::client;
+using namespace i2p::data;
+
+const uint64_t ts = 1500000000000ULL; // in milliseconds
+
+// signed LeaseSet with one lease, gateway isn't known
+static std::shared_ptr<LeaseSet> CreateLeaseSet (const PrivateKeys& keys, uint64_t endDate)
+{
+    uint8_t buf[MAX_LS_BUFFER_SIZE];
+    size_t len = keys.GetPublic ().ToBuffer (buf, MAX_LS_BUFFER_SIZE);
+    size_t keysLen = 256 + keys.GetPublic ().GetSigningPublicKeyLen ();
+    memset (buf + len, 0, keysLen); // encryption and unused signing key
+    len += keysLen;
+    buf[len] = 1; // num leases
+    len++;
+    memset (buf + len, 0, 36); // gateway and tunnel ID
+    len += 36;
+    htobe64buf (buf + len, endDate);
+    len += 8;
+    keys.Sign (buf, len, buf + len);
+    len += keys.GetPublic ().GetSignatureLen ();
+    return std::make_shared<LeaseSet> (buf, len);
+}
+
+static std::vector<PrivateKeys> CreateKeysInSameShard (size_t num)
+{
+    std::vector<PrivateKeys> keys;
+    int shard = -1;
+    while (keys.size () < num)
+    {
+        auto k = PrivateKeys::CreateRandomKeys ();
+        int s = k.GetPublic ().GetIdentHash ()[0] % LEASESET_CACHE_NUM_SHARDS;
+        if (shard < 0) shard = s;
+        if (s == shard) keys.push_back (k);
+    }
+    return keys;
+}
+
+BOOST_AUTO_TEST_CASE(ExpiredAreDropped)
+{
+    LeaseSetCache cache;
+    auto keys = PrivateKeys::CreateRandomKeys ();
+    auto leaseSet = CreateLeaseSet (keys, ts + 60000);
+    IdentHash ident = leaseSet->GetIdentHash ();
+    BOOST_CHECK(cache.Put (leaseSet, ts));
+    BOOST_CHECK(cache.Get (ident, ts + 59999) == leaseSet);
+    BOOST_CHECK(!cache.Get (ident, ts + 60000));
+    cache.Cleanup (ts + 59999);
+    BOOST_CHECK_EQUAL(cache.GetSize (), 1);
+    cache.Cleanup (ts + 60000);
+    BOOST_CHECK_EQUAL(cache.GetSize (), 0);
+
+    auto newer = CreateLeaseSet (keys, ts + 120000), older = CreateLeaseSet (keys, ts + 60000);
+    BOOST_CHECK(cache.Put (newer, ts));
+    BOOST_CHECK(!cache.Put (older, ts)); // from floodfill
+    BOOST_CHECK(older == newer);
+    BOOST_CHECK(cache.Get (ident, ts) == newer);
+}
+
+BOOST_AUTO_TEST_CASE(RefreshSelection)
+{
+    LeaseSetCache cache;
+    auto keys = PrivateKeys::CreateRandomKeys ();
+    auto leaseSet = CreateLeaseSet (keys, ts + 100000);
+    IdentHash ident = leaseSet->GetIdentHash ();
+    cache.Put (leaseSet, ts);
+    auto later = CreateLeaseSet (PrivateKeys::CreateRandomKeys (), ts + 3600000);
+    cache.Put (later, ts); // doesn't expire soon
+
+    auto idents = cache.GetLeaseSetsToRefresh (ts);
+    BOOST_REQUIRE_EQUAL(idents.size (), 1);
+    BOOST_CHECK(idents[0] == ident);
+    BOOST_CHECK(cache.GetLeaseSetsToRefresh (ts + 1000).empty ()); // being refreshed
+
+    auto same = CreateLeaseSet (keys, ts + 100000);
+    BOOST_CHECK(cache.Put (same, ts + 2000)); // refresh returned unchanged copy
+    BOOST_CHECK(cache.GetLeaseSetsToRefresh (ts + 3000).empty ());
+    BOOST_CHECK_EQUAL(cache.GetLeaseSetsToRefresh (ts + LEASESET_REFRESH_RETRY_INTERVAL*1000).size (), 1);
+
+    auto updated = CreateLeaseSet (keys, ts + 140000);
+    BOOST_CHECK(cache.Put (updated, ts + 31000)); // new leases
+    BOOST_CHECK_EQUAL(cache.GetLeaseSetsToRefresh (ts + 32000).size (), 1);
+}
+
+BOOST_AUTO_TEST_CASE(InactiveAreNotRefreshed)
+{
+    LeaseSetCache cache;
+    auto leaseSet = CreateLeaseSet (PrivateKeys::CreateRandomKeys (), ts + 300000);
+    IdentHash ident = leaseSet->GetIdentHash ();
+    cache.Put (leaseSet, ts);
+    BOOST_CHECK(cache.GetLeaseSetsToRefresh (ts + 200000).empty ()); // not looked up recently
+    BOOST_CHECK(cache.Get (ident, ts + 200000));
+    BOOST_CHECK_EQUAL(cache.GetLeaseSetsToRefresh (ts + 200001).size (), 1);
+}
+
+BOOST_AUTO_TEST_CASE(OnlyInactiveAreEvicted)
+{
+    LeaseSetCache cache (LEASESET_CACHE_NUM_SHARDS); // one per shard
+    auto keys = CreateKeysInSameShard (3);
+    auto first = CreateLeaseSet (keys[0], ts + 600000), second = CreateLeaseSet (keys[1], ts + 300000),
+        third = CreateLeaseSet (keys[2], ts + 600000);
+    cache.Put (first, ts);
+    cache.Put (second, ts + 10000);
+    BOOST_CHECK_EQUAL(cache.GetSize (), 2); // first is still active
+    BOOST_CHECK(cache.Get (second->GetIdentHash (), ts + 200000));
+    cache.Put (third, ts + 200000);
+    // second expires earlier, but is active
+    BOOST_CHECK_EQUAL(cache.GetSize (), 2);
+    BOOST_CHECK(!cache.Get (first->GetIdentHash (), ts + 200000));
+    BOOST_CHECK(cache.Get (second->GetIdentHash (), ts + 200000));
+    BOOST_CHECK(cache.Get (third->GetIdentHash (), ts + 200000));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,65 @@
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+#include <sstream>
+#include <thread>
+#include "util/Metrics.h"
+
+BOOST_AUTO_TEST_SUITE(MetricsTests)
+
+using namespace i2p::util;
+
+BOOST_AUTO_TEST_CASE(CounterSumsThreads)
+{
+    Counter counter;
+    std::thread t1([&counter]() { for (int i = 0; i < 1000; i++) counter.Inc (); });
+    std::thread t2([&counter]() { for (int i = 0; i < 1000; i++) counter.Inc (2); });
+    t1.join ();
+    t2.join ();
+    BOOST_CHECK_EQUAL(counter.GetValue (), 3000);
+}
+
+BOOST_AUTO_TEST_CASE(HistogramBuckets)
+{
+    Histogram histogram (ExponentialBuckets (10, 10, 3)); // 10, 100, 1000
+    histogram.Observe (5);
+    histogram.Observe (10);
+    histogram.Observe (500);
+    histogram.Observe (5000);
+    std::vector<uint64_t> counts;
+    uint64_t sum;
+    histogram.GetValues (counts, sum);
+    BOOST_CHECK_EQUAL(counts.size (), 4);
+    BOOST_CHECK_EQUAL(counts[0], 2);
+    BOOST_CHECK_EQUAL(counts[1], 0);
+    BOOST_CHECK_EQUAL(counts[2], 1);
+    BOOST_CHECK_EQUAL(counts[3], 1);
+    BOOST_CHECK_EQUAL(sum, 5515);
+}
+
+BOOST_AUTO_TEST_CASE(RegistryTextFormat)
+{
+    MetricsRegistry registry;
+    registry.GetCounter ("test_total", "Test counter", "type=\"a\"").Inc (3);
+    BOOST_CHECK_EQUAL(&registry.GetCounter ("test_total", "Test counter", "type=\"a\""),
+        &registry.GetCounter ("test_total", "Test counter", "type=\"a\""));
+    registry.SetCallback ("test_gauge", "Test gauge", eMetricGauge, []() { return (int64_t)-7; });
+    registry.GetHistogram ("test_ms", "Test histogram", { 10 }).Observe (20);
+    std::stringstream s;
+    registry.Write (s);
+    BOOST_CHECK_EQUAL(s.str (),
+        "# HELP test_gauge Test gauge\n"
+        "# TYPE test_gauge gauge\n"
+        "test_gauge -7\n"
+        "# HELP test_ms Test histogram\n"
+        "# TYPE test_ms histogram\n"
+        "test_ms_bucket{le=\"10\"} 0\n"
+        "test_ms_bucket{le=\"+Inf\"} 1\n"
+        "test_ms_sum 20\n"
+        "test_ms_count 1\n"
+        "# HELP test_total Test counter\n"
+        "# TYPE test_total counter\n"
+        "test_total{type=\"a\"} 3\n");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,212 @@
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <string.h>
+#include "Profiling.h"
+
+BOOST_AUTO_TEST_SUITE(ProfilingTests)
+
+using namespace i2p::data;
+
+struct ProfileStorageFixture
+{
+    ProfileStorageFixture ():
+        dataDir (boost::filesystem::temp_directory_path () / boost::filesystem::unique_path ())
+    {
+        boost::filesystem::create_directory (dataDir);
+    }
+
+    ~ProfileStorageFixture ()
+    {
+        boost::filesystem::remove_all (dataDir);
+    }
+
+    static ProfileRecord CreateRecord (uint32_t n, uint64_t lastUpdateTime = 1000000)
+    {
+        ProfileRecord record;
+        memset (&record, 0, sizeof (record));
+        memcpy (record.identHash, &n, sizeof (n));
+        record.lastUpdateTime = lastUpdateTime;
+        record.numTunnelsAgreed = n;
+        record.numTimesRejected = n + 1;
+        return record;
+    }
+
+    boost::filesystem::path dataDir;
+};
+
+BOOST_FIXTURE_TEST_CASE(SaveLoadReopen, ProfileStorageFixture)
+{
+    ProfileStorage storage;
+    BOOST_REQUIRE(storage.Open (dataDir));
+    storage.Save (CreateRecord (1));
+    storage.Save (CreateRecord (2));
+    auto updated = CreateRecord (1);
+    updated.numTunnelsDeclined = 5;
+    storage.Save (updated);
+    BOOST_CHECK_EQUAL(storage.GetNumProfiles (), 2);
+    storage.Close ();
+
+    BOOST_REQUIRE(storage.Open (dataDir));
+    ProfileRecord record;
+    BOOST_REQUIRE(storage.Load (IdentHash (updated.identHash), record));
+    BOOST_CHECK_EQUAL(record.numTunnelsDeclined, 5);
+    BOOST_CHECK_EQUAL(record.numTimesRejected, 2);
+    BOOST_CHECK(!storage.Load (IdentHash (CreateRecord (3).identHash), record));
+}
+
+BOOST_FIXTURE_TEST_CASE(GrowsWhenFull, ProfileStorageFixture)
+{
+    ProfileStorage storage;
+    BOOST_REQUIRE(storage.Open (dataDir));
+    for (uint32_t i = 1; i <= PEER_PROFILES_INITIAL_CAPACITY + 1; i++)
+        storage.Save (CreateRecord (i));
+    storage.Close ();
+
+    BOOST_REQUIRE(storage.Open (dataDir));
+    BOOST_CHECK_EQUAL(storage.GetNumProfiles (), PEER_PROFILES_INITIAL_CAPACITY + 1);
+    ProfileRecord record;
+    BOOST_REQUIRE(storage.Load (IdentHash (CreateRecord (PEER_PROFILES_INITIAL_CAPACITY + 1).identHash), record));
+    BOOST_CHECK_EQUAL(record.numTunnelsAgreed, PEER_PROFILES_INITIAL_CAPACITY + 1);
+}
+
+BOOST_FIXTURE_TEST_CASE(OpensAfterInterruptedGrowth, ProfileStorageFixture)
+{
+    ProfileStorage storage;
+    BOOST_REQUIRE(storage.Open (dataDir));
+    storage.Save (CreateRecord (1));
+    storage.Close ();
+    // file is resized, but header still has old capacity
+    auto fileName = dataDir / PEER_PROFILES_FILE;
+    boost::filesystem::resize_file (fileName, boost::filesystem::file_size (fileName) + 
+        PEER_PROFILES_INITIAL_CAPACITY*sizeof (ProfileRecord));
+
+    BOOST_REQUIRE(storage.Open (dataDir));
+    BOOST_CHECK_EQUAL(storage.GetNumProfiles (), 1);
+    for (uint32_t i = 2; i <= PEER_PROFILES_INITIAL_CAPACITY + 1; i++)
+        storage.Save (CreateRecord (i));
+    storage.Close ();
+
+    BOOST_REQUIRE(storage.Open (dataDir));
+    BOOST_CHECK_EQUAL(storage.GetNumProfiles (), PEER_PROFILES_INITIAL_CAPACITY + 1);
+}
+
+BOOST_FIXTURE_TEST_CASE(DeletesObsolete, ProfileStorageFixture)
+{
+    ProfileStorage storage;
+    BOOST_REQUIRE(storage.Open (dataDir));
+    storage.Save (CreateRecord (1, 100));
+    storage.Save (CreateRecord (2, 300));
+    BOOST_CHECK_EQUAL(storage.DeleteObsolete (200), 1);
+    BOOST_CHECK_EQUAL(storage.GetNumProfiles (), 1);
+    storage.Save (CreateRecord (3, 300)); // takes freed record
+    storage.Close ();
+
+    BOOST_REQUIRE(storage.Open (dataDir));
+    ProfileRecord record;
+    BOOST_CHECK(!storage.Load (IdentHash (CreateRecord (1).identHash), record));
+    BOOST_CHECK(storage.Load (IdentHash (CreateRecord (3).identHash), record));
+}
+
+BOOST_FIXTURE_TEST_CASE(MigratesINIProfiles, ProfileStorageFixture)
+{
+    IdentHash identHash (CreateRecord (7).identHash);
+    std::string base64 = identHash.ToBase64 ();
+    auto directory = dataDir / PEER_PROFILES_DIRECTORY / (std::string ("p") + base64[0]);
+    boost::filesystem::create_directories (directory);
+    {
+        std::ofstream f ((directory / (std::string (PEER_PROFILE_PREFIX) + base64 + ".txt")).string ());
+        f << PEER_PROFILE_LAST_UPDATE_TIME << "="
+            << boost::posix_time::to_simple_string (boost::posix_time::second_clock::local_time ()) << "\n"
+            << "[" << PEER_PROFILE_SECTION_PARTICIPATION << "]\n" << PEER_PROFILE_PARTICIPATION_AGREED << "=3\n"
+            << "[" << PEER_PROFILE_SECTION_USAGE << "]\n" << PEER_PROFILE_USAGE_TAKEN << "=4\n";
+    }
+
+    ProfileStorage storage;
+    BOOST_REQUIRE(storage.Open (dataDir));
+    BOOST_CHECK(!boost::filesystem::exists (dataDir / PEER_PROFILES_DIRECTORY));
+    ProfileRecord record;
+    BOOST_REQUIRE(storage.Load (identHash, record));
+    BOOST_CHECK_EQUAL(record.numTunnelsAgreed, 3);
+    BOOST_CHECK_EQUAL(record.numTimesTaken, 4);
+}
+
+BOOST_FIXTURE_TEST_CASE(UpgradesVersion1File, ProfileStorageFixture)
+{
+    // header, then records without measurements
+    {
+        std::ofstream f ((dataDir / PEER_PROFILES_FILE).string (), std::ofstream::binary);
+        ProfileStorageHeader header;
+        memset (&header, 0, sizeof (header));
+        memcpy (header.magic, "i2pdprof", 8);
+        header.byteOrder = 0x01020304;
+        header.version = 1;
+        header.recordSize = 64;
+        header.capacity = 2;
+        f.write ((const char *)&header, sizeof (header));
+        uint8_t record[64] = {};
+        uint32_t n = 5;
+        memcpy (record, &n, sizeof (n));
+        uint64_t lastUpdateTime = 1000000;
+        memcpy (record + 32, &lastUpdateTime, 8);
+        uint32_t agreed = 6;
+        memcpy (record + 40, &agreed, 4);
+        f.write ((const char *)record, sizeof (record));
+        memset (record, 0, sizeof (record)); // free
+        f.write ((const char *)record, sizeof (record));
+    }
+
+    ProfileStorage storage;
+    BOOST_REQUIRE(storage.Open (dataDir));
+    BOOST_CHECK_EQUAL(storage.GetNumProfiles (), 1);
+    ProfileRecord record;
+    BOOST_REQUIRE(storage.Load (IdentHash (CreateRecord (5).identHash), record));
+    BOOST_CHECK_EQUAL(record.numTunnelsAgreed, 6);
+    BOOST_CHECK_EQUAL(record.buildLatency, 0);
+    storage.Close ();
+
+    BOOST_REQUIRE(storage.Open (dataDir)); // version 2 now
+    BOOST_CHECK_EQUAL(storage.GetNumProfiles (), 1);
+}
+
+BOOST_FIXTURE_TEST_CASE(KeepsMeasurements, ProfileStorageFixture)
+{
+    BOOST_REQUIRE(profileStorage.Open (dataDir));
+    IdentHash identHash (CreateRecord (9).identHash);
+    {
+        RouterProfile profile (identHash);
+        profile.TunnelBuildResponse (0, 100);
+        profile.TunnelBuildResponse (0, 200);
+        BOOST_CHECK_EQUAL(profile.GetBuildLatency (), 112); // (100*7 + 200)/8
+        BOOST_CHECK_EQUAL(profile.GetLatency (), 112);
+        profile.TunnelTested (50);
+        BOOST_CHECK_EQUAL(profile.GetLatency (), 50);
+        profile.TunnelExpired (PEER_PROFILE_CAPACITY_UNIT);
+        BOOST_CHECK_CLOSE(profile.GetCapacity (), 4.0, 0.001); // 2 agreed, twice for traffic
+        profile.TunnelTestFailed ();
+        profile.Save ();
+    }
+    RouterProfile profile (identHash);
+    profile.Load ();
+    BOOST_CHECK_EQUAL(profile.GetBuildLatency (), 112);
+    BOOST_CHECK_EQUAL(profile.GetTestRTT (), 50);
+    BOOST_CHECK_EQUAL(profile.GetBytesPerTunnel (), PEER_PROFILE_CAPACITY_UNIT);
+    BOOST_CHECK_EQUAL(profile.GetNumTestsFailed (), 1);
+    BOOST_CHECK_CLOSE(profile.GetCapacity (), 2.0, 0.001);
+    profileStorage.Close ();
+}
+
+BOOST_AUTO_TEST_CASE(PredictsBuildSuccess)
+{
+    RouterProfile profile (IdentHash (ProfileStorageFixture::CreateRecord (10).identHash));
+    BOOST_CHECK_CLOSE(profile.GetBuildSuccessProbability (), 0.75, 0.001); // prior of unknown peer
+    profile.TunnelBuildResponse (0, 100);
+    profile.TunnelBuildResponse (30, 100);
+    profile.TunnelNonReplied ();
+    profile.TunnelNonReplied ();
+    BOOST_CHECK_CLOSE(profile.GetBuildSuccessProbability (), 0.5, 0.001); // (1 + 3)/(4 + 4)
+}
+
+BOOST_AUTO_TEST_SUITE_END()
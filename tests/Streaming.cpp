@@ -0,0 +1,93 @@
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+#include <string.h>
+#include <vector>
+#include "Streaming.h"
+
+BOOST_AUTO_TEST_SUITE(StreamingTests)
+
+using namespace i2p::stream;
+
+BOOST_AUTO_TEST_CASE(SendBufferQueueTakesAcrossChunks)
+{
+    SendBufferQueue queue;
+    BOOST_CHECK(queue.IsEmpty ());
+    queue.Add ((const uint8_t *)"hello ", 6);
+    queue.Add ((const uint8_t *)"world", 5);
+    BOOST_CHECK_EQUAL(queue.GetSize (), 11);
+
+    uint8_t buf[16];
+    BOOST_CHECK_EQUAL(queue.Get (buf, 4), 4);
+    BOOST_CHECK(!memcmp (buf, "hell", 4));
+    BOOST_CHECK_EQUAL(queue.Get (buf, 16), 7); // rest of first chunk and second one
+    BOOST_CHECK(!memcmp (buf, "o world", 7));
+    BOOST_CHECK(queue.IsEmpty ());
+    BOOST_CHECK_EQUAL(queue.Get (buf, 16), 0);
+    BOOST_CHECK_EQUAL(queue.GetNumTakenBytes (), 11);
+}
+
+BOOST_AUTO_TEST_CASE(SendHandlersCompleteInOrder)
+{
+    // as Stream::AsyncSend with 50 bytes send buffer
+    SendBufferQueue queue;
+    std::vector<int> completed;
+    uint8_t buf[40] = {};
+    for (int i = 0; i < 3; i++)
+    {
+        queue.Add (buf, 40);
+        if (!queue.AddSendHandler (50, [&completed, i](const boost::system::error_code&) { completed.push_back (i); }))
+            completed.push_back (i); // fits
+    }
+    BOOST_REQUIRE_EQUAL(completed.size (), 1);
+    BOOST_CHECK_EQUAL(completed[0], 0);
+
+    std::vector<SendBufferQueue::SendHandler> handlers;
+    queue.Get (buf, 20);
+    queue.TakeCompletedSendHandlers (handlers);
+    BOOST_CHECK(handlers.empty ()); // 100 bytes left
+    queue.Get (buf, 10);
+    queue.TakeCompletedSendHandlers (handlers);
+    BOOST_REQUIRE_EQUAL(handlers.size (), 1);
+    queue.Get (buf, 40);
+    queue.Get (buf, 40);
+    queue.TakeCompletedSendHandlers (handlers);
+    BOOST_REQUIRE_EQUAL(handlers.size (), 2);
+    for (auto& it: handlers)
+        it (boost::system::error_code ());
+    BOOST_REQUIRE_EQUAL(completed.size (), 3);
+    BOOST_CHECK_EQUAL(completed[1], 1);
+    BOOST_CHECK_EQUAL(completed[2], 2);
+
+    // stream is terminated with handlers waiting
+    for (int i = 3; i < 6; i++)
+    {
+        queue.Add (buf, 40);
+        queue.AddSendHandler (0, [&completed, i](const boost::system::error_code&) { completed.push_back (i); });
+    }
+    handlers.clear ();
+    queue.TakeAllSendHandlers (handlers);
+    for (auto& it: handlers)
+        it (boost::asio::error::make_error_code (boost::asio::error::operation_aborted));
+    BOOST_REQUIRE_EQUAL(completed.size (), 6);
+    for (int i = 3; i < 6; i++)
+        BOOST_CHECK_EQUAL(completed[i], i);
+    handlers.clear ();
+    queue.TakeCompletedSendHandlers (handlers);
+    BOOST_CHECK(handlers.empty ());
+}
+
+BOOST_AUTO_TEST_CASE(RemoteLeaseWeightByRTTAndFailures)
+{
+    // not measured lease counts with default RTT
+    BOOST_CHECK_EQUAL(StreamingDestination::GetRemoteLeaseWeight (0, 0),
+        StreamingDestination::GetRemoteLeaseWeight (REMOTE_LEASE_DEFAULT_RTT, 0));
+    // twice slower or one failure halves probability
+    BOOST_CHECK_CLOSE(StreamingDestination::GetRemoteLeaseWeight (200, 0),
+        2*StreamingDestination::GetRemoteLeaseWeight (400, 0), 1e-9);
+    BOOST_CHECK_CLOSE(StreamingDestination::GetRemoteLeaseWeight (200, 0),
+        2*StreamingDestination::GetRemoteLeaseWeight (200, 1), 1e-9);
+    BOOST_CHECK(StreamingDestination::GetRemoteLeaseWeight (100, 3) < StreamingDestination::GetRemoteLeaseWeight (300, 0));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,81 @@
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+#include <vector>
+#include "tunnel/TunnelPool.h"
+#include "util/util.h"
+
+BOOST_AUTO_TEST_SUITE(TunnelPoolTests)
+
+using namespace i2p::tunnel;
+
+BOOST_AUTO_TEST_CASE(TunnelCostGrowsWithThroughput)
+{
+    BOOST_CHECK_EQUAL(TunnelPool::GetTunnelCost (0, 0), TUNNEL_DEFAULT_RTT); // not tested yet
+    BOOST_CHECK_EQUAL(TunnelPool::GetTunnelCost (500, 0), 500);
+    BOOST_CHECK_EQUAL(TunnelPool::GetTunnelCost (500, TUNNEL_LOAD_UNIT), 1000);
+    BOOST_CHECK_EQUAL(TunnelPool::GetTunnelCost (500, 3*TUNNEL_LOAD_UNIT), 2000);
+}
+
+BOOST_AUTO_TEST_CASE(TunnelSelectionInverseToCost)
+{
+    // idle fast tunnel, same tunnel loaded, slow idle tunnel
+    std::vector<double> weights = { 1.0/TunnelPool::GetTunnelCost (500, 0),
+        1.0/TunnelPool::GetTunnelCost (500, TUNNEL_LOAD_UNIT), 1.0/TunnelPool::GetTunnelCost (2000, 0) };
+    double totalWeight = weights[0] + weights[1] + weights[2];
+    const int numSteps = 1000;
+    int numSelected[3] = { 0, 0, 0 };
+    for (int i = 0; i < numSteps; i++) // r evenly spread over whole range
+        numSelected[i2p::util::SelectWeighted (weights, totalWeight*(i + 0.5)/numSteps)]++;
+    // weights are 4:2:1
+    BOOST_CHECK_EQUAL(numSelected[0], 571);
+    BOOST_CHECK_EQUAL(numSelected[1], 286);
+    BOOST_CHECK_EQUAL(numSelected[2], 143);
+}
+
+BOOST_AUTO_TEST_CASE(AdjustQuantityWithinRange)
+{
+    int numIdle = 0;
+    // high traffic or overload adds one tunnel, up to max
+    BOOST_CHECK_EQUAL(TunnelPool::AdjustQuantity (3, 2, 5, 3, 3*TUNNEL_POOL_HIGH_TRAFFIC + 1, false, numIdle), 4);
+    BOOST_CHECK_EQUAL(TunnelPool::AdjustQuantity (3, 2, 5, 3, 0, true, numIdle), 4);
+    BOOST_CHECK_EQUAL(TunnelPool::AdjustQuantity (5, 2, 5, 5, 0, true, numIdle), 5);
+    BOOST_CHECK_EQUAL(TunnelPool::AdjustQuantity (3, 2, 5, 0, TUNNEL_POOL_HIGH_TRAFFIC + 1, false, numIdle), 4); // no tunnels yet
+    // traffic exactly at high threshold keeps quantity
+    BOOST_CHECK_EQUAL(TunnelPool::AdjustQuantity (3, 2, 5, 3, 3*TUNNEL_POOL_HIGH_TRAFFIC, false, numIdle), 3);
+    BOOST_CHECK_EQUAL(numIdle, 0);
+    // low traffic never goes below min
+    numIdle = TUNNEL_POOL_NUM_IDLE_ADJUSTMENTS;
+    BOOST_CHECK_EQUAL(TunnelPool::AdjustQuantity (2, 2, 5, 2, 0, false, numIdle), 2);
+    BOOST_CHECK_EQUAL(numIdle, 0);
+}
+
+BOOST_AUTO_TEST_CASE(AdjustQuantityHysteresis)
+{
+    int numIdle = 0, quantity = 4;
+    // one tunnel less only after traffic stays low that many intervals
+    for (int i = 1; i < TUNNEL_POOL_NUM_IDLE_ADJUSTMENTS; i++)
+    {
+        quantity = TunnelPool::AdjustQuantity (quantity, 2, 5, 4, 0, false, numIdle);
+        BOOST_CHECK_EQUAL(quantity, 4);
+        BOOST_CHECK_EQUAL(numIdle, i);
+    }
+    quantity = TunnelPool::AdjustQuantity (quantity, 2, 5, 4, 0, false, numIdle);
+    BOOST_CHECK_EQUAL(quantity, 3);
+    BOOST_CHECK_EQUAL(numIdle, 0);
+
+    // traffic between thresholds resets count
+    numIdle = TUNNEL_POOL_NUM_IDLE_ADJUSTMENTS - 1;
+    BOOST_CHECK_EQUAL(TunnelPool::AdjustQuantity (3, 2, 5, 3, TUNNEL_POOL_LOW_TRAFFIC*2, false, numIdle), 3);
+    BOOST_CHECK_EQUAL(numIdle, 0);
+    // so does high traffic
+    numIdle = TUNNEL_POOL_NUM_IDLE_ADJUSTMENTS - 1;
+    BOOST_CHECK_EQUAL(TunnelPool::AdjustQuantity (3, 2, 5, 3, 0, true, numIdle), 4);
+    BOOST_CHECK_EQUAL(numIdle, 0);
+    // just below low threshold for one tunnel less counts as idle
+    numIdle = 0;
+    BOOST_CHECK_EQUAL(TunnelPool::AdjustQuantity (3, 2, 5, 3, TUNNEL_POOL_LOW_TRAFFIC*2 - 1, false, numIdle), 3);
+    BOOST_CHECK_EQUAL(numIdle, 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
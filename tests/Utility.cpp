@@ -1,4 +1,5 @@
 #include <boost/test/unit_test.hpp>
+#include <string.h>
 #include "util/util.h"
 
 BOOST_AUTO_TEST_SUITE(UtilityTests)
@@ -88,4 +89,131 @@ BOOST_AUTO_TEST_CASE(ParseUrlPassword)
     BOOST_CHECK_EQUAL(url("").pass_, "");
 }
 
+BOOST_AUTO_TEST_CASE(ParseHTTPRequestIncrementally)
+{
+    const char request[] = "\r\nPOST http://site.i2p/a?b HTTP/1.1\r\nHost:  site.i2p \r\n"
+        "Proxy-Connection: close\r\nContent-Length: 3\r\n\r\nabcGET";
+    HTTPParser parser(false);
+    size_t len = strlen(request), consumed = 0;
+    for(size_t i = 1; i <= len && parser.GetState() == HTTPParser::eHead; i++) // byte by byte
+        consumed += parser.Parse(request + consumed, i - consumed);
+    BOOST_REQUIRE_EQUAL(parser.GetState(), HTTPParser::eBody);
+    BOOST_CHECK_EQUAL(parser.GetMethod(), "POST");
+    BOOST_CHECK_EQUAL(parser.GetURL(), "http://site.i2p/a?b");
+    BOOST_CHECK_EQUAL(parser.GetVersion(), "HTTP/1.1");
+    std::string host;
+    BOOST_CHECK(parser.GetHeader("host", host));
+    BOOST_CHECK_EQUAL(host, "site.i2p");
+    BOOST_CHECK(!parser.IsKeepAlive());
+    BOOST_CHECK_EQUAL(parser.Parse(request + consumed, len - consumed), 3); // next request isn't consumed
+    BOOST_CHECK_EQUAL(parser.GetState(), HTTPParser::eComplete);
+
+    parser.Reset();
+    BOOST_CHECK_EQUAL(parser.Parse("GET / HTTP/1.0\r\nConnection: keep-alive\r\n\r\n", 42), 42);
+    BOOST_CHECK_EQUAL(parser.GetState(), HTTPParser::eComplete);
+    BOOST_CHECK(parser.IsKeepAlive());
+    BOOST_CHECK_EQUAL(parser.GetNumHeaders(), 1);
+
+    parser.Reset();
+    parser.Parse("GET /\r\n\r\n", 9);
+    BOOST_CHECK_EQUAL(parser.GetState(), HTTPParser::eError);
+}
+
+BOOST_AUTO_TEST_CASE(ParseHTTPResponseFraming)
+{
+    const char chunked[] = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "4;ext\r\nWiki\r\nA\r\n0123456789\r\n0\r\nTrailer: x\r\n\r\nextra";
+    HTTPParser parser(true);
+    size_t len = strlen(chunked), consumed = parser.Parse(chunked, len);
+    BOOST_REQUIRE_EQUAL(parser.GetState(), HTTPParser::eBody);
+    BOOST_CHECK_EQUAL(parser.GetBodyType(), HTTPParser::eChunkedBody);
+    BOOST_CHECK_EQUAL(parser.GetStatusCode(), 200);
+    BOOST_CHECK(parser.IsKeepAlive());
+    while(consumed < len - 5 && parser.GetState() == HTTPParser::eBody)
+        consumed += parser.Parse(chunked + consumed, 3); // chunks split at random places
+    BOOST_CHECK_EQUAL(parser.GetState(), HTTPParser::eComplete);
+    BOOST_CHECK_EQUAL(consumed, len - 5);
+
+    parser.Reset(true); // response to HEAD
+    BOOST_CHECK_EQUAL(parser.Parse("HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\n", 39), 39);
+    BOOST_CHECK_EQUAL(parser.GetState(), HTTPParser::eComplete);
+
+    parser.Reset();
+    parser.Parse("HTTP/1.0 200 OK\r\n\r\n", 19);
+    BOOST_CHECK_EQUAL(parser.GetBodyType(), HTTPParser::eUntilCloseBody);
+    BOOST_CHECK_EQUAL(parser.Parse("data", 4), 4);
+    BOOST_CHECK_EQUAL(parser.GetState(), HTTPParser::eBody);
+    BOOST_CHECK(!parser.IsKeepAlive());
+}
+
+BOOST_AUTO_TEST_CASE(ParseHTTPAmbiguousFraming)
+{
+    const char both[] = "POST / HTTP/1.1\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n";
+    HTTPParser parser(false);
+    parser.Parse(both, strlen(both));
+    BOOST_REQUIRE_EQUAL(parser.GetState(), HTTPParser::eBody);
+    BOOST_CHECK_EQUAL(parser.GetBodyType(), HTTPParser::eChunkedBody);
+    BOOST_CHECK_EQUAL(parser.GetNumHeaders(), 1); // Content-Length is stripped
+    std::string value;
+    BOOST_CHECK(!parser.GetHeader("Content-Length", value));
+
+    parser.Reset();
+    const char conflicting[] = "POST / HTTP/1.1\r\nContent-Length: 5\r\ncontent-length: 6\r\n\r\n";
+    parser.Parse(conflicting, strlen(conflicting));
+    BOOST_CHECK_EQUAL(parser.GetState(), HTTPParser::eError);
+
+    parser.Reset();
+    const char duplicate[] = "POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 5\r\n\r\n";
+    parser.Parse(duplicate, strlen(duplicate));
+    BOOST_CHECK_EQUAL(parser.GetState(), HTTPParser::eBody);
+    BOOST_CHECK_EQUAL(parser.GetBodyType(), HTTPParser::eLengthBody);
+
+    parser.Reset();
+    const char notLast[] = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked, gzip\r\n\r\n";
+    parser.Parse(notLast, strlen(notLast));
+    BOOST_CHECK_EQUAL(parser.GetState(), HTTPParser::eError);
+
+    parser.Reset();
+    const char split[] = "POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "\xff\r\n";
+    size_t len = strlen(split), consumed = parser.Parse(split, len);
+    BOOST_CHECK_EQUAL(parser.GetBodyType(), HTTPParser::eChunkedBody);
+    parser.Parse(split + consumed, len - consumed);
+    BOOST_CHECK_EQUAL(parser.GetState(), HTTPParser::eError); // not a hex digit
+}
+
+BOOST_AUTO_TEST_CASE(ParseHTTPUpgrade)
+{
+    const char request[] = "GET /ws HTTP/1.1\r\nUpgrade: websocket\r\nConnection: keep-alive, Upgrade\r\n\r\n";
+    HTTPParser parser(false);
+    parser.Parse(request, strlen(request));
+    BOOST_CHECK_EQUAL(parser.GetState(), HTTPParser::eComplete);
+    BOOST_CHECK(parser.IsUpgrade());
+
+    parser.Reset();
+    parser.Parse("GET / HTTP/1.1\r\nUpgrade: websocket\r\n\r\n", 38);
+    BOOST_CHECK(!parser.IsUpgrade()); // not listed in Connection
+
+    const char response[] = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n\r\n\x81\x02hi";
+    HTTPParser responseParser(true);
+    size_t len = strlen(response);
+    BOOST_CHECK_EQUAL(responseParser.Parse(response, len), len - 4); // frames after head aren't HTTP
+    BOOST_CHECK_EQUAL(responseParser.GetState(), HTTPParser::eComplete);
+    BOOST_CHECK_EQUAL(responseParser.GetStatusCode(), 101);
+    BOOST_CHECK_EQUAL(responseParser.GetReason(), "Switching Protocols");
+    BOOST_CHECK(responseParser.IsUpgrade());
+}
+
+BOOST_AUTO_TEST_CASE(SelectWeightedByRange)
+{
+    std::vector<double> weights = { 1.0, 0.0, 3.0 };
+    BOOST_CHECK_EQUAL(i2p::util::SelectWeighted(weights, 0.0), 0);
+    BOOST_CHECK_EQUAL(i2p::util::SelectWeighted(weights, 0.99), 0);
+    BOOST_CHECK_EQUAL(i2p::util::SelectWeighted(weights, 1.0), 2); // zero weight is skipped
+    BOOST_CHECK_EQUAL(i2p::util::SelectWeighted(weights, 3.99), 2);
+    BOOST_CHECK_EQUAL(i2p::util::SelectWeighted(weights, 4.0), 2); // rounding of r past the end
+    weights.back() = 0.0;
+    BOOST_CHECK_EQUAL(i2p::util::SelectWeighted(weights, 5.0), 0); // last non-zero one
+}
+
 BOOST_AUTO_TEST_SUITE_END()